@@ -10,10 +10,40 @@ SOURCES += \
         $$PWD/src/SocketIO/internal/sio_client_impl.cpp \
         $$PWD/src/SocketIO/internal/sio_packet.cpp \
         src/audio/audiooutput.cpp \
+        src/audio/audiodecoder.cpp \
+        src/audio/audioencoder.cpp \
+        src/audio/audiomixer.cpp \
+        src/audio/comfortnoise.cpp \
+        src/audio/driftestimator.cpp \
+        src/audio/echocanceller.cpp \
+        src/audio/framepool.cpp \
+        src/audio/jitterbuffer.cpp \
+        src/audio/latencyhistogram.cpp \
+        src/audio/latencyprobe.cpp \
         src/audio/audioinput.cpp \
+        src/audio/audiopreprocessor.cpp \
+        src/audio/audioringbuffer.cpp \
+        src/audio/pcmconvert.cpp \
+        src/audio/peerstream.cpp \
+        src/audio/resampler.cpp \
+        src/audio/simd.cpp \
+        src/audio/timestretcher.cpp \
+        src/audio/voiceactivitydetector.cpp \
+        src/audio/wavfile.cpp \
         src/main.cpp \
+        src/network/bandwidthestimator.cpp \
         src/network/client.cpp \
-        src/network/webrtc.cpp
+        src/network/nack.cpp \
+        src/network/peersession.cpp \
+        src/network/redcodec.cpp \
+        src/network/rtcpsession.cpp \
+        src/network/rtcsetup.cpp \
+        src/network/rtpdepacketizer.cpp \
+        src/network/rtppacketizer.cpp \
+        src/network/webrtc.cpp \
+        src/sfu/forwarder.cpp \
+        src/sfu/sfuserver.cpp \
+        src/tools/tools.cpp
 
 
 HEADERS += \
@@ -22,10 +52,50 @@ HEADERS += \
     $$PWD/src/SocketIO/sio_socket.h \
     $$PWD/src/SocketIO/internal/sio_client_impl.h \
     $$PWD/src/SocketIO/internal/sio_packet.h \
+    src/network/bandwidthestimator.h \
+    src/network/nack.h \
+    src/network/peersession.h \
+    src/network/redcodec.h \
+    src/network/rtcpsession.h \
+    src/network/rtcsetup.h \
+    src/network/rtpdepacketizer.h \
+    src/network/rtppacketizer.h \
     src/network/webrtc.h \
     src/audio/audiooutput.h \
+    src/audio/audiodecoder.h \
+    src/audio/audioencoder.h \
+    src/audio/audiomixer.h \
+    src/audio/comfortnoise.h \
+    src/audio/driftestimator.h \
+    src/audio/echocanceller.h \
+    src/audio/framepool.h \
+    src/audio/jitterbuffer.h \
+    src/audio/latencyhistogram.h \
+    src/audio/latencyprobe.h \
+    src/audio/mpscqueue.h \
     src/audio/audioinput.h \
-    src/network/client.h
+    src/audio/audiopreprocessor.h \
+    src/audio/audioringbuffer.h \
+    src/audio/pcmconvert.h \
+    src/audio/peerstream.h \
+    src/audio/resampler.h \
+    src/audio/simd.h \
+    src/audio/timestretcher.h \
+    src/audio/voiceactivitydetector.h \
+    src/audio/wavfile.h \
+    src/network/client.h \
+    src/sfu/forwarder.h \
+    src/sfu/sfuserver.h \
+    src/tools/tools.h
+
+# The heap allocation counter behind "--benchmark allocations" replaces the
+# allocator of the whole process, so it stays out of normal builds:
+# qmake CONFIG+=allocation_counter
+allocation_counter {
+    DEFINES += ALLOCATION_COUNTER
+    SOURCES += src/tools/allocationcounter.cpp
+    HEADERS += src/tools/allocationcounter.h
+}
 
 RESOURCES += qml.qrc
 
@@ -0,0 +1,67 @@
+# Headless selective forwarding unit: qmake DistributedVoiceCallSfu.pro
+QT = core
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = DistributedVoiceCallSfu
+
+SOURCES += \
+        $$PWD/src/SocketIO/sio_client.cpp \
+        $$PWD/src/SocketIO/sio_socket.cpp \
+        $$PWD/src/SocketIO/internal/sio_client_impl.cpp \
+        $$PWD/src/SocketIO/internal/sio_packet.cpp \
+        src/audio/framepool.cpp \
+        src/audio/latencyhistogram.cpp \
+        src/network/client.cpp \
+        src/network/rtcsetup.cpp \
+        src/network/rtpdepacketizer.cpp \
+        src/sfu/forwarder.cpp \
+        src/sfu/loadtest.cpp \
+        src/sfu/main.cpp \
+        src/sfu/sfuserver.cpp
+
+
+HEADERS += \
+    $$PWD/src/SocketIO/sio_client.h \
+    $$PWD/src/SocketIO/sio_message.h \
+    $$PWD/src/SocketIO/sio_socket.h \
+    $$PWD/src/SocketIO/internal/sio_client_impl.h \
+    $$PWD/src/SocketIO/internal/sio_packet.h \
+    src/audio/framepool.h \
+    src/audio/latencyhistogram.h \
+    src/audio/mpscqueue.h \
+    src/network/client.h \
+    src/network/rtcsetup.h \
+    src/network/rtpdepacketizer.h \
+    src/sfu/forwarder.h \
+    src/sfu/loadtest.h \
+    src/sfu/sfuserver.h
+
+PATH_TO_LIBDATACHANNEL = C:/cn-files/libdatachannel
+INCLUDEPATH += $$PATH_TO_LIBDATACHANNEL/include
+LIBS += -L$$PATH_TO_LIBDATACHANNEL/Windows/Mingw64 -ldatachannel.dll
+LIBS += -LC:/Qt/Tools/OpenSSLv3/Win_x64/bin -lcrypto-3-x64 -lssl-3-x64
+INCLUDEPATH += C:/Qt/Tools/OpenSSLv3/Win_x64/include
+LIBS += -lws2_32
+QMAKE_LFLAGS += -fuse-ld=lld
+
+LIBS += -lssp
+
+
+PATH_TO_SIO = C:/cn-files/socket.io-client-cpp
+INCLUDEPATH += $$PATH_TO_SIO/lib/websocketpp
+INCLUDEPATH += $$PATH_TO_SIO/lib/asio/asio/include
+INCLUDEPATH += $$PATH_TO_SIO/lib/rapidjson/include
+DEFINES += BOOST_DATE_TIME_NO_LIB
+DEFINES += BOOST_REGEX_NO_LIB
+DEFINES += ASIO_STANDALONE
+DEFINES += _WEBSOCKETPP_CPP11_STL_
+DEFINES += _WEBSOCKETPP_CPP11_FUNCTIONAL_
+# DEFINES += SIO_TLS
+
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
+
+CONFIG += no_keywords
@@ -20,8 +20,6 @@ Window {
 
         onLocalCandidateGenerated: (id, candidate, mid) => client.sendIceCandidate(id, candidate, mid);
 
-        onIncommingPacket: (id, data, len) => output.addData(data);
-
         onRtcConnected: () => {
                             callbtn.pushed = true;
                             callbtn.Material.background = "red"
@@ -65,12 +63,17 @@ Window {
     AudioOutput {
         id: output
 
+        // Received packets go from the network thread to the output as pooled frames
+        Component.onCompleted: webrtc.attachAudioOutput(output)
     }
 
     AudioInput{
         id: input
-        onAudioIsReady: (data) => webrtc.sendTrack(textfield.text, data);
+        bitrate: webrtc.bitRate
+        echoReference: output
 
+        // Encoded frames go straight from the encoder thread to the peers
+        Component.onCompleted: webrtc.attachAudioInput(input)
     }
 
     Item {
@@ -0,0 +1,186 @@
+#include "audiodecoder.h"
+
+// Peers are mixed in blocks of this length
+static constexpr int BlockMs = 10;
+// Mixed audio kept ready for the sink: one block being read and one to spare
+// while the worker wakes up
+static constexpr int LeadMs = 2 * BlockMs;
+// Received frames waiting for the worker; 64 peers at 50 packets/s fill it in
+// 300 ms, ten times the longest the worker sleeps
+static constexpr size_t QueueCapacity = 1024;
+
+AudioDecoder::AudioDecoder(AudioRingBuffer *sink, int sampleRate, QObject *parent)
+    : QThread{parent},
+    m_sink(sink),
+    m_sampleRate(sampleRate),
+    m_blockSamples(size_t(sampleRate) * BlockMs / 1000),
+    m_leadSamples(size_t(sampleRate) * LeadMs / 1000),
+    m_queue(QueueCapacity),
+    m_mixer(m_blockSamples)
+{
+    m_peerBlock.resize(m_blockSamples);
+    m_mixPcm.resize(m_blockSamples);
+    m_clock.start();
+}
+
+AudioDecoder::~AudioDecoder()
+{
+    stop();
+}
+
+int64_t AudioDecoder::nowUs() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+bool AudioDecoder::push(const QString &peerId, const MediaFrame &frame)
+{
+    if (frame.isNull())
+        return false;
+    return m_queue.push(ReceivedFrame{peerId, frame, nowUs()});
+}
+
+void AudioDecoder::removePeer(const QString &peerId)
+{
+    // Through the queue, so frames already queued for the peer go first
+    const bool queued = m_queue.push(ReceivedFrame{peerId, MediaFrame(), nowUs()});
+    QMutexLocker locker(&m_streamsMutex);
+    if (!queued)
+        m_streams.remove(peerId);
+    m_peerGains.remove(peerId);
+}
+
+void AudioDecoder::notify()
+{
+    m_wake.release();
+}
+
+void AudioDecoder::stop()
+{
+    if (!isRunning())
+        return;
+    requestInterruption();
+    m_wake.release();
+    wait();
+}
+
+int AudioDecoder::leadMs() const
+{
+    return int(m_leadSamples * 1000 / size_t(m_sampleRate));
+}
+
+void AudioDecoder::setPeerGain(const QString &peerId, float gain)
+{
+    QMutexLocker locker(&m_streamsMutex);
+    m_peerGains.insert(peerId, gain);
+    if (const std::shared_ptr<PeerStream> stream = m_streams.value(peerId))
+        stream->setGain(gain);
+}
+
+void AudioDecoder::setLatencyProbe(LatencyProbe *probe)
+{
+    m_latencyProbe.store(probe, std::memory_order_release);
+}
+
+QMap<QString, std::shared_ptr<PeerStream>> AudioDecoder::streams() const
+{
+    QMutexLocker locker(&m_streamsMutex);
+    return m_streams;
+}
+
+std::shared_ptr<PeerStream> AudioDecoder::stream(const QString &peerId) const
+{
+    QMutexLocker locker(&m_streamsMutex);
+    return m_streams.value(peerId);
+}
+
+void AudioDecoder::run()
+{
+    // A new call: whatever arrived while stopped is stale, and the peers come
+    // back with their first packet
+    ReceivedFrame stale;
+    while (m_queue.pop(stale)) {
+    }
+    {
+        QMutexLocker locker(&m_streamsMutex);
+        m_streams.clear();
+    }
+    m_queueLatency.reset();
+    m_sinkClock.reset();
+    m_renderedSamples = 0;
+    m_wake.tryAcquire(m_wake.available());
+
+    while (!isInterruptionRequested()) {
+        drainQueue();
+        while (m_sink->available() < m_leadSamples)
+            renderBlock();
+
+        // The sink reads at least every block, but frames are taken from the
+        // queue even when it doesn't
+        if (m_wake.tryAcquire(1, BlockMs))
+            m_wake.tryAcquire(m_wake.available());
+    }
+}
+
+// Hands every queued frame to its peer's jitter buffer, creating the stream
+// on a peer's first packet
+void AudioDecoder::drainQueue()
+{
+    ReceivedFrame received;
+    while (m_queue.pop(received)) {
+        m_queueLatency.record(nowUs() - received.arrivalUs);
+
+        std::shared_ptr<PeerStream> stream;
+        {
+            QMutexLocker locker(&m_streamsMutex);
+            if (received.frame.isNull()) {
+                m_streams.remove(received.peerId);
+                continue;
+            }
+            stream = m_streams.value(received.peerId);
+            if (!stream) {
+                stream = std::make_shared<PeerStream>(m_sampleRate, m_blockSamples);
+                if (!stream->isValid())
+                    continue;
+                stream->setGain(m_peerGains.value(received.peerId, 1.0f));
+                m_streams.insert(received.peerId, stream);
+            }
+        }
+        stream->insert(received.frame, received.arrivalUs);
+    }
+}
+
+// Mixes one block from every peer into the sink ring
+void AudioDecoder::renderBlock()
+{
+    // The block is read once everything already in the ring has been
+    const int64_t now = nowUs();
+    const int64_t playoutUs = now + int64_t(m_sink->available()) * 1000000 / m_sampleRate;
+    // The ring is kept at a constant lead, so blocks are rendered at the rate
+    // the sink consumes them
+    m_sinkClock.update(now, m_renderedSamples * 1000000 / m_sampleRate);
+    m_renderedSamples += int64_t(m_blockSamples);
+    const double sinkPpm = m_sinkClock.ppm();
+    const bool sinkValid = m_sinkClock.isValid();
+
+    // A shared copy of the table: decoding never holds the lock the owner
+    // thread takes for statistics
+    QMap<QString, std::shared_ptr<PeerStream>> streams;
+    {
+        QMutexLocker locker(&m_streamsMutex);
+        streams = m_streams;
+    }
+
+    m_mixer.begin(m_blockSamples);
+    for (const std::shared_ptr<PeerStream> &stream : std::as_const(streams)) {
+        stream->setSinkClock(sinkPpm, sinkValid);
+        stream->render(m_peerBlock.data(), m_blockSamples, playoutUs);
+        m_mixer.add(m_peerBlock.data(), stream->gain());
+    }
+    const float *mixed = m_mixer.finish();
+    if (LatencyProbe *probe = m_latencyProbe.load(std::memory_order_acquire))
+        probe->detect(mixed, m_blockSamples, playoutUs - now);
+
+    Simd::kernels().floatToInt16(mixed, m_mixPcm.data(), m_blockSamples);
+    m_sink->write(m_mixPcm.data(), m_blockSamples);
+}
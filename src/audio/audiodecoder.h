@@ -0,0 +1,102 @@
+#ifndef AUDIODECODER_H
+#define AUDIODECODER_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QMutex>
+#include <QMap>
+#include <QElapsedTimer>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "audiomixer.h"
+#include "audioringbuffer.h"
+#include "driftestimator.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "latencyprobe.h"
+#include "mpscqueue.h"
+#include "peerstream.h"
+
+// Real-time worker that takes received frames from a lock-free queue, runs
+// every peer's jitter buffer, decoder and stretcher, and mixes them into the
+// playout ring ahead of the sink, so the QAudioSink callback only has to
+// convert samples and neither decoding nor packet delivery ever goes through
+// the GUI event loop.
+class AudioDecoder : public QThread
+{
+    Q_OBJECT
+public:
+    explicit AudioDecoder(AudioRingBuffer *sink, int sampleRate, QObject *parent = nullptr);
+    ~AudioDecoder();
+
+    // Queues a received frame, stamped with its arrival time. Lock-free and
+    // never blocks, so it is called straight from the network thread; false
+    // if the queue is full.
+    bool push(const QString &peerId, const MediaFrame &frame);
+    // Drops the peer's stream once the worker gets to it in the queue
+    void removePeer(const QString &peerId);
+    // Wakes the worker after the consumer read from the sink ring; never blocks
+    void notify();
+    void stop();
+
+    // Samples per mixed block; the sink ring is read in whole blocks
+    size_t blockSamples() const { return m_blockSamples; }
+    // Mixed audio the worker keeps in the sink ring
+    int leadMs() const;
+
+    // Linear gain of one peer in the mix (1 by default, 0 mutes)
+    void setPeerGain(const QString &peerId, float gain);
+    QMap<QString, std::shared_ptr<PeerStream>> streams() const;
+    std::shared_ptr<PeerStream> stream(const QString &peerId) const;
+
+    float limiterGain() const { return m_mixer.limiterGain(); }
+    uint64_t limitedBlocks() const { return m_mixer.limitedBlocks(); }
+    // From each packet's arrival on the network thread to the worker taking it
+    const LatencyHistogram &queueLatency() const { return m_queueLatency; }
+    uint64_t queueOverflows() const { return m_queue.overflowCount(); }
+    // The sink's clock against the local one, from the rate it consumes the
+    // mixed blocks at; the peers' skews are relative to it
+    const DriftEstimator &sinkClock() const { return m_sinkClock; }
+    // Searches every mixed block for the probe's chirp; null turns it off
+    void setLatencyProbe(LatencyProbe *probe);
+
+protected:
+    void run() override;
+
+private:
+    struct ReceivedFrame {
+        QString    peerId;
+        MediaFrame frame;      // null: the peer left
+        int64_t    arrivalUs = 0;
+    };
+
+    void drainQueue();
+    void renderBlock();
+    int64_t nowUs() const;
+
+    AudioRingBuffer                *m_sink;
+    int                             m_sampleRate;
+    size_t                          m_blockSamples;
+    size_t                          m_leadSamples;
+    MpscQueue<ReceivedFrame>        m_queue;
+    QSemaphore                      m_wake;
+    QElapsedTimer                   m_clock;
+    std::atomic<LatencyProbe *>     m_latencyProbe{nullptr};
+
+    // Written by the worker, read by the owner thread for statistics and gains
+    mutable QMutex                  m_streamsMutex;
+    QMap<QString, std::shared_ptr<PeerStream>> m_streams;
+    QMap<QString, float>            m_peerGains;
+
+    // Only touched by the worker
+    AudioMixer                      m_mixer;
+    std::vector<float>              m_peerBlock;
+    std::vector<int16_t>            m_mixPcm;
+    LatencyHistogram                m_queueLatency;
+    DriftEstimator                  m_sinkClock;
+    int64_t                         m_renderedSamples = 0;
+};
+
+#endif // AUDIODECODER_H
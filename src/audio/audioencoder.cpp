@@ -0,0 +1,304 @@
+#include "audioencoder.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <algorithm>
+
+// Interval of the comfort noise packets sent while silence is suppressed,
+// matching the update rate of Opus' own DTX
+static constexpr int KeepaliveIntervalMs = 400;
+
+// Opus DTX frames carry no audio, only the 1-2 byte TOC
+static constexpr int MaxDtxPacketSize = 2;
+
+// Loopback audio beyond this many frames is dropped, so it can't pile up
+// between the far side's sink and capture clocks
+static constexpr int MaxLoopbackFrames = 3;
+
+// How long the worker sleeps without a wake-up before rechecking for interruption
+static constexpr int IdleWaitMs = 100;
+
+AudioEncoder::AudioEncoder(AudioRingBuffer *source, int sampleRate, QObject *parent)
+    : QThread{parent},
+    m_source(source),
+    m_sampleRate(sampleRate),
+    m_preprocessor(sampleRate, sampleRate * 60 / 1000)
+{
+    // Echo has to be removed before the gate and AGC change the signal level
+    auto echoCanceller = std::make_unique<EchoCanceller>(Simd::kernels(), m_sampleRate, m_sampleRate * 60 / 1000);
+    m_echoCanceller = echoCanceller.get();
+    m_preprocessor.addProcessor(std::move(echoCanceller));
+    m_preprocessor.addDefaultStages();
+
+    int error;
+    m_encoder = opus_encoder_create(m_sampleRate, 1, m_appliedSettings.application, &error);
+    if (error != OPUS_OK) {
+        qCritical() << "Failed to create Opus encoder:" << opus_strerror(error);
+        m_encoder = nullptr;
+    } else {
+        applySettings(m_appliedSettings, true);
+    }
+
+    // Sized for the longest (60 ms) frame so encoding never allocates
+    m_frame.resize(m_sampleRate * 60 / 1000);
+}
+
+AudioEncoder::~AudioEncoder()
+{
+    stop();
+    if (m_encoder)
+        opus_encoder_destroy(m_encoder);
+}
+
+void AudioEncoder::notify()
+{
+    m_dataReady.release();
+}
+
+void AudioEncoder::stop()
+{
+    if (!isRunning())
+        return;
+    requestInterruption();
+    m_dataReady.release();
+    wait();
+}
+
+void AudioEncoder::setFrameDuration(int milliseconds)
+{
+    m_frameDuration.store(milliseconds, std::memory_order_relaxed);
+}
+
+void AudioEncoder::setSettings(const OpusEncoderSettings &settings)
+{
+    QMutexLocker locker(&m_settingsMutex);
+    m_pendingSettings = settings;
+    m_settingsDirty.store(true, std::memory_order_release);
+}
+
+void AudioEncoder::setSilenceSuppression(bool enabled)
+{
+    m_silenceSuppression.store(enabled, std::memory_order_relaxed);
+    // Reapply the settings so DTX follows the suppression switch
+    QMutexLocker locker(&m_settingsMutex);
+    m_settingsDirty.store(true, std::memory_order_release);
+}
+
+AudioPreprocessor &AudioEncoder::preprocessor()
+{
+    return m_preprocessor;
+}
+
+EchoCanceller *AudioEncoder::echoCanceller()
+{
+    return m_echoCanceller;
+}
+
+void AudioEncoder::setLatencyProbe(LatencyProbe *probe)
+{
+    m_latencyProbe.store(probe, std::memory_order_release);
+}
+
+void AudioEncoder::setLoopbackSource(AudioRingBuffer *source)
+{
+    m_loopbackSource.store(source, std::memory_order_release);
+}
+
+void AudioEncoder::run()
+{
+    m_preprocessor.reset();
+    m_vad.reset();
+    m_inTalkspurt = false;
+    m_rtpTimestamp = QRandomGenerator::global()->generate();
+    // The first silent frame of a call is sent right away so the peer hears from us
+    m_sinceKeepaliveMs = KeepaliveIntervalMs;
+
+    while (!isInterruptionRequested()) {
+        if (!m_dataReady.tryAcquire(1, IdleWaitMs))
+            continue;
+        // One wake-up is enough to drain everything that is buffered
+        m_dataReady.tryAcquire(m_dataReady.available());
+
+        const int samplesPerFrame = m_sampleRate * m_frameDuration.load(std::memory_order_relaxed) / 1000;
+        while (!isInterruptionRequested() && m_source->readFrame(m_frame.data(), samplesPerFrame)) {
+            applyPendingSettings();
+            encodeFrame(samplesPerFrame);
+        }
+    }
+}
+
+void AudioEncoder::encodeFrame(int samplesPerFrame)
+{
+    if (!m_encoder)
+        return;
+
+    const int frameMs = samplesPerFrame * 1000 / m_sampleRate;
+    // Time moves on for suppressed and failed frames too, so gaps show in the timestamps
+    const uint32_t timestamp = m_rtpTimestamp;
+    m_rtpTimestamp += uint32_t(samplesPerFrame) * (48000 / m_sampleRate);
+    m_preprocessor.process(m_frame.data(), samplesPerFrame);
+    applyLoopback(samplesPerFrame);
+    if (LatencyProbe *probe = m_latencyProbe.load(std::memory_order_acquire))
+        probe->inject(m_frame.data(), size_t(samplesPerFrame), m_sampleRate);
+
+    const bool suppression = m_silenceSuppression.load(std::memory_order_relaxed);
+    const bool speech = !suppression || m_vad.process(m_frame.data(), samplesPerFrame, frameMs);
+
+    // Encode straight into a pooled frame; its headroom takes the RTP header later
+    MediaFrame packet = FramePool::media().acquire();
+
+    QElapsedTimer timer;
+    timer.start();
+    int encodedBytes = opus_encode(m_encoder,
+                                   m_frame.data(),
+                                   samplesPerFrame,
+                                   packet.data(),
+                                   opus_int32(packet.capacity()));
+    const qint64 elapsed = timer.nsecsElapsed();
+
+    if (encodedBytes < 0) {
+        m_encodeErrors.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Only this thread writes the metrics, so plain load/store pairs are enough
+    m_lastEncodeNs.store(elapsed, std::memory_order_relaxed);
+    m_totalEncodeNs.store(m_totalEncodeNs.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    if (elapsed > m_maxEncodeNs.load(std::memory_order_relaxed))
+        m_maxEncodeNs.store(elapsed, std::memory_order_relaxed);
+    m_framesEncoded.fetch_add(1, std::memory_order_release);
+
+    // Silent frames are still encoded so the encoder state and Opus' own DTX
+    // keep tracking the signal; they are just not sent
+    bool marker = false;
+    if (suppression && !shouldSend(speech, encodedBytes, frameMs, marker)) {
+        m_framesSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    packet.setSize(encodedBytes);
+    packet.setMarker(marker);
+    packet.setTimestamp(timestamp);
+    Q_EMIT frameEncoded(packet);
+}
+
+// Sends the playout back instead of the microphone; silence until a whole
+// frame of it is there
+void AudioEncoder::applyLoopback(int samplesPerFrame)
+{
+    AudioRingBuffer *source = m_loopbackSource.load(std::memory_order_acquire);
+    if (!source)
+        return;
+    while (source->available() > size_t(samplesPerFrame) * MaxLoopbackFrames)
+        source->readFrame(m_frame.data(), samplesPerFrame);
+    if (!source->readFrame(m_frame.data(), samplesPerFrame))
+        std::fill(m_frame.begin(), m_frame.begin() + samplesPerFrame, opus_int16(0));
+}
+
+// Decides whether a frame is sent while silence suppression is on. The first
+// silent frame closes the talkspurt, after that only a comfort noise update
+// goes out every KeepaliveIntervalMs. The first speech frame after silence
+// carries the RTP marker bit.
+bool AudioEncoder::shouldSend(bool speech, int encodedBytes, int frameMs, bool &marker)
+{
+    const bool silent = !speech || encodedBytes <= MaxDtxPacketSize;
+    if (!silent) {
+        marker = !m_inTalkspurt;
+        if (marker)
+            m_talkspurts.fetch_add(1, std::memory_order_relaxed);
+        m_inTalkspurt = true;
+        return true;
+    }
+
+    if (m_inTalkspurt) {
+        m_inTalkspurt = false;
+        m_sinceKeepaliveMs = 0;
+        return true;
+    }
+
+    m_sinceKeepaliveMs += frameMs;
+    if (m_sinceKeepaliveMs < KeepaliveIntervalMs)
+        return false;
+
+    m_sinceKeepaliveMs = 0;
+    m_keepalivesSent.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Applies settings changed since the last frame. Never waits for the owner
+// thread: if it is in the middle of an update, the change is picked up next frame.
+void AudioEncoder::applyPendingSettings()
+{
+    if (!m_settingsDirty.load(std::memory_order_acquire) || !m_settingsMutex.tryLock())
+        return;
+    const OpusEncoderSettings settings = m_pendingSettings;
+    m_settingsDirty.store(false, std::memory_order_relaxed);
+    m_settingsMutex.unlock();
+
+    applySettings(settings, false);
+}
+
+void AudioEncoder::applySettings(const OpusEncoderSettings &settings, bool force)
+{
+    if (!m_encoder)
+        return;
+
+    const OpusEncoderSettings &current = m_appliedSettings;
+    if (force || settings.application != current.application) {
+        // libopus refuses to switch the application after the first frame, so
+        // reinitialise the encoder in place (same memory, no reallocation) and
+        // reapply everything else on top of it
+        if (opus_encoder_ctl(m_encoder, OPUS_SET_APPLICATION(settings.application)) != OPUS_OK) {
+            opus_encoder_init(m_encoder, m_sampleRate, 1, settings.application);
+            force = true;
+        }
+    }
+    if (force || settings.bitrate != current.bitrate)
+        opus_encoder_ctl(m_encoder, OPUS_SET_BITRATE(settings.bitrate));
+    if (force || settings.vbr != current.vbr)
+        opus_encoder_ctl(m_encoder, OPUS_SET_VBR(settings.vbr ? 1 : 0));
+    if (force || settings.complexity != current.complexity)
+        opus_encoder_ctl(m_encoder, OPUS_SET_COMPLEXITY(settings.complexity));
+    if (force || settings.bandwidth != current.bandwidth)
+        opus_encoder_ctl(m_encoder, OPUS_SET_BANDWIDTH(settings.bandwidth));
+    if (force || settings.inbandFec != current.inbandFec)
+        opus_encoder_ctl(m_encoder, OPUS_SET_INBAND_FEC(settings.inbandFec ? 1 : 0));
+    if (force || settings.packetLossPercent != current.packetLossPercent)
+        opus_encoder_ctl(m_encoder, OPUS_SET_PACKET_LOSS_PERC(settings.packetLossPercent));
+    // Silence suppression relies on DTX, so it is forced on while suppression is enabled
+    const bool dtx = settings.dtx || m_silenceSuppression.load(std::memory_order_relaxed);
+    if (force || dtx != m_appliedDtx) {
+        opus_encoder_ctl(m_encoder, OPUS_SET_DTX(dtx ? 1 : 0));
+        m_appliedDtx = dtx;
+    }
+
+    m_appliedSettings = settings;
+}
+
+AudioEncoder::Metrics AudioEncoder::metrics() const
+{
+    Metrics result;
+    result.framesEncoded = m_framesEncoded.load(std::memory_order_acquire);
+    result.encodeErrors = m_encodeErrors.load(std::memory_order_relaxed);
+    result.lastEncodeUs = m_lastEncodeNs.load(std::memory_order_relaxed) / 1000;
+    result.maxEncodeUs = m_maxEncodeNs.load(std::memory_order_relaxed) / 1000;
+    if (result.framesEncoded)
+        result.averageEncodeUs = m_totalEncodeNs.load(std::memory_order_relaxed) / 1000 / qint64(result.framesEncoded);
+    result.framesSuppressed = m_framesSuppressed.load(std::memory_order_relaxed);
+    result.keepalivesSent = m_keepalivesSent.load(std::memory_order_relaxed);
+    result.talkspurts = m_talkspurts.load(std::memory_order_relaxed);
+    return result;
+}
+
+void AudioEncoder::resetMetrics()
+{
+    m_framesEncoded.store(0, std::memory_order_relaxed);
+    m_encodeErrors.store(0, std::memory_order_relaxed);
+    m_lastEncodeNs.store(0, std::memory_order_relaxed);
+    m_maxEncodeNs.store(0, std::memory_order_relaxed);
+    m_totalEncodeNs.store(0, std::memory_order_relaxed);
+    m_framesSuppressed.store(0, std::memory_order_relaxed);
+    m_keepalivesSent.store(0, std::memory_order_relaxed);
+    m_talkspurts.store(0, std::memory_order_relaxed);
+    m_preprocessor.resetMetrics();
+}
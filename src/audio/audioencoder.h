@@ -0,0 +1,128 @@
+#ifndef AUDIOENCODER_H
+#define AUDIOENCODER_H
+
+#include <QThread>
+#include <QSemaphore>
+#include <QMutex>
+#include <atomic>
+#include <vector>
+#include <opus.h>
+#include "audiopreprocessor.h"
+#include "echocanceller.h"
+#include "framepool.h"
+#include "audioringbuffer.h"
+#include "latencyprobe.h"
+#include "voiceactivitydetector.h"
+
+// Encoder parameters that can be changed while a call is running; values use
+// the libopus constants (OPUS_APPLICATION_*, OPUS_BANDWIDTH_*, OPUS_AUTO)
+struct OpusEncoderSettings {
+    int  bitrate = 48000;
+    bool vbr = true;
+    int  complexity = 10;
+    int  application = OPUS_APPLICATION_AUDIO;
+    int  bandwidth = OPUS_AUTO;
+    bool inbandFec = false;
+    int  packetLossPercent = 0;
+    bool dtx = false;
+};
+
+// Real-time worker that drains whole frames from the capture ring and encodes
+// them with Opus, so the QAudioSource callback only has to copy samples.
+class AudioEncoder : public QThread
+{
+    Q_OBJECT
+public:
+    explicit AudioEncoder(AudioRingBuffer *source, int sampleRate, QObject *parent = nullptr);
+    ~AudioEncoder();
+
+    // Wakes the worker after the producer wrote new samples; never blocks
+    void notify();
+    void stop();
+
+    // Both take effect from the next frame, without recreating the encoder
+    void setFrameDuration(int milliseconds);
+    void setSettings(const OpusEncoderSettings &settings);
+    // Runs the VAD, forces DTX on and drops packets during silence
+    void setSilenceSuppression(bool enabled);
+
+    struct Metrics {
+        quint64 framesEncoded = 0;
+        quint64 encodeErrors = 0;
+        qint64  lastEncodeUs = 0;
+        qint64  maxEncodeUs = 0;
+        qint64  averageEncodeUs = 0;
+        quint64 framesSuppressed = 0;
+        quint64 keepalivesSent = 0;
+        quint64 talkspurts = 0;
+    };
+    Metrics metrics() const;
+    void resetMetrics();
+
+    // High-pass/gate/AGC chain run on every frame before the VAD and encoder;
+    // stages can be toggled from any thread
+    AudioPreprocessor &preprocessor();
+    // First stage of the chain, disabled until a far-end reference is attached
+    EchoCanceller *echoCanceller();
+
+    // Latency measurement; both hooks act on the frame after pre-processing,
+    // so the canceller and AGC never touch the test signal. A loopback source
+    // replaces the captured audio with the local playout, so the far end
+    // hears itself, and the probe then overwrites it with its chirp when one
+    // is due. Null turns them off.
+    void setLatencyProbe(LatencyProbe *probe);
+    void setLoopbackSource(AudioRingBuffer *source);
+
+Q_SIGNALS:
+    // Emitted from the worker thread for every frame that should be sent, as
+    // a pooled buffer; frame.marker() is set on the first packet of a talkspurt
+    void frameEncoded(const MediaFrame &frame);
+
+protected:
+    void run() override;
+
+private:
+    void encodeFrame(int samplesPerFrame);
+    void applyLoopback(int samplesPerFrame);
+    void applyPendingSettings();
+    void applySettings(const OpusEncoderSettings &settings, bool force);
+    bool shouldSend(bool speech, int encodedBytes, int frameMs, bool &marker);
+
+    AudioRingBuffer           *m_source;
+    OpusEncoder               *m_encoder = nullptr;
+    int                        m_sampleRate;
+    std::atomic<int>           m_frameDuration{20};
+    QSemaphore                 m_dataReady;
+    std::vector<opus_int16>    m_frame;
+    AudioPreprocessor          m_preprocessor;
+    EchoCanceller             *m_echoCanceller;
+    std::atomic<LatencyProbe *>    m_latencyProbe{nullptr};
+    std::atomic<AudioRingBuffer *> m_loopbackSource{nullptr};
+
+    // Written by the owner thread, picked up by the worker between frames
+    QMutex                     m_settingsMutex;
+    OpusEncoderSettings        m_pendingSettings;
+    std::atomic<bool>          m_settingsDirty{false};
+    // Only touched by the worker (or before it starts)
+    OpusEncoderSettings        m_appliedSettings;
+    bool                       m_appliedDtx = false;
+
+    // Silence suppression state, only touched by the worker
+    std::atomic<bool>          m_silenceSuppression{false};
+    VoiceActivityDetector      m_vad;
+    bool                       m_inTalkspurt = false;
+    // RTP timestamp of the next frame; Opus' RTP clock is always 48 kHz
+    uint32_t                   m_rtpTimestamp = 0;
+    int                        m_sinceKeepaliveMs = 0;
+
+    std::atomic<quint64>       m_framesEncoded{0};
+    std::atomic<quint64>       m_encodeErrors{0};
+    std::atomic<qint64>        m_lastEncodeNs{0};
+    std::atomic<qint64>        m_maxEncodeNs{0};
+    std::atomic<qint64>        m_totalEncodeNs{0};
+    std::atomic<quint64>       m_framesSuppressed{0};
+    std::atomic<quint64>       m_keepalivesSent{0};
+    std::atomic<quint64>       m_talkspurts{0};
+};
+
+#endif // AUDIOENCODER_H
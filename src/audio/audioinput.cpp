@@ -1,30 +1,52 @@
 #include "audioinput.h"
+#include "audiooutput.h"
+#include "pcmconvert.h"
 #include <QAudioFormat>
 #include <QDebug>
 #include <QMediaDevices>
-#include <vector>
+#include <algorithm>
 
-// #include <opus
 AudioInput::AudioInput()
 {
-    int error;
-    opusEncoder = opus_encoder_create(48000, 1, OPUS_APPLICATION_AUDIO, &error);
-    QAudioFormat format;
-    format.setSampleRate(48000);
-    format.setChannelCount(1);
-    format.setSampleFormat(QAudioFormat::Int16);
+    // Open the microphone in its own format so the backend doesn't resample,
+    // and run Opus at the lowest rate that keeps the device bandwidth
+    const QAudioDevice device = QMediaDevices::defaultAudioInput();
+    deviceFormat = Pcm::deviceFormat(device);
+    sampleRate = Resampler::codecRateFor(deviceFormat.sampleRate());
 
-    audio = new QAudioSource(format, this);
+    // 100 ms of device audio per conversion step; longer callbacks are split
+    captureChunk = size_t(deviceFormat.sampleRate()) / 10;
+    captureResampler = std::make_unique<Resampler>(deviceFormat.sampleRate(), sampleRate, captureChunk);
+    captureFloat.resize(captureChunk);
+    captureResampled.resize(captureResampler->maxOutput(captureChunk));
+    capturePcm.resize(captureResampled.size());
+
+    // The ring is sized once here so writeData never allocates: one second of
+    // capture is enough headroom for the longest frame plus scheduling hiccups
+    captureBuffer.reset(sampleRate);
+    encoder = new AudioEncoder(&captureBuffer, sampleRate, this);
+    encoder->setFrameDuration(m_frameDuration);
+    encoder->setSettings(m_encoderSettings);
+    encoder->setSilenceSuppression(m_silenceSuppression);
+    // Direct connection keeps the signal on the encoder thread; receivers in
+    // other threads still get it queued
+    connect(encoder, &AudioEncoder::frameEncoded, this, &AudioInput::audioIsReady, Qt::DirectConnection);
+
+    audio = new QAudioSource(device, deviceFormat, this);
     if (!audio) {
         qCritical() << "Failed to initialize audio source!";
         return;
     }
     connect(audio, &QAudioSource::stateChanged, this, &AudioInput::handleStateChanged);
+
+    // Device latencies drift while running, so keep the echo canceller's alignment up to date
+    echoDelayTimer.setInterval(500);
+    connect(&echoDelayTimer, &QTimer::timeout, this, &AudioInput::updateEchoDelay);
 }
 
 AudioInput::~AudioInput()
 {
-    opus_encoder_destroy(opusEncoder);
+    encoder->stop();
     this->close();
     delete audio;
 }
@@ -50,21 +72,26 @@ void AudioInput::handleStateChanged(QAudio::State newState)
 
 qint64 AudioInput::writeData(const char *data, qint64 len)
 {
-    std::vector<unsigned char> opusData(960);
-    int frameSize = len / 2;
-
-    int encodedBytes = opus_encode(opusEncoder,
-                                   reinterpret_cast<const opus_int16 *>(data),
-                                   frameSize,
-                                   opusData.data(),
-                                   opusData.size());
-
     if (len < 0) {
         return len;
     }
 
-    QByteArray encodedOpusData(reinterpret_cast<const char *>(opusData.data()), encodedBytes);
-    Q_EMIT audioIsReady(encodedOpusData);
+    // QAudioSource hands over chunks of arbitrary length, but Opus only accepts
+    // 2.5/5/10/20/40/60 ms frames. Only convert the samples to the codec
+    // format here; the encoder thread slices them into whole frames and
+    // encodes them. The backend always delivers whole device frames.
+    const int bytesPerFrame = deviceFormat.bytesPerFrame();
+    size_t frames = size_t(len) / bytesPerFrame;
+    while (frames > 0) {
+        const size_t chunk = std::min(frames, captureChunk);
+        Pcm::toMonoFloat(data, chunk, deviceFormat, captureFloat.data());
+        const size_t produced = captureResampler->process(captureFloat.data(), chunk, captureResampled.data());
+        Simd::kernels().floatToInt16(captureResampled.data(), capturePcm.data(), produced);
+        captureBuffer.write(capturePcm.data(), produced);
+        data += chunk * bytesPerFrame;
+        frames -= chunk;
+    }
+    encoder->notify();
     return len;
 }
 
@@ -74,11 +101,19 @@ void AudioInput::start()
         qCritical() << "Failed to open QIODevice!";
         return;
     }
+    captureBuffer.clear();
+    captureResampler->reset();
+    encoder->resetMetrics();
+    encoder->start(QThread::TimeCriticalPriority);
     audio->start(this);
+    updateEchoDelay();
+    echoDelayTimer.start();
 }
 void AudioInput::stop()
 {
+    echoDelayTimer.stop();
     audio->stop();
+    encoder->stop();
     this->close();
 }
 
@@ -86,3 +121,376 @@ qint64 AudioInput::readData(char *data, qint64 maxlen)
 {
     return 0;
 }
+
+int AudioInput::frameDuration() const
+{
+    return m_frameDuration;
+}
+
+// Sets the duration of each encoded frame in milliseconds (5, 10, 20, 40 or 60)
+void AudioInput::setFrameDuration(int newFrameDuration)
+{
+    if (m_frameDuration == newFrameDuration)
+        return;
+    switch (newFrameDuration) {
+    case 5:
+    case 10:
+    case 20:
+    case 40:
+    case 60:
+        break;
+    default:
+        qWarning() << "Unsupported Opus frame duration:" << newFrameDuration << "ms";
+        return;
+    }
+    m_frameDuration = newFrameDuration;
+    encoder->setFrameDuration(m_frameDuration);
+    encoder->setSettings(m_encoderSettings);
+    Q_EMIT frameDurationChanged();
+}
+
+int AudioInput::deviceSampleRate() const
+{
+    return deviceFormat.sampleRate();
+}
+
+int AudioInput::codecSampleRate() const
+{
+    return sampleRate;
+}
+
+qint64 AudioInput::leftoverSamples() const
+{
+    return captureBuffer.available();
+}
+
+quint64 AudioInput::overflowCount() const
+{
+    return captureBuffer.overflowCount();
+}
+
+QVariantMap AudioInput::encoderStats() const
+{
+    const AudioEncoder::Metrics metrics = encoder->metrics();
+    const AudioPreprocessor::Metrics preprocessing = encoder->preprocessor().metrics();
+    const EchoCanceller::Metrics echo = encoder->echoCanceller()->metrics();
+    const FramePool::Stats pool = FramePool::media().stats();
+    return {
+        {"framesEncoded", metrics.framesEncoded},
+        {"encodeErrors", metrics.encodeErrors},
+        {"lastEncodeUs", metrics.lastEncodeUs},
+        {"maxEncodeUs", metrics.maxEncodeUs},
+        {"averageEncodeUs", metrics.averageEncodeUs},
+        {"framesSuppressed", metrics.framesSuppressed},
+        {"keepalivesSent", metrics.keepalivesSent},
+        {"talkspurts", metrics.talkspurts},
+        {"suppressedRatio", metrics.framesEncoded
+                                ? double(metrics.framesSuppressed) / metrics.framesEncoded
+                                : 0.0},
+        {"preprocessAverageUs", preprocessing.averageNs / 1000.0},
+        {"preprocessMaxUs", preprocessing.maxNs / 1000.0},
+        {"simdLevel", QString::fromLatin1(Simd::levelName(Simd::detectedLevel()))},
+        {"echoCancellerErleDb", echo.erleDb},
+        {"echoCancellerDelayMs", echo.delayMs},
+        {"echoCancellerTaps", echo.activeTaps},
+        {"echoCancellerAverageUs", echo.averageNs / 1000.0},
+        {"echoCancellerOverBudgetFrames", echo.overBudgetFrames},
+        {"framePoolInUse", qulonglong(pool.inUse)},
+        {"framePoolHeapFallbacks", qulonglong(pool.heapFallbacks)},
+    };
+}
+
+OpusEncoderSettings AudioInput::encoderSettings() const
+{
+    return m_encoderSettings;
+}
+
+void AudioInput::setEncoderSettings(const OpusEncoderSettings &settings)
+{
+    OpusEncoderSettings validated = settings;
+    if (validated.bitrate != OPUS_AUTO && validated.bitrate != OPUS_BITRATE_MAX)
+        validated.bitrate = qBound(6000, validated.bitrate, 510000);
+    validated.complexity = qBound(0, validated.complexity, 10);
+    validated.packetLossPercent = qBound(0, validated.packetLossPercent, 100);
+
+    m_encoderSettings = validated;
+    encoder->setSettings(m_encoderSettings);
+    Q_EMIT encoderSettingsChanged();
+}
+
+int AudioInput::bitrate() const
+{
+    return m_encoderSettings.bitrate;
+}
+
+// Target bitrate in bits per second (6000-510000, or OPUS_AUTO)
+void AudioInput::setBitrate(int newBitrate)
+{
+    if (m_encoderSettings.bitrate == newBitrate)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.bitrate = newBitrate;
+    setEncoderSettings(settings);
+}
+
+bool AudioInput::vbr() const
+{
+    return m_encoderSettings.vbr;
+}
+
+// Variable bitrate when true, constant bitrate when false
+void AudioInput::setVbr(bool newVbr)
+{
+    if (m_encoderSettings.vbr == newVbr)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.vbr = newVbr;
+    setEncoderSettings(settings);
+}
+
+int AudioInput::complexity() const
+{
+    return m_encoderSettings.complexity;
+}
+
+// Encoder CPU/quality trade-off from 0 (cheapest) to 10 (best)
+void AudioInput::setComplexity(int newComplexity)
+{
+    if (m_encoderSettings.complexity == newComplexity)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.complexity = newComplexity;
+    setEncoderSettings(settings);
+}
+
+AudioInput::Application AudioInput::application() const
+{
+    return static_cast<Application>(m_encoderSettings.application);
+}
+
+void AudioInput::setApplication(Application newApplication)
+{
+    if (m_encoderSettings.application == newApplication)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.application = newApplication;
+    setEncoderSettings(settings);
+}
+
+AudioInput::Bandwidth AudioInput::bandwidth() const
+{
+    return static_cast<Bandwidth>(m_encoderSettings.bandwidth);
+}
+
+// Upper limit of the coded audio bandwidth, AutoBandwidth lets Opus decide
+void AudioInput::setBandwidth(Bandwidth newBandwidth)
+{
+    if (m_encoderSettings.bandwidth == newBandwidth)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.bandwidth = newBandwidth;
+    setEncoderSettings(settings);
+}
+
+bool AudioInput::inbandFec() const
+{
+    return m_encoderSettings.inbandFec;
+}
+
+// In-band forward error correction; only used when packetLossPercent > 0
+void AudioInput::setInbandFec(bool newInbandFec)
+{
+    if (m_encoderSettings.inbandFec == newInbandFec)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.inbandFec = newInbandFec;
+    setEncoderSettings(settings);
+}
+
+int AudioInput::packetLossPercent() const
+{
+    return m_encoderSettings.packetLossPercent;
+}
+
+// Expected packet loss (0-100) the encoder should protect against
+void AudioInput::setPacketLossPercent(int newPacketLossPercent)
+{
+    if (m_encoderSettings.packetLossPercent == newPacketLossPercent)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.packetLossPercent = newPacketLossPercent;
+    setEncoderSettings(settings);
+}
+
+bool AudioInput::dtx() const
+{
+    return m_encoderSettings.dtx;
+}
+
+// Discontinuous transmission: near-empty packets during silence
+void AudioInput::setDtx(bool newDtx)
+{
+    if (m_encoderSettings.dtx == newDtx)
+        return;
+    OpusEncoderSettings settings = m_encoderSettings;
+    settings.dtx = newDtx;
+    setEncoderSettings(settings);
+}
+
+bool AudioInput::silenceSuppression() const
+{
+    return m_silenceSuppression;
+}
+
+void AudioInput::setSilenceSuppression(bool newSilenceSuppression)
+{
+    if (m_silenceSuppression == newSilenceSuppression)
+        return;
+    m_silenceSuppression = newSilenceSuppression;
+    encoder->setSilenceSuppression(m_silenceSuppression);
+    Q_EMIT silenceSuppressionChanged();
+}
+
+bool AudioInput::highPassFilter() const
+{
+    return isStageEnabled("highpass");
+}
+
+void AudioInput::setHighPassFilter(bool enabled)
+{
+    setStageEnabled("highpass", enabled);
+}
+
+bool AudioInput::noiseGate() const
+{
+    return isStageEnabled("gate");
+}
+
+void AudioInput::setNoiseGate(bool enabled)
+{
+    setStageEnabled("gate", enabled);
+}
+
+bool AudioInput::automaticGainControl() const
+{
+    return isStageEnabled("agc");
+}
+
+void AudioInput::setAutomaticGainControl(bool enabled)
+{
+    setStageEnabled("agc", enabled);
+}
+
+bool AudioInput::isStageEnabled(const char *name) const
+{
+    const AudioProcessor *stage = encoder->preprocessor().processor(name);
+    return stage && stage->isEnabled();
+}
+
+void AudioInput::setStageEnabled(const char *name, bool enabled)
+{
+    AudioProcessor *stage = encoder->preprocessor().processor(name);
+    if (!stage || stage->isEnabled() == enabled)
+        return;
+    stage->setEnabled(enabled);
+    Q_EMIT preprocessingChanged();
+}
+
+AudioOutput *AudioInput::echoReference() const
+{
+    return m_echoReference;
+}
+
+void AudioInput::setEchoReference(AudioOutput *output)
+{
+    if (m_echoReference == output)
+        return;
+    if (m_echoReference) {
+        disconnect(m_echoReference, &QObject::destroyed, this, nullptr);
+        // The measurement moves to the new output
+        if (m_measureLatency)
+            m_echoReference->latencyProbe()->setEnabled(false);
+        if (m_loopback)
+            m_echoReference->setLoopbackEnabled(false);
+    }
+    m_echoReference = output;
+
+    EchoCanceller *echoCanceller = encoder->echoCanceller();
+    echoCanceller->setEnabled(output != nullptr);
+    // The canceller needs the reference at the capture codec rate
+    if (output)
+        output->setEchoReferenceRate(sampleRate);
+    echoCanceller->setReference(output ? output->echoReference() : nullptr);
+    if (output) {
+        // The reference ring goes away with the output
+        connect(output, &QObject::destroyed, this, [this]() {
+            encoder->echoCanceller()->setEnabled(false);
+            encoder->echoCanceller()->setReference(nullptr);
+            encoder->setLatencyProbe(nullptr);
+            encoder->setLoopbackSource(nullptr);
+            Q_EMIT echoReferenceChanged();
+        });
+    }
+    updateEchoDelay();
+    updateLatencyMeasurement();
+    Q_EMIT echoReferenceChanged();
+}
+
+bool AudioInput::measureLatency() const
+{
+    return m_measureLatency;
+}
+
+void AudioInput::setMeasureLatency(bool enabled)
+{
+    if (m_measureLatency == enabled)
+        return;
+    if (m_echoReference && m_measureLatency)
+        m_echoReference->latencyProbe()->setEnabled(false);
+    m_measureLatency = enabled;
+    updateLatencyMeasurement();
+    Q_EMIT latencyMeasurementChanged();
+}
+
+bool AudioInput::loopback() const
+{
+    return m_loopback;
+}
+
+void AudioInput::setLoopback(bool enabled)
+{
+    if (m_loopback == enabled)
+        return;
+    if (m_echoReference && m_loopback)
+        m_echoReference->setLoopbackEnabled(false);
+    m_loopback = enabled;
+    updateLatencyMeasurement();
+    Q_EMIT latencyMeasurementChanged();
+}
+
+// Points the encoder's probe and loopback hooks at the echo reference output
+void AudioInput::updateLatencyMeasurement()
+{
+    AudioOutput *output = m_echoReference;
+    LatencyProbe *probe = output && m_measureLatency ? output->latencyProbe() : nullptr;
+    if (probe)
+        probe->setEnabled(true);
+    encoder->setLatencyProbe(probe);
+
+    if (output)
+        output->setLoopbackEnabled(m_loopback);
+    encoder->setLoopbackSource(output && m_loopback ? output->loopbackSource() : nullptr);
+}
+
+// A decoded sample reaches the capture frame after sitting in the sink's
+// buffer, travelling through the room and then through the source's buffer
+void AudioInput::updateEchoDelay()
+{
+    if (!m_echoReference)
+        return;
+
+    const qint64 captureLatencyUs = audio->format().durationForBytes(audio->bufferSize());
+    const int outputLatencyMs = m_echoReference->outputLatencyMs();
+    encoder->echoCanceller()->setDelay(outputLatencyMs + int(captureLatencyUs / 1000));
+    m_echoReference->latencyProbe()->setDeviceLatency(captureLatencyUs, qint64(outputLatencyMs) * 1000);
+}
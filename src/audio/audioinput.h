@@ -3,25 +3,161 @@
 
 #include <QAudioSource>
 #include <QIODevice>
-#include <opus.h>
+#include <QPointer>
+#include <QTimer>
+#include <QVariantMap>
+#include <memory>
+#include <vector>
+#include "audioencoder.h"
+#include "audioringbuffer.h"
+#include "resampler.h"
+
+class AudioOutput;
 
 class AudioInput : public QIODevice
 {
     Q_OBJECT
+    Q_PROPERTY(int frameDuration READ frameDuration WRITE setFrameDuration NOTIFY frameDurationChanged FINAL)
+    Q_PROPERTY(int bitrate READ bitrate WRITE setBitrate NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(bool vbr READ vbr WRITE setVbr NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(int complexity READ complexity WRITE setComplexity NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(Application application READ application WRITE setApplication NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(Bandwidth bandwidth READ bandwidth WRITE setBandwidth NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(bool inbandFec READ inbandFec WRITE setInbandFec NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(int packetLossPercent READ packetLossPercent WRITE setPacketLossPercent NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(bool dtx READ dtx WRITE setDtx NOTIFY encoderSettingsChanged FINAL)
+    Q_PROPERTY(bool silenceSuppression READ silenceSuppression WRITE setSilenceSuppression NOTIFY silenceSuppressionChanged FINAL)
+    Q_PROPERTY(bool highPassFilter READ highPassFilter WRITE setHighPassFilter NOTIFY preprocessingChanged FINAL)
+    Q_PROPERTY(bool noiseGate READ noiseGate WRITE setNoiseGate NOTIFY preprocessingChanged FINAL)
+    Q_PROPERTY(bool automaticGainControl READ automaticGainControl WRITE setAutomaticGainControl NOTIFY preprocessingChanged FINAL)
+    Q_PROPERTY(AudioOutput *echoReference READ echoReference WRITE setEchoReference NOTIFY echoReferenceChanged FINAL)
+    Q_PROPERTY(bool measureLatency READ measureLatency WRITE setMeasureLatency NOTIFY latencyMeasurementChanged FINAL)
+    Q_PROPERTY(bool loopback READ loopback WRITE setLoopback NOTIFY latencyMeasurementChanged FINAL)
+    Q_PROPERTY(int deviceSampleRate READ deviceSampleRate CONSTANT FINAL)
+    Q_PROPERTY(int codecSampleRate READ codecSampleRate CONSTANT FINAL)
+
 public:
+    enum Application {
+        Voip = OPUS_APPLICATION_VOIP,
+        Audio = OPUS_APPLICATION_AUDIO,
+        RestrictedLowDelay = OPUS_APPLICATION_RESTRICTED_LOWDELAY
+    };
+    Q_ENUM(Application)
+
+    enum Bandwidth {
+        AutoBandwidth = OPUS_AUTO,
+        Narrowband = OPUS_BANDWIDTH_NARROWBAND,
+        Mediumband = OPUS_BANDWIDTH_MEDIUMBAND,
+        Wideband = OPUS_BANDWIDTH_WIDEBAND,
+        SuperWideband = OPUS_BANDWIDTH_SUPERWIDEBAND,
+        Fullband = OPUS_BANDWIDTH_FULLBAND
+    };
+    Q_ENUM(Bandwidth)
+
     AudioInput();
     ~AudioInput();
     Q_INVOKABLE void start();
     Q_INVOKABLE void stop();
 
+    int frameDuration() const;
+    void setFrameDuration(int newFrameDuration);
+
+    // Encoder controls; every change is applied by the encoder thread before
+    // the next frame, without recreating the encoder
+    OpusEncoderSettings encoderSettings() const;
+    void setEncoderSettings(const OpusEncoderSettings &settings);
+
+    int bitrate() const;
+    void setBitrate(int newBitrate);
+    bool vbr() const;
+    void setVbr(bool newVbr);
+    int complexity() const;
+    void setComplexity(int newComplexity);
+    Application application() const;
+    void setApplication(Application newApplication);
+    Bandwidth bandwidth() const;
+    void setBandwidth(Bandwidth newBandwidth);
+    bool inbandFec() const;
+    void setInbandFec(bool newInbandFec);
+    int packetLossPercent() const;
+    void setPacketLossPercent(int newPacketLossPercent);
+    bool dtx() const;
+    void setDtx(bool newDtx);
+
+    // Voice activity detection on the send path: silent frames are not sent
+    // except for periodic comfort noise updates
+    bool silenceSuppression() const;
+    void setSilenceSuppression(bool newSilenceSuppression);
+
+    // Capture pre-processing stages, applied in place before encoding
+    bool highPassFilter() const;
+    void setHighPassFilter(bool enabled);
+    bool noiseGate() const;
+    void setNoiseGate(bool enabled);
+    bool automaticGainControl() const;
+    void setAutomaticGainControl(bool enabled);
+
+    // Output whose decoded audio is cancelled from the capture (echo
+    // cancellation is on while one is set)
+    AudioOutput *echoReference() const;
+    void setEchoReference(AudioOutput *output);
+
+    // Mouth-to-ear latency measurement against the echo reference output:
+    // measureLatency sends a chirp every two seconds and times its return in
+    // the output's playout (results in AudioOutput::mouthToEarStats()), and
+    // loopback sends the output's playout instead of the microphone, so the
+    // far end's chirps come back. Turn on one of them at each end.
+    bool measureLatency() const;
+    void setMeasureLatency(bool enabled);
+    bool loopback() const;
+    void setLoopback(bool enabled);
+
+    // Rate the microphone runs at, and the Opus rate the capture is resampled to
+    int deviceSampleRate() const;
+    int codecSampleRate() const;
+
+    // Samples waiting in the capture buffer for the next full frame
+    Q_INVOKABLE qint64 leftoverSamples() const;
+    // Number of callbacks that didn't fit in the capture buffer
+    Q_INVOKABLE quint64 overflowCount() const;
+    // Per-frame encode and pre-processing time and silence suppression statistics of the current call
+    Q_INVOKABLE QVariantMap encoderStats() const;
 
 Q_SIGNALS:
-    void audioIsReady(const QByteArray &data);
+    // Emitted from the encoder thread for every frame to send; frame.marker()
+    // is set on the first packet of a talkspurt
+    void audioIsReady(const MediaFrame &frame);
+    void frameDurationChanged();
+    void encoderSettingsChanged();
+    void silenceSuppressionChanged();
+    void preprocessingChanged();
+    void echoReferenceChanged();
+    void latencyMeasurementChanged();
 
 private:
     void handleStateChanged(QAudio::State newState);
+    bool isStageEnabled(const char *name) const;
+    void setStageEnabled(const char *name, bool enabled);
+    void updateEchoDelay();
+    void updateLatencyMeasurement();
     QAudioSource *audio;
-    OpusEncoder *opusEncoder;
+    QAudioFormat deviceFormat;
+    AudioRingBuffer captureBuffer;
+    AudioEncoder *encoder;
+    int sampleRate = 48000;
+    // Device format -> mono float -> codec rate -> Int16, sized for one chunk
+    std::unique_ptr<Resampler> captureResampler;
+    size_t captureChunk = 0;
+    std::vector<float> captureFloat;
+    std::vector<float> captureResampled;
+    std::vector<int16_t> capturePcm;
+    int m_frameDuration = 20;
+    OpusEncoderSettings m_encoderSettings;
+    bool m_silenceSuppression = true;
+    QPointer<AudioOutput> m_echoReference;
+    bool m_measureLatency = false;
+    bool m_loopback = false;
+    QTimer echoDelayTimer;
 
 protected:
     qint64 readData(char *data, qint64 maxlen) override;
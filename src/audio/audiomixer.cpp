@@ -0,0 +1,44 @@
+#include "audiomixer.h"
+#include <algorithm>
+
+// Share of the distance back to unity gain recovered per block; with 10 ms
+// blocks the gain is most of the way back after a second
+static constexpr float LimiterRelease = 0.03f;
+
+AudioMixer::AudioMixer(size_t maxBlock, const Simd::Kernels &kernels)
+    : m_kernels(kernels),
+    m_mix(maxBlock)
+{
+}
+
+void AudioMixer::begin(size_t count)
+{
+    m_count = std::min(count, m_mix.size());
+    std::fill(m_mix.begin(), m_mix.begin() + m_count, 0.0f);
+}
+
+void AudioMixer::add(const float *samples, float gain)
+{
+    if (gain != 0.0f)
+        m_kernels.multiplyAdd(m_mix.data(), samples, gain, m_count);
+}
+
+const float *AudioMixer::finish()
+{
+    const float previous = m_limiterGain.load(std::memory_order_relaxed);
+    const float peak = m_kernels.peak(m_mix.data(), m_count);
+
+    // Attack at once over the whole block, so nothing clips; release slowly
+    float start = previous;
+    float gain = previous + (1.0f - previous) * LimiterRelease;
+    if (peak * std::max(previous, gain) > LimiterThreshold) {
+        gain = std::min(previous, LimiterThreshold / peak);
+        start = gain;
+        m_limitedBlocks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (start != 1.0f || gain != 1.0f)
+        m_kernels.applyGainRamp(m_mix.data(), m_count, start, gain);
+    // Close enough to unity to stop touching the samples
+    m_limiterGain.store(gain > 0.9999f ? 1.0f : gain, std::memory_order_relaxed);
+    return m_mix.data();
+}
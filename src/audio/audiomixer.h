@@ -0,0 +1,43 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "simd.h"
+
+// Sums blocks of mono float audio from several streams into one, each
+// scaled by its own gain, with the SIMD multiply-add kernel. The sum of
+// many loud talkers can go far past full scale, so a limiter then keeps the
+// block's peak under LimiterThreshold: the gain drops at once for a block
+// that would clip and recovers over about a second, ramped across each block
+// so it never clicks. Whatever is left is saturated by the Int16 conversion
+// after the mixer.
+class AudioMixer
+{
+public:
+    static constexpr float LimiterThreshold = 0.9f;
+
+    explicit AudioMixer(size_t maxBlock, const Simd::Kernels &kernels = Simd::kernels());
+
+    // Clears the sum for a block of count samples (at most maxBlock)
+    void begin(size_t count);
+    // Adds count samples scaled by gain
+    void add(const float *samples, float gain);
+    // Limits the sum and returns it; valid until the next begin()
+    const float *finish();
+
+    float limiterGain() const { return m_limiterGain.load(std::memory_order_relaxed); }
+    // Blocks the limiter had to turn down
+    uint64_t limitedBlocks() const { return m_limitedBlocks.load(std::memory_order_relaxed); }
+
+private:
+    const Simd::Kernels  &m_kernels;
+    std::vector<float>    m_mix;
+    size_t                m_count = 0;
+    std::atomic<float>    m_limiterGain{1.0f};
+    std::atomic<uint64_t> m_limitedBlocks{0};
+};
+
+#endif // AUDIOMIXER_H
@@ -1,56 +1,83 @@
 #include "audiooutput.h"
+#include "pcmconvert.h"
 #include <QDebug>
 #include <QFile>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Sink buffer; everything beyond it waits in the peers' jitter buffers, where
+// the delay adapts to the network
+static constexpr int SinkBufferMs = 40;
+// Room in the playout ring; the decoder thread only keeps a couple of blocks in it
+static constexpr int PlayoutRingMs = 100;
 
 AudioOutput::AudioOutput(QObject *parent)
-    : QObject{parent}
+    : QIODevice{parent}
 {
     setupAudio();
     setupDecoder();
-    connect(this, &AudioOutput::newPacket, this, &AudioOutput::play);
-
+    // One second of reference covers any sane playout + capture latency
+    echoReferenceBuffer.reset(48000);
+    loopbackBuffer.reset(48000);
 }
 
 AudioOutput::~AudioOutput(){
-    opus_decoder_destroy(decoder);
+    decoder->stop();
 }
 
 
 void AudioOutput::setupDecoder(){
-    int error;
-    int sampleRate = 48000;
-    int channels = 1;
-
-    decoder = opus_decoder_create(sampleRate, channels, &error);
+    // A narrowband device doesn't need a fullband decode
+    decoderSampleRate = Resampler::codecRateFor(audioFormat.sampleRate());
 
-    if (error != OPUS_OK) {
-        qFatal("Failed to create decoder.\n");
-        return;
-    }
+    playoutRing.reset(size_t(decoderSampleRate) * PlayoutRingMs / 1000);
+    decoder = new AudioDecoder(&playoutRing, decoderSampleRate, this);
+    mixBlockSamples = decoder->blockSamples();
+    mixPcm.resize(mixBlockSamples);
+    mixFloat.resize(mixBlockSamples);
+    playoutResampler = std::make_unique<Resampler>(decoderSampleRate, audioFormat.sampleRate(), mixBlockSamples);
+    playoutFloat.resize(playoutResampler->maxOutput(mixBlockSamples));
+    playoutBytes.resize(qsizetype(playoutFloat.size()) * audioFormat.bytesPerFrame());
+    setEchoReferenceRate(decoderSampleRate);
+    probe = std::make_unique<LatencyProbe>(Simd::kernels(), decoderSampleRate, mixBlockSamples);
+    decoder->setLatencyProbe(probe.get());
 }
 
 void AudioOutput::setupAudio()
 {
-    audioFormat.setSampleRate(48000);
-    audioFormat.setChannelCount(1);
-    audioFormat.setSampleFormat(QAudioFormat::Int16);
+    // Play in the device's own format so the backend doesn't resample
+    const QAudioDevice device = QMediaDevices::defaultAudioOutput();
+    audioFormat = Pcm::deviceFormat(device);
 
-    audioSink = new QAudioSink(QMediaDevices::defaultAudioOutput(), audioFormat, this);
+    audioSink = new QAudioSink(device, audioFormat, this);
     if (!audioSink) {
         qCritical() << "Failed to initialize audio sink!";
         return;
     }
+    audioSink->setBufferSize(audioFormat.bytesForDuration(SinkBufferMs * 1000));
     //connect(audioSink, &QAudioSink::stateChanged, this, &AudioOutput::handleStateChanged);
 
 }
 
 void AudioOutput::start(){
-    ioDevice = audioSink->start();
-    ioDevice->open(QIODevice::WriteOnly);
-    if (!ioDevice) {
-        qCritical() << "Failed to start audio output!";
+    if (!this->open(QIODeviceBase::ReadOnly)) {
+        qCritical() << "Failed to open QIODevice!";
         return;
     }
+    {
+        QMutexLocker locker(&mutex);
+        playoutRing.clear();
+        playoutResampler->reset();
+        playoutOffset = 0;
+        playoutPending = 0;
+        playoutUnderruns = 0;
+    }
+    probe->reset();
+    // The decoder thread starts a new call with no peers; whatever the sink
+    // asks for before it filled the ring is played as silence
+    decoder->start(QThread::TimeCriticalPriority);
+    audioSink->start(this);
 }
 
 void AudioOutput::handleStateChanged(QAudio::State newState)
@@ -75,37 +102,262 @@ void AudioOutput::handleStateChanged(QAudio::State newState)
     }
 }
 
+// Copies a packet from QML into a pooled frame; QML only has one stream
 void AudioOutput::addData(const QByteArray &data){
-    mutex.lock();
-    playQueue.push(data);
-    mutex.unlock();
-    Q_EMIT newPacket();
+    MediaFrame frame = FramePool::media().acquire();
+    if (!frame.assign(data.constData(), size_t(data.size()))) {
+        qWarning() << "Dropping oversized packet of" << data.size() << "bytes";
+        return;
+    }
+    addFrame(QString(), frame);
 }
 
-void AudioOutput::play(){
-    mutex.lock();
-    QByteArray data = playQueue.front();
+// Can be called from any thread; only queues the frame for the decoder thread
+void AudioOutput::addFrame(const QString &peerId, const MediaFrame &frame){
+    decoder->push(peerId, frame);
+}
 
-    std::vector<opus_int16> decodedOutput(960);
+void AudioOutput::removePeer(const QString &peerId){
+    decoder->removePeer(peerId);
+}
 
-    int decodedBytes = opus_decode(decoder,
-                                     reinterpret_cast<const unsigned char*>(data.data()),
-                                     data.size(),
-                                     decodedOutput.data(),
-                                     960,
-                                     0) * 2;
+void AudioOutput::setPeerGain(const QString &peerId, double gain){
+    decoder->setPeerGain(peerId, float(gain));
+}
 
-    const char* outputToWrite = reinterpret_cast<const char*>(decodedOutput.data());
+QStringList AudioOutput::peers() const
+{
+    return decoder->streams().keys();
+}
+
+// Called by the sink whenever it wants more audio. Always fills the whole
+// request (in whole device frames), taking mixed blocks from the playout ring
+// as needed and keeping the remainder of the last one for the next read.
+qint64 AudioOutput::readData(char *data, qint64 maxlen)
+{
+    QMutexLocker locker(&mutex);
+    maxlen -= maxlen % audioFormat.bytesPerFrame();
 
-    ioDevice->write(outputToWrite, decodedBytes);
-    playQueue.pop();
-    mutex.unlock();
+    qint64 written = 0;
+    while (written < maxlen) {
+        if (playoutPending.load(std::memory_order_relaxed) == 0)
+            readBlock();
+        const qint64 pending = playoutPending.load(std::memory_order_relaxed);
+        if (pending == 0)
+            break;
+        const qint64 chunk = qMin(maxlen - written, pending);
+        std::memcpy(data + written, playoutBytes.constData() + playoutOffset, size_t(chunk));
+        playoutOffset += chunk;
+        playoutPending.store(pending - chunk, std::memory_order_relaxed);
+        written += chunk;
+    }
+    // The decoder thread tops the ring up again
+    decoder->notify();
+    return written;
+}
+
+qint64 AudioOutput::writeData(const char *data, qint64 len)
+{
+    return 0;
 }
 
+// Converts the next mixed block to the device format into playoutBytes for
+// the sink to read, and copies it to the echo reference
+void AudioOutput::readBlock(){
+    if (!playoutRing.readFrame(mixPcm.data(), mixBlockSamples)) {
+        // The decoder thread fell behind; the sink keeps its clock either way
+        std::fill(mixPcm.begin(), mixPcm.end(), int16_t(0));
+        playoutUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    Simd::kernels().int16ToFloat(mixPcm.data(), mixFloat.data(), mixBlockSamples);
+
+    const size_t frames = playoutResampler->process(mixFloat.data(), mixBlockSamples, playoutFloat.data());
+    Pcm::fromMonoFloat(playoutFloat.data(), frames, audioFormat, playoutBytes.data());
+    playoutOffset = 0;
+    playoutPending.store(qint64(frames) * audioFormat.bytesPerFrame(), std::memory_order_relaxed);
+
+    const size_t echoSamples = echoResampler->process(mixFloat.data(), mixBlockSamples, echoFloat.data());
+    Simd::kernels().floatToInt16(echoFloat.data(), echoPcm.data(), echoSamples);
+    echoReferenceBuffer.write(echoPcm.data(), echoSamples);
+    if (loopbackEnabled.load(std::memory_order_relaxed))
+        loopbackBuffer.write(echoPcm.data(), echoSamples);
+}
+
+
+AudioRingBuffer *AudioOutput::echoReference()
+{
+    return &echoReferenceBuffer;
+}
+
+void AudioOutput::setEchoReferenceRate(int sampleRate)
+{
+    QMutexLocker locker(&mutex);
+    if (echoResampler && echoResampler->outputRate() == sampleRate)
+        return;
+    echoResampler = std::make_unique<Resampler>(decoderSampleRate, sampleRate, mixBlockSamples);
+    echoFloat.resize(echoResampler->maxOutput(mixBlockSamples));
+    echoPcm.resize(echoFloat.size());
+}
+
+LatencyProbe *AudioOutput::latencyProbe()
+{
+    return probe.get();
+}
+
+AudioRingBuffer *AudioOutput::loopbackSource()
+{
+    return &loopbackBuffer;
+}
+
+void AudioOutput::setLoopbackEnabled(bool enabled)
+{
+    loopbackEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+int AudioOutput::outputLatencyMs() const
+{
+    const qsizetype queuedBytes = audioSink->bufferSize() - audioSink->bytesFree()
+                                  + qsizetype(playoutPending.load(std::memory_order_relaxed));
+    return int(audioFormat.durationForBytes(qMax<qsizetype>(0, queuedBytes)) / 1000);
+}
+
+// Latency percentiles in milliseconds
+static QVariantMap latencyMap(const LatencyHistogram::Summary &summary)
+{
+    QVariantMap map;
+    map["count"] = qulonglong(summary.count);
+    map["meanMs"] = double(summary.meanUs) / 1000.0;
+    map["p50Ms"] = double(summary.p50Us) / 1000.0;
+    map["p95Ms"] = double(summary.p95Us) / 1000.0;
+    map["p99Ms"] = double(summary.p99Us) / 1000.0;
+    map["maxMs"] = double(summary.maxUs) / 1000.0;
+    return map;
+}
+
+static void addJitterStats(QVariantMap &map, const JitterBuffer::Stats &stats)
+{
+    map["depthMs"] = qMax(map.value("depthMs").toInt(), stats.depthMs);
+    map["targetDelayMs"] = qMax(map.value("targetDelayMs").toInt(), stats.targetDelayMs);
+    map["jitterMs"] = qMax(map.value("jitterMs").toFloat(), stats.jitterMs);
+    map["packets"] = map.value("packets").toInt() + stats.packets;
+    map["received"] = map.value("received").toULongLong() + stats.received;
+    map["duplicates"] = map.value("duplicates").toULongLong() + stats.duplicates;
+    map["late"] = map.value("late").toULongLong() + stats.late;
+    map["overflows"] = map.value("overflows").toULongLong() + stats.overflows;
+    map["restarts"] = map.value("restarts").toULongLong() + stats.restarts;
+    map["flushed"] = map.value("flushed").toULongLong() + stats.flushed;
+    map["dropped"] = map.value("dropped").toULongLong() + stats.dropped;
+    map["missing"] = map.value("missing").toULongLong() + stats.missing;
+    map["underruns"] = map.value("underruns").toULongLong() + stats.underruns;
+}
+
+static void addLossStats(QVariantMap &map, const PeerStream::Stats &stats)
+{
+    map["decodedFrames"] = map.value("decodedFrames").toULongLong() + stats.decodedFrames;
+    map["lostFrames"] = map.value("lostFrames").toULongLong() + stats.lostFrames;
+    map["concealedFrames"] = map.value("concealedFrames").toULongLong() + stats.concealedFrames;
+    map["recoveredFrames"] = map.value("recoveredFrames").toULongLong() + stats.recoveredFrames;
+    map["underrunFrames"] = map.value("underrunFrames").toULongLong() + stats.underrunFrames;
+    map["comfortNoiseFrames"] = map.value("comfortNoiseFrames").toULongLong() + stats.comfortNoiseFrames;
+    const qulonglong lost = map.value("lostFrames").toULongLong();
+    const qulonglong total = map.value("decodedFrames").toULongLong() + lost;
+    map["lossRate"] = total ? double(lost) / total : 0.0;
+}
+
+QVariantMap AudioOutput::peerStats(const QString &peerId) const
+{
+    const std::shared_ptr<PeerStream> stream = decoder->stream(peerId);
+    if (!stream)
+        return {};
+    QVariantMap result;
+    addJitterStats(result, stream->jitterStats());
+    const PeerStream::Stats stats = stream->stats();
+    addLossStats(result, stats);
+    result["gain"] = stream->gain();
+    result["playoutRate"] = stats.playoutRate;
+    result["acceleratedFrames"] = qulonglong(stats.acceleratedFrames);
+    result["deceleratedFrames"] = qulonglong(stats.deceleratedFrames);
+    result["senderClockPpm"] = stats.senderClockPpm;
+    result["clockSkewPpm"] = stats.clockSkewPpm;
+    result["comfortNoiseLevelDb"] = stats.comfortNoiseLevelDb;
+    result["playoutLatency"] = latencyMap(stream->latency().summary());
+    return result;
+}
+
+int AudioOutput::playoutDelayMs(const QString &peerId) const
+{
+    const std::shared_ptr<PeerStream> stream = decoder->stream(peerId);
+    return stream ? stream->jitterStats().targetDelayMs : 0;
+}
+
+// Depths and delays are the worst peer's, counters are summed
+QVariantMap AudioOutput::jitterStats() const
+{
+    const QMap<QString, std::shared_ptr<PeerStream>> streams = decoder->streams();
+    QVariantMap result;
+    qulonglong accelerated = 0, decelerated = 0;
+    double skewPpm = 0.0;
+    for (const std::shared_ptr<PeerStream> &stream : streams) {
+        addJitterStats(result, stream->jitterStats());
+        const PeerStream::Stats stats = stream->stats();
+        accelerated += stats.acceleratedFrames;
+        decelerated += stats.deceleratedFrames;
+        if (std::abs(stats.clockSkewPpm) > std::abs(skewPpm))
+            skewPpm = stats.clockSkewPpm;
+    }
+    result["peers"] = int(streams.size());
+    result["sinkBufferedMs"] = outputLatencyMs();
+    result["acceleratedFrames"] = accelerated;
+    result["deceleratedFrames"] = decelerated;
+    result["limiterGain"] = decoder->limiterGain();
+    result["limitedBlocks"] = qulonglong(decoder->limitedBlocks());
+    result["sinkClockPpm"] = decoder->sinkClock().ppm();
+    result["clockSkewPpm"] = skewPpm;
+    return result;
+}
+
+QVariantMap AudioOutput::latencyStats() const
+{
+    const QMap<QString, std::shared_ptr<PeerStream>> streams = decoder->streams();
+    LatencyHistogram playout;
+    for (const std::shared_ptr<PeerStream> &stream : streams)
+        playout.merge(stream->latency());
+
+    QVariantMap result;
+    result["queue"] = latencyMap(decoder->queueLatency().summary());
+    result["playout"] = latencyMap(playout.summary());
+    result["queueOverflows"] = qulonglong(decoder->queueOverflows());
+    result["playoutLeadMs"] = decoder->leadMs();
+    result["playoutUnderruns"] = qulonglong(playoutUnderruns.load(std::memory_order_relaxed));
+    return result;
+}
+
+QVariantMap AudioOutput::mouthToEarStats() const
+{
+    const LatencyProbe::Stats stats = probe->stats();
+    QVariantMap result;
+    result["enabled"] = probe->isEnabled();
+    result["roundTrip"] = latencyMap(probe->roundTrip().summary());
+    result["mouthToEar"] = latencyMap(probe->mouthToEar().summary());
+    result["sent"] = qulonglong(stats.sent);
+    result["detected"] = qulonglong(stats.detected);
+    result["lost"] = qulonglong(stats.lost);
+    result["lastScore"] = stats.lastScore;
+    return result;
+}
+
+QVariantMap AudioOutput::lossStats() const
+{
+    const QMap<QString, std::shared_ptr<PeerStream>> streams = decoder->streams();
+    QVariantMap result;
+    for (const std::shared_ptr<PeerStream> &stream : streams)
+        addLossStats(result, stream->stats());
+    return result;
+}
 
 void AudioOutput::stop()
 {
-    ioDevice->close();
     audioSink->stop();
+    decoder->stop();
+    this->close();
 }
-
@@ -6,12 +6,25 @@
 #include <QAudioFormat>
 #include <QAudioSink>
 #include <QMediaDevices>
+#include <QMap>
 #include <QMutex>
 #include <QBuffer>
-#include <queue>
-#include <opus.h>
+#include <QStringList>
+#include <QVariantMap>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "audiodecoder.h"
+#include "audioringbuffer.h"
+#include "framepool.h"
+#include "latencyprobe.h"
+#include "resampler.h"
 
-class AudioOutput : public QObject
+// Pull-mode playout: the sink reads from this device on the sound card's
+// clock, and every read is filled with exactly that much audio from the
+// playout ring, so playout timing never follows packet arrival. The peers'
+// streams are decoded and mixed into the ring by the AudioDecoder thread.
+class AudioOutput : public QIODevice
 {
     Q_OBJECT
 public:
@@ -20,24 +33,86 @@ public:
     Q_INVOKABLE void start();
     Q_INVOKABLE void stop();
 
+    // Copy of every mixed sample handed to the sink, for the capture side's
+    // echo canceller (single consumer)
+    AudioRingBuffer *echoReference();
+    // Rate the echo reference is written at (the decoder rate until set)
+    void setEchoReferenceRate(int sampleRate);
+    // Audio handed to the sink (and mixed but not yet read by it) that
+    // hasn't been played yet
+    Q_INVOKABLE int outputLatencyMs() const;
+
+    // Chirp detector of the mouth-to-ear measurement; it searches every mixed
+    // block while enabled or while a chirp is on its way
+    LatencyProbe *latencyProbe();
+    // Copy of the playout at the echo reference rate, for the capture side to
+    // send back to the far end while enabled (single consumer)
+    AudioRingBuffer *loopbackSource();
+    void setLoopbackEnabled(bool enabled);
+
+    // Linear gain of one peer in the mix (1 by default, 0 mutes)
+    Q_INVOKABLE void setPeerGain(const QString &peerId, double gain);
+    Q_INVOKABLE QStringList peers() const;
+    // Jitter buffer and loss statistics of one peer
+    Q_INVOKABLE QVariantMap peerStats(const QString &peerId) const;
+    // How long the peer's packets wait in its jitter buffer before they are
+    // played (the target delay), 0 if the peer has no stream yet
+    int playoutDelayMs(const QString &peerId) const;
+    // Jitter buffer depth, target delay and discard counters over all peers
+    Q_INVOKABLE QVariantMap jitterStats() const;
+    // Latency percentiles from packet arrival to the playout thread and to
+    // the sink, and how often the sink found the playout ring empty
+    Q_INVOKABLE QVariantMap latencyStats() const;
+    // Round-trip and mouth-to-ear percentiles of the latency probe, and how
+    // many chirps came back
+    Q_INVOKABLE QVariantMap mouthToEarStats() const;
+    // Frames decoded, lost, and how the lost ones were filled in, over all peers since start()
+    Q_INVOKABLE QVariantMap lossStats() const;
+
 public Q_SLOTS:
     void addData(const QByteArray &data);
-    void play();
+    void addFrame(const QString &peerId, const MediaFrame &frame);
+    void removePeer(const QString &peerId);
     void handleStateChanged(QAudio::State newState);
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
 private:
     void setupAudio();
     void setupDecoder();
-    OpusDecoder* decoder;
-    std::queue<QByteArray> playQueue;
-    QIODevice* ioDevice;
+    void readBlock();
     QAudioFormat audioFormat;
     QAudioSink* audioSink;
     QMediaDevices mediaDevices;
-    QMutex mutex;
-
-Q_SIGNALS:
-    void newPacket();  // Signal emitted when new data is added
+    // Guards the resamplers and the playout buffer
+    mutable QMutex mutex;
+    AudioRingBuffer echoReferenceBuffer;
 
+    // Opus decodes at the lowest rate that covers the device; the decoder
+    // thread mixes the peers at that rate into playoutRing, and each block
+    // is resampled and converted to the device format as the sink reads it.
+    // Buffers are allocated in setupDecoder().
+    int decoderSampleRate = 48000;
+    AudioRingBuffer playoutRing;
+    AudioDecoder *decoder = nullptr;
+    size_t mixBlockSamples = 0;
+    std::vector<int16_t> mixPcm;
+    std::vector<float> mixFloat;
+    std::unique_ptr<Resampler> playoutResampler;
+    std::vector<float> playoutFloat;
+    std::atomic<quint64> playoutUnderruns{0};
+    // The last mixed block in the device format; the sink reads it in
+    // whatever chunks it likes, starting at playoutOffset
+    QByteArray playoutBytes;
+    qint64 playoutOffset = 0;
+    std::atomic<qint64> playoutPending{0};
+    std::unique_ptr<Resampler> echoResampler;
+    std::vector<float> echoFloat;
+    std::vector<int16_t> echoPcm;
+    std::unique_ptr<LatencyProbe> probe;
+    AudioRingBuffer loopbackBuffer;
+    std::atomic<bool> loopbackEnabled{false};
 };
 
 #endif // AUDIOOUTPUT_H
@@ -0,0 +1,277 @@
+#include "audiopreprocessor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+static constexpr float Pi = 3.14159265358979f;
+
+static float toDb(float meanSquare)
+{
+    return 10.0f * std::log10(std::max(meanSquare, 1e-10f));
+}
+
+static float fromDb(float decibels)
+{
+    return std::pow(10.0f, decibels / 20.0f);
+}
+
+/*
+ * ====================================================
+ * ================= HighPassFilter ===================
+ * ====================================================
+ */
+
+HighPassFilter::HighPassFilter(int sampleRate, float cutoffHz)
+{
+    // RBJ cookbook high-pass with Q = 1/sqrt(2), normalised by a0
+    const float w0 = 2.0f * Pi * cutoffHz / sampleRate;
+    const float cosW0 = std::cos(w0);
+    const float alpha = std::sin(w0) / (2.0f * 0.70710678f);
+    const float a0 = 1.0f + alpha;
+
+    m_b0 = (1.0f + cosW0) / 2.0f / a0;
+    m_b1 = -(1.0f + cosW0) / a0;
+    m_b2 = m_b0;
+    m_a1 = -2.0f * cosW0 / a0;
+    m_a2 = (1.0f - alpha) / a0;
+}
+
+void HighPassFilter::reset()
+{
+    m_z1 = 0.0f;
+    m_z2 = 0.0f;
+}
+
+void HighPassFilter::process(float *samples, size_t count)
+{
+    // The recursion makes every output depend on the previous one, so this
+    // stage stays scalar (transposed direct form II)
+    float z1 = m_z1;
+    float z2 = m_z2;
+    for (size_t i = 0; i < count; ++i) {
+        const float in = samples[i];
+        const float out = m_b0 * in + z1;
+        z1 = m_b1 * in - m_a1 * out + z2;
+        z2 = m_b2 * in - m_a2 * out;
+        samples[i] = out;
+    }
+    m_z1 = z1;
+    m_z2 = z2;
+}
+
+/*
+ * ====================================================
+ * ============== AutomaticGainControl ================
+ * ====================================================
+ */
+
+// Below this level the input is treated as silence and the gain is held
+static constexpr float AgcActivityLevelDb = -50.0f;
+static constexpr float AgcMaxGainDb = 24.0f;
+static constexpr float AgcMinGainDb = -12.0f;
+static constexpr float AgcPeakLimit = 0.98f;
+// Fraction of the distance to the wanted gain covered per frame; reducing the
+// gain is faster than raising it
+static constexpr float AgcAttack = 0.5f;
+static constexpr float AgcRelease = 0.05f;
+
+AutomaticGainControl::AutomaticGainControl(const Simd::Kernels &kernels, float targetLevelDb)
+    : m_kernels(kernels),
+    m_targetLevelDb(targetLevelDb)
+{}
+
+void AutomaticGainControl::reset()
+{
+    m_gain = 1.0f;
+}
+
+void AutomaticGainControl::process(float *samples, size_t count)
+{
+    if (count == 0)
+        return;
+
+    const float levelDb = toDb(m_kernels.sumSquares(samples, count) / count);
+    float wanted = m_gain;
+    if (levelDb > AgcActivityLevelDb)
+        wanted = fromDb(std::clamp(m_targetLevelDb - levelDb, AgcMinGainDb, AgcMaxGainDb));
+
+    const float peak = m_kernels.peak(samples, count);
+    if (peak * wanted > AgcPeakLimit)
+        wanted = AgcPeakLimit / peak;
+
+    const float rate = wanted < m_gain ? AgcAttack : AgcRelease;
+    float next = m_gain + (wanted - m_gain) * rate;
+    // Never end the frame above what the peak allows
+    if (peak * next > AgcPeakLimit)
+        next = AgcPeakLimit / peak;
+
+    m_kernels.applyGainRamp(samples, count, m_gain, next);
+    m_gain = next;
+}
+
+float AutomaticGainControl::gainDb() const
+{
+    return 20.0f * std::log10(m_gain);
+}
+
+/*
+ * ====================================================
+ * ==================== NoiseGate =====================
+ * ====================================================
+ */
+
+static constexpr float GateFloorGain = 0.03f; // about -30 dB
+static constexpr int GateHoldMs = 150;
+// Gain multiplier per 10 ms while closing, so the gate fades out over ~100 ms
+static constexpr float GateReleasePer10Ms = 0.7f;
+
+NoiseGate::NoiseGate(const Simd::Kernels &kernels, int sampleRate, float thresholdDb)
+    : m_kernels(kernels),
+    m_sampleRate(sampleRate),
+    m_thresholdDb(thresholdDb)
+{}
+
+void NoiseGate::reset()
+{
+    m_gain = 1.0f;
+    m_quietMs = 0;
+}
+
+void NoiseGate::process(float *samples, size_t count)
+{
+    if (count == 0)
+        return;
+
+    const int frameMs = std::max<int>(1, int(count * 1000 / m_sampleRate));
+    const float levelDb = toDb(m_kernels.sumSquares(samples, count) / count);
+
+    if (levelDb >= m_thresholdDb)
+        m_quietMs = 0;
+    else
+        m_quietMs += frameMs;
+
+    float next = 1.0f;
+    if (m_quietMs > GateHoldMs)
+        next = std::max(GateFloorGain, m_gain * std::pow(GateReleasePer10Ms, frameMs / 10.0f));
+
+    if (m_gain != 1.0f || next != 1.0f)
+        m_kernels.applyGainRamp(samples, count, m_gain, next);
+    m_gain = next;
+}
+
+/*
+ * ====================================================
+ * ================ AudioPreprocessor =================
+ * ====================================================
+ */
+
+AudioPreprocessor::AudioPreprocessor(int sampleRate, size_t maxFrameSize, const Simd::Kernels &kernels)
+    : m_kernels(kernels),
+    m_sampleRate(sampleRate),
+    m_scratch(maxFrameSize)
+{}
+
+void AudioPreprocessor::addDefaultStages()
+{
+    addProcessor(std::make_unique<HighPassFilter>(m_sampleRate));
+    addProcessor(std::make_unique<NoiseGate>(m_kernels, m_sampleRate));
+    addProcessor(std::make_unique<AutomaticGainControl>(m_kernels));
+}
+
+// Processors must be added before processing starts
+void AudioPreprocessor::addProcessor(std::unique_ptr<AudioProcessor> processor)
+{
+    m_processors.push_back(std::move(processor));
+}
+
+AudioProcessor *AudioPreprocessor::processor(const char *name) const
+{
+    for (const auto &processor : m_processors) {
+        if (std::strcmp(processor->name(), name) == 0)
+            return processor.get();
+    }
+    return nullptr;
+}
+
+void AudioPreprocessor::reset()
+{
+    for (const auto &processor : m_processors)
+        processor->reset();
+}
+
+void AudioPreprocessor::process(int16_t *samples, size_t count)
+{
+    bool anyEnabled = false;
+    for (const auto &processor : m_processors)
+        anyEnabled = anyEnabled || processor->isEnabled();
+    if (!anyEnabled || m_scratch.empty())
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Frames longer than the scratch buffer go through in pieces, so every
+    // sample is processed and nothing is allocated here
+    for (size_t offset = 0; offset < count; offset += m_scratch.size()) {
+        const size_t chunk = std::min(count - offset, m_scratch.size());
+        m_kernels.int16ToFloat(samples + offset, m_scratch.data(), chunk);
+        for (const auto &processor : m_processors) {
+            if (processor->isEnabled())
+                processor->process(m_scratch.data(), chunk);
+        }
+        m_kernels.floatToInt16(m_scratch.data(), samples + offset, chunk);
+    }
+
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+    // Only the processing thread writes the metrics
+    m_lastNs.store(elapsed, std::memory_order_relaxed);
+    m_totalNs.store(m_totalNs.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    if (elapsed > m_maxNs.load(std::memory_order_relaxed))
+        m_maxNs.store(elapsed, std::memory_order_relaxed);
+    m_frames.fetch_add(1, std::memory_order_release);
+}
+
+AudioPreprocessor::Metrics AudioPreprocessor::metrics() const
+{
+    Metrics result;
+    result.frames = m_frames.load(std::memory_order_acquire);
+    result.lastNs = m_lastNs.load(std::memory_order_relaxed);
+    result.maxNs = m_maxNs.load(std::memory_order_relaxed);
+    if (result.frames)
+        result.averageNs = m_totalNs.load(std::memory_order_relaxed) / int64_t(result.frames);
+    return result;
+}
+
+void AudioPreprocessor::resetMetrics()
+{
+    m_frames.store(0, std::memory_order_relaxed);
+    m_lastNs.store(0, std::memory_order_relaxed);
+    m_maxNs.store(0, std::memory_order_relaxed);
+    m_totalNs.store(0, std::memory_order_relaxed);
+}
+
+double AudioPreprocessor::benchmark(int sampleRate, int frameMs, Simd::Level level, int iterations)
+{
+    const size_t frameSize = size_t(sampleRate) * frameMs / 1000;
+    AudioPreprocessor preprocessor(sampleRate, frameSize, Simd::kernels(level));
+    preprocessor.addDefaultStages();
+
+    // Speech-like input: a tone with noise, alternating loud and quiet
+    // stretches so the gate and the AGC both do work
+    std::mt19937 generator(1);
+    std::normal_distribution<float> noise(0.0f, 200.0f);
+    std::vector<int16_t> input(frameSize * 16);
+    for (size_t i = 0; i < input.size(); ++i) {
+        const float amplitude = (i / frameSize) % 4 == 0 ? 50.0f : 6000.0f;
+        input[i] = int16_t(amplitude * std::sin(i * 0.037f) + noise(generator));
+    }
+
+    std::vector<int16_t> frame(frameSize);
+    for (int i = 0; i < iterations; ++i) {
+        std::memcpy(frame.data(), input.data() + (i % 16) * frameSize, frameSize * sizeof(int16_t));
+        preprocessor.process(frame.data(), frameSize);
+    }
+    return double(preprocessor.metrics().averageNs);
+}
@@ -0,0 +1,124 @@
+#ifndef AUDIOPREPROCESSOR_H
+#define AUDIOPREPROCESSOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "simd.h"
+
+// One in-place stage of the capture pre-processing chain. Stages work on
+// float samples in [-1, 1) and can be switched on and off from any thread.
+class AudioProcessor
+{
+public:
+    virtual ~AudioProcessor() = default;
+
+    virtual const char *name() const = 0;
+    virtual void reset() {}
+    virtual void process(float *samples, size_t count) = 0;
+
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> m_enabled{true};
+};
+
+// Second-order Butterworth high-pass that removes DC offset and low rumble
+class HighPassFilter : public AudioProcessor
+{
+public:
+    HighPassFilter(int sampleRate, float cutoffHz = 80.0f);
+
+    const char *name() const override { return "highpass"; }
+    void reset() override;
+    void process(float *samples, size_t count) override;
+
+private:
+    float m_b0, m_b1, m_b2, m_a1, m_a2;
+    float m_z1 = 0.0f;
+    float m_z2 = 0.0f;
+};
+
+// Slow automatic gain control towards a target RMS level. The gain is frozen
+// while the input is below the activity threshold so silence isn't pumped up,
+// and limited so the frame peak never clips.
+class AutomaticGainControl : public AudioProcessor
+{
+public:
+    explicit AutomaticGainControl(const Simd::Kernels &kernels, float targetLevelDb = -18.0f);
+
+    const char *name() const override { return "agc"; }
+    void reset() override;
+    void process(float *samples, size_t count) override;
+
+    float gainDb() const;
+
+private:
+    const Simd::Kernels &m_kernels;
+    float m_targetLevelDb;
+    float m_gain = 1.0f;
+};
+
+// Attenuates frames whose level stays below the threshold for longer than the
+// hold time; opens again within one frame when speech comes back
+class NoiseGate : public AudioProcessor
+{
+public:
+    NoiseGate(const Simd::Kernels &kernels, int sampleRate, float thresholdDb = -50.0f);
+
+    const char *name() const override { return "gate"; }
+    void reset() override;
+    void process(float *samples, size_t count) override;
+
+private:
+    const Simd::Kernels &m_kernels;
+    int   m_sampleRate;
+    float m_thresholdDb;
+    float m_gain = 1.0f;
+    int   m_quietMs = 0;
+};
+
+// Runs the enabled stages in order on an Int16 capture frame, in place.
+// Scratch memory is allocated up front, so process() never allocates;
+// frames longer than maxFrameSize are processed in maxFrameSize pieces.
+class AudioPreprocessor
+{
+public:
+    AudioPreprocessor(int sampleRate, size_t maxFrameSize, const Simd::Kernels &kernels = Simd::kernels());
+
+    // Adds the default high-pass -> noise gate -> AGC chain
+    void addDefaultStages();
+    void addProcessor(std::unique_ptr<AudioProcessor> processor);
+    AudioProcessor *processor(const char *name) const;
+
+    void reset();
+    void process(int16_t *samples, size_t count);
+
+    struct Metrics {
+        uint64_t frames = 0;
+        int64_t  lastNs = 0;
+        int64_t  maxNs = 0;
+        int64_t  averageNs = 0;
+    };
+    Metrics metrics() const;
+    void resetMetrics();
+
+    // Average cost in nanoseconds of running the default chain on one frame
+    // with the given kernels
+    static double benchmark(int sampleRate, int frameMs, Simd::Level level, int iterations);
+
+private:
+    const Simd::Kernels                         &m_kernels;
+    int                                          m_sampleRate;
+    std::vector<float>                           m_scratch;
+    std::vector<std::unique_ptr<AudioProcessor>> m_processors;
+
+    std::atomic<uint64_t>                        m_frames{0};
+    std::atomic<int64_t>                         m_lastNs{0};
+    std::atomic<int64_t>                         m_maxNs{0};
+    std::atomic<int64_t>                         m_totalNs{0};
+};
+
+#endif // AUDIOPREPROCESSOR_H
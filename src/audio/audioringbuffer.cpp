@@ -0,0 +1,88 @@
+#include "audioringbuffer.h"
+#include <algorithm>
+#include <cstring>
+
+AudioRingBuffer::AudioRingBuffer(size_t capacity)
+{
+    reset(capacity);
+}
+
+void AudioRingBuffer::reset(size_t capacity)
+{
+    // Power of two capacity lets positions wrap with a mask instead of a modulo
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    m_buffer.assign(capacity ? size : 0, 0);
+    m_mask = capacity ? size - 1 : 0;
+    clear();
+}
+
+void AudioRingBuffer::clear()
+{
+    m_readPos.store(0, std::memory_order_relaxed);
+    m_writePos.store(0, std::memory_order_relaxed);
+    m_overflowCount.store(0, std::memory_order_relaxed);
+    m_droppedSamples.store(0, std::memory_order_relaxed);
+}
+
+size_t AudioRingBuffer::write(const int16_t *samples, size_t count)
+{
+    const size_t writePos = m_writePos.load(std::memory_order_relaxed);
+    const size_t readPos = m_readPos.load(std::memory_order_acquire);
+
+    const size_t toWrite = std::min(count, capacity() - (writePos - readPos));
+    if (toWrite < count) {
+        m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+        m_droppedSamples.fetch_add(count - toWrite, std::memory_order_relaxed);
+    }
+
+    // Copy in at most two chunks: up to the end of the storage, then from the start
+    const size_t start = writePos & m_mask;
+    const size_t first = std::min(toWrite, m_buffer.size() - start);
+    std::memcpy(m_buffer.data() + start, samples, first * sizeof(int16_t));
+    std::memcpy(m_buffer.data(), samples + first, (toWrite - first) * sizeof(int16_t));
+
+    // Publish the samples to the consumer only after they have been copied
+    m_writePos.store(writePos + toWrite, std::memory_order_release);
+    return toWrite;
+}
+
+bool AudioRingBuffer::readFrame(int16_t *frame, size_t frameSize)
+{
+    const size_t readPos = m_readPos.load(std::memory_order_relaxed);
+    const size_t writePos = m_writePos.load(std::memory_order_acquire);
+
+    if (frameSize == 0 || writePos - readPos < frameSize)
+        return false;
+
+    const size_t start = readPos & m_mask;
+    const size_t first = std::min(frameSize, m_buffer.size() - start);
+    std::memcpy(frame, m_buffer.data() + start, first * sizeof(int16_t));
+    std::memcpy(frame + first, m_buffer.data(), (frameSize - first) * sizeof(int16_t));
+
+    // Hand the slots back to the producer only after they have been copied out
+    m_readPos.store(readPos + frameSize, std::memory_order_release);
+    return true;
+}
+
+size_t AudioRingBuffer::available() const
+{
+    return m_writePos.load(std::memory_order_acquire) - m_readPos.load(std::memory_order_acquire);
+}
+
+size_t AudioRingBuffer::capacity() const
+{
+    return m_buffer.size();
+}
+
+uint64_t AudioRingBuffer::overflowCount() const
+{
+    return m_overflowCount.load(std::memory_order_relaxed);
+}
+
+uint64_t AudioRingBuffer::droppedSamples() const
+{
+    return m_droppedSamples.load(std::memory_order_relaxed);
+}
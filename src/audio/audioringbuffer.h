@@ -0,0 +1,45 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fixed-capacity, lock-free single-producer/single-consumer ring of mono
+// 16-bit PCM samples. Storage is allocated once in reset(); write() and
+// readFrame() never allocate or block, so the capture callback can feed the
+// encoder thread through it. write() must only be called from one thread and
+// readFrame() from one (other) thread; reset() and clear() only while idle.
+class AudioRingBuffer
+{
+public:
+    explicit AudioRingBuffer(size_t capacity = 0);
+
+    // (Re)allocates the storage, rounded up to a power of two, and clears it
+    void reset(size_t capacity);
+    void clear();
+
+    // Producer: appends as many samples as fit; the rest are dropped and counted as an overflow
+    size_t write(const int16_t *samples, size_t count);
+
+    // Consumer: copies exactly frameSize samples out, or nothing if a full frame isn't buffered yet
+    bool readFrame(int16_t *frame, size_t frameSize);
+
+    size_t available() const;
+    size_t capacity() const;
+
+    uint64_t overflowCount() const;
+    uint64_t droppedSamples() const;
+
+private:
+    std::vector<int16_t>  m_buffer;
+    size_t                m_mask = 0;
+    // Each index lives on its own cache line so producer and consumer don't false-share
+    alignas(64) std::atomic<size_t>   m_readPos{0};
+    alignas(64) std::atomic<size_t>   m_writePos{0};
+    std::atomic<uint64_t> m_overflowCount{0};
+    std::atomic<uint64_t> m_droppedSamples{0};
+};
+
+#endif // AUDIORINGBUFFER_H
@@ -0,0 +1,128 @@
+#include "comfortnoise.h"
+#include <algorithm>
+#include <cmath>
+
+// Frames up to this far above the noise floor are taken as background
+static constexpr float BackgroundMarginDb = 6.0f;
+// The floor creeps up this fast, so it follows a background that got louder
+static constexpr float FloorRiseDbPerSecond = 3.0f;
+// Weight of a new background frame in the smoothed autocorrelation
+static constexpr double Smoothing = 0.2;
+// Loud "background" (music, a noisy room the sender's VAD kept sending) is
+// not reproduced above this level
+static constexpr float MaxLevelDb = -35.0f;
+
+static float toDb(double meanSquare)
+{
+    return 10.0f * float(std::log10(std::max(meanSquare, 1e-10)));
+}
+
+ComfortNoiseGenerator::ComfortNoiseGenerator(const Simd::Kernels &kernels, int sampleRate)
+    : m_kernels(kernels),
+    m_sampleRate(sampleRate)
+{
+}
+
+void ComfortNoiseGenerator::reset()
+{
+    m_haveFloor = false;
+    m_haveModel = false;
+    m_autocorrelation.fill(0.0);
+    m_lpc.fill(0.0f);
+    m_excitation = 0.0f;
+    m_synthesis.fill(0.0f);
+    m_active = false;
+}
+
+void ComfortNoiseGenerator::analyse(const float *samples, size_t count)
+{
+    if (count <= size_t(Order))
+        return;
+    const double meanSquare = double(m_kernels.sumSquares(samples, count)) / count;
+    const float levelDb = toDb(meanSquare);
+    if (!m_haveFloor || levelDb < m_floorDb) {
+        m_floorDb = levelDb;
+        m_haveFloor = true;
+    } else {
+        m_floorDb += FloorRiseDbPerSecond * float(count) / float(m_sampleRate);
+    }
+    if (levelDb > m_floorDb + BackgroundMarginDb)
+        return;
+
+    // The vectorised dot product does the heavy lifting; the frame is short
+    // enough that the biased estimate needs no window
+    for (size_t lag = 0; lag <= size_t(Order); ++lag) {
+        const double value = double(m_kernels.dot(samples, samples + lag, count - lag)) / count;
+        m_autocorrelation[lag] = m_haveModel
+            ? m_autocorrelation[lag] + Smoothing * (value - m_autocorrelation[lag])
+            : value;
+    }
+    m_haveModel = true;
+    updateFilter();
+}
+
+// Levinson-Durbin recursion from the smoothed autocorrelation to the
+// predictor, whose residual energy sets the excitation level
+void ComfortNoiseGenerator::updateFilter()
+{
+    // A little white noise keeps the recursion stable on tonal or silent input
+    const double energy = m_autocorrelation[0] * 1.0001 + 1e-12;
+    std::array<double, Order + 1> predictor{};
+    std::array<double, Order + 1> previous{};
+    double error = energy;
+    for (int i = 1; i <= Order; ++i) {
+        double accumulator = m_autocorrelation[size_t(i)];
+        for (int j = 1; j < i; ++j)
+            accumulator -= predictor[size_t(j)] * m_autocorrelation[size_t(i - j)];
+        const double reflection = accumulator / error;
+        previous = predictor;
+        predictor[size_t(i)] = reflection;
+        for (int j = 1; j < i; ++j)
+            predictor[size_t(j)] = previous[size_t(j)] - reflection * previous[size_t(i - j)];
+        error *= 1.0 - reflection * reflection;
+        if (error <= 0.0)
+            break;
+    }
+    for (int j = 0; j < Order; ++j)
+        m_lpc[size_t(j)] = float(predictor[size_t(j + 1)]);
+
+    const double maxEnergy = std::pow(10.0, MaxLevelDb / 10.0);
+    const double scale = energy > maxEnergy ? maxEnergy / energy : 1.0;
+    // Uniform noise in [-1, 1) has a variance of 1/3
+    m_excitation = float(std::sqrt(3.0 * std::max(error, 0.0) * scale));
+}
+
+void ComfortNoiseGenerator::generate(float *out, size_t count)
+{
+    if (!m_haveModel) {
+        std::fill(out, out + count, 0.0f);
+        return;
+    }
+
+    // The recursion makes every output depend on the previous ones, so the
+    // synthesis filter stays scalar; m_synthesis holds the newest output first
+    for (size_t i = 0; i < count; ++i) {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+        const float white = float(int32_t(m_seed)) * (1.0f / 2147483648.0f);
+        float sample = m_excitation * white;
+        for (int j = 0; j < Order; ++j)
+            sample += m_lpc[size_t(j)] * m_synthesis[size_t(j)];
+        std::copy_backward(m_synthesis.begin(), m_synthesis.end() - 1, m_synthesis.end());
+        m_synthesis[0] = sample;
+        out[i] = sample;
+    }
+
+    if (!m_active) {
+        m_kernels.applyGainRamp(out, count, 0.0f, 1.0f);
+        m_active = true;
+    }
+}
+
+float ComfortNoiseGenerator::levelDb() const
+{
+    if (!m_haveModel)
+        return -100.0f;
+    return std::min(toDb(m_autocorrelation[0]), MaxLevelDb);
+}
@@ -0,0 +1,53 @@
+#ifndef COMFORTNOISE_H
+#define COMFORTNOISE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "simd.h"
+
+// Receive-side comfort noise. The decoded frames are watched for background
+// noise (frames close to the tracked noise floor); their level and spectral
+// envelope (a 10th-order LPC fit of the smoothed autocorrelation, as in the
+// RFC 3389 CN payload) are kept, and while the sender is silent the gap is
+// filled with white noise shaped by that envelope at that level instead of
+// digital silence. Only used from one thread.
+class ComfortNoiseGenerator
+{
+public:
+    static constexpr int Order = 10;
+
+    ComfortNoiseGenerator(const Simd::Kernels &kernels, int sampleRate);
+
+    void reset();
+    // Learns the background from a decoded frame
+    void analyse(const float *samples, size_t count);
+    // Writes count samples of noise; fades in after real audio
+    void generate(float *out, size_t count);
+    // Real audio follows, so the next generate() fades in again
+    void interrupt() { m_active = false; }
+
+    bool hasModel() const { return m_haveModel; }
+    // Level of the generated noise in dBFS
+    float levelDb() const;
+
+private:
+    void updateFilter();
+
+    const Simd::Kernels           &m_kernels;
+    int                            m_sampleRate;
+    // Background floor and the smoothed model of the frames near it
+    float                          m_floorDb = 0.0f;
+    bool                           m_haveFloor = false;
+    bool                           m_haveModel = false;
+    std::array<double, Order + 1>  m_autocorrelation{};
+    // All-pole synthesis filter and the excitation scale that gives it the
+    // background's energy
+    std::array<float, Order>       m_lpc{};
+    float                          m_excitation = 0.0f;
+    std::array<float, Order>       m_synthesis{};
+    uint32_t                       m_seed = 0x2545f491;
+    bool                           m_active = false;
+};
+
+#endif // COMFORTNOISE_H
@@ -0,0 +1,103 @@
+#include "driftestimator.h"
+#include <algorithm>
+#include <cmath>
+
+// An offset this far off the fitted line is a discontinuity, not drift
+static constexpr double StepUs = 20000.0;
+// Real crystals are within a few hundred ppm; anything beyond is a bad fit
+static constexpr double MaxPpm = 1000.0;
+
+DriftEstimator::DriftEstimator(int64_t windowUs, size_t maxWindows, size_t minWindows)
+    : m_windowUs(windowUs),
+    m_minWindows(std::max<size_t>(2, minWindows)),
+    m_points(std::max<size_t>(2, maxWindows))
+{
+}
+
+void DriftEstimator::reset()
+{
+    clearHistory();
+    m_haveOrigin = false;
+    m_inWindow = false;
+}
+
+void DriftEstimator::clearHistory()
+{
+    m_head = 0;
+    m_count = 0;
+    m_intercept = 0.0;
+    m_slope = 0.0;
+    m_ppm.store(0.0, std::memory_order_relaxed);
+    m_valid.store(false, std::memory_order_relaxed);
+}
+
+void DriftEstimator::update(int64_t localUs, int64_t mediaUs)
+{
+    const int64_t offsetUs = localUs - mediaUs;
+    if (!m_haveOrigin) {
+        // Keeps the doubles in the fit small
+        m_haveOrigin = true;
+        m_originUs = localUs;
+        m_originOffsetUs = offsetUs;
+    }
+    if (m_inWindow && localUs - m_windowStartUs >= m_windowUs)
+        closeWindow();
+    if (!m_inWindow) {
+        m_inWindow = true;
+        m_windowStartUs = localUs;
+        m_windowMinOffsetUs = offsetUs;
+        m_windowMinLocalUs = localUs;
+    } else if (offsetUs < m_windowMinOffsetUs) {
+        m_windowMinOffsetUs = offsetUs;
+        m_windowMinLocalUs = localUs;
+    }
+}
+
+void DriftEstimator::closeWindow()
+{
+    m_inWindow = false;
+    const Point point{double(m_windowMinLocalUs - m_originUs) / 1e6,
+                      double(m_windowMinOffsetUs - m_originOffsetUs)};
+
+    if (m_count >= 2 && std::abs(point.offsetUs - (m_intercept + m_slope * point.localS)) > StepUs) {
+        m_steps.fetch_add(1, std::memory_order_relaxed);
+        clearHistory();
+    }
+
+    m_points[m_head] = point;
+    m_head = (m_head + 1) % m_points.size();
+    m_count = std::min(m_count + 1, m_points.size());
+    if (m_count >= 2)
+        fit();
+}
+
+// Least-squares line through the window floors; its slope is the offset
+// gained per second, in microseconds, so minus the slope is the skew in ppm
+void DriftEstimator::fit()
+{
+    const size_t size = m_points.size();
+    const size_t first = (m_head + size - m_count) % size;
+    double meanX = 0.0, meanY = 0.0;
+    for (size_t i = 0; i < m_count; ++i) {
+        const Point &point = m_points[(first + i) % size];
+        meanX += point.localS;
+        meanY += point.offsetUs;
+    }
+    meanX /= double(m_count);
+    meanY /= double(m_count);
+
+    double covariance = 0.0, variance = 0.0;
+    for (size_t i = 0; i < m_count; ++i) {
+        const Point &point = m_points[(first + i) % size];
+        covariance += (point.localS - meanX) * (point.offsetUs - meanY);
+        variance += (point.localS - meanX) * (point.localS - meanX);
+    }
+    if (variance <= 0.0)
+        return;
+    m_slope = covariance / variance;
+    m_intercept = meanY - m_slope * meanX;
+
+    const bool valid = m_count >= m_minWindows && std::abs(m_slope) < MaxPpm;
+    m_ppm.store(valid ? -m_slope : 0.0, std::memory_order_relaxed);
+    m_valid.store(valid, std::memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+#ifndef DRIFTESTIMATOR_H
+#define DRIFTESTIMATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Estimates how fast a media clock (a sender's RTP timestamps, or the samples
+// a sound card consumes) runs against the local monotonic clock. Every
+// update() pairs a media position with the local time it was reached at; the
+// offset between the two only grows or shrinks with the clock skew, plus
+// positive noise from network and scheduling delays. The smallest offset of
+// each window is that noise floor, and a least-squares line through the
+// floors of the last few minutes gives the skew to a fraction of a ppm, so
+// it follows slow temperature drift over an hours-long call.
+//
+// update() and reset() from one thread; ppm() and isValid() from any.
+class DriftEstimator
+{
+public:
+    explicit DriftEstimator(int64_t windowUs = 1000000, size_t maxWindows = 600, size_t minWindows = 30);
+
+    void reset();
+    void update(int64_t localUs, int64_t mediaUs);
+
+    // How much faster the media clock runs than the local one, in parts per
+    // million; 0 until minWindows windows have been seen
+    double ppm() const { return m_ppm.load(std::memory_order_relaxed); }
+    bool isValid() const { return m_valid.load(std::memory_order_relaxed); }
+    // Resets after a step in the offset (a restarted stream, a stalled device)
+    uint64_t steps() const { return m_steps.load(std::memory_order_relaxed); }
+
+private:
+    struct Point {
+        double localS;    // since m_originUs
+        double offsetUs;  // local minus media time, since m_originOffsetUs
+    };
+
+    void closeWindow();
+    void fit();
+    void clearHistory();
+
+    int64_t                 m_windowUs;
+    size_t                  m_minWindows;
+    std::vector<Point>      m_points;      // ring of window floors
+    size_t                  m_head = 0;
+    size_t                  m_count = 0;
+
+    bool                    m_haveOrigin = false;
+    int64_t                 m_originUs = 0;
+    int64_t                 m_originOffsetUs = 0;
+    bool                    m_inWindow = false;
+    int64_t                 m_windowStartUs = 0;
+    int64_t                 m_windowMinOffsetUs = 0;
+    int64_t                 m_windowMinLocalUs = 0;
+    // Fitted line, to spot steps
+    double                  m_intercept = 0.0;
+    double                  m_slope = 0.0;
+
+    std::atomic<double>     m_ppm{0.0};
+    std::atomic<bool>       m_valid{false};
+    std::atomic<uint64_t>   m_steps{0};
+};
+
+#endif // DRIFTESTIMATOR_H
@@ -0,0 +1,209 @@
+#include "echocanceller.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+// NLMS step size and regularisation (per tap, about -50 dBFS of reference power)
+static constexpr float StepSize = 0.3f;
+static constexpr float RegularisationPerTap = 1e-5f;
+// Below this reference peak there is nothing to cancel and the frame is skipped
+static constexpr float SilentReference = 1e-4f;
+// Geigel double talk detector: near-end louder than this share of the far-end
+// peak means the local user is talking, so the filter must not adapt
+static constexpr float DoubleTalkRatio = 0.6f;
+static constexpr int DoubleTalkHoldMs = 60;
+// Consecutive frames over the CPU budget before the filter is shortened
+static constexpr int OverBudgetRunLimit = 25;
+static constexpr size_t MinTaps = 256;
+
+EchoCanceller::EchoCanceller(const Simd::Kernels &kernels, int sampleRate, size_t maxFrameSize,
+                             int tailMs, int maxDelayMs)
+    : m_kernels(kernels),
+    m_sampleRate(sampleRate),
+    m_taps(size_t(sampleRate) * tailMs / 1000),
+    m_maxDelay(size_t(sampleRate) * maxDelayMs / 1000),
+    m_keep(m_taps + m_maxDelay + maxFrameSize),
+    m_weights(m_taps),
+    m_history(m_keep * 2 + maxFrameSize),
+    m_pcm(maxFrameSize),
+    m_pcmFloat(maxFrameSize),
+    m_activeTaps(m_taps)
+{
+    // Only enabled once a reference is attached
+    setEnabled(false);
+    reset();
+}
+
+void EchoCanceller::reset()
+{
+    std::fill(m_weights.begin(), m_weights.end(), 0.0f);
+    std::fill(m_history.begin(), m_history.end(), 0.0f);
+    // Start with a full window of silence so every index below is valid
+    m_historyEnd = m_keep;
+    m_activeTaps = m_taps;
+    m_overBudgetRun = 0;
+    m_doubleTalkHold = 0;
+    m_nearEnergy = 0.0f;
+    m_errorEnergy = 0.0f;
+
+    // Drop whatever was played before this call started
+    if (AudioRingBuffer *reference = m_reference.load(std::memory_order_acquire)) {
+        while (reference->available())
+            reference->readFrame(m_pcm.data(), std::min(reference->available(), m_pcm.size()));
+    }
+
+    m_frames.store(0, std::memory_order_relaxed);
+    m_overBudgetFrames.store(0, std::memory_order_relaxed);
+    m_totalNs.store(0, std::memory_order_relaxed);
+    m_maxNs.store(0, std::memory_order_relaxed);
+    m_erleDb.store(0.0f, std::memory_order_relaxed);
+    m_activeTapsMetric.store(int(m_activeTaps), std::memory_order_relaxed);
+}
+
+void EchoCanceller::setReference(AudioRingBuffer *reference)
+{
+    m_reference.store(reference, std::memory_order_release);
+}
+
+void EchoCanceller::setDelay(int milliseconds)
+{
+    m_delayMs.store(std::max(0, milliseconds), std::memory_order_relaxed);
+}
+
+void EchoCanceller::setCpuBudget(float fractionOfFrame)
+{
+    m_cpuBudget.store(fractionOfFrame, std::memory_order_relaxed);
+}
+
+void EchoCanceller::process(float *samples, size_t count)
+{
+    const auto start = std::chrono::steady_clock::now();
+    count = std::min(count, m_pcmFloat.size());
+    pullReference();
+
+    const size_t delay = std::min(size_t(m_delayMs.load(std::memory_order_relaxed)) * m_sampleRate / 1000,
+                                  m_maxDelay);
+    const size_t taps = m_activeTaps;
+    float *weights = m_weights.data() + (m_taps - taps);
+    const float *history = m_history.data();
+
+    // Reference sample aligned with the first capture sample, and the window
+    // of reference the filter looks at over the whole frame
+    const size_t first = m_historyEnd - count - delay;
+    const size_t windowStart = first + 1 - taps;
+    const float farPeak = m_kernels.peak(history + windowStart, taps + count - 1);
+
+    if (farPeak >= SilentReference) {
+        const int frameMs = int(count * 1000 / m_sampleRate);
+        if (m_kernels.peak(samples, count) > DoubleTalkRatio * farPeak)
+            m_doubleTalkHold = DoubleTalkHoldMs;
+        else
+            m_doubleTalkHold = std::max(0, m_doubleTalkHold - frameMs);
+        const bool adapt = m_doubleTalkHold == 0;
+
+        // Keep the near-end frame in case cancelling makes it worse
+        std::memcpy(m_pcmFloat.data(), samples, count * sizeof(float));
+
+        const float regularisation = RegularisationPerTap * taps;
+        float energy = m_kernels.sumSquares(history + windowStart, taps);
+        float nearEnergy = 0.0f;
+        float errorEnergy = 0.0f;
+
+        for (size_t i = 0; i < count; ++i) {
+            const size_t newest = first + i;
+            const float *window = history + newest + 1 - taps;
+            if (i > 0) {
+                // Slide the reference energy by one sample instead of recomputing it
+                const float leaving = history[newest - taps];
+                energy = std::max(0.0f, energy + history[newest] * history[newest] - leaving * leaving);
+            }
+
+            const float nearSample = samples[i];
+            const float error = nearSample - m_kernels.dot(weights, window, taps);
+            if (adapt)
+                m_kernels.multiplyAdd(weights, window, StepSize * error / (energy + regularisation), taps);
+
+            nearEnergy += nearSample * nearSample;
+            errorEnergy += error * error;
+            samples[i] = error;
+        }
+
+        // A filter that is still converging (or was just disturbed) must not add echo
+        if (errorEnergy > nearEnergy)
+            std::memcpy(samples, m_pcmFloat.data(), count * sizeof(float));
+
+        m_nearEnergy = 0.9f * m_nearEnergy + 0.1f * nearEnergy;
+        m_errorEnergy = 0.9f * m_errorEnergy + 0.1f * std::min(errorEnergy, nearEnergy);
+        if (m_errorEnergy > 0.0f)
+            m_erleDb.store(10.0f * std::log10(std::max(m_nearEnergy, 1e-12f) / m_errorEnergy),
+                           std::memory_order_relaxed);
+    }
+
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - start).count();
+    checkBudget(elapsed, count);
+}
+
+// Moves everything the playout side wrote since the last frame into the history
+void EchoCanceller::pullReference()
+{
+    AudioRingBuffer *reference = m_reference.load(std::memory_order_acquire);
+    if (!reference)
+        return;
+
+    size_t available;
+    while ((available = reference->available()) > 0) {
+        const size_t chunk = std::min(available, m_pcm.size());
+        if (!reference->readFrame(m_pcm.data(), chunk))
+            break;
+        m_kernels.int16ToFloat(m_pcm.data(), m_pcmFloat.data(), chunk);
+        appendReference(m_pcmFloat.data(), chunk);
+    }
+}
+
+void EchoCanceller::appendReference(const float *samples, size_t count)
+{
+    if (m_historyEnd + count > m_history.size()) {
+        // Only the newest m_keep samples can still be reached by the filter
+        std::memmove(m_history.data(), m_history.data() + m_historyEnd - m_keep, m_keep * sizeof(float));
+        m_historyEnd = m_keep;
+    }
+    std::memcpy(m_history.data() + m_historyEnd, samples, count * sizeof(float));
+    m_historyEnd += count;
+}
+
+void EchoCanceller::checkBudget(int64_t elapsedNs, size_t count)
+{
+    const double budgetNs = m_cpuBudget.load(std::memory_order_relaxed) * count * 1e9 / m_sampleRate;
+    if (elapsedNs > budgetNs) {
+        m_overBudgetFrames.fetch_add(1, std::memory_order_relaxed);
+        // Persistently too slow for this box: give up some of the room tail
+        if (++m_overBudgetRun >= OverBudgetRunLimit && m_activeTaps > MinTaps) {
+            m_activeTaps = std::max(MinTaps, m_activeTaps * 3 / 4);
+            m_overBudgetRun = 0;
+        }
+    } else {
+        m_overBudgetRun = 0;
+    }
+
+    m_totalNs.store(m_totalNs.load(std::memory_order_relaxed) + elapsedNs, std::memory_order_relaxed);
+    if (elapsedNs > m_maxNs.load(std::memory_order_relaxed))
+        m_maxNs.store(elapsedNs, std::memory_order_relaxed);
+    m_activeTapsMetric.store(int(m_activeTaps), std::memory_order_relaxed);
+    m_frames.fetch_add(1, std::memory_order_release);
+}
+
+EchoCanceller::Metrics EchoCanceller::metrics() const
+{
+    Metrics result;
+    result.frames = m_frames.load(std::memory_order_acquire);
+    result.overBudgetFrames = m_overBudgetFrames.load(std::memory_order_relaxed);
+    result.maxNs = m_maxNs.load(std::memory_order_relaxed);
+    if (result.frames)
+        result.averageNs = m_totalNs.load(std::memory_order_relaxed) / int64_t(result.frames);
+    result.erleDb = m_erleDb.load(std::memory_order_relaxed);
+    result.activeTaps = m_activeTapsMetric.load(std::memory_order_relaxed);
+    result.delayMs = m_delayMs.load(std::memory_order_relaxed);
+    return result;
+}
@@ -0,0 +1,79 @@
+#ifndef ECHOCANCELLER_H
+#define ECHOCANCELLER_H
+
+#include <atomic>
+#include <vector>
+#include "audiopreprocessor.h"
+#include "audioringbuffer.h"
+
+// Acoustic echo canceller stage. The far-end reference is the decoded PCM the
+// playout side wrote to the sink; it is delayed by the measured playout +
+// capture latency so it lines up with its echo in the capture frame, and a
+// time-domain NLMS filter covering the room tail after that delay estimates
+// the echo and subtracts it. Adaptation freezes during double talk.
+class EchoCanceller : public AudioProcessor
+{
+public:
+    EchoCanceller(const Simd::Kernels &kernels, int sampleRate, size_t maxFrameSize,
+                  int tailMs = 32, int maxDelayMs = 500);
+
+    const char *name() const override { return "aec"; }
+    void reset() override;
+    void process(float *samples, size_t count) override;
+
+    // Ring the playout side writes its decoded samples to; only this stage reads from it
+    void setReference(AudioRingBuffer *reference);
+    // Time between a sample being written to the sink and its echo reaching the capture frame
+    void setDelay(int milliseconds);
+    // Share of the frame duration the canceller may spend per frame; the
+    // filter is shortened if it keeps running over
+    void setCpuBudget(float fractionOfFrame);
+
+    struct Metrics {
+        uint64_t frames = 0;
+        uint64_t overBudgetFrames = 0;
+        int64_t  averageNs = 0;
+        int64_t  maxNs = 0;
+        float    erleDb = 0.0f;
+        int      activeTaps = 0;
+        int      delayMs = 0;
+    };
+    Metrics metrics() const;
+
+private:
+    void pullReference();
+    void appendReference(const float *samples, size_t count);
+    void checkBudget(int64_t elapsedNs, size_t count);
+
+    const Simd::Kernels             &m_kernels;
+    int                              m_sampleRate;
+    size_t                           m_taps;
+    size_t                           m_maxDelay;
+    size_t                           m_keep;
+
+    std::atomic<AudioRingBuffer *>   m_reference{nullptr};
+    std::atomic<int>                 m_delayMs{0};
+    std::atomic<float>               m_cpuBudget{0.25f};
+
+    // Filter weights in reverse order, so the dot product runs over the
+    // reference history in ascending time order
+    std::vector<float>               m_weights;
+    std::vector<float>               m_history;
+    size_t                           m_historyEnd = 0;
+    std::vector<int16_t>             m_pcm;
+    std::vector<float>               m_pcmFloat;
+    size_t                           m_activeTaps;
+    int                              m_overBudgetRun = 0;
+    int                              m_doubleTalkHold = 0;
+    float                            m_nearEnergy = 0.0f;
+    float                            m_errorEnergy = 0.0f;
+
+    std::atomic<uint64_t>            m_frames{0};
+    std::atomic<uint64_t>            m_overBudgetFrames{0};
+    std::atomic<int64_t>             m_totalNs{0};
+    std::atomic<int64_t>             m_maxNs{0};
+    std::atomic<float>               m_erleDb{0.0f};
+    std::atomic<int>                 m_activeTapsMetric{0};
+};
+
+#endif // ECHOCANCELLER_H
@@ -0,0 +1,260 @@
+#include "framepool.h"
+#include <algorithm>
+#include <cstring>
+
+// Enough for 64 frames in flight each way with room to spare, plus the
+// packets (plain and RED) the retransmission history holds on to
+static constexpr size_t MediaPoolFrames = 384;
+// A packet has to fit in one datagram anyway
+static constexpr size_t MediaFrameSize = 1500;
+// RTP header with a few extensions and a RED header
+static constexpr size_t MediaHeadroom = 64;
+
+struct MediaFrame::Slot {
+    std::atomic<int> refs{0};
+    FramePool       *pool = nullptr;
+    uint32_t         index = 0;
+    bool             heap = false;
+    uint8_t         *storage = nullptr;
+    size_t           capacity = 0;
+    size_t           offset = 0;
+    size_t           size = 0;
+    bool             marker = false;
+    uint32_t         timestamp = 0;
+    uint16_t         sequenceNumber = 0;
+};
+
+/*
+ * ====================================================
+ * ==================== MediaFrame ====================
+ * ====================================================
+ */
+
+MediaFrame::MediaFrame(const MediaFrame &other)
+    : m_slot(other.m_slot)
+{
+    if (m_slot)
+        m_slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+MediaFrame::MediaFrame(MediaFrame &&other) noexcept
+    : m_slot(other.m_slot)
+{
+    other.m_slot = nullptr;
+}
+
+MediaFrame &MediaFrame::operator=(const MediaFrame &other)
+{
+    if (m_slot != other.m_slot) {
+        if (other.m_slot)
+            other.m_slot->refs.fetch_add(1, std::memory_order_relaxed);
+        reset();
+        m_slot = other.m_slot;
+    }
+    return *this;
+}
+
+MediaFrame &MediaFrame::operator=(MediaFrame &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        m_slot = other.m_slot;
+        other.m_slot = nullptr;
+    }
+    return *this;
+}
+
+MediaFrame::~MediaFrame()
+{
+    reset();
+}
+
+void MediaFrame::reset()
+{
+    if (m_slot && m_slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        m_slot->pool->release(m_slot);
+    m_slot = nullptr;
+}
+
+uint8_t *MediaFrame::data()
+{
+    return m_slot ? m_slot->storage + m_slot->offset : nullptr;
+}
+
+const uint8_t *MediaFrame::data() const
+{
+    return m_slot ? m_slot->storage + m_slot->offset : nullptr;
+}
+
+size_t MediaFrame::size() const
+{
+    return m_slot ? m_slot->size : 0;
+}
+
+void MediaFrame::setSize(size_t size)
+{
+    if (m_slot)
+        m_slot->size = std::min(size, capacity());
+}
+
+size_t MediaFrame::capacity() const
+{
+    return m_slot ? m_slot->capacity - m_slot->offset : 0;
+}
+
+bool MediaFrame::assign(const void *bytes, size_t size)
+{
+    if (!m_slot || size > capacity())
+        return false;
+    std::memcpy(data(), bytes, size);
+    m_slot->size = size;
+    return true;
+}
+
+uint8_t *MediaFrame::prepend(size_t bytes)
+{
+    if (!m_slot || bytes > m_slot->offset)
+        return nullptr;
+    m_slot->offset -= bytes;
+    m_slot->size += bytes;
+    return data();
+}
+
+void MediaFrame::trimFront(size_t bytes)
+{
+    if (!m_slot)
+        return;
+    bytes = std::min(bytes, m_slot->size);
+    m_slot->offset += bytes;
+    m_slot->size -= bytes;
+}
+
+bool MediaFrame::marker() const
+{
+    return m_slot && m_slot->marker;
+}
+
+void MediaFrame::setMarker(bool marker)
+{
+    if (m_slot)
+        m_slot->marker = marker;
+}
+
+uint32_t MediaFrame::timestamp() const
+{
+    return m_slot ? m_slot->timestamp : 0;
+}
+
+void MediaFrame::setTimestamp(uint32_t timestamp)
+{
+    if (m_slot)
+        m_slot->timestamp = timestamp;
+}
+
+uint16_t MediaFrame::sequenceNumber() const
+{
+    return m_slot ? m_slot->sequenceNumber : 0;
+}
+
+void MediaFrame::setSequenceNumber(uint16_t sequenceNumber)
+{
+    if (m_slot)
+        m_slot->sequenceNumber = sequenceNumber;
+}
+
+/*
+ * ====================================================
+ * ==================== FramePool =====================
+ * ====================================================
+ */
+
+FramePool::FramePool(size_t frames, size_t frameSize, size_t headroom)
+    : m_frameSize(frameSize),
+    m_headroom(std::min(headroom, frameSize)),
+    m_storage(frames * frameSize),
+    m_slots(new MediaFrame::Slot[frames]),
+    m_next(new std::atomic<uint32_t>[frames]),
+    m_count(frames)
+{
+    // Chain every slot into the free list
+    for (size_t i = 0; i < frames; ++i) {
+        MediaFrame::Slot &slot = m_slots[i];
+        slot.pool = this;
+        slot.index = uint32_t(i);
+        slot.storage = m_storage.data() + i * frameSize;
+        slot.capacity = frameSize;
+        m_next[i].store(i + 1 < frames ? uint32_t(i + 1) : Empty, std::memory_order_relaxed);
+    }
+    m_head.store(frames ? 0 : Empty, std::memory_order_release);
+}
+
+// Every frame has to be back before the pool goes away
+FramePool::~FramePool() = default;
+
+MediaFrame FramePool::acquire()
+{
+    MediaFrame::Slot *slot = nullptr;
+
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    while (uint32_t(head) != Empty) {
+        const uint32_t index = uint32_t(head);
+        const uint64_t next = ((head >> 32) + 1) << 32 | m_next[index].load(std::memory_order_relaxed);
+        if (m_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+            slot = &m_slots[index];
+            break;
+        }
+    }
+
+    if (!slot) {
+        // Pool exhausted: still hand out a frame, but make it visible
+        slot = new MediaFrame::Slot;
+        slot->pool = this;
+        slot->heap = true;
+        slot->storage = new uint8_t[m_frameSize];
+        slot->capacity = m_frameSize;
+        m_heapFallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    slot->refs.store(1, std::memory_order_relaxed);
+    slot->offset = m_headroom;
+    slot->size = 0;
+    slot->marker = false;
+    slot->timestamp = 0;
+    slot->sequenceNumber = 0;
+    m_inUse.fetch_add(1, std::memory_order_relaxed);
+    m_acquired.fetch_add(1, std::memory_order_relaxed);
+    return MediaFrame(slot);
+}
+
+void FramePool::release(MediaFrame::Slot *slot)
+{
+    m_inUse.fetch_sub(1, std::memory_order_relaxed);
+    if (slot->heap) {
+        delete[] slot->storage;
+        delete slot;
+        return;
+    }
+
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        m_next[slot->index].store(uint32_t(head), std::memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | slot->index;
+    } while (!m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+FramePool &FramePool::media()
+{
+    static FramePool pool(MediaPoolFrames, MediaFrameSize, MediaHeadroom);
+    return pool;
+}
+
+FramePool::Stats FramePool::stats() const
+{
+    Stats result;
+    result.capacity = m_count;
+    result.inUse = m_inUse.load(std::memory_order_relaxed);
+    result.acquired = m_acquired.load(std::memory_order_relaxed);
+    result.heapFallbacks = m_heapFallbacks.load(std::memory_order_relaxed);
+    return result;
+}
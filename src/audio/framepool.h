@@ -0,0 +1,110 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QMetaType>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class FramePool;
+
+// Reference-counted handle to a media buffer borrowed from a FramePool.
+// Copying a handle only bumps the count; the buffer goes back to its pool
+// when the last handle is gone. Every buffer keeps some headroom in front of
+// the payload so headers can be prepended in place. Handles sharing a buffer
+// see the same bytes, so a frame must be filled before it is handed on.
+class MediaFrame
+{
+public:
+    MediaFrame() = default;
+    MediaFrame(const MediaFrame &other);
+    MediaFrame(MediaFrame &&other) noexcept;
+    MediaFrame &operator=(const MediaFrame &other);
+    MediaFrame &operator=(MediaFrame &&other) noexcept;
+    ~MediaFrame();
+
+    bool isNull() const { return m_slot == nullptr; }
+    void reset();
+
+    uint8_t *data();
+    const uint8_t *data() const;
+    size_t size() const;
+    void setSize(size_t size);
+    // Bytes available from data() to the end of the buffer
+    size_t capacity() const;
+    // Copies bytes in as the payload; false if they don't fit
+    bool assign(const void *bytes, size_t size);
+
+    // Moves the start of the frame back by bytes (into the headroom) and
+    // returns the new start, or nullptr if there isn't enough headroom
+    uint8_t *prepend(size_t bytes);
+    // Drops bytes from the front, e.g. a header that has been parsed
+    void trimFront(size_t bytes);
+
+    // RTP marker: first frame of a talkspurt
+    bool marker() const;
+    void setMarker(bool marker);
+    // RTP timestamp of the first sample, in 48 kHz units (the Opus RTP clock)
+    uint32_t timestamp() const;
+    void setTimestamp(uint32_t timestamp);
+    // RTP sequence number, set on received frames
+    uint16_t sequenceNumber() const;
+    void setSequenceNumber(uint16_t sequenceNumber);
+
+private:
+    friend class FramePool;
+    struct Slot;
+    explicit MediaFrame(Slot *slot) : m_slot(slot) {}
+
+    Slot *m_slot = nullptr;
+};
+
+// Fixed set of equally sized media buffers, allocated once. acquire() and
+// release are lock-free and can be called from any thread; when the pool is
+// empty a buffer is taken from the heap instead and counted, so a steady
+// state without heap fallbacks proves the pool is sized right.
+class FramePool
+{
+public:
+    FramePool(size_t frames, size_t frameSize, size_t headroom);
+    ~FramePool();
+
+    // An empty frame (size 0, metadata cleared) with the full headroom in front
+    MediaFrame acquire();
+
+    // Pool shared by capture, send and receive for encoded audio packets
+    static FramePool &media();
+
+    struct Stats {
+        size_t   capacity = 0;
+        size_t   inUse = 0;
+        uint64_t acquired = 0;
+        uint64_t heapFallbacks = 0;
+    };
+    Stats stats() const;
+
+private:
+    friend class MediaFrame;
+    void release(MediaFrame::Slot *slot);
+
+    static constexpr uint32_t Empty = 0xFFFFFFFFu;
+
+    size_t                                  m_frameSize;
+    size_t                                  m_headroom;
+    std::vector<uint8_t>                    m_storage;
+    std::unique_ptr<MediaFrame::Slot[]>     m_slots;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_next;
+    size_t                                  m_count;
+    // Free list head: slot index in the low 32 bits, a change counter in the
+    // high 32 bits so a pop can't succeed on a head that was recycled (ABA)
+    std::atomic<uint64_t>                   m_head{Empty};
+    std::atomic<size_t>                     m_inUse{0};
+    std::atomic<uint64_t>                   m_acquired{0};
+    std::atomic<uint64_t>                   m_heapFallbacks{0};
+};
+
+Q_DECLARE_METATYPE(MediaFrame)
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,288 @@
+#include "jitterbuffer.h"
+#include <algorithm>
+#include <cmath>
+
+// RTP clock of the Opus payload
+static constexpr int TicksPerMs = 48;
+// Longest Opus frame; anything further apart is a gap, not a frame duration
+static constexpr uint32_t MaxFrameTicks = 120 * TicksPerMs;
+// The smallest transit delay is tracked over two of these, so a route change
+// or clock drift is forgotten within 10 s
+static constexpr int64_t TransitWindowUs = 5000000;
+// Per packet; at 50 packets/s the histogram has a memory of about 4 s
+static constexpr float HistogramDecay = 0.995f;
+static constexpr float TargetQuantile = 0.95f;
+
+JitterBuffer::JitterBuffer(int minDelayMs, int maxDelayMs)
+    : m_minDelayMs(minDelayMs),
+    m_maxDelayMs(std::max(minDelayMs, maxDelayMs))
+{
+}
+
+void JitterBuffer::reset()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (Slot &slot : m_slots) {
+        slot.frame.reset();
+        slot.sequence = -1;
+    }
+    m_started = false;
+    m_buffering = true;
+    m_packets = 0;
+    m_frameTicks = 960;
+    resetTransit();
+    m_jitterMs = 0.0f;
+    m_counters = Stats();
+}
+
+void JitterBuffer::setFixedDelay(int milliseconds)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_fixedDelayMs = std::max(0, milliseconds);
+}
+
+void JitterBuffer::setSkipMargin(int milliseconds)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_skipMarginMs = std::max(0, milliseconds);
+}
+
+int JitterBuffer::excessDelayMs() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if (!m_started || m_buffering)
+        return 0;
+    return int(m_averageDepthMs) - targetDelayLocked();
+}
+
+int64_t JitterBuffer::unwrapSequence(uint16_t sequenceNumber) const
+{
+    // Closest to the newest sequence number seen, in either direction
+    const int16_t difference = int16_t(uint16_t(sequenceNumber - uint16_t(m_newestSequence)));
+    return m_newestSequence + difference;
+}
+
+void JitterBuffer::insert(const MediaFrame &frame, int64_t arrivalUs)
+{
+    if (frame.isNull())
+        return;
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    ++m_counters.received;
+
+    if (!m_started) {
+        m_started = true;
+        m_buffering = true;
+        m_playSequence = frame.sequenceNumber();
+        m_newestSequence = m_playSequence;
+    }
+
+    const int64_t sequence = unwrapSequence(frame.sequenceNumber());
+    if (sequence < m_playSequence - int64_t(Capacity) || sequence >= m_newestSequence + int64_t(Capacity)) {
+        // Far outside the ring either way: the sender restarted its stream.
+        // Its timestamps start from a new base too, so the transit delays
+        // measured so far say nothing about the new one.
+        ++m_counters.restarts;
+        dropUntil(m_newestSequence + 1, m_counters.flushed);
+        m_playSequence = m_newestSequence = sequence;
+        m_buffering = true;
+        resetTransit();
+    } else if (sequence < m_playSequence) {
+        ++m_counters.late;
+        return;
+    } else if (sequence >= m_playSequence + int64_t(Capacity)) {
+        // Ring full: the oldest frames make room
+        dropUntil(sequence - int64_t(Capacity) + 1, m_counters.overflows);
+    }
+
+    Slot &slot = m_slots[size_t(sequence) % Capacity];
+    if (slot.sequence == sequence) {
+        ++m_counters.duplicates;
+        return;
+    }
+
+    // The previous frame gives the frame duration, unless a talkspurt starts here
+    const Slot &previous = m_slots[size_t(sequence - 1) % Capacity];
+    if (!frame.marker() && previous.sequence == sequence - 1) {
+        const uint32_t ticks = frame.timestamp() - previous.frame.timestamp();
+        if (ticks > 0 && ticks <= MaxFrameTicks)
+            m_frameTicks = ticks;
+    }
+
+    slot.frame = frame;
+    slot.sequence = sequence;
+    slot.arrivalUs = arrivalUs;
+    ++m_packets;
+    m_newestSequence = std::max(m_newestSequence, sequence);
+    updateDelay(frame.timestamp(), arrivalUs);
+}
+
+void JitterBuffer::dropUntil(int64_t sequence, uint64_t &counter)
+{
+    for (; m_playSequence < sequence; ++m_playSequence) {
+        Slot &slot = m_slots[size_t(m_playSequence) % Capacity];
+        if (slot.sequence == m_playSequence) {
+            slot.frame.reset();
+            slot.sequence = -1;
+            --m_packets;
+            ++counter;
+        }
+    }
+}
+
+void JitterBuffer::resetTransit()
+{
+    // updateDelay() takes the next packet as the new base and window minimum
+    m_haveTransit = false;
+    m_windowMinMs = m_previousWindowMinMs = 0.0;
+    m_histogram.fill(0.0f);
+    m_histogramTotal = 0.0f;
+}
+
+void JitterBuffer::updateDelay(uint32_t timestamp, int64_t arrivalUs)
+{
+    const double arrivalMs = double(arrivalUs) / 1000.0;
+    if (!m_haveTransit) {
+        m_haveTransit = true;
+        m_baseTimestamp = timestamp;
+        m_lastTransitMs = m_windowMinMs = m_previousWindowMinMs = arrivalMs;
+        m_windowStartUs = arrivalUs;
+    }
+
+    // Keep the media time relative to a recent base so it never overflows
+    int32_t mediaTicks = int32_t(timestamp - m_baseTimestamp);
+    if (mediaTicks > (1 << 30)) {
+        const double shiftMs = double(mediaTicks) / TicksPerMs;
+        m_baseTimestamp = timestamp;
+        m_lastTransitMs += shiftMs;
+        m_windowMinMs += shiftMs;
+        m_previousWindowMinMs += shiftMs;
+        mediaTicks = 0;
+    }
+    const double transitMs = arrivalMs - double(mediaTicks) / TicksPerMs;
+
+    // RFC 3550 interarrival jitter, for the stats
+    m_jitterMs += (float(std::fabs(transitMs - m_lastTransitMs)) - m_jitterMs) / 16.0f;
+    m_lastTransitMs = transitMs;
+
+    m_windowMinMs = std::min(m_windowMinMs, transitMs);
+    if (arrivalUs - m_windowStartUs > TransitWindowUs) {
+        m_previousWindowMinMs = m_windowMinMs;
+        m_windowMinMs = transitMs;
+        m_windowStartUs = arrivalUs;
+    }
+    const double delayMs = transitMs - std::min(m_windowMinMs, m_previousWindowMinMs);
+
+    for (float &count : m_histogram)
+        count *= HistogramDecay;
+    const size_t bucket = std::min(size_t(std::max(0.0, delayMs) / HistogramBucketMs), HistogramBuckets - 1);
+    m_histogram[bucket] += 1.0f;
+    m_histogramTotal = m_histogramTotal * HistogramDecay + 1.0f;
+}
+
+int JitterBuffer::targetDelayLocked() const
+{
+    if (m_fixedDelayMs > 0)
+        return m_fixedDelayMs;
+
+    // Enough delay for all but the slowest few percent of packets, plus the frame itself
+    int quantileMs = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < HistogramBuckets; ++i) {
+        sum += m_histogram[i];
+        if (sum >= TargetQuantile * m_histogramTotal) {
+            quantileMs = int(i + 1) * HistogramBucketMs;
+            break;
+        }
+    }
+    const int frameMs = int(m_frameTicks / TicksPerMs);
+    return std::clamp(quantileMs + frameMs, m_minDelayMs, m_maxDelayMs);
+}
+
+int JitterBuffer::depthMsLocked() const
+{
+    if (!m_started || m_newestSequence < m_playSequence)
+        return 0;
+    return int((m_newestSequence - m_playSequence + 1) * m_frameTicks / TicksPerMs);
+}
+
+JitterBuffer::Result JitterBuffer::pop(MediaFrame &frame, int64_t *arrivalUs)
+{
+    frame.reset();
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if (!m_started)
+        return Result::Empty;
+
+    const int depthMs = depthMsLocked();
+    const int targetMs = targetDelayLocked();
+    const int frameMs = int(m_frameTicks / TicksPerMs);
+
+    if (m_buffering) {
+        if (depthMs < targetMs)
+            return Result::Empty;
+        m_buffering = false;
+        m_averageDepthMs = float(depthMs);
+    }
+    if (depthMs == 0) {
+        ++m_counters.underruns;
+        m_buffering = true;
+        return Result::Empty;
+    }
+
+    // Consistently past the target by more than the margin (the jitter went
+    // down, or a late burst arrived at once): skip a frame to bring the delay
+    // back in range. The depth is smoothed so a single burst doesn't cost a frame.
+    const int marginMs = m_skipMarginMs > 0 ? m_skipMarginMs : frameMs;
+    m_averageDepthMs += (float(depthMs) - m_averageDepthMs) / 8.0f;
+    if (m_averageDepthMs > float(targetMs + marginMs) && depthMs > targetMs + marginMs) {
+        m_averageDepthMs -= float(frameMs);
+        Slot &skipped = m_slots[size_t(m_playSequence) % Capacity];
+        if (skipped.sequence == m_playSequence) {
+            skipped.frame.reset();
+            skipped.sequence = -1;
+            --m_packets;
+            ++m_counters.dropped;
+        }
+        ++m_playSequence;
+    }
+
+    Slot &slot = m_slots[size_t(m_playSequence) % Capacity];
+    const int64_t sequence = m_playSequence++;
+    if (slot.sequence != sequence) {
+        ++m_counters.missing;
+        return Result::Missing;
+    }
+    frame = std::move(slot.frame);
+    if (arrivalUs)
+        *arrivalUs = slot.arrivalUs;
+    slot.sequence = -1;
+    --m_packets;
+    return Result::Frame;
+}
+
+bool JitterBuffer::peekNext(MediaFrame &frame) const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    const Slot &slot = m_slots[size_t(m_playSequence) % Capacity];
+    if (!m_started || slot.sequence != m_playSequence)
+        return false;
+    frame = slot.frame;
+    return true;
+}
+
+uint32_t JitterBuffer::frameTicks() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_frameTicks;
+}
+
+JitterBuffer::Stats JitterBuffer::stats() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    Stats result = m_counters;
+    result.depthMs = depthMsLocked();
+    result.packets = m_packets;
+    result.targetDelayMs = targetDelayLocked();
+    result.jitterMs = m_jitterMs;
+    return result;
+}
@@ -0,0 +1,127 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include "framepool.h"
+
+// Adaptive jitter buffer for one incoming stream of encoded frames. Frames
+// are kept in a fixed ring indexed by their (unwrapped) RTP sequence number,
+// so reordered packets fall into place and duplicates or packets whose turn
+// has already passed are discarded. Playout starts once the buffered audio
+// reaches a target delay; the target follows the 95th percentile of the
+// measured transit delay variation, so it grows with network jitter and
+// shrinks again when the network calms down.
+//
+// insert() and pop() are both called from the AudioDecoder thread: frames
+// reach it through the decoder's queue, not straight from the network
+// thread. The short lock is for stats(), which the GUI reads; neither side
+// allocates.
+class JitterBuffer
+{
+public:
+    // Enough for 640 ms of 5 ms frames or several seconds of 20 ms ones
+    static constexpr size_t Capacity = 128;
+
+    explicit JitterBuffer(int minDelayMs = 20, int maxDelayMs = 300);
+
+    void reset();
+
+    // Pins the target delay (the trace harness uses it to compare against
+    // fixed buffers); 0 goes back to adapting
+    void setFixedDelay(int milliseconds);
+
+    // How far above the target the delay may stay before frames are skipped
+    // outright; 0 means one frame. Playout that time-stretches to converge
+    // sets it high, so skipping is only the last resort.
+    void setSkipMargin(int milliseconds);
+    // Smoothed delay above (positive) or below the target while playing, for
+    // playout rate control; 0 while filling up
+    int excessDelayMs() const;
+
+    // arrivalUs is a monotonic receive time, only differences matter
+    void insert(const MediaFrame &frame, int64_t arrivalUs);
+
+    enum class Result {
+        Frame,   // frame holds the next frame to play
+        Missing, // the next frame never arrived (or came too late); conceal one frame
+        Empty    // nothing to play: not started, building up the target delay, or underrun
+    };
+    // Takes the next frame in sequence order; call once per frame duration.
+    // arrivalUs, if given, receives the time the frame was inserted with.
+    Result pop(MediaFrame &frame, int64_t *arrivalUs = nullptr);
+    // The frame the next pop() would return, left in place; false if it
+    // hasn't arrived. After a Missing pop this is the packet whose in-band
+    // FEC data may hold the missing frame.
+    bool peekNext(MediaFrame &frame) const;
+
+    // Duration of one frame in 48 kHz RTP ticks, learnt from consecutive
+    // timestamps (20 ms until known)
+    uint32_t frameTicks() const;
+
+    struct Stats {
+        int      depthMs = 0;         // audio between the playout point and the newest frame
+        int      packets = 0;         // frames held
+        int      targetDelayMs = 0;
+        float    jitterMs = 0.0f;     // RFC 3550 interarrival jitter
+        uint64_t received = 0;
+        uint64_t duplicates = 0;      // discarded: already buffered
+        uint64_t late = 0;            // discarded: arrived after their turn
+        uint64_t overflows = 0;       // discarded: ring full
+        uint64_t restarts = 0;        // the sender restarted its stream
+        uint64_t flushed = 0;         // discarded: left over from before a restart
+        uint64_t dropped = 0;         // skipped to bring the delay back down
+        uint64_t missing = 0;         // turns with no frame to play
+        uint64_t underruns = 0;       // buffer ran dry, playout paused to refill
+    };
+    Stats stats() const;
+
+private:
+    struct Slot {
+        MediaFrame frame;
+        int64_t    sequence = -1;
+        int64_t    arrivalUs = 0;
+    };
+
+    int64_t unwrapSequence(uint16_t sequenceNumber) const;
+    void dropUntil(int64_t sequence, uint64_t &counter);
+    void resetTransit();
+    void updateDelay(uint32_t timestamp, int64_t arrivalUs);
+    int targetDelayLocked() const;
+    int depthMsLocked() const;
+
+    static constexpr int HistogramBucketMs = 5;
+    static constexpr size_t HistogramBuckets = 100;
+
+    mutable std::mutex                       m_mutex;
+    int                                      m_minDelayMs;
+    int                                      m_maxDelayMs;
+    int                                      m_fixedDelayMs = 0;
+    int                                      m_skipMarginMs = 0;
+
+    std::array<Slot, Capacity>               m_slots;
+    bool                                     m_started = false;
+    bool                                     m_buffering = true;
+    int64_t                                  m_playSequence = 0;
+    int64_t                                  m_newestSequence = 0;
+    uint32_t                                 m_frameTicks = 960;
+    int                                      m_packets = 0;
+    float                                    m_averageDepthMs = 0.0f;
+
+    // Transit delay (arrival minus media time) relative to the smallest one
+    // seen in the last two windows, collected in a decaying histogram
+    bool                                     m_haveTransit = false;
+    uint32_t                                 m_baseTimestamp = 0;
+    double                                   m_lastTransitMs = 0.0;
+    double                                   m_windowMinMs = 0.0;
+    double                                   m_previousWindowMinMs = 0.0;
+    int64_t                                  m_windowStartUs = 0;
+    std::array<float, HistogramBuckets>      m_histogram{};
+    float                                    m_histogramTotal = 0.0f;
+    float                                    m_jitterMs = 0.0f;
+
+    Stats                                    m_counters;
+};
+
+#endif // JITTERBUFFER_H
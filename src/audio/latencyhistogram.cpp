@@ -0,0 +1,79 @@
+#include "latencyhistogram.h"
+#include <algorithm>
+#include <cmath>
+
+size_t LatencyHistogram::bucketFor(int64_t latencyUs)
+{
+    if (latencyUs <= 1)
+        return 0;
+    const size_t bucket = size_t(std::ceil(4.0 * std::log2(double(latencyUs))));
+    return std::min(bucket, Buckets - 1);
+}
+
+int64_t LatencyHistogram::upperBoundUs(size_t bucket)
+{
+    return int64_t(std::ceil(std::exp2(double(bucket) / 4.0)));
+}
+
+void LatencyHistogram::record(int64_t latencyUs)
+{
+    latencyUs = std::max<int64_t>(0, latencyUs);
+    m_counts[bucketFor(latencyUs)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_totalUs.fetch_add(latencyUs, std::memory_order_relaxed);
+
+    int64_t max = m_maxUs.load(std::memory_order_relaxed);
+    while (latencyUs > max && !m_maxUs.compare_exchange_weak(max, latencyUs, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (std::atomic<uint64_t> &count : m_counts)
+        count.store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_totalUs.store(0, std::memory_order_relaxed);
+    m_maxUs.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < Buckets; ++i)
+        m_counts[i].fetch_add(other.m_counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_count.fetch_add(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_totalUs.fetch_add(other.m_totalUs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    const int64_t otherMax = other.m_maxUs.load(std::memory_order_relaxed);
+    if (otherMax > m_maxUs.load(std::memory_order_relaxed))
+        m_maxUs.store(otherMax, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const
+{
+    std::array<uint64_t, Buckets> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < Buckets; ++i) {
+        counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    Summary result;
+    result.count = total;
+    result.maxUs = m_maxUs.load(std::memory_order_relaxed);
+    if (total == 0)
+        return result;
+    result.meanUs = m_totalUs.load(std::memory_order_relaxed) / int64_t(total);
+
+    // Walk the buckets once for all three percentiles
+    const double quantiles[] = {0.50, 0.95, 0.99};
+    int64_t *targets[] = {&result.p50Us, &result.p95Us, &result.p99Us};
+    uint64_t sum = 0;
+    size_t next = 0;
+    for (size_t i = 0; i < Buckets && next < 3; ++i) {
+        sum += counts[i];
+        while (next < 3 && double(sum) >= quantiles[next] * double(total)) {
+            *targets[next] = std::min(upperBoundUs(i), result.maxUs);
+            ++next;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,45 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free histogram of latencies in microseconds, with quarter-octave
+// buckets from 1 us to about 14 s, so both thread hand-offs and jitter buffer
+// delays resolve to within 19%. record() never blocks or allocates and may be
+// called from any thread; summary() may run concurrently and sees a slightly
+// torn but consistent-enough picture.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t Buckets = 96;
+
+    void record(int64_t latencyUs);
+    void reset();
+    // Adds other's counts to this one, e.g. to summarise several streams
+    void merge(const LatencyHistogram &other);
+
+    struct Summary {
+        uint64_t count = 0;
+        int64_t  meanUs = 0;
+        int64_t  p50Us = 0;
+        int64_t  p95Us = 0;
+        int64_t  p99Us = 0;
+        int64_t  maxUs = 0;
+    };
+    // Percentiles are the upper bound of the bucket they fall in
+    Summary summary() const;
+
+private:
+    static size_t bucketFor(int64_t latencyUs);
+    static int64_t upperBoundUs(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, Buckets> m_counts{};
+    std::atomic<uint64_t>                      m_count{0};
+    std::atomic<int64_t>                       m_totalUs{0};
+    std::atomic<int64_t>                       m_maxUs{0};
+};
+
+#endif // LATENCYHISTOGRAM_H
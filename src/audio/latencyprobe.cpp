@@ -0,0 +1,201 @@
+#include "latencyprobe.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+static constexpr double Pi = 3.14159265358979323846;
+
+// The sweep stays inside the narrowband voice range, so it survives every
+// Opus bandwidth and mode
+static constexpr double StartHz = 300.0;
+static constexpr double EndHz = 3400.0;
+// Raised-cosine fade in and out, so the edges don't splatter
+static constexpr double FadeMs = 5.0;
+static constexpr double Amplitude = 0.5;
+// A match is taken once nothing better turned up for this long after it
+static constexpr int64_t PeakHoldUs = LatencyProbe::ChirpMs * 1000 / 4;
+// Windows quieter than this can't hold the chirp
+static constexpr double MinEnergy = 1e-3;
+
+LatencyProbe::LatencyProbe(const Simd::Kernels &kernels, int playoutRate, size_t maxBlock)
+    : m_kernels(kernels),
+    m_playoutRate(playoutRate)
+{
+    const size_t length = size_t(playoutRate) * ChirpMs / 1000;
+    m_template.resize(length);
+    for (size_t i = 0; i < length; ++i)
+        m_template[i] = chirp(double(i) / playoutRate);
+    const float scale = 1.0f / std::sqrt(m_kernels.sumSquares(m_template.data(), length));
+    for (float &sample : m_template)
+        sample *= scale;
+
+    m_history.resize(length - 1 + maxBlock);
+}
+
+float LatencyProbe::chirp(double seconds)
+{
+    const double duration = ChirpMs / 1000.0;
+    if (seconds < 0.0 || seconds >= duration)
+        return 0.0f;
+    const double sweep = (EndHz - StartHz) / duration;
+    const double phase = 2.0 * Pi * (StartHz * seconds + 0.5 * sweep * seconds * seconds);
+
+    const double fade = FadeMs / 1000.0;
+    const double edge = std::min(seconds, duration - seconds);
+    const double window = edge < fade ? 0.5 - 0.5 * std::cos(Pi * edge / fade) : 1.0;
+    return float(Amplitude * window * std::sin(phase));
+}
+
+int64_t LatencyProbe::nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyProbe::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void LatencyProbe::setDeviceLatency(int64_t captureUs, int64_t playoutUs)
+{
+    m_captureLatencyUs.store(captureUs, std::memory_order_relaxed);
+    m_playoutLatencyUs.store(playoutUs, std::memory_order_relaxed);
+}
+
+void LatencyProbe::inject(int16_t *samples, size_t count, int sampleRate)
+{
+    if (!m_injecting) {
+        if (!isEnabled())
+            return;
+        const int64_t now = nowUs();
+        if (now < m_nextInjectUs)
+            return;
+        m_injecting = true;
+        m_injectPos = 0;
+        m_nextInjectUs = now + IntervalMs * 1000;
+        // The frame was just completed, so its first sample was captured a
+        // frame duration ago
+        const int64_t sentUs = now - int64_t(count) * 1000000 / sampleRate;
+        if (m_sentUs.exchange(sentUs, std::memory_order_acq_rel) != 0)
+            m_lost.fetch_add(1, std::memory_order_relaxed);
+        m_sent.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const size_t length = size_t(sampleRate) * ChirpMs / 1000;
+    for (size_t i = 0; i < count && m_injectPos < length; ++i, ++m_injectPos)
+        samples[i] = int16_t(std::lrint(chirp(double(m_injectPos) / sampleRate) * 32767.0));
+    if (m_injectPos >= length)
+        m_injecting = false;
+}
+
+void LatencyProbe::detect(const float *block, size_t count, int64_t leadUs)
+{
+    const size_t length = m_template.size();
+    const size_t maxBlock = m_history.size() - (length - 1);
+    // Longer blocks are searched in pieces; the later pieces reach the sink later
+    while (count > maxBlock) {
+        detect(block, maxBlock, leadUs);
+        block += maxBlock;
+        count -= maxBlock;
+        leadUs += int64_t(maxBlock) * 1000000 / m_playoutRate;
+    }
+
+    const int64_t now = nowUs();
+    expire(now);
+    const int64_t sent = m_sentUs.load(std::memory_order_acquire);
+    if (sent == 0 && !isEnabled()) {
+        m_historyFill = 0;
+        return;
+    }
+
+    std::memcpy(m_history.data() + m_historyFill, block, count * sizeof(float));
+    const size_t blockStart = m_historyFill;
+    m_historyFill += count;
+
+    if (sent != 0 && m_historyFill >= length) {
+        // Every window that ends in this block; the sink plays blockStart at now + leadUs
+        const size_t first = blockStart >= length - 1 ? blockStart - (length - 1) : 0;
+        const size_t last = m_historyFill - length;
+        const float *history = m_history.data();
+        const int64_t blockUs = now + leadUs;
+
+        double energy = m_kernels.sumSquares(history + first, length);
+        for (size_t position = first; position <= last; ++position) {
+            if (position > first) {
+                const double entering = history[position + length - 1];
+                const double leaving = history[position - 1];
+                energy += entering * entering - leaving * leaving;
+            }
+            if (energy < MinEnergy)
+                continue;
+            const float score = float(m_kernels.dot(history + position, m_template.data(), length) / std::sqrt(energy));
+            if (score > Threshold && score > m_bestScore) {
+                m_bestScore = score;
+                m_bestUs = blockUs + (int64_t(position) - int64_t(blockStart)) * 1000000 / m_playoutRate;
+            }
+        }
+
+        const int64_t lastUs = blockUs + (int64_t(last) - int64_t(blockStart)) * 1000000 / m_playoutRate;
+        if (m_bestScore > 0.0f && lastUs - m_bestUs >= PeakHoldUs)
+            commit();
+    }
+
+    if (m_historyFill > length - 1) {
+        std::memmove(m_history.data(), m_history.data() + m_historyFill - (length - 1),
+                     (length - 1) * sizeof(float));
+        m_historyFill = length - 1;
+    }
+}
+
+// Gives up on a chirp that should have been back long ago
+void LatencyProbe::expire(int64_t now)
+{
+    int64_t sent = m_sentUs.load(std::memory_order_acquire);
+    if (sent == 0 || now - sent < int64_t(TimeoutMs) * 1000)
+        return;
+    if (m_sentUs.compare_exchange_strong(sent, 0, std::memory_order_acq_rel))
+        m_lost.fetch_add(1, std::memory_order_relaxed);
+    m_bestScore = 0.0f;
+}
+
+void LatencyProbe::commit()
+{
+    const float score = m_bestScore;
+    const int64_t detectedUs = m_bestUs;
+    m_bestScore = 0.0f;
+
+    // The capture side may have sent the next chirp in the meantime
+    int64_t sent = m_sentUs.load(std::memory_order_acquire);
+    if (sent == 0 || detectedUs <= sent || !m_sentUs.compare_exchange_strong(sent, 0, std::memory_order_acq_rel))
+        return;
+
+    const int64_t roundTripUs = detectedUs - sent;
+    m_roundTrip.record(roundTripUs);
+    m_mouthToEar.record(roundTripUs / 2
+                        + m_captureLatencyUs.load(std::memory_order_relaxed)
+                        + m_playoutLatencyUs.load(std::memory_order_relaxed));
+    m_detected.fetch_add(1, std::memory_order_relaxed);
+    m_lastScore.store(score, std::memory_order_relaxed);
+}
+
+LatencyProbe::Stats LatencyProbe::stats() const
+{
+    Stats result;
+    result.sent = m_sent.load(std::memory_order_relaxed);
+    result.detected = m_detected.load(std::memory_order_relaxed);
+    result.lost = m_lost.load(std::memory_order_relaxed);
+    result.lastScore = m_lastScore.load(std::memory_order_relaxed);
+    return result;
+}
+
+void LatencyProbe::reset()
+{
+    m_roundTrip.reset();
+    m_mouthToEar.reset();
+    m_sent.store(0, std::memory_order_relaxed);
+    m_detected.store(0, std::memory_order_relaxed);
+    m_lost.store(0, std::memory_order_relaxed);
+    m_lastScore.store(0.0f, std::memory_order_relaxed);
+}
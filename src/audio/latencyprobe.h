@@ -0,0 +1,95 @@
+#ifndef LATENCYPROBE_H
+#define LATENCYPROBE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "latencyhistogram.h"
+#include "simd.h"
+
+// Mouth-to-ear latency measurement. Every IntervalMs the capture side
+// overwrites its audio with a short linear chirp; the far side loops its
+// playout back into its capture, and the playout side finds the chirp in the
+// mixed audio by normalised cross-correlation. The time from the chirp
+// entering the capture path to it reaching the sink is the round trip; the
+// one-way estimate is half of that plus the local capture and playout device
+// latencies (the loop is closed digitally on the far side, so its device
+// buffers are assumed to match ours).
+class LatencyProbe
+{
+public:
+    static constexpr int ChirpMs = 40;
+    static constexpr int IntervalMs = 2000;
+    // Chirps not found within this time are counted as lost
+    static constexpr int TimeoutMs = 1500;
+    // Normalised correlation a chirp has to reach
+    static constexpr float Threshold = 0.5f;
+
+    LatencyProbe(const Simd::Kernels &kernels, int playoutRate, size_t maxBlock);
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    // Latencies of the local capture and playout devices, added to the one-way estimate
+    void setDeviceLatency(int64_t captureUs, int64_t playoutUs);
+
+    // Capture side: overwrites the frame with the chirp while one is due.
+    // Called from one thread, after the frame was captured completely.
+    void inject(int16_t *samples, size_t count, int sampleRate);
+    // Playout side: searches a mixed block for the chirp; the block reaches
+    // the sink leadUs from now. Called from one thread.
+    void detect(const float *block, size_t count, int64_t leadUs);
+
+    const LatencyHistogram &roundTrip() const { return m_roundTrip; }
+    const LatencyHistogram &mouthToEar() const { return m_mouthToEar; }
+
+    struct Stats {
+        uint64_t sent = 0;
+        uint64_t detected = 0;
+        uint64_t lost = 0;
+        float    lastScore = 0.0f;
+    };
+    Stats stats() const;
+    // Clears the histograms and counters; a chirp on its way is still matched
+    void reset();
+
+    // The test signal at t seconds from its start, in [-1, 1]
+    static float chirp(double seconds);
+    static int64_t nowUs();
+
+private:
+    void expire(int64_t now);
+    void commit();
+
+    const Simd::Kernels    &m_kernels;
+    int                     m_playoutRate;
+    // The chirp at the playout rate, scaled to unit energy
+    std::vector<float>      m_template;
+
+    std::atomic<bool>       m_enabled{false};
+    std::atomic<int64_t>    m_captureLatencyUs{0};
+    std::atomic<int64_t>    m_playoutLatencyUs{0};
+    // Capture time of the chirp on its way, 0 if none
+    std::atomic<int64_t>    m_sentUs{0};
+
+    // Only touched by the capture side
+    int64_t                 m_nextInjectUs = 0;
+    size_t                  m_injectPos = 0;
+    bool                    m_injecting = false;
+
+    // Only touched by the playout side: the last template length - 1 samples
+    // followed by the current block, and the best match seen so far
+    std::vector<float>      m_history;
+    size_t                  m_historyFill = 0;
+    float                   m_bestScore = 0.0f;
+    int64_t                 m_bestUs = 0;
+
+    LatencyHistogram        m_roundTrip;
+    LatencyHistogram        m_mouthToEar;
+    std::atomic<uint64_t>   m_sent{0};
+    std::atomic<uint64_t>   m_detected{0};
+    std::atomic<uint64_t>   m_lost{0};
+    std::atomic<float>      m_lastScore{0.0f};
+};
+
+#endif // LATENCYPROBE_H
@@ -0,0 +1,91 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer/single-consumer queue (Vyukov's sequenced
+// ring). Every cell carries a sequence number that tells producers and the
+// consumer whose turn it is, so push() only contends on one atomic index and
+// never waits for another producer to finish. Storage is allocated once;
+// push() and pop() never allocate or block. push() may be called from any
+// thread, pop() only from one.
+template <typename T>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(size_t capacity)
+    {
+        // Power of two capacity lets positions wrap with a mask instead of a modulo
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_cells = std::make_unique<Cell[]>(size);
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Producer: false (and counted) if the queue is full
+    bool push(T value)
+    {
+        size_t position = m_writePos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &m_cells[position & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (m_writePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            } else if (difference < 0) {
+                // The consumer hasn't freed this cell yet
+                m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = m_writePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        // Publish the value to the consumer only after it has been stored
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: moves the oldest value out, or returns false if there is none
+    // (or its producer is still storing it)
+    bool pop(T &value)
+    {
+        Cell &cell = m_cells[m_readPos & m_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != m_readPos + 1)
+            return false;
+        value = std::move(cell.value);
+        // Leave nothing behind that holds on to a resource
+        cell.value = T();
+        cell.sequence.store(m_readPos + m_mask + 1, std::memory_order_release);
+        ++m_readPos;
+        return true;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+    uint64_t overflowCount() const { return m_overflowCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence{0};
+        T                   value{};
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t                  m_mask = 0;
+    // Producers and the consumer each get their own cache line
+    alignas(64) std::atomic<size_t> m_writePos{0};
+    alignas(64) size_t              m_readPos = 0;
+    std::atomic<uint64_t>   m_overflowCount{0};
+};
+
+#endif // MPSCQUEUE_H
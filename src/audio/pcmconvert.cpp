@@ -0,0 +1,118 @@
+#include "pcmconvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "simd.h"
+
+namespace Pcm {
+
+// Device buffers are not guaranteed to be aligned for their sample type
+template<typename T>
+static T load(const char *data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+template<typename T>
+static void store(char *data, T value)
+{
+    std::memcpy(data, &value, sizeof(T));
+}
+
+static float sampleToFloat(const char *data, QAudioFormat::SampleFormat format)
+{
+    switch (format) {
+    case QAudioFormat::UInt8:
+        return (load<uint8_t>(data) - 128) * (1.0f / 128.0f);
+    case QAudioFormat::Int16:
+        return load<int16_t>(data) * (1.0f / 32768.0f);
+    case QAudioFormat::Int32:
+        return float(load<int32_t>(data) * (1.0 / 2147483648.0));
+    case QAudioFormat::Float:
+        return load<float>(data);
+    default:
+        return 0.0f;
+    }
+}
+
+static void floatToSample(float value, char *data, QAudioFormat::SampleFormat format)
+{
+    value = std::clamp(value, -1.0f, 1.0f);
+    switch (format) {
+    case QAudioFormat::UInt8:
+        store<uint8_t>(data, uint8_t(std::clamp(std::lround(value * 128.0f) + 128, 0L, 255L)));
+        break;
+    case QAudioFormat::Int16:
+        store<int16_t>(data, int16_t(std::clamp(std::lround(value * 32768.0f), -32768L, 32767L)));
+        break;
+    case QAudioFormat::Int32:
+        store<int32_t>(data, int32_t(std::clamp<double>(std::nearbyint(value * 2147483648.0),
+                                                        -2147483648.0, 2147483647.0)));
+        break;
+    case QAudioFormat::Float:
+        store<float>(data, value);
+        break;
+    default:
+        break;
+    }
+}
+
+QAudioFormat deviceFormat(const QAudioDevice &device)
+{
+    const QAudioFormat preferred = device.preferredFormat();
+    if (preferred.isValid() && device.isFormatSupported(preferred))
+        return preferred;
+
+    QAudioFormat format;
+    format.setSampleRate(preferred.sampleRate() > 0 ? preferred.sampleRate() : 48000);
+    format.setChannelCount(1);
+    format.setSampleFormat(QAudioFormat::Int16);
+    if (!device.isFormatSupported(format))
+        format.setSampleRate(48000);
+    return format;
+}
+
+void toMonoFloat(const char *data, size_t frames, const QAudioFormat &format, float *out)
+{
+    const int channels = format.channelCount();
+    // The common case goes through the vectorised kernel
+    if (channels == 1 && format.sampleFormat() == QAudioFormat::Int16 &&
+        reinterpret_cast<uintptr_t>(data) % alignof(int16_t) == 0) {
+        Simd::kernels().int16ToFloat(reinterpret_cast<const int16_t *>(data), out, frames);
+        return;
+    }
+
+    const int bytesPerSample = format.bytesPerSample();
+    const float scale = 1.0f / channels;
+    for (size_t i = 0; i < frames; ++i) {
+        float sum = 0.0f;
+        for (int channel = 0; channel < channels; ++channel) {
+            sum += sampleToFloat(data, format.sampleFormat());
+            data += bytesPerSample;
+        }
+        out[i] = sum * scale;
+    }
+}
+
+void fromMonoFloat(const float *in, size_t frames, const QAudioFormat &format, char *data)
+{
+    const int channels = format.channelCount();
+    if (channels == 1 && format.sampleFormat() == QAudioFormat::Int16 &&
+        reinterpret_cast<uintptr_t>(data) % alignof(int16_t) == 0) {
+        Simd::kernels().floatToInt16(in, reinterpret_cast<int16_t *>(data), frames);
+        return;
+    }
+
+    const int bytesPerSample = format.bytesPerSample();
+    for (size_t i = 0; i < frames; ++i) {
+        for (int channel = 0; channel < channels; ++channel) {
+            floatToSample(in[i], data, format.sampleFormat());
+            data += bytesPerSample;
+        }
+    }
+}
+
+} // namespace Pcm
@@ -0,0 +1,23 @@
+#ifndef PCMCONVERT_H
+#define PCMCONVERT_H
+
+#include <QAudioDevice>
+#include <QAudioFormat>
+#include <cstddef>
+
+// Conversions between the interleaved PCM a device uses and the mono float
+// samples the processing pipeline works on
+namespace Pcm {
+
+// Format to open a device with: its preferred format when it reports a
+// supported one, else mono Int16 at the preferred (or 48 kHz) rate
+QAudioFormat deviceFormat(const QAudioDevice &device);
+
+// Averages the channels of frames device frames into mono floats
+void toMonoFloat(const char *data, size_t frames, const QAudioFormat &format, float *out);
+// Writes every mono sample to all channels of frames device frames
+void fromMonoFloat(const float *in, size_t frames, const QAudioFormat &format, char *data);
+
+} // namespace Pcm
+
+#endif // PCMCONVERT_H
@@ -0,0 +1,290 @@
+#include "peerstream.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+
+// An underrun fades out through PLC for this many frames, then goes silent
+static constexpr int MaxUnderrunConcealFrames = 3;
+// Playout speed change while the jitter buffer is off target; inaudible on speech
+static constexpr float MaxStretch = 0.06f;
+// Beyond this much excess delay frames are skipped instead of waiting for the
+// stretcher to catch up (6% of speed takes 3 s to absorb 200 ms)
+static constexpr int MaxStretchBacklogMs = 200;
+
+PeerStream::PeerStream(int sampleRate, size_t maxBlock)
+    : m_sampleRate(sampleRate),
+    m_maxFrameSamples(size_t(sampleRate) * 60 / 1000),
+    m_comfortNoise(Simd::kernels(), sampleRate)
+{
+    int error;
+    m_decoder = opus_decoder_create(sampleRate, 1, &error);
+    if (error != OPUS_OK) {
+        qWarning() << "Failed to create decoder:" << opus_strerror(error);
+        m_decoder = nullptr;
+        return;
+    }
+
+    m_jitterBuffer.setSkipMargin(MaxStretchBacklogMs);
+    m_timeStretcher = std::make_unique<TimeStretcher>(sampleRate, m_maxFrameSamples);
+    m_decoded.resize(m_maxFrameSamples);
+    m_decodedFloat.resize(m_maxFrameSamples);
+    // Room for a stretched frame behind whatever is left of the previous one
+    m_stretched.resize(m_timeStretcher->maxOutput(m_maxFrameSamples) + maxBlock);
+}
+
+PeerStream::~PeerStream()
+{
+    if (m_decoder)
+        opus_decoder_destroy(m_decoder);
+}
+
+void PeerStream::insert(const MediaFrame &frame, int64_t arrivalUs)
+{
+    m_jitterBuffer.insert(frame, arrivalUs);
+    updateSenderClock(frame.timestamp(), arrivalUs);
+}
+
+// Late and reordered frames only raise the offset the estimator tracks the
+// floor of, so they need no special case
+void PeerStream::updateSenderClock(uint32_t timestamp, int64_t arrivalUs)
+{
+    if (!m_haveTimestamp) {
+        m_haveTimestamp = true;
+        m_lastTimestamp = timestamp;
+        m_lastTicks = 0;
+    }
+    const int64_t ticks = m_lastTicks + int32_t(timestamp - m_lastTimestamp);
+    if (ticks > m_lastTicks) {
+        m_lastTicks = ticks;
+        m_lastTimestamp = timestamp;
+    }
+    m_senderClock.update(arrivalUs, ticks * 1000 / 48);
+}
+
+void PeerStream::setSinkClock(double ppm, bool valid)
+{
+    m_sinkClockPpm = ppm;
+    m_sinkClockValid = valid;
+}
+
+void PeerStream::reset()
+{
+    m_jitterBuffer.reset();
+    if (!m_decoder)
+        return;
+    opus_decoder_ctl(m_decoder, OPUS_RESET_STATE);
+    m_timeStretcher->reset();
+    m_timeStretcher->setRate(1.0f);
+    m_pendingOffset = 0;
+    m_pending = 0;
+    m_underrunRun = 0;
+    m_comfortNoise.reset();
+    m_playoutRate = 1.0f;
+    m_controlRate = 1.0f;
+    m_latency.reset();
+    m_senderClock.reset();
+    m_haveTimestamp = false;
+    m_clockSkewPpm = 0.0;
+}
+
+void PeerStream::render(float *out, size_t count, int64_t playoutUs)
+{
+    size_t written = 0;
+    while (written < count && m_decoder) {
+        // A new frame starts behind what was written, and comes out of the
+        // stretcher one hop late
+        const int64_t frameUs = playoutUs + int64_t(written + m_timeStretcher->latency()) * 1000000 / m_sampleRate;
+        // The stretcher may hold a short frame back entirely
+        for (int attempt = 0; attempt < 4 && m_pending == 0; ++attempt)
+            renderFrame(frameUs);
+        if (m_pending == 0)
+            break;
+        const size_t chunk = std::min(count - written, m_pending);
+        std::memcpy(out + written, m_stretched.data() + m_pendingOffset, chunk * sizeof(float));
+        m_pendingOffset += chunk;
+        m_pending -= chunk;
+        written += chunk;
+    }
+    std::fill(out + written, out + count, 0.0f);
+}
+
+int PeerStream::frameSamples() const
+{
+    return std::min(int(m_maxFrameSamples), int(int64_t(m_jitterBuffer.frameTicks()) * m_sampleRate / 48000));
+}
+
+// Decodes, conceals or fills in the next frame behind the pending samples
+void PeerStream::renderFrame(int64_t playoutUs)
+{
+    MediaFrame frame;
+    int64_t arrivalUs = 0;
+    switch (m_jitterBuffer.pop(frame, &arrivalUs)) {
+    case JitterBuffer::Result::Frame:
+        m_latency.record(playoutUs - arrivalUs);
+        m_underrunRun = 0;
+        updatePlayoutRate();
+        decode(frame);
+        break;
+    case JitterBuffer::Result::Missing:
+        m_underrunRun = 0;
+        updatePlayoutRate();
+        concealFrame();
+        break;
+    case JitterBuffer::Result::Empty:
+        m_timeStretcher->setRate(1.0f);
+        m_playoutRate = 1.0f;
+        m_controlRate = 1.0f;
+        fillUnderrun();
+        break;
+    }
+}
+
+// Plays a few percent fast while the jitter buffer holds more than its target
+// and a few percent slow while it holds less, until the delay crosses the
+// target again, so it converges without skipped frames or gaps. Underneath,
+// the sender's clock skew is played out continuously, so the delay doesn't
+// drift off the target in the first place.
+void PeerStream::updatePlayoutRate()
+{
+    const int excessMs = m_jitterBuffer.excessDelayMs();
+    const int frameMs = int(m_jitterBuffer.frameTicks() / 48);
+    if (excessMs > frameMs)
+        m_controlRate = 1.0f + MaxStretch;
+    else if (excessMs < -frameMs)
+        m_controlRate = 1.0f - MaxStretch;
+    else if ((m_controlRate > 1.0f && excessMs <= 0) || (m_controlRate < 1.0f && excessMs >= 0))
+        m_controlRate = 1.0f;
+
+    // Frames arrive (1 + sender skew) / (1 + sink skew) times as fast as the
+    // sink plays them
+    double skewPpm = 0.0;
+    if (m_senderClock.isValid() && m_sinkClockValid)
+        skewPpm = ((1.0 + m_senderClock.ppm() * 1e-6) / (1.0 + m_sinkClockPpm * 1e-6) - 1.0) * 1e6;
+    m_clockSkewPpm = skewPpm;
+
+    const float rate = float(double(m_controlRate) * (1.0 + skewPpm * 1e-6));
+    m_timeStretcher->setRate(rate);
+    m_playoutRate = rate;
+
+    if (m_controlRate > 1.0f)
+        ++m_acceleratedFrames;
+    else if (m_controlRate < 1.0f)
+        ++m_deceleratedFrames;
+}
+
+void PeerStream::decode(const MediaFrame &frame)
+{
+    const int samples = opus_decode(m_decoder, frame.data(), opus_int32(frame.size()),
+                                    m_decoded.data(), int(m_maxFrameSamples), 0);
+    if (samples < 0) {
+        // The mixer still needs its frame
+        qWarning() << "Failed to decode packet:" << opus_strerror(samples);
+        concealFrame();
+        return;
+    }
+    ++m_decodedFrames;
+    writeDecoded(samples);
+    m_comfortNoise.analyse(m_decodedFloat.data(), size_t(samples));
+}
+
+// Only SILK and hybrid frames (TOC configs 0-15) have room for the LBRR copy
+// of the previous frame that in-band FEC sends
+static bool mayCarryFec(const MediaFrame &frame)
+{
+    return frame.size() > 0 && (frame.data()[0] >> 3) < 16;
+}
+
+// Fills in one frame whose packet never arrived: from the in-band FEC copy in
+// the next packet if that is already buffered, otherwise by Opus PLC. Both
+// produce exactly one frame duration, so the frames after it stay aligned
+// with their timestamps.
+void PeerStream::concealFrame()
+{
+    const int samples = frameSamples();
+    ++m_lostFrames;
+
+    MediaFrame next;
+    if (m_jitterBuffer.peekNext(next) && mayCarryFec(next)) {
+        const int recovered = opus_decode(m_decoder, next.data(), opus_int32(next.size()),
+                                          m_decoded.data(), samples, 1);
+        if (recovered > 0) {
+            ++m_recoveredFrames;
+            writeDecoded(recovered);
+            return;
+        }
+    }
+
+    const int concealed = opus_decode(m_decoder, nullptr, 0, m_decoded.data(), samples, 0);
+    if (concealed < 0) {
+        qWarning() << "Failed to conceal a lost packet:" << opus_strerror(concealed);
+        writeComfortNoise(samples);
+        return;
+    }
+    ++m_concealedFrames;
+    writeDecoded(concealed);
+}
+
+// Nothing to play: before the first frame, while the jitter buffer fills up
+// to its target, or after it ran dry (the sender went quiet). Right after
+// audio, PLC fades it out instead of cutting it off, and comfort noise fades
+// in behind it.
+void PeerStream::fillUnderrun()
+{
+    const int samples = frameSamples();
+    if (m_decodedFrames > 0 && m_underrunRun < MaxUnderrunConcealFrames) {
+        const int concealed = opus_decode(m_decoder, nullptr, 0, m_decoded.data(), samples, 0);
+        if (concealed > 0) {
+            ++m_underrunRun;
+            ++m_underrunFrames;
+            writeDecoded(concealed);
+            return;
+        }
+    }
+    writeComfortNoise(samples);
+}
+
+// Silence until the first frames gave the generator a background to model
+void PeerStream::writeComfortNoise(int samples)
+{
+    m_comfortNoise.generate(m_decodedFloat.data(), size_t(samples));
+    if (m_comfortNoise.hasModel()) {
+        ++m_comfortNoiseFrames;
+        m_comfortNoiseLevelDb.store(m_comfortNoise.levelDb(), std::memory_order_relaxed);
+    }
+    stretch(samples);
+}
+
+void PeerStream::writeDecoded(int samples)
+{
+    Simd::kernels().int16ToFloat(m_decoded.data(), m_decodedFloat.data(), size_t(samples));
+    m_comfortNoise.interrupt();
+    stretch(samples);
+}
+
+// Time-stretches the samples in m_decodedFloat behind the ones still pending
+void PeerStream::stretch(int samples)
+{
+    if (m_pendingOffset > 0) {
+        std::memmove(m_stretched.data(), m_stretched.data() + m_pendingOffset, m_pending * sizeof(float));
+        m_pendingOffset = 0;
+    }
+    m_pending += m_timeStretcher->process(m_decodedFloat.data(), size_t(samples), m_stretched.data() + m_pending);
+}
+
+PeerStream::Stats PeerStream::stats() const
+{
+    Stats result;
+    result.decodedFrames = m_decodedFrames.load(std::memory_order_relaxed);
+    result.lostFrames = m_lostFrames.load(std::memory_order_relaxed);
+    result.concealedFrames = m_concealedFrames.load(std::memory_order_relaxed);
+    result.recoveredFrames = m_recoveredFrames.load(std::memory_order_relaxed);
+    result.underrunFrames = m_underrunFrames.load(std::memory_order_relaxed);
+    result.comfortNoiseFrames = m_comfortNoiseFrames.load(std::memory_order_relaxed);
+    result.comfortNoiseLevelDb = m_comfortNoiseLevelDb.load(std::memory_order_relaxed);
+    result.acceleratedFrames = m_acceleratedFrames.load(std::memory_order_relaxed);
+    result.deceleratedFrames = m_deceleratedFrames.load(std::memory_order_relaxed);
+    result.playoutRate = m_playoutRate.load(std::memory_order_relaxed);
+    result.senderClockPpm = m_senderClock.ppm();
+    result.clockSkewPpm = m_clockSkewPpm.load(std::memory_order_relaxed);
+    return result;
+}
@@ -0,0 +1,136 @@
+#ifndef PEERSTREAM_H
+#define PEERSTREAM_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <opus.h>
+#include "comfortnoise.h"
+#include "driftestimator.h"
+#include "framepool.h"
+#include "jitterbuffer.h"
+#include "latencyhistogram.h"
+#include "timestretcher.h"
+
+// Receive pipeline of one remote peer: its own jitter buffer and Opus
+// decoder (a decoder carries state from frame to frame, so streams must
+// never share one), loss concealment, and the time-stretcher that lets its
+// delay converge on the jitter buffer target. The mixer pulls fixed-size
+// blocks of mono float audio from it at the decoder rate.
+//
+// While the sender is silent (DTX, suppressed silence, or a gap the jitter
+// buffer runs dry in), the stream plays comfort noise modelled on the
+// background of its last decoded frames instead of digital silence.
+//
+// The sender's sound card and ours never run at exactly the same speed, so
+// the sender's RTP clock is compared against the local clock on arrival, and
+// the difference to the sink's own skew is played out as a constant few ppm
+// of time-stretch; over a long call the delay then stays where the jitter
+// buffer put it instead of slowly filling or draining.
+//
+// Apart from the gain and the statistics, it is only used from the playout
+// thread.
+class PeerStream
+{
+public:
+    PeerStream(int sampleRate, size_t maxBlock);
+    ~PeerStream();
+    PeerStream(const PeerStream &) = delete;
+    PeerStream &operator=(const PeerStream &) = delete;
+
+    bool isValid() const { return m_decoder != nullptr; }
+    int sampleRate() const { return m_sampleRate; }
+
+    void insert(const MediaFrame &frame, int64_t arrivalUs);
+
+    // Writes exactly count samples (at most maxBlock): decoded audio,
+    // concealment for lost frames, or silence while there is nothing to play.
+    // playoutUs is when the first of them will be handed to the sink, on the
+    // clock of the arrival times.
+    void render(float *out, size_t count, int64_t playoutUs);
+    void reset();
+
+    // The sink's skew against the local clock (the clock of the arrival
+    // times), in ppm; the playout rate follows from the next frame
+    void setSinkClock(double ppm, bool valid);
+    // How much faster the sender's clock runs than the sink's, in ppm; 0
+    // until both have been measured for long enough
+    double clockSkewPpm() const { return m_clockSkewPpm.load(std::memory_order_relaxed); }
+
+    // Linear gain applied by the mixer
+    void setGain(float gain) { m_gain.store(gain, std::memory_order_relaxed); }
+    float gain() const { return m_gain.load(std::memory_order_relaxed); }
+
+    struct Stats {
+        uint64_t decodedFrames = 0;
+        uint64_t lostFrames = 0;
+        uint64_t concealedFrames = 0;
+        uint64_t recoveredFrames = 0;
+        uint64_t underrunFrames = 0;
+        uint64_t comfortNoiseFrames = 0;
+        uint64_t acceleratedFrames = 0;
+        uint64_t deceleratedFrames = 0;
+        float    playoutRate = 1.0f;
+        double   senderClockPpm = 0.0;   // against the local clock
+        double   clockSkewPpm = 0.0;     // against the sink
+        float    comfortNoiseLevelDb = -100.0f;
+    };
+    Stats stats() const;
+    JitterBuffer::Stats jitterStats() const { return m_jitterBuffer.stats(); }
+    // From the arrival of each decoded packet to its audio reaching the sink
+    const LatencyHistogram &latency() const { return m_latency; }
+
+private:
+    void renderFrame(int64_t playoutUs);
+    void updatePlayoutRate();
+    void updateSenderClock(uint32_t timestamp, int64_t arrivalUs);
+    void decode(const MediaFrame &frame);
+    void concealFrame();
+    void fillUnderrun();
+    void writeComfortNoise(int samples);
+    void writeDecoded(int samples);
+    void stretch(int samples);
+    int frameSamples() const;
+
+    int                          m_sampleRate;
+    OpusDecoder                 *m_decoder = nullptr;
+    JitterBuffer                 m_jitterBuffer;
+    std::unique_ptr<TimeStretcher> m_timeStretcher;
+    std::atomic<float>           m_gain{1.0f};
+
+    // One 60 ms frame, decoded and stretched; the stretched samples are
+    // handed out in blocks starting at m_pendingOffset
+    size_t                       m_maxFrameSamples;
+    std::vector<opus_int16>      m_decoded;
+    std::vector<float>           m_decodedFloat;
+    std::vector<float>           m_stretched;
+    size_t                       m_pendingOffset = 0;
+    size_t                       m_pending = 0;
+    int                          m_underrunRun = 0;
+    ComfortNoiseGenerator        m_comfortNoise;
+    LatencyHistogram             m_latency;
+    // Rate the jitter buffer delay asks for, before the clock skew correction
+    float                        m_controlRate = 1.0f;
+
+    // Sender clock, from RTP timestamps unwrapped to 64 bits
+    DriftEstimator               m_senderClock;
+    bool                         m_haveTimestamp = false;
+    uint32_t                     m_lastTimestamp = 0;
+    int64_t                      m_lastTicks = 0;
+    double                       m_sinkClockPpm = 0.0;
+    bool                         m_sinkClockValid = false;
+    std::atomic<double>          m_clockSkewPpm{0.0};
+
+    std::atomic<uint64_t>        m_decodedFrames{0};
+    std::atomic<uint64_t>        m_lostFrames{0};
+    std::atomic<uint64_t>        m_concealedFrames{0};
+    std::atomic<uint64_t>        m_recoveredFrames{0};
+    std::atomic<uint64_t>        m_underrunFrames{0};
+    std::atomic<uint64_t>        m_comfortNoiseFrames{0};
+    std::atomic<float>           m_comfortNoiseLevelDb{-100.0f};
+    std::atomic<uint64_t>        m_acceleratedFrames{0};
+    std::atomic<uint64_t>        m_deceleratedFrames{0};
+    std::atomic<float>           m_playoutRate{1.0f};
+};
+
+#endif // PEERSTREAM_H
@@ -0,0 +1,48 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstddef>
+#include <vector>
+#include "simd.h"
+
+// Polyphase windowed-sinc sample rate converter for mono float audio. The
+// rate ratio is reduced to L/M; the Kaiser-windowed low-pass prototype is
+// zeroCrossings * max(L, M) taps long, about that many zero crossings of its
+// sinc whatever the ratio, and is split into L phases stored back to front,
+// so every output sample is a single SIMD dot product over the most recent
+// input. Buffers are sized for maxInput samples per call up front, so
+// process() never allocates.
+class Resampler
+{
+public:
+    Resampler(int inputRate, int outputRate, size_t maxInput,
+              const Simd::Kernels &kernels = Simd::kernels(), int zeroCrossings = 64);
+
+    int inputRate() const { return m_inputRate; }
+    int outputRate() const { return m_outputRate; }
+    bool isPassthrough() const { return m_inputRate == m_outputRate; }
+
+    // Most samples process() can return for count input samples
+    size_t maxOutput(size_t count) const;
+    // Converts up to maxInput samples and returns the number written to out
+    size_t process(const float *in, size_t count, float *out);
+    void reset();
+
+    // Opus rate (8/12/16/24/48 kHz) to run the codec at for a device rate:
+    // the lowest one that keeps the whole device bandwidth
+    static int codecRateFor(int deviceRate);
+
+private:
+    const Simd::Kernels &m_kernels;
+    int                  m_inputRate;
+    int                  m_outputRate;
+    size_t               m_maxInput;
+    size_t               m_up;       // L
+    size_t               m_down;     // M
+    size_t               m_taps;     // per phase
+    std::vector<float>   m_phases;   // m_up * m_taps, each phase reversed
+    std::vector<float>   m_history;  // m_taps - 1 previous samples, then the new input
+    size_t               m_position = 0; // next output, in 1/L input samples from the block start
+};
+
+#endif // RESAMPLER_H
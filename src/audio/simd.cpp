@@ -0,0 +1,505 @@
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+// Per-function targets let the SSE4.1/AVX2 versions live next to the scalar
+// ones without building the whole file for a newer CPU
+#define SIMD_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#elif defined(__aarch64__)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace Simd {
+
+/*
+ * ====================================================
+ * ================= scalar kernels ===================
+ * ====================================================
+ */
+
+static void int16ToFloatScalar(const int16_t *in, float *out, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        out[i] = in[i] * (1.0f / 32768.0f);
+}
+
+static void floatToInt16Scalar(const float *in, int16_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const float scaled = std::nearbyint(in[i] * 32768.0f);
+        out[i] = static_cast<int16_t>(std::clamp(scaled, -32768.0f, 32767.0f));
+    }
+}
+
+static void applyGainRampScalar(float *samples, size_t count, float startGain, float endGain)
+{
+    const float step = count ? (endGain - startGain) / count : 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        samples[i] *= startGain + step * i;
+}
+
+static float sumSquaresScalar(const float *samples, size_t count)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        sum += samples[i] * samples[i];
+    return sum;
+}
+
+static float peakScalar(const float *samples, size_t count)
+{
+    float result = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        result = std::max(result, std::fabs(samples[i]));
+    return result;
+}
+
+static float dotScalar(const float *a, const float *b, size_t count)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static void multiplyAddScalar(float *accumulator, const float *samples, float scale, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        accumulator[i] += scale * samples[i];
+}
+
+#if SIMD_X86
+
+/*
+ * ====================================================
+ * ================= SSE4.1 kernels ===================
+ * ====================================================
+ */
+
+SIMD_TARGET_SSE41 static void int16ToFloatSse41(const int16_t *in, float *out, size_t count)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i pcm = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        const __m128i low = _mm_cvtepi16_epi32(pcm);
+        const __m128i high = _mm_cvtepi16_epi32(_mm_srli_si128(pcm, 8));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    }
+    int16ToFloatScalar(in + i, out + i, count - i);
+}
+
+SIMD_TARGET_SSE41 static void floatToInt16Sse41(const float *in, int16_t *out, size_t count)
+{
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // cvtps rounds to nearest; packs saturates to the Int16 range
+        const __m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), scale));
+        const __m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(low, high));
+    }
+    floatToInt16Scalar(in + i, out + i, count - i);
+}
+
+SIMD_TARGET_SSE41 static void applyGainRampSse41(float *samples, size_t count, float startGain, float endGain)
+{
+    const float step = count ? (endGain - startGain) / count : 0.0f;
+    __m128 gain = _mm_add_ps(_mm_set1_ps(startGain), _mm_mul_ps(_mm_set1_ps(step), _mm_setr_ps(0, 1, 2, 3)));
+    const __m128 increment = _mm_set1_ps(step * 4);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gain));
+        gain = _mm_add_ps(gain, increment);
+    }
+    for (; i < count; ++i)
+        samples[i] *= startGain + step * i;
+}
+
+SIMD_TARGET_SSE41 static float horizontalSumSse41(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+SIMD_TARGET_SSE41 static float horizontalMaxSse41(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+SIMD_TARGET_SSE41 static float sumSquaresSse41(const float *samples, size_t count)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128 a = _mm_loadu_ps(samples + i);
+        const __m128 b = _mm_loadu_ps(samples + i + 4);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+    }
+    return horizontalSumSse41(_mm_add_ps(acc0, acc1)) + sumSquaresScalar(samples + i, count - i);
+}
+
+SIMD_TARGET_SSE41 static float peakSse41(const float *samples, size_t count)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 result = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        result = _mm_max_ps(result, _mm_and_ps(_mm_loadu_ps(samples + i), absMask));
+    return std::max(horizontalMaxSse41(result), peakScalar(samples + i, count - i));
+}
+
+SIMD_TARGET_SSE41 static float dotSse41(const float *a, const float *b, size_t count)
+{
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    return horizontalSumSse41(_mm_add_ps(acc0, acc1)) + dotScalar(a + i, b + i, count - i);
+}
+
+SIMD_TARGET_SSE41 static void multiplyAddSse41(float *accumulator, const float *samples, float scale, size_t count)
+{
+    const __m128 factor = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 sum = _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_mul_ps(factor, _mm_loadu_ps(samples + i)));
+        _mm_storeu_ps(accumulator + i, sum);
+    }
+    multiplyAddScalar(accumulator + i, samples + i, scale, count - i);
+}
+
+/*
+ * ====================================================
+ * ================== AVX2 kernels ====================
+ * ====================================================
+ */
+
+SIMD_TARGET_AVX2 static float horizontalSumAvx2(__m256 v)
+{
+    const __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    return horizontalSumSse41(sum);
+}
+
+SIMD_TARGET_AVX2 static void int16ToFloatAvx2(const int16_t *in, float *out, size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 8));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(low)), scale));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(high)), scale));
+    }
+    int16ToFloatSse41(in + i, out + i, count - i);
+}
+
+SIMD_TARGET_AVX2 static void floatToInt16Avx2(const float *in, int16_t *out, size_t count)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i low = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale));
+        const __m256i high = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale));
+        // packs works per 128-bit lane, so restore the sample order afterwards
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+    }
+    floatToInt16Sse41(in + i, out + i, count - i);
+}
+
+SIMD_TARGET_AVX2 static void applyGainRampAvx2(float *samples, size_t count, float startGain, float endGain)
+{
+    const float step = count ? (endGain - startGain) / count : 0.0f;
+    __m256 gain = _mm256_fmadd_ps(_mm256_set1_ps(step), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_ps(startGain));
+    const __m256 increment = _mm256_set1_ps(step * 8);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), gain));
+        gain = _mm256_add_ps(gain, increment);
+    }
+    for (; i < count; ++i)
+        samples[i] *= startGain + step * i;
+}
+
+SIMD_TARGET_AVX2 static float sumSquaresAvx2(const float *samples, size_t count)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256 a = _mm256_loadu_ps(samples + i);
+        const __m256 b = _mm256_loadu_ps(samples + i + 8);
+        acc0 = _mm256_fmadd_ps(a, a, acc0);
+        acc1 = _mm256_fmadd_ps(b, b, acc1);
+    }
+    return horizontalSumAvx2(_mm256_add_ps(acc0, acc1)) + sumSquaresScalar(samples + i, count - i);
+}
+
+SIMD_TARGET_AVX2 static float peakAvx2(const float *samples, size_t count)
+{
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 result = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        result = _mm256_max_ps(result, _mm256_and_ps(_mm256_loadu_ps(samples + i), absMask));
+    const __m128 half = _mm_max_ps(_mm256_castps256_ps128(result), _mm256_extractf128_ps(result, 1));
+    return std::max(horizontalMaxSse41(half), peakScalar(samples + i, count - i));
+}
+
+SIMD_TARGET_AVX2 static float dotAvx2(const float *a, const float *b, size_t count)
+{
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    return horizontalSumAvx2(_mm256_add_ps(acc0, acc1)) + dotScalar(a + i, b + i, count - i);
+}
+
+SIMD_TARGET_AVX2 static void multiplyAddAvx2(float *accumulator, const float *samples, float scale, size_t count)
+{
+    const __m256 factor = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 sum = _mm256_fmadd_ps(factor, _mm256_loadu_ps(samples + i), _mm256_loadu_ps(accumulator + i));
+        _mm256_storeu_ps(accumulator + i, sum);
+    }
+    multiplyAddScalar(accumulator + i, samples + i, scale, count - i);
+}
+
+#endif // SIMD_X86
+
+#if SIMD_NEON
+
+/*
+ * ====================================================
+ * ================== NEON kernels ====================
+ * ====================================================
+ */
+
+static void int16ToFloatNeon(const int16_t *in, float *out, size_t count)
+{
+    const float32x4_t scale = vdupq_n_f32(1.0f / 32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int16x8_t pcm = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(pcm))), scale));
+        vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(pcm))), scale));
+    }
+    int16ToFloatScalar(in + i, out + i, count - i);
+}
+
+static void floatToInt16Neon(const float *in, int16_t *out, size_t count)
+{
+    const float32x4_t scale = vdupq_n_f32(32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const int32x4_t low = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i), scale));
+        const int32x4_t high = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), scale));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    }
+    floatToInt16Scalar(in + i, out + i, count - i);
+}
+
+static void applyGainRampNeon(float *samples, size_t count, float startGain, float endGain)
+{
+    const float step = count ? (endGain - startGain) / count : 0.0f;
+    const float offsets[4] = {0, 1, 2, 3};
+    float32x4_t gain = vmlaq_n_f32(vdupq_n_f32(startGain), vld1q_f32(offsets), step);
+    const float32x4_t increment = vdupq_n_f32(step * 4);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), gain));
+        gain = vaddq_f32(gain, increment);
+    }
+    for (; i < count; ++i)
+        samples[i] *= startGain + step * i;
+}
+
+static float sumSquaresNeon(const float *samples, size_t count)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const float32x4_t a = vld1q_f32(samples + i);
+        const float32x4_t b = vld1q_f32(samples + i + 4);
+        acc0 = vfmaq_f32(acc0, a, a);
+        acc1 = vfmaq_f32(acc1, b, b);
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + sumSquaresScalar(samples + i, count - i);
+}
+
+static float peakNeon(const float *samples, size_t count)
+{
+    float32x4_t result = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        result = vmaxq_f32(result, vabsq_f32(vld1q_f32(samples + i)));
+    return std::max(vmaxvq_f32(result), peakScalar(samples + i, count - i));
+}
+
+static float dotNeon(const float *a, const float *b, size_t count)
+{
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + dotScalar(a + i, b + i, count - i);
+}
+
+static void multiplyAddNeon(float *accumulator, const float *samples, float scale, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(accumulator + i, vfmaq_n_f32(vld1q_f32(accumulator + i), vld1q_f32(samples + i), scale));
+    multiplyAddScalar(accumulator + i, samples + i, scale, count - i);
+}
+
+#endif // SIMD_NEON
+
+/*
+ * ====================================================
+ * ==================== dispatch ======================
+ * ====================================================
+ */
+
+static const Kernels ScalarKernels = {
+    Level::Scalar,
+    int16ToFloatScalar,
+    floatToInt16Scalar,
+    applyGainRampScalar,
+    sumSquaresScalar,
+    peakScalar,
+    dotScalar,
+    multiplyAddScalar,
+};
+
+#if SIMD_X86
+static const Kernels Sse41Kernels = {
+    Level::Sse41,
+    int16ToFloatSse41,
+    floatToInt16Sse41,
+    applyGainRampSse41,
+    sumSquaresSse41,
+    peakSse41,
+    dotSse41,
+    multiplyAddSse41,
+};
+
+static const Kernels Avx2Kernels = {
+    Level::Avx2,
+    int16ToFloatAvx2,
+    floatToInt16Avx2,
+    applyGainRampAvx2,
+    sumSquaresAvx2,
+    peakAvx2,
+    dotAvx2,
+    multiplyAddAvx2,
+};
+#endif
+
+#if SIMD_NEON
+static const Kernels NeonKernels = {
+    Level::Neon,
+    int16ToFloatNeon,
+    floatToInt16Neon,
+    applyGainRampNeon,
+    sumSquaresNeon,
+    peakNeon,
+    dotNeon,
+    multiplyAddNeon,
+};
+#endif
+
+bool isSupported(Level level)
+{
+    switch (level) {
+    case Level::Scalar:
+        return true;
+#if SIMD_X86
+    case Level::Sse41:
+        return __builtin_cpu_supports("sse4.1");
+    case Level::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#if SIMD_NEON
+    case Level::Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+Level detectedLevel()
+{
+    for (Level level : {Level::Avx2, Level::Sse41, Level::Neon}) {
+        if (isSupported(level))
+            return level;
+    }
+    return Level::Scalar;
+}
+
+const char *levelName(Level level)
+{
+    switch (level) {
+    case Level::Sse41:
+        return "SSE4.1";
+    case Level::Avx2:
+        return "AVX2";
+    case Level::Neon:
+        return "NEON";
+    default:
+        return "scalar";
+    }
+}
+
+const Kernels &kernels(Level level)
+{
+    if (!isSupported(level))
+        return ScalarKernels;
+    switch (level) {
+#if SIMD_X86
+    case Level::Sse41:
+        return Sse41Kernels;
+    case Level::Avx2:
+        return Avx2Kernels;
+#endif
+#if SIMD_NEON
+    case Level::Neon:
+        return NeonKernels;
+#endif
+    default:
+        return ScalarKernels;
+    }
+}
+
+const Kernels &kernels()
+{
+    // Resolved once; thread-safe since C++11
+    static const Kernels &best = kernels(detectedLevel());
+    return best;
+}
+
+} // namespace Simd
@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorised DSP kernels with runtime CPU dispatch. Each kernel exists in a
+// scalar version and, where the target supports it, in SSE4.1/AVX2 (x86) or
+// NEON (ARM) versions; kernels() returns the best set for the running CPU.
+// Samples are floats in [-1, 1) unless noted otherwise.
+namespace Simd {
+
+enum class Level {
+    Scalar,
+    Sse41,
+    Avx2,
+    Neon
+};
+
+struct Kernels {
+    Level level;
+
+    // Int16 PCM to float, scaled by 1/32768
+    void (*int16ToFloat)(const int16_t *in, float *out, size_t count);
+    // Float to Int16 PCM, rounded and saturated
+    void (*floatToInt16)(const float *in, int16_t *out, size_t count);
+    // Multiplies the samples by a gain ramping linearly from startGain to endGain
+    void (*applyGainRamp)(float *samples, size_t count, float startGain, float endGain);
+    float (*sumSquares)(const float *samples, size_t count);
+    float (*peak)(const float *samples, size_t count);
+    float (*dot)(const float *a, const float *b, size_t count);
+    // accumulator += scale * samples
+    void (*multiplyAdd)(float *accumulator, const float *samples, float scale, size_t count);
+};
+
+// Best level supported by the running CPU
+Level detectedLevel();
+bool isSupported(Level level);
+const char *levelName(Level level);
+
+// Kernels for the detected level, resolved once
+const Kernels &kernels();
+// Kernels for a specific level (falls back to scalar if unsupported), for benchmarks
+const Kernels &kernels(Level level);
+
+} // namespace Simd
+
+#endif // SIMD_H
@@ -0,0 +1,120 @@
+#include "timestretcher.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The coarse search looks at every CoarseStep-th offset, the fine one at the
+// neighbours of the best; speech correlation peaks are wider than that
+static constexpr size_t CoarseStep = 4;
+
+TimeStretcher::TimeStretcher(int sampleRate, size_t maxInput, const Simd::Kernels &kernels,
+                             int windowMs, int toleranceMs)
+    : m_kernels(kernels),
+    m_window(std::max<size_t>(2, size_t(sampleRate) * windowMs / 1000) & ~size_t(1)),
+    m_hop(m_window / 2),
+    m_tolerance(size_t(sampleRate) * toleranceMs / 1000),
+    m_maxInput(maxInput),
+    m_hann(m_window),
+    m_overlap(m_hop)
+{
+    // Periodic Hann: w[i] + w[i + hop] == 1, so overlapping segments taken at
+    // their natural positions add back up to the input
+    const double pi = std::acos(-1.0);
+    for (size_t i = 0; i < m_window; ++i)
+        m_hann[i] = float(0.5 - 0.5 * std::cos(2.0 * pi * double(i) / double(m_window)));
+
+    // Left over between calls: less than a window, the search range and one
+    // hop at the fastest rate
+    m_input.resize(maxInput + 2 * m_window + 2 * m_tolerance + size_t(std::ceil(m_hop * MaxRate)));
+    reset();
+}
+
+void TimeStretcher::setRate(float rate)
+{
+    m_rate = std::clamp(rate, MinRate, MaxRate);
+}
+
+void TimeStretcher::reset()
+{
+    std::fill(m_input.begin(), m_input.end(), 0.0f);
+    std::fill(m_overlap.begin(), m_overlap.end(), 0.0f);
+    m_inputCount = 0;
+    m_nominal = 0.0;
+    m_natural = 0;
+}
+
+size_t TimeStretcher::maxOutput(size_t count) const
+{
+    // Everything held back can come out too
+    const size_t buffered = m_input.size() - m_maxInput;
+    return (size_t(double(count + buffered) / MinRate) / m_hop + 1) * m_hop;
+}
+
+// Offset in [low, high] whose segment start correlates best with the natural
+// continuation of the previous segment
+size_t TimeStretcher::bestOffset(size_t low, size_t high, size_t step) const
+{
+    const float *target = m_input.data() + m_natural;
+    size_t best = low;
+    float bestScore = -2.0f;
+    for (size_t offset = low; offset <= high; offset += step) {
+        const float *candidate = m_input.data() + offset;
+        const float energy = m_kernels.sumSquares(candidate, m_hop);
+        const float score = m_kernels.dot(candidate, target, m_hop) / std::sqrt(energy + 1e-9f);
+        if (score > bestScore) {
+            bestScore = score;
+            best = offset;
+        }
+    }
+    return best;
+}
+
+size_t TimeStretcher::process(const float *in, size_t count, float *out)
+{
+    count = std::min(count, m_maxInput);
+    std::memcpy(m_input.data() + m_inputCount, in, count * sizeof(float));
+    m_inputCount += count;
+
+    size_t produced = 0;
+    while (true) {
+        size_t start;
+        if (m_rate == 1.0f) {
+            // Nothing to stretch: follow the input exactly
+            if (m_natural + m_window > m_inputCount)
+                break;
+            start = m_natural;
+        } else {
+            const size_t nominal = size_t(m_nominal);
+            const size_t low = nominal > m_tolerance ? nominal - m_tolerance : 0;
+            const size_t high = nominal + m_tolerance;
+            if (std::max(high, m_natural) + m_window > m_inputCount)
+                break;
+            const size_t coarse = bestOffset(low, high, CoarseStep);
+            start = bestOffset(coarse > low + CoarseStep ? coarse - CoarseStep + 1 : low,
+                               std::min(high, coarse + CoarseStep - 1), 1);
+        }
+
+        // First half overlaps the tail of the previous segment, second half
+        // becomes the new tail
+        const float *segment = m_input.data() + start;
+        for (size_t i = 0; i < m_hop; ++i) {
+            out[produced + i] = m_overlap[i] + m_hann[i] * segment[i];
+            m_overlap[i] = m_hann[m_hop + i] * segment[m_hop + i];
+        }
+        produced += m_hop;
+
+        m_natural = start + m_hop;
+        m_nominal = m_rate == 1.0f ? double(m_natural) : m_nominal + double(m_hop) * m_rate;
+    }
+
+    // Drop the input no future segment can start in
+    const size_t nominal = size_t(m_nominal);
+    const size_t keepFrom = std::min(m_natural, nominal > m_tolerance ? nominal - m_tolerance : 0);
+    if (keepFrom > 0) {
+        std::memmove(m_input.data(), m_input.data() + keepFrom, (m_inputCount - keepFrom) * sizeof(float));
+        m_inputCount -= keepFrom;
+        m_natural -= keepFrom;
+        m_nominal -= double(keepFrom);
+    }
+    return produced;
+}
@@ -0,0 +1,63 @@
+#ifndef TIMESTRETCHER_H
+#define TIMESTRETCHER_H
+
+#include <cstddef>
+#include <vector>
+#include "simd.h"
+
+// WSOLA (waveform similarity overlap-add) time-scale modification for mono
+// float audio. Output is built from Hann-windowed segments overlapping by
+// half; each segment is taken from around its nominal position in the input
+// (which advances by rate times the output hop), at the offset whose start
+// best matches the natural continuation of the previous segment. Matching
+// whole waveforms keeps the pitch and avoids phasing, so speech can be played
+// a few percent faster or slower without audible artifacts.
+//
+// At rate 1 the segments follow the input exactly and the output is the input
+// delayed by half a window. The similarity search is a normalised cross
+// correlation done with the SIMD dot product, coarse then fine. Buffers are
+// sized for maxInput samples per call up front, so process() never allocates.
+class TimeStretcher
+{
+public:
+    // Slowest and fastest rates process() accepts
+    static constexpr float MinRate = 0.5f;
+    static constexpr float MaxRate = 2.0f;
+
+    TimeStretcher(int sampleRate, size_t maxInput, const Simd::Kernels &kernels = Simd::kernels(),
+                  int windowMs = 20, int toleranceMs = 5);
+
+    // Input consumed per output sample: above 1 plays faster (shrinks the
+    // delay), below 1 slower. Takes effect from the next segment.
+    void setRate(float rate);
+    float rate() const { return m_rate; }
+
+    // Most samples process() can return for count input samples
+    size_t maxOutput(size_t count) const;
+    // Appends up to maxInput samples and writes every output segment that is
+    // complete; returns the number of samples written to out
+    size_t process(const float *in, size_t count, float *out);
+    void reset();
+
+    // Output samples the stretcher holds back, at rate 1
+    size_t latency() const { return m_hop; }
+
+private:
+    size_t bestOffset(size_t low, size_t high, size_t step) const;
+
+    const Simd::Kernels &m_kernels;
+    size_t               m_window;     // segment length
+    size_t               m_hop;        // output hop, half a window
+    size_t               m_tolerance;  // search range either side of the nominal position
+    size_t               m_maxInput;
+    float                m_rate = 1.0f;
+
+    std::vector<float>   m_hann;       // m_window coefficients, summing to 1 at half overlap
+    std::vector<float>   m_input;      // unconsumed input, starting at sample 0
+    size_t               m_inputCount = 0;
+    double               m_nominal = 0.0;  // where the next segment would start without search
+    size_t               m_natural = 0;    // continuation of the previous segment
+    std::vector<float>   m_overlap;    // windowed second half of the previous segment
+};
+
+#endif // TIMESTRETCHER_H
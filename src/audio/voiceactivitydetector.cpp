@@ -0,0 +1,68 @@
+#include "voiceactivitydetector.h"
+#include <algorithm>
+#include <cmath>
+
+// Frames quieter than this are never speech, whatever the noise floor is
+static constexpr float MinSpeechLevel = -55.0f;
+// The noise floor follows quieter frames quickly and louder frames slowly, so
+// it settles on the background level without climbing up during speech
+static constexpr float FloorAttack = 0.3f;
+static constexpr float FloorRelease = 0.005f;
+
+void VoiceActivityDetector::reset()
+{
+    m_noiseFloor = -60.0f;
+    m_lastLevel = -96.0f;
+    m_hangoverLeftMs = 0;
+    m_initialised = false;
+}
+
+bool VoiceActivityDetector::process(const int16_t *samples, size_t count, int frameMs)
+{
+    if (count == 0)
+        return m_hangoverLeftMs > 0;
+
+    double energy = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        energy += double(samples[i]) * samples[i];
+
+    // Frame level in dB relative to full scale
+    const double meanSquare = energy / count / (32768.0 * 32768.0);
+    m_lastLevel = float(10.0 * std::log10(std::max(meanSquare, 1e-10)));
+
+    if (!m_initialised) {
+        m_noiseFloor = m_lastLevel;
+        m_initialised = true;
+    }
+
+    const float rate = m_lastLevel < m_noiseFloor ? FloorAttack : FloorRelease;
+    m_noiseFloor += rate * (m_lastLevel - m_noiseFloor);
+
+    const bool active = m_lastLevel > MinSpeechLevel && m_lastLevel > m_noiseFloor + m_threshold;
+    if (active)
+        m_hangoverLeftMs = m_hangoverMs;
+    else
+        m_hangoverLeftMs = std::max(0, m_hangoverLeftMs - frameMs);
+
+    return active || m_hangoverLeftMs > 0;
+}
+
+void VoiceActivityDetector::setThreshold(float decibels)
+{
+    m_threshold = decibels;
+}
+
+void VoiceActivityDetector::setHangover(int milliseconds)
+{
+    m_hangoverMs = std::max(0, milliseconds);
+}
+
+float VoiceActivityDetector::noiseFloor() const
+{
+    return m_noiseFloor;
+}
+
+float VoiceActivityDetector::lastLevel() const
+{
+    return m_lastLevel;
+}
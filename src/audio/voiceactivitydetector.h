@@ -0,0 +1,37 @@
+#ifndef VOICEACTIVITYDETECTOR_H
+#define VOICEACTIVITYDETECTOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Energy based voice activity detector. It tracks the background noise floor
+// and reports speech while the frame energy is clearly above it, holding the
+// decision for a short hangover so word endings and short pauses aren't cut.
+class VoiceActivityDetector
+{
+public:
+    VoiceActivityDetector() = default;
+
+    void reset();
+
+    // Returns true if the frame (frameMs long) should be treated as speech
+    bool process(const int16_t *samples, size_t count, int frameMs);
+
+    // How far above the noise floor (in dB) a frame has to be to count as speech
+    void setThreshold(float decibels);
+    // How long speech is still reported after the last active frame
+    void setHangover(int milliseconds);
+
+    float noiseFloor() const;
+    float lastLevel() const;
+
+private:
+    float m_threshold = 9.0f;
+    int   m_hangoverMs = 200;
+    float m_noiseFloor = -60.0f;
+    float m_lastLevel = -96.0f;
+    int   m_hangoverLeftMs = 0;
+    bool  m_initialised = false;
+};
+
+#endif // VOICEACTIVITYDETECTOR_H
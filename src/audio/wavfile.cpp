@@ -0,0 +1,89 @@
+#include "wavfile.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+
+bool WavFile::read(const QString &path, std::vector<int16_t> &samples, int &sampleRate)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << path;
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    char riff[4], wave[4];
+    quint32 riffSize;
+    stream.readRawData(riff, 4);
+    stream >> riffSize;
+    stream.readRawData(wave, 4);
+    if (qstrncmp(riff, "RIFF", 4) != 0 || qstrncmp(wave, "WAVE", 4) != 0) {
+        qWarning() << path << "is not a WAV file";
+        return false;
+    }
+
+    quint16 format = 0, channels = 0, bitsPerSample = 0;
+    quint32 rate = 0;
+    // Walk the chunks until the samples; anything else (LIST, fact, ...) is skipped
+    while (!stream.atEnd()) {
+        char id[4];
+        quint32 size;
+        stream.readRawData(id, 4);
+        stream >> size;
+
+        if (qstrncmp(id, "fmt ", 4) == 0) {
+            quint32 byteRate;
+            quint16 blockAlign;
+            stream >> format >> channels >> rate >> byteRate >> blockAlign >> bitsPerSample;
+            stream.skipRawData(size - 16);
+        } else if (qstrncmp(id, "data", 4) == 0) {
+            if (format != 1 || bitsPerSample != 16 || channels == 0) {
+                qWarning() << path << "is not 16-bit PCM";
+                return false;
+            }
+            const quint32 frames = size / (2 * channels);
+            samples.resize(frames);
+            for (quint32 i = 0; i < frames; ++i) {
+                qint16 sample;
+                stream >> sample;
+                samples[i] = sample;
+                stream.skipRawData(2 * (channels - 1));
+            }
+            sampleRate = int(rate);
+            return stream.status() == QDataStream::Ok;
+        } else {
+            stream.skipRawData(size + (size & 1));
+        }
+    }
+
+    qWarning() << path << "has no data chunk";
+    return false;
+}
+
+bool WavFile::write(const QString &path, const std::vector<int16_t> &samples, int sampleRate)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to create" << path;
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setByteOrder(QDataStream::LittleEndian);
+
+    const quint32 dataSize = quint32(samples.size() * 2);
+    stream.writeRawData("RIFF", 4);
+    stream << quint32(36 + dataSize);
+    stream.writeRawData("WAVE", 4);
+    stream.writeRawData("fmt ", 4);
+    stream << quint32(16) << quint16(1) << quint16(1) << quint32(sampleRate)
+           << quint32(sampleRate * 2) << quint16(2) << quint16(16);
+    stream.writeRawData("data", 4);
+    stream << dataSize;
+    for (int16_t sample : samples)
+        stream << qint16(sample);
+
+    return stream.status() == QDataStream::Ok;
+}
@@ -0,0 +1,19 @@
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+// Minimal reader/writer for 16-bit PCM WAV files, used by the offline tools
+// to feed recorded audio through the processing stages
+class WavFile
+{
+public:
+    // Reads the first channel of a 16-bit PCM file
+    static bool read(const QString &path, std::vector<int16_t> &samples, int &sampleRate);
+    // Writes mono 16-bit PCM
+    static bool write(const QString &path, const std::vector<int16_t> &samples, int sampleRate);
+};
+
+#endif // WAVFILE_H
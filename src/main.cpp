@@ -5,8 +5,15 @@
 #include "audio/audiooutput.h"
 #include "network/client.h"
 #include "network/webrtc.h"
+#include "tools/tools.h"
 int main(int argc, char *argv[])
 {
+    // Benchmarks and offline tools run headless and exit without the UI
+    if (Tools::isToolInvocation(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return Tools::run(app);
+    }
+
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
     QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
 #endif
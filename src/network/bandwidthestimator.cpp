@@ -0,0 +1,279 @@
+#include "bandwidthestimator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Bandwidth {
+
+// Timestamps are on the 48 kHz Opus RTP clock
+static constexpr double TicksPerMs = 48.0;
+// Weight of the previous value in the smoothed accumulated delay
+static constexpr double Smoothing = 0.9;
+// Scales the trendline slope before it is compared to the threshold
+static constexpr double TrendGain = 4.0;
+static constexpr size_t MaxDeltas = 60;
+// The threshold follows the trend so that noise alone doesn't trip it
+static constexpr double ThresholdUp = 0.0087;
+static constexpr double ThresholdDown = 0.039;
+static constexpr double MinThreshold = 6.0;
+static constexpr double MaxThreshold = 600.0;
+// The trend has to stay above the threshold this long to count as over-use
+static constexpr double OveruseMs = 10.0;
+// A gap this long (silence, a stall) starts the delay tracking over
+static constexpr int32_t MaxGapTicks = 24000;
+static constexpr int64_t BucketUs = 100000;
+static constexpr int64_t DecreaseIntervalUs = 300000;
+static constexpr double Backoff = 0.85;
+static constexpr double IncreasePerSecond = 1.08;
+// Close to the rate of the last cut, where the path ran full before, the
+// estimate only creeps up
+static constexpr double NearLastCut = 0.9;
+static constexpr int64_t AdditiveBpsPerSecond = 4000;
+// An REMB nobody renewed for this long no longer caps the rate
+static constexpr int64_t RembTimeoutUs = 5000000;
+// Opus' lowest useful bitrate
+static constexpr int MinOpusBitrate = 6000;
+
+void DelayEstimator::onPacket(uint32_t timestamp, size_t payloadSize, int64_t nowUs)
+{
+    updateRate(payloadSize + PacketOverhead, nowUs);
+    if (!m_started) {
+        m_started = true;
+        m_firstArrivalUs = nowUs;
+        m_lastControlUs = nowUs;
+        m_lastTimestamp = timestamp;
+        m_lastArrivalUs = nowUs;
+        return;
+    }
+
+    const int32_t ticks = int32_t(timestamp - m_lastTimestamp);
+    if (ticks <= 0)
+        return; // reordered or retransmitted, no gradient to take
+    const double arrivalMs = double(nowUs - m_lastArrivalUs) / 1000.0;
+    m_lastTimestamp = timestamp;
+    m_lastArrivalUs = nowUs;
+    if (ticks > MaxGapTicks) {
+        m_accumulatedMs = 0.0;
+        m_smoothedMs = 0.0;
+        m_trendCount = 0;
+        m_deltas = 0;
+        control(nowUs);
+        return;
+    }
+
+    // How much later than its predecessor the packet arrived, compared with
+    // how much later it was sent
+    m_accumulatedMs += arrivalMs - double(ticks) / TicksPerMs;
+    m_smoothedMs = Smoothing * m_smoothedMs + (1.0 - Smoothing) * m_accumulatedMs;
+    m_trend[m_trendNext] = {double(nowUs - m_firstArrivalUs) / 1000.0, m_smoothedMs};
+    m_trendNext = (m_trendNext + 1) % TrendWindow;
+    m_trendCount = std::min(m_trendCount + 1, TrendWindow);
+    m_deltas = std::min(m_deltas + 1, MaxDeltas);
+    if (m_trendCount == TrendWindow)
+        detect(trendSlope() * double(m_deltas) * TrendGain, arrivalMs);
+    control(nowUs);
+}
+
+// Least-squares slope of the smoothed delay over arrival time
+double DelayEstimator::trendSlope() const
+{
+    double meanX = 0.0, meanY = 0.0;
+    for (const auto &point : m_trend) {
+        meanX += point[0];
+        meanY += point[1];
+    }
+    meanX /= TrendWindow;
+    meanY /= TrendWindow;
+    double numerator = 0.0, denominator = 0.0;
+    for (const auto &point : m_trend) {
+        numerator += (point[0] - meanX) * (point[1] - meanY);
+        denominator += (point[0] - meanX) * (point[0] - meanX);
+    }
+    return denominator > 0.0 ? numerator / denominator : 0.0;
+}
+
+void DelayEstimator::detect(double trend, double elapsedMs)
+{
+    if (trend > m_threshold) {
+        m_overuseMs += elapsedMs;
+        if (m_overuseMs > OveruseMs && trend >= m_previousTrend) {
+            m_usage = Usage::Overusing;
+            m_overuseMs = 0.0;
+        }
+    } else if (trend < -m_threshold) {
+        m_usage = Usage::Underusing;
+        m_overuseMs = 0.0;
+    } else {
+        m_usage = Usage::Normal;
+        m_overuseMs = 0.0;
+    }
+    m_previousTrend = trend;
+
+    // Spikes far above the threshold (a stall) don't drag it along
+    const double magnitude = std::abs(trend);
+    if (magnitude < m_threshold + 15.0) {
+        const double gain = magnitude < m_threshold ? ThresholdDown : ThresholdUp;
+        m_threshold += gain * (magnitude - m_threshold) * std::min(elapsedMs, 100.0);
+        m_threshold = std::clamp(m_threshold, MinThreshold, MaxThreshold);
+    }
+}
+
+void DelayEstimator::control(int64_t nowUs)
+{
+    const double elapsed = double(std::min<int64_t>(nowUs - m_lastControlUs, 1000000)) / 1e6;
+    m_lastControlUs = nowUs;
+    if (nowUs - m_firstArrivalUs < int64_t(RateBuckets) * BucketUs)
+        return;
+
+    const int64_t incoming = m_incomingBps.load(std::memory_order_relaxed);
+    const int64_t previous = m_estimateBps.load(std::memory_order_relaxed);
+    // Starts out of the way, at the cap
+    int64_t estimate = previous > 0 ? previous : incoming * 3 / 2 + 10000;
+    switch (m_usage) {
+    case Usage::Overusing:
+        if (nowUs - m_lastDecreaseUs >= DecreaseIntervalUs) {
+            estimate = std::min(estimate, int64_t(Backoff * double(incoming)));
+            m_lastCutBps = incoming;
+            m_lastDecreaseUs = nowUs;
+            m_decreased = true;
+        }
+        break;
+    case Usage::Underusing:
+        // Queues are draining; hold until they are empty
+        break;
+    case Usage::Normal:
+        if (nowUs - m_lastDecreaseUs < DecreaseIntervalUs)
+            break;
+        if (m_lastCutBps > 0 && double(estimate) >= NearLastCut * double(m_lastCutBps)
+            && double(estimate) <= double(m_lastCutBps) / NearLastCut)
+            estimate += int64_t(double(AdditiveBpsPerSecond) * elapsed);
+        else
+            estimate = int64_t(double(estimate) * std::pow(IncreasePerSecond, elapsed));
+        break;
+    }
+    // Growth is limited by what actually arrives, but a quiet sender (DTX)
+    // doesn't pull the estimate down
+    const int64_t cap = incoming * 3 / 2 + 10000;
+    if (estimate > cap)
+        estimate = std::max(cap, std::min(previous, estimate));
+    m_estimateBps.store(std::max(estimate, MinBps), std::memory_order_relaxed);
+}
+
+void DelayEstimator::updateRate(size_t bytes, int64_t nowUs)
+{
+    const int64_t bucket = nowUs / BucketUs;
+    if (m_bucketIndex < 0)
+        m_bucketIndex = bucket;
+    for (int64_t i = m_bucketIndex + 1; i <= bucket && i <= m_bucketIndex + int64_t(RateBuckets); ++i)
+        m_buckets[size_t(i % int64_t(RateBuckets))] = 0;
+    m_bucketIndex = std::max(m_bucketIndex, bucket);
+    m_buckets[size_t(m_bucketIndex % int64_t(RateBuckets))] += int64_t(bytes);
+
+    int64_t total = 0;
+    for (int64_t value : m_buckets)
+        total += value;
+    m_incomingBps.store(total * 8 * 1000000 / (int64_t(RateBuckets) * BucketUs), std::memory_order_relaxed);
+}
+
+bool DelayEstimator::takeDecrease()
+{
+    const bool decreased = m_decreased;
+    m_decreased = false;
+    return decreased;
+}
+
+void DelayEstimator::reset()
+{
+    m_started = false;
+    m_accumulatedMs = 0.0;
+    m_smoothedMs = 0.0;
+    m_trendCount = 0;
+    m_trendNext = 0;
+    m_deltas = 0;
+    m_threshold = 12.5;
+    m_previousTrend = 0.0;
+    m_overuseMs = 0.0;
+    m_usage = Usage::Normal;
+    m_buckets.fill(0);
+    m_bucketIndex = -1;
+    m_lastDecreaseUs = 0;
+    m_lastCutBps = 0;
+    m_decreased = false;
+    m_estimateBps.store(0, std::memory_order_relaxed);
+    m_incomingBps.store(0, std::memory_order_relaxed);
+}
+
+Estimator::Estimator(int64_t startBps, int64_t maxBps)
+    : m_maxBps(std::max(maxBps, MinBps)),
+    m_lossBasedBps(std::clamp(startBps, MinBps, m_maxBps))
+{
+}
+
+void Estimator::setMaxBps(int64_t bps)
+{
+    m_maxBps = std::max(bps, MinBps);
+    m_lossBasedBps = std::min(m_lossBasedBps, m_maxBps);
+}
+
+void Estimator::onReport(float fractionLost, int64_t nowUs)
+{
+    m_loss += 0.5f * (fractionLost - m_loss);
+    // Works from the rate actually in use, so a long spell under the REMB
+    // cap doesn't leave a loss-based rate far above it
+    const int64_t current = targetBps(nowUs);
+    if (fractionLost < 0.02f)
+        m_lossBasedBps = std::max(m_lossBasedBps, int64_t(double(current) * IncreasePerSecond) + 1000);
+    else if (fractionLost > 0.1f)
+        m_lossBasedBps = int64_t(double(current) * (1.0 - 0.5 * fractionLost));
+    else
+        m_lossBasedBps = current;
+    m_lossBasedBps = std::clamp(m_lossBasedBps, MinBps, m_maxBps);
+}
+
+void Estimator::onRemb(int64_t bps, int64_t nowUs)
+{
+    m_rembBps = bps;
+    m_rembUs = nowUs;
+}
+
+int64_t Estimator::targetBps(int64_t nowUs) const
+{
+    int64_t target = m_lossBasedBps;
+    if (m_rembBps > 0 && nowUs - m_rembUs < RembTimeoutUs)
+        target = std::min(target, m_rembBps);
+    return std::clamp(target, MinBps, m_maxBps);
+}
+
+// Headers of a packet every frameMs, in bits per second
+static int64_t overheadBps(int frameMs)
+{
+    return int64_t(PacketOverhead) * 8 * 1000 / frameMs;
+}
+
+EncoderTarget EncoderController::update(int64_t sendBps, float lossFraction, int maxBitrate)
+{
+    // 20 ms frames while half the rate is left for the payload after the
+    // headers, 40 ms while 16 kbps are; shorter frames again only 15% above
+    // that
+    const double shrinkMargin = 1.15;
+    const double rate = double(sendBps);
+    if (rate >= 40000.0 * (m_frameMs > 20 ? shrinkMargin : 1.0))
+        m_frameMs = 20;
+    else if (rate >= 26000.0 * (m_frameMs > 40 ? shrinkMargin : 1.0))
+        m_frameMs = 40;
+    else
+        m_frameMs = 60;
+
+    EncoderTarget target;
+    target.frameMs = m_frameMs;
+    target.bitrate = int(std::clamp<int64_t>(sendBps - overheadBps(m_frameMs), MinOpusBitrate,
+                                             std::max(maxBitrate, MinOpusBitrate)));
+    // LBRR takes its share of the bitrate, so below 12 kbps it costs more
+    // than it saves
+    if (lossFraction >= 0.01f && target.bitrate >= 12000) {
+        target.inbandFec = true;
+        target.packetLossPercent = std::clamp(int(std::ceil(lossFraction * 100.0f)), 1, 30);
+    }
+    return target;
+}
+
+} // namespace Bandwidth
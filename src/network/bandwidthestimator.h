@@ -0,0 +1,130 @@
+#ifndef BANDWIDTHESTIMATOR_H
+#define BANDWIDTHESTIMATOR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Congestion control for the outgoing audio, after Google Congestion Control
+// (draft-ietf-rmcat-gcc). The receiver watches the one-way delay gradient of
+// the packets it gets and reports the rate the path can take in REMB
+// messages; the sender combines that with the loss in its receiver reports
+// and maps the result onto the Opus bitrate, frame size and FEC. Rates are
+// on the wire: every packet counts with PacketOverhead bytes of RTP, SRTP,
+// UDP and IPv4 headers on top of its payload.
+namespace Bandwidth {
+
+static constexpr size_t PacketOverhead = 12 + 10 + 8 + 20;
+static constexpr int64_t MinBps = 12000;
+
+// Receiver side. A trendline fitted to the accumulated delay variation tells
+// whether queues on the path are growing (over-use), draining (under-use) or
+// steady; over-use cuts the estimate to 85% of the incoming rate, steady
+// delay lets it grow again by 8% a second, up to 1.5 times what arrives.
+// onPacket() and takeDecrease() are called from the track's media thread;
+// the estimate can be read from any thread.
+class DelayEstimator
+{
+public:
+    enum class Usage { Normal, Overusing, Underusing };
+
+    // For every received RTP packet: its RTP timestamp (48 kHz) and payload size
+    void onPacket(uint32_t timestamp, size_t payloadSize, int64_t nowUs);
+    // Rate the sender should stay under, 0 until a second of packets arrived
+    int64_t estimateBps() const { return m_estimateBps.load(std::memory_order_relaxed); }
+    int64_t incomingBps() const { return m_incomingBps.load(std::memory_order_relaxed); }
+    Usage usage() const { return m_usage; }
+    // True once after each cut, so a REMB can go out right away
+    bool takeDecrease();
+    void reset();
+
+private:
+    static constexpr size_t TrendWindow = 20;
+    static constexpr size_t RateBuckets = 10;
+
+    void updateRate(size_t bytes, int64_t nowUs);
+    double trendSlope() const;
+    void detect(double trend, double elapsedMs);
+    void control(int64_t nowUs);
+
+    // Delay variation, only touched by the media thread
+    bool                                   m_started = false;
+    uint32_t                               m_lastTimestamp = 0;
+    int64_t                                m_lastArrivalUs = 0;
+    int64_t                                m_firstArrivalUs = 0;
+    double                                 m_accumulatedMs = 0.0;
+    double                                 m_smoothedMs = 0.0;
+    std::array<std::array<double, 2>, TrendWindow> m_trend{};  // arrival ms, smoothed delay ms
+    size_t                                 m_trendCount = 0;
+    size_t                                 m_trendNext = 0;
+    size_t                                 m_deltas = 0;
+    double                                 m_threshold = 12.5;
+    double                                 m_previousTrend = 0.0;
+    double                                 m_overuseMs = 0.0;
+    Usage                                  m_usage = Usage::Normal;
+
+    // Incoming rate over the last second, in 100 ms buckets
+    std::array<int64_t, RateBuckets>       m_buckets{};
+    int64_t                                m_bucketIndex = -1;
+
+    int64_t                                m_lastControlUs = 0;
+    int64_t                                m_lastDecreaseUs = 0;
+    int64_t                                m_lastCutBps = 0;
+    bool                                   m_decreased = false;
+    std::atomic<int64_t>                   m_estimateBps{0};
+    std::atomic<int64_t>                   m_incomingBps{0};
+};
+
+// Sender side: the loss-based rate (grows 8% per report below 2% loss, cut
+// by half the loss above 10%) capped by the receiver's REMB. Not
+// thread-safe; the owner serialises calls.
+class Estimator
+{
+public:
+    Estimator(int64_t startBps, int64_t maxBps);
+
+    void setMaxBps(int64_t bps);
+    // A receiver report block on our stream
+    void onReport(float fractionLost, int64_t nowUs);
+    void onRemb(int64_t bps, int64_t nowUs);
+
+    int64_t targetBps(int64_t nowUs) const;
+    int64_t lossBasedBps() const { return m_lossBasedBps; }
+    // Reported loss, smoothed over a few reports
+    float lossFraction() const { return m_loss; }
+
+private:
+    int64_t m_maxBps;
+    int64_t m_lossBasedBps;
+    int64_t m_rembBps = 0;
+    int64_t m_rembUs = 0;
+    float   m_loss = 0.0f;
+};
+
+// What the encoder should do to send at a given rate
+struct EncoderTarget {
+    int  bitrate = 0;
+    int  frameMs = 20;
+    bool inbandFec = false;
+    int  packetLossPercent = 0;
+};
+
+// Maps a send rate onto Opus settings. Short frames cost a header per 20 ms,
+// which eats most of a low rate, so the frame grows to 40 and 60 ms as the
+// rate drops and only shrinks again with some margin. In-band FEC is turned
+// on, tuned to the reported loss, once there is loss and room for it.
+class EncoderController
+{
+public:
+    // maxBitrate is the Opus bitrate never to exceed
+    EncoderTarget update(int64_t sendBps, float lossFraction, int maxBitrate);
+    int frameMs() const { return m_frameMs; }
+
+private:
+    int m_frameMs = 20;
+};
+
+} // namespace Bandwidth
+
+#endif // BANDWIDTHESTIMATOR_H
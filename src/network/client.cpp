@@ -6,6 +6,11 @@
 #include <QJsonDocument>
 
 Client::Client(QObject *parent)
+    : Client(QString::fromLatin1(DefaultServerUrl), parent)
+{
+}
+
+Client::Client(const QString &serverUrl, QObject *parent)
     : QObject(parent)
 {
 
@@ -54,7 +59,7 @@ Client::Client(QObject *parent)
                         }));
 
     //client.connect("http://127.0.0.1:3000");
-    client.connect("http://74.234.202.9:3000");
+    client.connect(serverUrl.toStdString());
 }
 
 void Client::sendOffer(const QString &id, const QString &sdp)
@@ -11,6 +11,10 @@ class Client : public QObject
 
 public:
     explicit Client(QObject *parent = nullptr);
+    // Connects to another signalling server, e.g. from the headless SFU
+    explicit Client(const QString &serverUrl, QObject *parent = nullptr);
+
+    static constexpr const char *DefaultServerUrl = "http://74.234.202.9:3000";
 
     QString mySocketId() const { return m_mySocketId; }
     QString newSdp() const { return m_newSdp; }
@@ -0,0 +1,228 @@
+#include "nack.h"
+
+namespace Nack {
+
+// Timestamps are on the 48 kHz Opus RTP clock
+static constexpr int64_t ClockRate = 48000;
+// Round trip assumed until RTCP measured one; high enough that nothing is
+// requested on a path where it wouldn't pay off
+static constexpr int64_t DefaultRttUs = 100000;
+// Retransmissions are spaced a little more than a round trip apart, so a
+// repeat only goes out once the previous answer should have arrived
+static constexpr double RetryFactor = 1.5;
+// Sequence numbers one FCI entry covers: the PID and 16 in the bitmask
+static constexpr uint16_t EntrySpan = 17;
+
+static uint16_t readBigEndian16(const uint8_t *in)
+{
+    return uint16_t((in[0] << 8) | in[1]);
+}
+
+static uint32_t readBigEndian32(const uint8_t *in)
+{
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+static void writeBigEndian16(uint8_t *out, uint16_t value)
+{
+    out[0] = uint8_t(value >> 8);
+    out[1] = uint8_t(value);
+}
+
+static void writeBigEndian32(uint8_t *out, uint32_t value)
+{
+    out[0] = uint8_t(value >> 24);
+    out[1] = uint8_t(value >> 16);
+    out[2] = uint8_t(value >> 8);
+    out[3] = uint8_t(value);
+}
+
+size_t write(uint32_t senderSsrc, uint32_t mediaSsrc, const uint16_t *sequenceNumbers, size_t count,
+             uint8_t *out, size_t capacity)
+{
+    size_t size = HeaderSize;
+    size_t i = 0;
+    while (i < count && size + 4 <= capacity) {
+        const uint16_t pid = sequenceNumbers[i++];
+        uint16_t mask = 0;
+        for (; i < count; ++i) {
+            const uint16_t distance = uint16_t(sequenceNumbers[i] - pid);
+            if (distance == 0 || distance >= EntrySpan)
+                break;
+            mask = uint16_t(mask | (1u << (distance - 1)));
+        }
+        writeBigEndian16(out + size, pid);
+        writeBigEndian16(out + size + 2, mask);
+        size += 4;
+    }
+    if (size == HeaderSize)
+        return 0;
+
+    out[0] = uint8_t(0x80 | Format);
+    out[1] = PayloadType;
+    writeBigEndian16(out + 2, uint16_t(size / 4 - 1));
+    writeBigEndian32(out + 4, senderSsrc);
+    writeBigEndian32(out + 8, mediaSsrc);
+    return size;
+}
+
+size_t parse(const uint8_t *data, size_t size, uint32_t mediaSsrc, uint16_t *out, size_t capacity)
+{
+    size_t count = 0;
+    while (size >= 4) {
+        if ((data[0] >> 6) != 2)
+            break;
+        const size_t length = (size_t(readBigEndian16(data + 2)) + 1) * 4;
+        if (length > size)
+            break;
+
+        if (data[1] == PayloadType && (data[0] & 0x1F) == Format && length >= HeaderSize
+            && readBigEndian32(data + 8) == mediaSsrc) {
+            for (size_t offset = HeaderSize; offset + 4 <= length; offset += 4) {
+                const uint16_t pid = readBigEndian16(data + offset);
+                const uint16_t mask = readBigEndian16(data + offset + 2);
+                for (uint16_t bit = 0; bit < EntrySpan; ++bit) {
+                    const bool lost = bit == 0 || (mask & (1u << (bit - 1))) != 0;
+                    if (lost && count < capacity)
+                        out[count++] = uint16_t(pid + bit);
+                }
+            }
+        }
+
+        data += length;
+        size -= length;
+    }
+    return count;
+}
+
+void History::store(uint16_t sequenceNumber, const MediaFrame &packet, const MediaFrame &redPacket, int64_t nowUs)
+{
+    Entry &entry = m_entries[sequenceNumber % Capacity];
+    entry.packet = packet;
+    entry.redPacket = redPacket;
+    entry.sequenceNumber = sequenceNumber;
+    entry.sentUs = nowUs;
+}
+
+MediaFrame History::find(uint16_t sequenceNumber, bool red, int64_t nowUs) const
+{
+    const Entry &entry = m_entries[sequenceNumber % Capacity];
+    if (entry.sequenceNumber != sequenceNumber || nowUs - entry.sentUs > MaxAgeUs)
+        return MediaFrame();
+    return red && !entry.redPacket.isNull() ? entry.redPacket : entry.packet;
+}
+
+void History::reset()
+{
+    for (Entry &entry : m_entries)
+        entry = Entry();
+}
+
+bool Tracker::onReceived(uint16_t sequenceNumber, uint32_t timestamp, int64_t nowUs)
+{
+    if (!m_started) {
+        m_started = true;
+        m_newestSequence = sequenceNumber;
+        m_newestTimestamp = timestamp;
+        return false;
+    }
+
+    const int16_t delta = int16_t(sequenceNumber - m_newestSequence);
+    if (delta <= 0) {
+        // Reordered, retransmitted or duplicated
+        const int index = find(sequenceNumber);
+        if (index < 0)
+            return false;
+        const bool requested = m_missing[size_t(index)].requests > 0;
+        remove(size_t(index));
+        return requested;
+    }
+
+    const uint32_t elapsed = timestamp - m_newestTimestamp;
+    if (delta == 1 && elapsed > 0 && elapsed <= uint32_t(ClockRate / 10))
+        m_timestampStep = elapsed;
+
+    // The packets in between should have arrived one step apart before this one
+    const int64_t stepUs = int64_t(m_timestampStep) * 1000000 / ClockRate;
+    const int gap = delta - 1;
+    for (int i = gap > int(MaxMissing) ? gap - int(MaxMissing) : 0; i < gap; ++i) {
+        if (m_missingCount == MaxMissing) {
+            m_expired.fetch_add(1, std::memory_order_relaxed);
+            remove(0);
+        }
+        Missing &missing = m_missing[m_missingCount++];
+        missing.sequenceNumber = uint16_t(m_newestSequence + 1 + i);
+        missing.expectedUs = nowUs - int64_t(gap - i) * stepUs;
+        missing.requestedUs = 0;
+        missing.requests = 0;
+    }
+    m_newestSequence = sequenceNumber;
+    m_newestTimestamp = timestamp;
+    return false;
+}
+
+void Tracker::onRepaired(uint16_t sequenceNumber)
+{
+    const int index = find(sequenceNumber);
+    if (index >= 0)
+        remove(size_t(index));
+}
+
+size_t Tracker::due(int64_t nowUs, double rttMs, uint16_t *out, size_t capacity)
+{
+    const int64_t playoutDelayUs = int64_t(m_playoutDelayMs.load(std::memory_order_relaxed)) * 1000;
+    if (playoutDelayUs <= 0) {
+        m_missingCount = 0;
+        return 0;
+    }
+    const int64_t rttUs = rttMs >= 0.0 ? int64_t(rttMs * 1000.0) : DefaultRttUs;
+
+    size_t count = 0;
+    size_t i = 0;
+    while (i < m_missingCount) {
+        Missing &missing = m_missing[i];
+        if (nowUs + rttUs > missing.expectedUs + playoutDelayUs) {
+            // An answer would come after the packet's turn
+            m_expired.fetch_add(1, std::memory_order_relaxed);
+            remove(i);
+            continue;
+        }
+        const bool repeat = missing.requests > 0
+            && nowUs - missing.requestedUs >= int64_t(double(rttUs) * RetryFactor);
+        if ((missing.requests == 0 || repeat) && missing.requests < MaxRequests && count < capacity) {
+            out[count++] = missing.sequenceNumber;
+            missing.requests++;
+            missing.requestedUs = nowUs;
+            m_requested.fetch_add(1, std::memory_order_relaxed);
+        }
+        ++i;
+    }
+    return count;
+}
+
+int Tracker::find(uint16_t sequenceNumber) const
+{
+    for (size_t i = 0; i < m_missingCount; ++i) {
+        if (m_missing[i].sequenceNumber == sequenceNumber)
+            return int(i);
+    }
+    return -1;
+}
+
+void Tracker::remove(size_t index)
+{
+    for (size_t i = index + 1; i < m_missingCount; ++i)
+        m_missing[i - 1] = m_missing[i];
+    --m_missingCount;
+}
+
+Tracker::Stats Tracker::stats() const
+{
+    Stats result;
+    result.requested = m_requested.load(std::memory_order_relaxed);
+    result.recovered = m_recovered.load(std::memory_order_relaxed);
+    result.expired = m_expired.load(std::memory_order_relaxed);
+    return result;
+}
+
+} // namespace Nack
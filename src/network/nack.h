@@ -0,0 +1,130 @@
+#ifndef NACK_H
+#define NACK_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "src/audio/framepool.h"
+
+// Selective retransmission with generic NACK feedback (RFC 4585 section
+// 6.2.1). The receiver tells the sender which sequence numbers it misses,
+// and the sender sends those packets again, unchanged, on the original SSRC
+// and sequence number, so the jitter buffer slots them in like a late
+// packet. Worth it where the round trip is shorter than the jitter buffer
+// delay, which is the common case on a LAN or within a region.
+//
+//   V=2 | P | FMT=1 (5) | PT=205 (8) | length in 32-bit words - 1 (16)
+//   SSRC of the packet sender
+//   SSRC of the media source
+//   PID (16) | BLP (16), once per 17 sequence numbers: PID is lost, and bit
+//   i of BLP set means PID + i + 1 is lost too
+namespace Nack {
+
+static constexpr uint8_t PayloadType = 205;
+static constexpr uint8_t Format = 1;
+static constexpr size_t HeaderSize = 12;
+
+// Writes a NACK for the sequence numbers (ascending) and returns its size,
+// or 0 if there are none or not even one entry fits
+size_t write(uint32_t senderSsrc, uint32_t mediaSsrc, const uint16_t *sequenceNumbers, size_t count,
+             uint8_t *out, size_t capacity);
+// Collects the sequence numbers requested for the media SSRC by the NACKs
+// in a compound RTCP packet; returns how many were written to out
+size_t parse(const uint8_t *data, size_t size, uint32_t mediaSsrc, uint16_t *out, size_t capacity);
+
+// Sender side: the packets sent recently, in a ring indexed by sequence
+// number. Holding a pooled frame only keeps a reference, nothing is copied.
+// Not thread-safe; the owner serialises calls.
+class History
+{
+public:
+    // 1.28 s of 20 ms packets, longer than any jitter buffer waits for one
+    static constexpr size_t Capacity = 64;
+    // Older packets are not sent again even if still held
+    static constexpr int64_t MaxAgeUs = 1000000;
+
+    // The packet sent with the sequence number and, for peers that
+    // negotiated RED, its RED alternative (may be null)
+    void store(uint16_t sequenceNumber, const MediaFrame &packet, const MediaFrame &redPacket, int64_t nowUs);
+    // The packet to send again, or a null frame if it is gone or too old
+    MediaFrame find(uint16_t sequenceNumber, bool red, int64_t nowUs) const;
+    void reset();
+
+private:
+    struct Entry {
+        MediaFrame packet;
+        MediaFrame redPacket;
+        int32_t    sequenceNumber = -1;
+        int64_t    sentUs = 0;
+    };
+
+    std::array<Entry, Capacity> m_entries;
+};
+
+// Receiver side: notices gaps in the sequence numbers and decides which of
+// the missing packets to request. A packet is only requested while a
+// retransmission can still make it before its playout deadline, i.e. while
+// a round trip fits before the missing packet's expected arrival plus the
+// playout delay. Requests are repeated once per round trip, up to
+// MaxRequests times. onReceived(), onRepaired() and due() are called from
+// the track's media thread; the playout delay can be set from any thread.
+class Tracker
+{
+public:
+    static constexpr size_t MaxMissing = 32;
+    static constexpr int MaxRequests = 3;
+
+    // Time a packet waits in the jitter buffer before it is played; 0 (the
+    // default, also while no one plays the stream) disables requests
+    void setPlayoutDelayMs(int milliseconds) { m_playoutDelayMs.store(milliseconds, std::memory_order_relaxed); }
+
+    // True if the packet is one that was requested: a retransmission, or the
+    // original arriving late. Whether it counts as recovered is up to the
+    // caller, through onRecovered(), once the frame went on to the output.
+    bool onReceived(uint16_t sequenceNumber, uint32_t timestamp, int64_t nowUs);
+    // The frame of a missing packet arrived some other way (as a redundant
+    // block of a later RED packet), so it is no longer requested
+    void onRepaired(uint16_t sequenceNumber);
+    void onRecovered() { m_recovered.fetch_add(1, std::memory_order_relaxed); }
+    // Writes the sequence numbers to request now, ascending, and returns
+    // how many; packets whose deadline can no longer be met are given up.
+    // rttMs below 0 means not measured yet.
+    size_t due(int64_t nowUs, double rttMs, uint16_t *out, size_t capacity);
+
+    struct Stats {
+        uint64_t requested = 0;    // NACKed sequence numbers, repeats included
+        uint64_t recovered = 0;    // requested packets that arrived afterwards and went to the output
+        uint64_t expired = 0;      // given up: too late or too many requests
+    };
+    Stats stats() const;
+
+private:
+    struct Missing {
+        uint16_t sequenceNumber = 0;
+        int64_t  expectedUs = 0;   // when it should have arrived
+        int64_t  requestedUs = 0;
+        int      requests = 0;
+    };
+
+    // Index of the missing packet, or -1
+    int find(uint16_t sequenceNumber) const;
+    void remove(size_t index);
+
+    std::atomic<int>                   m_playoutDelayMs{0};
+    bool                               m_started = false;
+    uint16_t                           m_newestSequence = 0;
+    uint32_t                           m_newestTimestamp = 0;
+    uint32_t                           m_timestampStep = 960;
+    // Ascending by sequence number, oldest first
+    std::array<Missing, MaxMissing>    m_missing;
+    size_t                             m_missingCount = 0;
+
+    std::atomic<uint64_t>              m_requested{0};
+    std::atomic<uint64_t>              m_recovered{0};
+    std::atomic<uint64_t>              m_expired{0};
+};
+
+} // namespace Nack
+
+#endif // NACK_H
@@ -0,0 +1,111 @@
+#include "peersession.h"
+
+#include <algorithm>
+
+ReceiveStream::ReceiveStream(const QString &streamId, uint32_t streamSsrc, uint32_t localSsrc, uint32_t clockRate)
+    : id(streamId),
+    ssrc(streamSsrc),
+    rtcp(localSsrc, clockRate)
+{
+}
+
+PeerSession::PeerSession(const QString &peerId, uint32_t localSsrc, uint32_t clockRate, int64_t maxSendBps)
+    : ReceiveStream(peerId, 0, localSsrc, clockRate),
+    sendRate(maxSendBps, maxSendBps),
+    m_clockRate(clockRate)
+{
+}
+
+std::shared_ptr<ReceiveStream> PeerSession::findStream(uint32_t ssrc) const
+{
+    // A peer with one stream, the usual case, never takes the lock
+    if (m_streamCount.load(std::memory_order_acquire) == 0)
+        return nullptr;
+    std::lock_guard<std::mutex> locker(m_streamsMutex);
+    for (const std::shared_ptr<ReceiveStream> &stream : m_streams) {
+        if (stream->ssrc == ssrc)
+            return stream;
+    }
+    return nullptr;
+}
+
+std::vector<std::shared_ptr<ReceiveStream>> PeerSession::streams() const
+{
+    std::lock_guard<std::mutex> locker(m_streamsMutex);
+    return m_streams;
+}
+
+std::vector<std::shared_ptr<ReceiveStream>> PeerSession::setDeclaredSsrcs(const std::vector<uint32_t> &ssrcs)
+{
+    std::vector<std::shared_ptr<ReceiveStream>> removed;
+    std::lock_guard<std::mutex> locker(m_streamsMutex);
+    if (m_ownSsrc == 0 && !ssrcs.empty())
+        m_ownSsrc = ssrcs.front();
+
+    const auto undeclared = [&](const std::shared_ptr<ReceiveStream> &stream) {
+        return std::find(ssrcs.begin(), ssrcs.end(), stream->ssrc) == ssrcs.end();
+    };
+    for (const std::shared_ptr<ReceiveStream> &stream : m_streams) {
+        if (undeclared(stream))
+            removed.push_back(stream);
+    }
+    m_streams.erase(std::remove_if(m_streams.begin(), m_streams.end(), undeclared), m_streams.end());
+
+    for (uint32_t declared : ssrcs) {
+        if (declared == m_ownSsrc)
+            continue;
+        const bool known = std::any_of(m_streams.begin(), m_streams.end(), [declared](const auto &stream) {
+            return stream->ssrc == declared;
+        });
+        if (!known) {
+            m_streams.push_back(std::make_shared<ReceiveStream>(id + '#' + QString::number(declared), declared,
+                                                                rtcp.localSsrc(), m_clockRate));
+        }
+    }
+    m_streamCount.store(m_streams.size(), std::memory_order_release);
+    return removed;
+}
+
+void PeerSession::setLocalSsrc(uint32_t ssrc)
+{
+    rtcp.setLocalSsrc(ssrc);
+    std::lock_guard<std::mutex> locker(m_streamsMutex);
+    for (const std::shared_ptr<ReceiveStream> &stream : m_streams)
+        stream->rtcp.setLocalSsrc(ssrc);
+}
+
+PeerTable::SessionPtr PeerTable::find(const QString &peerId) const
+{
+    const auto slot = m_slots.constFind(peerId);
+    if (slot == m_slots.cend())
+        return nullptr;
+    return m_sessions[*slot];
+}
+
+void PeerTable::insert(const SessionPtr &session)
+{
+    const auto slot = m_slots.constFind(session->id);
+    if (slot != m_slots.cend()) {
+        m_sessions[*slot] = session;
+        return;
+    }
+    m_slots.insert(session->id, m_sessions.size());
+    m_sessions.push_back(session);
+}
+
+PeerTable::SessionPtr PeerTable::remove(const QString &peerId)
+{
+    const auto slot = m_slots.constFind(peerId);
+    if (slot == m_slots.cend())
+        return nullptr;
+    const size_t index = *slot;
+    m_slots.erase(slot);
+
+    SessionPtr session = std::move(m_sessions[index]);
+    if (index + 1 != m_sessions.size()) {
+        m_sessions[index] = std::move(m_sessions.back());
+        m_slots[m_sessions[index]->id] = index;
+    }
+    m_sessions.pop_back();
+    return session;
+}
@@ -0,0 +1,122 @@
+#ifndef PEERSESSION_H
+#define PEERSESSION_H
+
+#include <QHash>
+#include <QString>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Build the datachannellib library and add the include path to .pro file
+#include <rtc/rtc.hpp>
+#include "bandwidthestimator.h"
+#include "nack.h"
+#include "redcodec.h"
+#include "rtcpsession.h"
+
+// The receive side of one RTP stream on a peer's track: its statistics and
+// reports, RED, NACK and delay-based rate estimation. id is the stream the
+// output plays it as, ssrc the one it was declared with (0 for a peer's own
+// stream, which takes whatever arrives). The RED decoder is only touched from the track's
+// callback. The NACK tracker and delay estimator are updated there too, and
+// the GUI thread reaches them only through their atomics: sendReports()
+// sets the tracker's playout delay and reads the delay estimate for the
+// REMB, and getStats() reads both.
+struct ReceiveStream
+{
+    ReceiveStream(const QString &streamId, uint32_t streamSsrc, uint32_t localSsrc, uint32_t clockRate);
+
+    const QString                           id;
+    const uint32_t                          ssrc;
+    RtcpSession                             rtcp;
+    Red::Decoder                            redDecoder;
+    Nack::Tracker                           nackTracker;
+    Bandwidth::DelayEstimator               receiveRate;
+};
+
+// Everything WebRTC keeps about the call with one peer: its connection and
+// signalling state, its audio track, what its description negotiated, and
+// the RTCP, NACK, RED and congestion control state of both directions. The
+// receive side it inherits is the peer's own stream, and its RTCP session
+// also reports on what we send.
+//
+// A peer that forwards others, like the SFU, sends several streams on the
+// one track and declares each SSRC in its description. The first declared
+// SSRC stays with the session; every further one gets a ReceiveStream of
+// its own, with the id "peerId#ssrc", so each sender has its own jitter
+// buffer, decoder and RTCP state.
+//
+// The track callbacks hold a weak reference to their session, so nothing on
+// the media path looks a peer up by id. The owner's mutex guards the
+// connection, track and localDescription; the negotiated flags are atomics
+// the media threads read without it. The further streams have a lock of
+// their own, only taken on the media path while the peer declared some.
+// The send rate estimator is only used on the GUI thread.
+struct PeerSession : ReceiveStream
+{
+    PeerSession(const QString &peerId, uint32_t localSsrc, uint32_t clockRate, int64_t maxSendBps);
+
+    std::shared_ptr<rtc::PeerConnection>    connection;
+    std::shared_ptr<rtc::Track>             track;
+
+    // Signalling: our role and the SDP we sent, once gathering completed
+    std::atomic<bool>                       offerer{false};
+    std::atomic<bool>                       gatheringCompleted{false};
+    QString                                 localDescription;
+
+    // What the peer's description accepted
+    std::atomic<bool>                       red{false};
+    std::atomic<bool>                       nack{false};
+    std::atomic<bool>                       remb{false};
+
+    // Our stream to the peer, after its feedback; the counts are the
+    // reports and REMBs already taken into account
+    Bandwidth::Estimator                    sendRate;
+    uint64_t                                reportsSeen = 0;
+    uint64_t                                rembsSeen = 0;
+
+    // The further stream with the SSRC, or null for the session's own
+    std::shared_ptr<ReceiveStream> findStream(uint32_t ssrc) const;
+    std::vector<std::shared_ptr<ReceiveStream>> streams() const;
+    // Takes the SSRCs the peer's latest description declared; returns the
+    // streams whose SSRC is no longer among them
+    std::vector<std::shared_ptr<ReceiveStream>> setDeclaredSsrcs(const std::vector<uint32_t> &ssrcs);
+    void setLocalSsrc(uint32_t ssrc);
+
+private:
+    const uint32_t                               m_clockRate;
+    mutable std::mutex                           m_streamsMutex;
+    uint32_t                                     m_ownSsrc = 0;
+    std::vector<std::shared_ptr<ReceiveStream>>  m_streams;
+    std::atomic<size_t>                          m_streamCount{0};
+};
+
+// The peers by id. Sessions sit in a dense array, so the per-packet loops
+// walk it without hashing; the id only maps to a slot, and the last session
+// moves into the slot of one that is removed. Not thread-safe; the owner
+// guards it.
+class PeerTable
+{
+public:
+    using SessionPtr = std::shared_ptr<PeerSession>;
+
+    // Null if the peer has no session
+    SessionPtr find(const QString &peerId) const;
+    bool contains(const QString &peerId) const { return m_slots.contains(peerId); }
+    // Replaces any session the peer already had
+    void insert(const SessionPtr &session);
+    // Takes the peer's session out of the table; null if it had none
+    SessionPtr remove(const QString &peerId);
+
+    const std::vector<SessionPtr> &sessions() const { return m_sessions; }
+    size_t size() const { return m_sessions.size(); }
+
+private:
+    std::vector<SessionPtr>     m_sessions;
+    QHash<QString, size_t>      m_slots;
+};
+
+#endif // PEERSESSION_H
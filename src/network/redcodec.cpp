@@ -0,0 +1,183 @@
+#include "redcodec.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Red {
+
+static constexpr size_t RedundantHeaderSize = 4;
+static constexpr size_t PrimaryHeaderSize = 1;
+
+// RTP timestamps wrap, so "newer" is decided on the signed difference
+static bool isNewer(uint32_t timestamp, uint32_t than)
+{
+    return int32_t(timestamp - than) > 0;
+}
+
+/*
+ * ====================================================
+ * ===================== Encoder ======================
+ * ====================================================
+ */
+
+void Encoder::setRedundancy(size_t depth)
+{
+    m_depth = std::min(depth, MaxRedundancy);
+}
+
+void Encoder::reset()
+{
+    m_stored = 0;
+    m_newest = 0;
+}
+
+size_t Encoder::encode(const uint8_t *primary, size_t size, uint32_t timestamp, int payloadType,
+                       uint8_t *out, size_t capacity)
+{
+    if (size + PrimaryHeaderSize > capacity)
+        return 0;
+
+    // Pick the stored frames to repeat, newest first, while they fit
+    std::array<const Stored *, MaxRedundancy> chosen{};
+    size_t count = 0;
+    size_t total = size + PrimaryHeaderSize;
+    for (size_t i = 0; i < std::min(m_depth, m_stored); ++i) {
+        const Stored &stored = m_history[(m_newest + MaxRedundancy - i) % MaxRedundancy];
+        const uint32_t offset = timestamp - stored.timestamp;
+        if (offset == 0 || offset > MaxTimestampOffset)
+            break;
+        if (total + stored.size + RedundantHeaderSize > capacity)
+            break;
+        total += stored.size + RedundantHeaderSize;
+        chosen[count++] = &stored;
+    }
+
+    // Headers oldest first, then the primary header, then the data in the same order
+    uint8_t *header = out;
+    for (size_t i = count; i-- > 0;) {
+        const uint32_t offset = timestamp - chosen[i]->timestamp;
+        const uint32_t length = uint32_t(chosen[i]->size);
+        header[0] = uint8_t(0x80 | (payloadType & 0x7F));
+        header[1] = uint8_t(offset >> 6);
+        header[2] = uint8_t(((offset & 0x3F) << 2) | (length >> 8));
+        header[3] = uint8_t(length & 0xFF);
+        header += RedundantHeaderSize;
+    }
+    *header++ = uint8_t(payloadType & 0x7F);
+
+    uint8_t *body = header;
+    for (size_t i = count; i-- > 0;) {
+        std::memcpy(body, chosen[i]->data.data(), chosen[i]->size);
+        body += chosen[i]->size;
+    }
+    std::memcpy(body, primary, size);
+    body += size;
+
+    // Remember the primary for the next packets; frames too large for a
+    // block length field are just never repeated
+    if (m_depth > 0 && size <= MaxBlockSize) {
+        m_newest = m_stored == 0 ? 0 : (m_newest + 1) % MaxRedundancy;
+        Stored &stored = m_history[m_newest];
+        std::memcpy(stored.data.data(), primary, size);
+        stored.size = size;
+        stored.timestamp = timestamp;
+        m_stored = std::min(m_stored + 1, MaxRedundancy);
+    }
+    return size_t(body - out);
+}
+
+/*
+ * ====================================================
+ * ====================== parse =======================
+ * ====================================================
+ */
+
+size_t parse(const uint8_t *payload, size_t size, uint32_t timestamp, Block *blocks, size_t maxBlocks)
+{
+    size_t count = 0;
+    size_t position = 0;
+    size_t redundantBytes = 0;
+
+    // Headers: any number of redundant ones, ended by the primary one
+    while (true) {
+        if (position >= size || count >= maxBlocks)
+            return 0;
+        const uint8_t first = payload[position];
+        Block &block = blocks[count++];
+        block.payloadType = first & 0x7F;
+        if (!(first & 0x80)) {
+            block.timestamp = timestamp;
+            position += PrimaryHeaderSize;
+            break;
+        }
+        if (position + RedundantHeaderSize > size)
+            return 0;
+        const uint32_t offset = (uint32_t(payload[position + 1]) << 6) | (payload[position + 2] >> 2);
+        block.timestamp = timestamp - offset;
+        block.size = ((payload[position + 2] & 0x03) << 8) | payload[position + 3];
+        redundantBytes += block.size;
+        position += RedundantHeaderSize;
+    }
+
+    if (position + redundantBytes > size)
+        return 0;
+
+    for (size_t i = 0; i + 1 < count; ++i) {
+        blocks[i].distance = int(count - 1 - i);
+        blocks[i].data = payload + position;
+        position += blocks[i].size;
+    }
+    Block &primary = blocks[count - 1];
+    primary.distance = 0;
+    primary.data = payload + position;
+    primary.size = size - position;
+    return count;
+}
+
+/*
+ * ====================================================
+ * ===================== Decoder ======================
+ * ====================================================
+ */
+
+void Decoder::reset()
+{
+    m_started = false;
+    m_newestTimestamp = 0;
+}
+
+size_t Decoder::unpack(const uint8_t *payload, size_t size, uint32_t timestamp, Block *blocks, size_t maxBlocks)
+{
+    std::array<Block, MaxRedundancy + 1> parsed;
+    const size_t count = parse(payload, size, timestamp, parsed.data(), parsed.size());
+    if (count == 0) {
+        ++m_malformed;
+        return 0;
+    }
+
+    // The first packet only gives its primary; earlier frames belong to
+    // before the call was joined
+    if (!m_started) {
+        m_started = true;
+        m_newestTimestamp = timestamp - 1;
+    }
+
+    // Redundant blocks only fill in frames that never arrived. The primary is
+    // always handed on: a late or retransmitted packet may still be in time
+    // for the jitter buffer, which drops it if it's a duplicate or too late.
+    size_t out = 0;
+    for (size_t i = 0; i < count && out < maxBlocks; ++i) {
+        const Block &block = parsed[i];
+        const bool isPrimary = i + 1 == count;
+        const bool newer = isNewer(block.timestamp, m_newestTimestamp);
+        if (!isPrimary && (!newer || block.size == 0))
+            continue;
+        if (!isPrimary)
+            ++m_recovered;
+        blocks[out++] = block;
+        if (newer)
+            m_newestTimestamp = block.timestamp;
+    }
+    return out;
+}
+
+} // namespace Red
@@ -0,0 +1,95 @@
+#ifndef REDCODEC_H
+#define REDCODEC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// RFC 2198 redundant audio data. Every RED payload carries up to
+// MaxRedundancy earlier frames in front of the current (primary) one:
+//
+//   redundant block header:  F=1 | PT (7) | timestamp offset (14) | length (10)
+//   primary block header:    F=0 | PT (7)
+//   block data in the same order, primary last
+//
+// A receiver that lost a packet gets its frame back from one of the
+// following packets, at the cost of sending every frame depth + 1 times.
+namespace Red {
+
+static constexpr size_t MaxRedundancy = 4;
+// Offsets and lengths have to fit in their header fields
+static constexpr uint32_t MaxTimestampOffset = (1u << 14) - 1;
+static constexpr size_t MaxBlockSize = (1u << 10) - 1;
+
+struct Block {
+    uint32_t       timestamp = 0;
+    // Packets back from the one carrying the block: the sender repeats the
+    // frames of its previous packets, so this is also the sequence number distance
+    int            distance = 0;
+    int            payloadType = 0;
+    const uint8_t *data = nullptr;
+    size_t         size = 0;
+};
+
+// Sender side: remembers the last frames it was given and builds RED
+// payloads from them. All storage is fixed, nothing is allocated per frame.
+class Encoder
+{
+public:
+    // 0 sends plain RED with only the primary block
+    void setRedundancy(size_t depth);
+    size_t redundancy() const { return m_depth; }
+    void reset();
+
+    // Writes a RED payload for the primary frame to out and remembers the
+    // frame for the following packets. Older frames that don't fit in
+    // capacity or in the header fields are left out. Returns the size
+    // written, or 0 if not even the primary fits.
+    size_t encode(const uint8_t *primary, size_t size, uint32_t timestamp, int payloadType,
+                  uint8_t *out, size_t capacity);
+
+private:
+    struct Stored {
+        std::array<uint8_t, MaxBlockSize> data;
+        size_t   size = 0;
+        uint32_t timestamp = 0;
+    };
+
+    size_t                               m_depth = 2;
+    std::array<Stored, MaxRedundancy>    m_history;
+    size_t                               m_newest = 0;
+    size_t                               m_stored = 0;
+};
+
+// Splits a RED payload into its blocks (oldest first, primary last). Returns
+// the number of blocks, or 0 for a malformed payload. Blocks point into payload.
+size_t parse(const uint8_t *payload, size_t size, uint32_t timestamp,
+             Block *blocks, size_t maxBlocks);
+
+// Receiver side: keeps the newest timestamp handed to the decoder, so that
+// only redundant blocks for frames that never arrived come out of a packet
+class Decoder
+{
+public:
+    void reset();
+
+    // Blocks to decode from this packet, in timestamp order: redundant
+    // blocks newer than anything seen so far (recovered frames), then the
+    // primary, which comes out even when it is late or retransmitted.
+    // Returns 0 for a malformed packet.
+    size_t unpack(const uint8_t *payload, size_t size, uint32_t timestamp,
+                  Block *blocks, size_t maxBlocks);
+
+    uint64_t recoveredFrames() const { return m_recovered; }
+    uint64_t malformedPackets() const { return m_malformed; }
+
+private:
+    bool     m_started = false;
+    uint32_t m_newestTimestamp = 0;
+    uint64_t m_recovered = 0;
+    uint64_t m_malformed = 0;
+};
+
+} // namespace Red
+
+#endif // REDCODEC_H
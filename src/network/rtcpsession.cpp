@@ -0,0 +1,369 @@
+#include "rtcpsession.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+static constexpr uint8_t SenderReport = 200;
+static constexpr uint8_t ReceiverReport = 201;
+static constexpr uint8_t PayloadFeedback = 206;
+static constexpr uint8_t RembFormat = 15;
+static constexpr size_t RembSize = 24;            // with one SSRC
+static constexpr size_t HeaderSize = 8;            // header and sender SSRC
+static constexpr size_t SenderInfoSize = 20;
+static constexpr size_t ReportBlockSize = 24;
+// RFC 3550 appendix A.1: larger jumps forward are a restarted sender,
+// smaller ones backwards are reordering
+static constexpr uint16_t MaxDropout = 3000;
+static constexpr uint16_t MaxMisorder = 100;
+// Seconds from the NTP epoch (1900) to the Unix one
+static constexpr uint64_t NtpUnixOffset = 2208988800ULL;
+
+static uint16_t readBigEndian16(const uint8_t *in)
+{
+    return uint16_t((in[0] << 8) | in[1]);
+}
+
+static uint32_t readBigEndian32(const uint8_t *in)
+{
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+static void writeBigEndian16(uint8_t *out, uint16_t value)
+{
+    out[0] = uint8_t(value >> 8);
+    out[1] = uint8_t(value);
+}
+
+static void writeBigEndian32(uint8_t *out, uint32_t value)
+{
+    out[0] = uint8_t(value >> 24);
+    out[1] = uint8_t(value >> 16);
+    out[2] = uint8_t(value >> 8);
+    out[3] = uint8_t(value);
+}
+
+// 64-bit NTP timestamp: seconds since 1900 and a binary fraction
+static uint64_t ntpTime(int64_t nowUs)
+{
+    const int64_t unixUs = RtcpSession::wallClockUs(nowUs);
+    const uint64_t seconds = uint64_t(unixUs / 1000000) + NtpUnixOffset;
+    const uint64_t fraction = (uint64_t(unixUs % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+// The middle 32 bits, in 1/65536 s, as LSR and DLSR use them
+static uint32_t compactNtp(int64_t nowUs)
+{
+    return uint32_t(ntpTime(nowUs) >> 16);
+}
+
+RtcpSession::RtcpSession(uint32_t localSsrc, uint32_t clockRate)
+    : m_clockRate(clockRate),
+    m_localSsrc(localSsrc)
+{
+}
+
+int64_t RtcpSession::nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t RtcpSession::wallClockUs(int64_t nowUs)
+{
+    // Anchored once, so the NTP timestamps advance with the monotonic clock
+    // even if the system clock is stepped during the call
+    using namespace std::chrono;
+    static const int64_t offset =
+        duration_cast<microseconds>(system_clock::now().time_since_epoch()).count() - RtcpSession::nowUs();
+    return nowUs + offset;
+}
+
+void RtcpSession::onSent(uint32_t rtpTimestamp, size_t payloadSize, int64_t nowUs)
+{
+    m_packetsSent.fetch_add(1, std::memory_order_relaxed);
+    m_bytesSent.fetch_add(payloadSize, std::memory_order_relaxed);
+    m_lastRtpTimestamp.store(rtpTimestamp, std::memory_order_relaxed);
+    m_lastSentUs.store(nowUs, std::memory_order_relaxed);
+}
+
+void RtcpSession::onReceived(const RtpPacketView &packet, int64_t nowUs)
+{
+    if (!m_receiving || packet.ssrc != m_remoteSsrc.load(std::memory_order_relaxed)) {
+        // First packet, or the peer picked a new SSRC: a new source
+        m_receiving = true;
+        m_remoteSsrc.store(packet.ssrc, std::memory_order_relaxed);
+        m_maxSequence = packet.sequenceNumber;
+        m_cycles = 0;
+        m_badSequence = 0x10000;
+        m_baseSequence.store(packet.sequenceNumber, std::memory_order_relaxed);
+        m_extendedMax.store(packet.sequenceNumber, std::memory_order_relaxed);
+        m_packetsReceived.store(0, std::memory_order_relaxed);
+        m_bytesReceived.store(0, std::memory_order_relaxed);
+        m_jitter.store(0.0, std::memory_order_relaxed);
+        m_lastTransit = 0;
+    } else {
+        const uint16_t delta = uint16_t(packet.sequenceNumber - m_maxSequence);
+        if (delta < MaxDropout) {
+            if (packet.sequenceNumber < m_maxSequence)
+                m_cycles += 0x10000;
+            m_maxSequence = packet.sequenceNumber;
+        } else if (delta <= 0xFFFF - MaxMisorder) {
+            // A big jump: the sender restarted if the next packet follows on
+            if (packet.sequenceNumber != m_badSequence) {
+                m_badSequence = uint16_t(packet.sequenceNumber + 1);
+                return;
+            }
+            m_maxSequence = packet.sequenceNumber;
+            m_cycles = 0;
+            m_badSequence = 0x10000;
+            m_baseSequence.store(packet.sequenceNumber, std::memory_order_relaxed);
+            m_packetsReceived.store(0, std::memory_order_relaxed);
+        }
+        // Otherwise a duplicate or a late packet, counted but not the maximum
+        m_extendedMax.store(m_cycles + m_maxSequence, std::memory_order_relaxed);
+    }
+
+    m_packetsReceived.fetch_add(1, std::memory_order_relaxed);
+    m_bytesReceived.fetch_add(packet.payloadSize, std::memory_order_relaxed);
+
+    // Interarrival jitter (appendix A.8): the change in transit time between
+    // consecutive packets, in timestamp units, smoothed by 1/16. Whole
+    // seconds and the rest are scaled apart, as nowUs times the clock rate
+    // would overflow
+    const int64_t arrival = (nowUs / 1000000) * m_clockRate + (nowUs % 1000000) * m_clockRate / 1000000;
+    const int64_t transit = int64_t(uint32_t(arrival) - packet.timestamp);
+    if (m_packetsReceived.load(std::memory_order_relaxed) > 1) {
+        int64_t change = int64_t(int32_t(uint32_t(transit - m_lastTransit)));
+        if (change < 0)
+            change = -change;
+        const double jitter = m_jitter.load(std::memory_order_relaxed);
+        m_jitter.store(jitter + (double(change) - jitter) / 16.0, std::memory_order_relaxed);
+    }
+    m_lastTransit = transit;
+}
+
+//   V=2 | P | RC (5) | PT (8) | length in 32-bit words - 1 (16)
+//   SSRC of the sender
+//   SR only: NTP timestamp (64) | RTP timestamp | packet count | octet count
+//   report blocks (24 bytes each)
+//   [profile-specific extensions]
+bool RtcpSession::onRtcp(const uint8_t *data, size_t size, int64_t nowUs)
+{
+    bool feedback = false;
+    while (size >= 4) {
+        if ((data[0] >> 6) != 2)
+            break;
+        const int count = data[0] & 0x1F;
+        const uint8_t type = data[1];
+        const size_t length = (size_t(readBigEndian16(data + 2)) + 1) * 4;
+        if (length > size)
+            break;
+
+        if (type == SenderReport && length >= HeaderSize + SenderInfoSize) {
+            const uint32_t lastSenderReport = (readBigEndian32(data + 8) << 16) | (readBigEndian32(data + 12) >> 16);
+            m_lastSenderReport.store((uint64_t(lastSenderReport) << 32) | compactNtp(nowUs), std::memory_order_relaxed);
+            m_lastSenderReportUs.store(nowUs, std::memory_order_relaxed);
+            feedback |= parseReportBlocks(data + HeaderSize + SenderInfoSize, count,
+                                          length - HeaderSize - SenderInfoSize, nowUs);
+        } else if (type == ReceiverReport && length >= HeaderSize) {
+            feedback |= parseReportBlocks(data + HeaderSize, count, length - HeaderSize, nowUs);
+        } else if (type == PayloadFeedback && count == RembFormat) {
+            feedback |= parseRemb(data, length);
+        }
+
+        data += length;
+        size -= length;
+    }
+    return feedback;
+}
+
+//   V=2 | P | FMT=15 (5) | PT=206 (8) | length
+//   SSRC of the sender
+//   SSRC of the media source, always 0
+//   'R' 'E' 'M' 'B'
+//   number of SSRCs (8) | exponent (6) | mantissa (18)
+//   SSRCs the estimate applies to
+bool RtcpSession::parseRemb(const uint8_t *data, size_t size)
+{
+    if (size < RembSize - 4 || std::memcmp(data + 12, "REMB", 4) != 0)
+        return false;
+    const size_t ssrcs = data[16];
+    if (size < RembSize - 4 + ssrcs * 4)
+        return false;
+    const uint32_t localSsrc = m_localSsrc.load(std::memory_order_relaxed);
+    bool ours = ssrcs == 0;
+    for (size_t i = 0; i < ssrcs && !ours; ++i)
+        ours = readBigEndian32(data + 20 + i * 4) == localSsrc;
+    if (!ours)
+        return false;
+
+    const int exponent = data[17] >> 2;
+    const uint64_t mantissa = (uint64_t(data[17] & 0x03) << 16) | (uint64_t(data[18]) << 8) | data[19];
+    const int64_t bps = exponent > 40 ? INT64_MAX : int64_t(mantissa << exponent);
+    m_rembBps.store(bps, std::memory_order_relaxed);
+    m_rembsReceived.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t RtcpSession::buildRemb(uint8_t *out, size_t capacity, int64_t bps) const
+{
+    if (capacity < RembSize || bps <= 0)
+        return 0;
+    uint64_t mantissa = uint64_t(bps);
+    uint8_t exponent = 0;
+    while (mantissa > 0x3FFFF) {
+        mantissa >>= 1;
+        ++exponent;
+    }
+    out[0] = uint8_t(0x80 | RembFormat);
+    out[1] = PayloadFeedback;
+    writeBigEndian16(out + 2, uint16_t(RembSize / 4 - 1));
+    writeBigEndian32(out + 4, m_localSsrc.load(std::memory_order_relaxed));
+    writeBigEndian32(out + 8, 0);
+    std::memcpy(out + 12, "REMB", 4);
+    out[16] = 1;
+    out[17] = uint8_t((exponent << 2) | (mantissa >> 16));
+    writeBigEndian16(out + 18, uint16_t(mantissa));
+    writeBigEndian32(out + 20, m_remoteSsrc.load(std::memory_order_relaxed));
+    return RembSize;
+}
+
+//   SSRC of the source reported on
+//   fraction lost (8) | cumulative packets lost (24, signed)
+//   extended highest sequence number received
+//   interarrival jitter
+//   last SR (LSR)
+//   delay since last SR (DLSR)
+bool RtcpSession::parseReportBlocks(const uint8_t *blocks, int count, size_t size, int64_t nowUs)
+{
+    const uint32_t localSsrc = m_localSsrc.load(std::memory_order_relaxed);
+    bool found = false;
+    for (int i = 0; i < count && size >= ReportBlockSize; ++i, blocks += ReportBlockSize, size -= ReportBlockSize) {
+        if (readBigEndian32(blocks) != localSsrc)
+            continue;
+        found = true;
+        m_reportsReceived.fetch_add(1, std::memory_order_relaxed);
+        const uint32_t lost = readBigEndian32(blocks + 4) & 0xFFFFFF;
+        m_remoteFractionLost.store(float(blocks[4]) / 256.0f, std::memory_order_relaxed);
+        m_remoteCumulativeLost.store(lost & 0x800000 ? int64_t(lost) - 0x1000000 : int64_t(lost),
+                                     std::memory_order_relaxed);
+        m_remoteJitterMs.store(double(readBigEndian32(blocks + 12)) * 1000.0 / m_clockRate,
+                               std::memory_order_relaxed);
+
+        // RTT = arrival - LSR - DLSR, all in 1/65536 s; LSR is 0 until the
+        // peer got one of our SRs
+        const uint32_t lastSenderReport = readBigEndian32(blocks + 16);
+        const uint32_t delay = readBigEndian32(blocks + 20);
+        if (lastSenderReport == 0)
+            continue;
+        const int32_t roundTrip = int32_t(compactNtp(nowUs) - lastSenderReport - delay);
+        if (roundTrip >= 0)
+            m_rttMs.store(double(roundTrip) * 1000.0 / 65536.0, std::memory_order_relaxed);
+    }
+    return found;
+}
+
+size_t RtcpSession::buildReport(uint8_t *out, size_t capacity, int64_t nowUs)
+{
+    const uint64_t packetsSent = m_packetsSent.load(std::memory_order_relaxed);
+    const bool sender = packetsSent != m_reportedPackets;
+    const bool receiver = m_packetsReceived.load(std::memory_order_relaxed) > 0;
+    if (!sender && !receiver)
+        return 0;
+    const size_t size = HeaderSize + (sender ? SenderInfoSize : 0) + (receiver ? ReportBlockSize : 0);
+    if (size > capacity)
+        return 0;
+
+    out[0] = uint8_t(0x80 | (receiver ? 1 : 0));
+    out[1] = sender ? SenderReport : ReceiverReport;
+    writeBigEndian16(out + 2, uint16_t(size / 4 - 1));
+    writeBigEndian32(out + 4, m_localSsrc.load(std::memory_order_relaxed));
+    uint8_t *block = out + HeaderSize;
+
+    if (sender) {
+        // The RTP timestamp of this instant, extrapolated from the last packet
+        const int64_t sinceSent = nowUs - m_lastSentUs.load(std::memory_order_relaxed);
+        const uint32_t rtpTimestamp = m_lastRtpTimestamp.load(std::memory_order_relaxed)
+            + uint32_t(sinceSent * m_clockRate / 1000000);
+        const uint64_t ntp = ntpTime(nowUs);
+        writeBigEndian32(block, uint32_t(ntp >> 32));
+        writeBigEndian32(block + 4, uint32_t(ntp));
+        writeBigEndian32(block + 8, rtpTimestamp);
+        writeBigEndian32(block + 12, uint32_t(packetsSent));
+        writeBigEndian32(block + 16, uint32_t(m_bytesSent.load(std::memory_order_relaxed)));
+        block += SenderInfoSize;
+        m_reportedPackets = packetsSent;
+    }
+    if (receiver)
+        writeReportBlock(block, nowUs);
+    return size;
+}
+
+size_t RtcpSession::writeReportBlock(uint8_t *out, int64_t nowUs)
+{
+    const uint64_t received = m_packetsReceived.load(std::memory_order_relaxed);
+    const uint64_t extendedMax = m_extendedMax.load(std::memory_order_relaxed);
+    const uint64_t expected = extendedMax - m_baseSequence.load(std::memory_order_relaxed) + 1;
+    if (expected < m_expectedPrior || received < m_receivedPrior) {
+        // The source restarted since the last report
+        m_expectedPrior = 0;
+        m_receivedPrior = 0;
+    }
+
+    // Loss over the interval since the last report, in 1/256
+    const int64_t expectedInterval = int64_t(expected - m_expectedPrior);
+    const int64_t lostInterval = expectedInterval - int64_t(received - m_receivedPrior);
+    m_expectedPrior = expected;
+    m_receivedPrior = received;
+    const uint8_t fraction = expectedInterval == 0 || lostInterval <= 0
+        ? 0 : uint8_t(std::min<int64_t>((lostInterval << 8) / expectedInterval, 255));
+    m_fractionLost.store(float(fraction) / 256.0f, std::memory_order_relaxed);
+
+    // Duplicates can make the cumulative count negative; it is clamped to 24 bits
+    const int64_t lost = std::clamp<int64_t>(int64_t(expected) - int64_t(received), -0x800000, 0x7FFFFF);
+
+    uint32_t lastSenderReport = 0;
+    uint32_t delay = 0;
+    const uint64_t senderReport = m_lastSenderReport.load(std::memory_order_relaxed);
+    if (senderReport != 0) {
+        lastSenderReport = uint32_t(senderReport >> 32);
+        delay = compactNtp(nowUs) - uint32_t(senderReport);
+    }
+
+    writeBigEndian32(out, m_remoteSsrc.load(std::memory_order_relaxed));
+    writeBigEndian32(out + 4, (uint32_t(fraction) << 24) | (uint32_t(lost) & 0xFFFFFF));
+    writeBigEndian32(out + 8, uint32_t(extendedMax));
+    writeBigEndian32(out + 12, uint32_t(m_jitter.load(std::memory_order_relaxed)));
+    writeBigEndian32(out + 16, lastSenderReport);
+    writeBigEndian32(out + 20, delay);
+    return ReportBlockSize;
+}
+
+RtcpSession::Stats RtcpSession::stats() const
+{
+    Stats result;
+    result.packetsSent = m_packetsSent.load(std::memory_order_relaxed);
+    result.bytesSent = m_bytesSent.load(std::memory_order_relaxed);
+    result.packetsRetransmitted = m_packetsRetransmitted.load(std::memory_order_relaxed);
+    result.packetsReceived = m_packetsReceived.load(std::memory_order_relaxed);
+    result.bytesReceived = m_bytesReceived.load(std::memory_order_relaxed);
+    if (result.packetsReceived > 0) {
+        const uint64_t expected = m_extendedMax.load(std::memory_order_relaxed)
+            - m_baseSequence.load(std::memory_order_relaxed) + 1;
+        result.cumulativeLost = int64_t(expected) - int64_t(result.packetsReceived);
+    }
+    result.fractionLost = m_fractionLost.load(std::memory_order_relaxed);
+    result.jitterMs = m_jitter.load(std::memory_order_relaxed) * 1000.0 / m_clockRate;
+    result.remoteFractionLost = m_remoteFractionLost.load(std::memory_order_relaxed);
+    result.remoteCumulativeLost = m_remoteCumulativeLost.load(std::memory_order_relaxed);
+    result.remoteJitterMs = m_remoteJitterMs.load(std::memory_order_relaxed);
+    result.rttMs = m_rttMs.load(std::memory_order_relaxed);
+    const int64_t lastSenderReportUs = m_lastSenderReportUs.load(std::memory_order_relaxed);
+    result.lastSenderReportUs = lastSenderReportUs != 0 ? wallClockUs(lastSenderReportUs) : 0;
+    result.reportsReceived = m_reportsReceived.load(std::memory_order_relaxed);
+    result.rembBps = m_rembBps.load(std::memory_order_relaxed);
+    result.rembsReceived = m_rembsReceived.load(std::memory_order_relaxed);
+    return result;
+}
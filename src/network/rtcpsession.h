@@ -0,0 +1,132 @@
+#ifndef RTCPSESSION_H
+#define RTCPSESSION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "rtpdepacketizer.h"
+
+// RTCP (RFC 3550 section 6) for the audio stream exchanged with one peer.
+// The send path counts what goes out, the receive path tracks sequence
+// numbers and interarrival jitter of what comes in, and every report
+// interval the owner builds a sender report (or a receiver report while
+// nothing was sent) with a report block on the peer's stream. Reports from
+// the peer give its view of our stream and, through LSR/DLSR, the round
+// trip time. Receiver estimated maximum bitrate (REMB) messages carry the
+// rate the peer's delay estimator found for our stream, and the other way
+// round.
+//
+// onReceived() and onRtcp() run on the media thread of the peer's track,
+// onSent() and buildReport() on threads the owner serialises; the figures
+// the threads share are atomics, so stats() can be taken from anywhere
+// without a lock. Times are microseconds on the monotonic clock (nowUs()), so
+// jitter, round trip times and the owner's deadlines don't jump when the
+// system clock is adjusted; only the NTP fields of the reports are converted
+// to the wall clock, through wallClockUs().
+class RtcpSession
+{
+public:
+    // Room for a sender report with one report block
+    static constexpr size_t MaxReportSize = 52;
+    static constexpr size_t MaxRembSize = 24;
+
+    explicit RtcpSession(uint32_t localSsrc, uint32_t clockRate = 48000);
+
+    void setLocalSsrc(uint32_t ssrc) { m_localSsrc.store(ssrc, std::memory_order_relaxed); }
+    uint32_t localSsrc() const { return m_localSsrc.load(std::memory_order_relaxed); }
+    // The peer's SSRC, 0 until its first packet
+    uint32_t remoteSsrc() const { return m_remoteSsrc.load(std::memory_order_relaxed); }
+    // Latest round trip time, -1 until measured
+    double rttMs() const { return m_rttMs.load(std::memory_order_relaxed); }
+
+    // After an RTP packet went out; rtpTimestamp as written in its header
+    void onSent(uint32_t rtpTimestamp, size_t payloadSize, int64_t nowUs);
+    // After a packet was sent again on request; not part of the SR counts
+    void onRetransmitted() { m_packetsRetransmitted.fetch_add(1, std::memory_order_relaxed); }
+    void onReceived(const RtpPacketView &packet, int64_t nowUs);
+    // Parses a compound RTCP packet from the peer; true if it held feedback
+    // on our stream (a report block or a REMB)
+    bool onRtcp(const uint8_t *data, size_t size, int64_t nowUs);
+
+    // Writes the next report to out; returns its size, or 0 if there is
+    // nothing to report yet or it doesn't fit
+    size_t buildReport(uint8_t *out, size_t capacity, int64_t nowUs);
+    // Writes a REMB asking the peer to stay under bps; 0 if it doesn't fit
+    size_t buildRemb(uint8_t *out, size_t capacity, int64_t bps) const;
+
+    struct Stats {
+        uint64_t packetsSent = 0;
+        uint64_t bytesSent = 0;             // payload only, like the SR octet count
+        uint64_t packetsRetransmitted = 0;
+        uint64_t packetsReceived = 0;
+        uint64_t bytesReceived = 0;
+        // The peer's stream, as we receive it
+        float    fractionLost = 0.0f;       // over the last report interval
+        int64_t  cumulativeLost = 0;
+        double   jitterMs = 0.0;
+        // Our stream, as the peer reported receiving it
+        float    remoteFractionLost = 0.0f;
+        int64_t  remoteCumulativeLost = 0;
+        double   remoteJitterMs = 0.0;
+        double   rttMs = -1.0;              // -1 until a report block echoed one of our SRs
+        int64_t  lastSenderReportUs = 0;    // arrival of the peer's last SR on the wall clock, 0 if none
+        uint64_t reportsReceived = 0;       // report blocks on our stream
+        int64_t  rembBps = 0;               // the peer's last REMB, 0 if none
+        uint64_t rembsReceived = 0;
+    };
+    Stats stats() const;
+
+    static int64_t nowUs();
+    // A nowUs() value as microseconds since the Unix epoch
+    static int64_t wallClockUs(int64_t nowUs);
+
+private:
+    void updateSequence(uint16_t sequenceNumber);
+    bool parseReportBlocks(const uint8_t *blocks, int count, size_t size, int64_t nowUs);
+    bool parseRemb(const uint8_t *data, size_t size);
+    size_t writeReportBlock(uint8_t *out, int64_t nowUs);
+
+    uint32_t                 m_clockRate;
+    std::atomic<uint32_t>    m_localSsrc;
+
+    // Send side
+    std::atomic<uint64_t>    m_packetsSent{0};
+    std::atomic<uint64_t>    m_bytesSent{0};
+    std::atomic<uint64_t>    m_packetsRetransmitted{0};
+    std::atomic<uint32_t>    m_lastRtpTimestamp{0};
+    std::atomic<int64_t>     m_lastSentUs{0};
+
+    // Receive side, only written by the media thread
+    bool                     m_receiving = false;
+    uint16_t                 m_maxSequence = 0;
+    uint32_t                 m_cycles = 0;
+    uint32_t                 m_badSequence = 0x10000;
+    int64_t                  m_lastTransit = 0;
+    std::atomic<uint32_t>    m_remoteSsrc{0};
+    std::atomic<uint32_t>    m_baseSequence{0};
+    std::atomic<uint32_t>    m_extendedMax{0};
+    std::atomic<uint64_t>    m_packetsReceived{0};
+    std::atomic<uint64_t>    m_bytesReceived{0};
+    std::atomic<double>      m_jitter{0.0};      // in RTP timestamp units
+    // Middle 32 bits of the NTP time in the peer's last SR (LSR), and when it
+    // arrived in the same format, packed so they are read together
+    std::atomic<uint64_t>    m_lastSenderReport{0};
+    std::atomic<int64_t>     m_lastSenderReportUs{0};
+
+    // Only touched by buildReport()
+    uint64_t                 m_expectedPrior = 0;
+    uint64_t                 m_receivedPrior = 0;
+    uint64_t                 m_reportedPackets = 0;
+    std::atomic<float>       m_fractionLost{0.0f};
+
+    // From the peer's report blocks on our stream
+    std::atomic<float>       m_remoteFractionLost{0.0f};
+    std::atomic<int64_t>     m_remoteCumulativeLost{0};
+    std::atomic<double>      m_remoteJitterMs{0.0};
+    std::atomic<double>      m_rttMs{-1.0};
+    std::atomic<uint64_t>    m_reportsReceived{0};
+    std::atomic<int64_t>     m_rembBps{0};
+    std::atomic<uint64_t>    m_rembsReceived{0};
+};
+
+#endif // RTCPSESSION_H
@@ -0,0 +1,54 @@
+#include "rtcsetup.h"
+#include <string>
+
+namespace RtcSetup {
+
+rtc::Configuration configuration()
+{
+    // Create an instance of rtc::Configuration to Set up ICE configuration
+    rtc::Configuration config;
+
+    // Add a STUN server to help peers find their public IP addresses
+    //config.iceServers.emplace_back("stun:stun.l.google.com:19302");
+    config.iceServers.emplace_back("stun:74.234.202.9:3478");
+
+    // Add a TURN server for relaying media if a direct connection can't be established
+    config.iceServers.emplace_back("turn:guest:somepassword@74.234.202.9:3478");
+
+    return config;
+}
+
+void addAudioCodecs(rtc::Description::Audio &audio, int payloadType, int redPayloadType, bool feedback)
+{
+    if (redPayloadType >= 0) {
+        // Listed first so RED is preferred; its blocks are all Opus
+        const std::string blocks = std::to_string(payloadType) + "/" + std::to_string(payloadType);
+        audio.addAudioCodec(redPayloadType, "red/48000/2", blocks);
+    }
+    audio.addOpusCodec(payloadType);
+    if (feedback) {
+        // Lost packets are requested again while there is time to play them,
+        // and the receiver's delay-based estimate comes back as REMB
+        audio.rtpMap(payloadType)->addFeedback("nack");
+        audio.rtpMap(payloadType)->addFeedback("goog-remb");
+    }
+}
+
+bool readVariant(const rtc::message_variant &data, const uint8_t *&bytes, size_t &size)
+{
+    if (std::holds_alternative<rtc::binary>(data)) {
+        const rtc::binary &binData = std::get<rtc::binary>(data);
+        bytes = reinterpret_cast<const uint8_t *>(binData.data());
+        size = binData.size();
+        return true;
+    }
+    if (std::holds_alternative<std::string>(data)) {
+        const std::string &strData = std::get<std::string>(data);
+        bytes = reinterpret_cast<const uint8_t *>(strData.data());
+        size = strData.size();
+        return true;
+    }
+    return false;
+}
+
+} // namespace RtcSetup
@@ -0,0 +1,27 @@
+#ifndef RTCSETUP_H
+#define RTCSETUP_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Build the datachannellib library and add the include path to .pro file
+#include <rtc/rtc.hpp>
+
+// The libdatachannel setup shared by the client (WebRTC) and the headless
+// SFU, so both ends of a call agree on servers and codecs.
+namespace RtcSetup {
+
+// ICE configuration with our STUN and TURN servers
+rtc::Configuration configuration();
+
+// Adds Opus at payloadType to an audio section, with RED (RFC 2198) over
+// Opus ahead of it if redPayloadType is not negative. With feedback, Opus
+// also lists the RTCP feedback the client handles (NACK and REMB).
+void addAudioCodecs(rtc::Description::Audio &audio, int payloadType, int redPayloadType, bool feedback);
+
+// The bytes of a received message, without copying them
+bool readVariant(const rtc::message_variant &data, const uint8_t *&bytes, size_t &size);
+
+} // namespace RtcSetup
+
+#endif // RTCSETUP_H
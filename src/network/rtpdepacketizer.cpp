@@ -0,0 +1,105 @@
+#include "rtpdepacketizer.h"
+
+static uint16_t readBigEndian16(const uint8_t *in)
+{
+    return uint16_t((in[0] << 8) | in[1]);
+}
+
+static uint32_t readBigEndian32(const uint8_t *in)
+{
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+// RTCP packet types 192-223 fall where the RTP marker bit and payload type
+// would be; RFC 5761 keeps RTP payload types out of that range
+bool RtpDepacketizer::isRtcp(const uint8_t *data, size_t size)
+{
+    return size >= 2 && (data[0] >> 6) == 2 && data[1] >= 192 && data[1] <= 223;
+}
+
+//   V=2 | P | X | CC (4) | M | PT (7) | sequence number (16)
+//   timestamp (32)
+//   SSRC (32)
+//   CSRC (32) x CC
+//   [profile (16) | length in 32-bit words (16) | extension data]
+//   payload
+//   [padding, the last byte counting the padding bytes]
+RtpDepacketizer::Result RtpDepacketizer::parse(const uint8_t *data, size_t size, RtpPacketView &packet)
+{
+    // An empty receiver report is shorter than an RTP header
+    if (isRtcp(data, size))
+        return count(Result::Rtcp);
+    if (size < FixedHeaderSize)
+        return count(Result::TooShort);
+    if ((data[0] >> 6) != 2)
+        return count(Result::BadVersion);
+
+    const bool padding = (data[0] & 0x20) != 0;
+    packet.hasExtension = (data[0] & 0x10) != 0;
+    packet.csrcCount = data[0] & 0x0F;
+    packet.marker = (data[1] & 0x80) != 0;
+    packet.payloadType = data[1] & 0x7F;
+    packet.sequenceNumber = readBigEndian16(data + 2);
+    packet.timestamp = readBigEndian32(data + 4);
+    packet.ssrc = readBigEndian32(data + 8);
+
+    size_t offset = FixedHeaderSize;
+    packet.csrcs = data + offset;
+    offset += size_t(packet.csrcCount) * 4;
+    if (offset > size)
+        return count(Result::TruncatedHeader);
+
+    packet.extensionProfile = 0;
+    packet.extension = nullptr;
+    packet.extensionSize = 0;
+    if (packet.hasExtension) {
+        if (offset + 4 > size)
+            return count(Result::TruncatedHeader);
+        packet.extensionProfile = readBigEndian16(data + offset);
+        packet.extensionSize = size_t(readBigEndian16(data + offset + 2)) * 4;
+        offset += 4;
+        packet.extension = data + offset;
+        offset += packet.extensionSize;
+        if (offset > size)
+            return count(Result::TruncatedHeader);
+    }
+
+    packet.paddingSize = 0;
+    if (padding) {
+        const size_t paddingSize = data[size - 1];
+        if (paddingSize == 0 || paddingSize > size - offset)
+            return count(Result::BadPadding);
+        packet.paddingSize = paddingSize;
+    }
+
+    packet.payload = data + offset;
+    packet.payloadSize = size - offset - packet.paddingSize;
+    return count(Result::Ok);
+}
+
+RtpDepacketizer::Result RtpDepacketizer::count(Result result)
+{
+    std::atomic<uint64_t> *counter = nullptr;
+    switch (result) {
+    case Result::Ok:              counter = &m_packets; break;
+    case Result::Rtcp:            counter = &m_rtcp; break;
+    case Result::TooShort:        counter = &m_tooShort; break;
+    case Result::BadVersion:      counter = &m_badVersion; break;
+    case Result::TruncatedHeader: counter = &m_truncatedHeader; break;
+    case Result::BadPadding:      counter = &m_badPadding; break;
+    }
+    counter->fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
+RtpDepacketizer::Stats RtpDepacketizer::stats() const
+{
+    Stats result;
+    result.packets = m_packets.load(std::memory_order_relaxed);
+    result.rtcp = m_rtcp.load(std::memory_order_relaxed);
+    result.tooShort = m_tooShort.load(std::memory_order_relaxed);
+    result.badVersion = m_badVersion.load(std::memory_order_relaxed);
+    result.truncatedHeader = m_truncatedHeader.load(std::memory_order_relaxed);
+    result.badPadding = m_badPadding.load(std::memory_order_relaxed);
+    return result;
+}
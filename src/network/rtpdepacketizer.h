@@ -0,0 +1,71 @@
+#ifndef RTPDEPACKETIZER_H
+#define RTPDEPACKETIZER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A parsed RTP packet (RFC 3550). The pointers are views into the buffer the
+// packet was parsed from and are only valid as long as it is.
+struct RtpPacketView {
+    int            payloadType = 0;
+    bool           marker = false;
+    uint16_t       sequenceNumber = 0;
+    uint32_t       timestamp = 0;
+    uint32_t       ssrc = 0;
+    int            csrcCount = 0;
+    const uint8_t *csrcs = nullptr;          // csrcCount big-endian 32-bit identifiers
+    bool           hasExtension = false;
+    uint16_t       extensionProfile = 0;     // e.g. 0xBEDE for RFC 8285 one-byte extensions
+    const uint8_t *extension = nullptr;
+    size_t         extensionSize = 0;
+    const uint8_t *payload = nullptr;
+    size_t         payloadSize = 0;          // without padding
+    size_t         paddingSize = 0;
+};
+
+// Receiver side of RTP: validates the fixed header, skips the CSRC list and
+// the header extension, and strips padding, without copying anything.
+// RTCP multiplexed on the same transport (RFC 5761) is recognised and left
+// to the caller. parse() keeps no state apart from the atomic counters, so
+// one instance can serve every track and thread.
+class RtpDepacketizer
+{
+public:
+    static constexpr size_t FixedHeaderSize = 12;
+
+    enum class Result {
+        Ok,
+        Rtcp,            // an RTCP packet, not RTP
+        TooShort,        // shorter than the fixed header
+        BadVersion,      // not version 2
+        TruncatedHeader, // CSRC list or extension runs past the end
+        BadPadding       // padding count is 0 or longer than the payload
+    };
+
+    Result parse(const uint8_t *data, size_t size, RtpPacketView &packet);
+
+    struct Stats {
+        uint64_t packets = 0;          // parsed successfully
+        uint64_t rtcp = 0;
+        uint64_t tooShort = 0;
+        uint64_t badVersion = 0;
+        uint64_t truncatedHeader = 0;
+        uint64_t badPadding = 0;
+    };
+    Stats stats() const;
+
+    static bool isRtcp(const uint8_t *data, size_t size);
+
+private:
+    Result count(Result result);
+
+    std::atomic<uint64_t> m_packets{0};
+    std::atomic<uint64_t> m_rtcp{0};
+    std::atomic<uint64_t> m_tooShort{0};
+    std::atomic<uint64_t> m_badVersion{0};
+    std::atomic<uint64_t> m_truncatedHeader{0};
+    std::atomic<uint64_t> m_badPadding{0};
+};
+
+#endif // RTPDEPACKETIZER_H
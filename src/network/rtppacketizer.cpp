@@ -0,0 +1,43 @@
+#include "rtppacketizer.h"
+
+static void writeBigEndian16(uint8_t *out, uint16_t value)
+{
+    out[0] = uint8_t(value >> 8);
+    out[1] = uint8_t(value);
+}
+
+static void writeBigEndian32(uint8_t *out, uint32_t value)
+{
+    out[0] = uint8_t(value >> 24);
+    out[1] = uint8_t(value >> 16);
+    out[2] = uint8_t(value >> 8);
+    out[3] = uint8_t(value);
+}
+
+RtpPacketizer::RtpPacketizer(uint32_t ssrc, uint16_t firstSequenceNumber, uint32_t timestampOffset)
+    : m_ssrc(ssrc),
+    m_sequenceNumber(firstSequenceNumber),
+    m_timestampOffset(timestampOffset)
+{
+}
+
+//   V=2 | P | X | CC (4) | M | PT (7) | sequence number (16)
+//   timestamp (32)
+//   SSRC (32)
+bool RtpPacketizer::writeHeader(MediaFrame &frame, int payloadType, uint16_t sequenceNumber) const
+{
+    uint8_t *header = frame.prepend(HeaderSize);
+    if (!header)
+        return false;
+    header[0] = 0x80;
+    header[1] = uint8_t((frame.marker() ? 0x80 : 0x00) | (payloadType & 0x7F));
+    writeBigEndian16(header + 2, sequenceNumber);
+    writeBigEndian32(header + 4, frame.timestamp() + m_timestampOffset);
+    writeBigEndian32(header + 8, m_ssrc);
+    return true;
+}
+
+bool RtpPacketizer::packetize(MediaFrame &frame, int payloadType)
+{
+    return writeHeader(frame, payloadType, nextSequenceNumber());
+}
@@ -0,0 +1,46 @@
+#ifndef RTPPACKETIZER_H
+#define RTPPACKETIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "src/audio/framepool.h"
+
+// Sender side of one outgoing RTP stream (RFC 3550). It owns the stream's
+// SSRC, sequence numbers and timestamp offset, and writes the 12-byte fixed
+// header straight into the headroom in front of the encoded payload, so a
+// packet is never assembled in a separate buffer. Timestamps are on the
+// 48 kHz media clock the frames carry. Not thread-safe; the owner serialises
+// calls.
+class RtpPacketizer
+{
+public:
+    static constexpr size_t HeaderSize = 12;
+    // Opus' RTP clock runs at 48 kHz whatever rate the codec runs at
+    static constexpr uint32_t ClockRate = 48000;
+
+    // The first sequence number and the timestamp offset should be random
+    // (RFC 3550 section 5.1), so packets of an earlier stream can't be
+    // mistaken for this one's
+    explicit RtpPacketizer(uint32_t ssrc = 0, uint16_t firstSequenceNumber = 0, uint32_t timestampOffset = 0);
+
+    void setSsrc(uint32_t ssrc) { m_ssrc = ssrc; }
+    uint32_t ssrc() const { return m_ssrc; }
+
+    // Takes the sequence number of the next packet. Alternative payloads of
+    // the same frame (plain and RED for different peers) share one.
+    uint16_t nextSequenceNumber() { return m_sequenceNumber++; }
+    // Prepends the header for the frame's timestamp and marker; false if the
+    // frame has no headroom left
+    bool writeHeader(MediaFrame &frame, int payloadType, uint16_t sequenceNumber) const;
+    // nextSequenceNumber() and writeHeader() in one
+    bool packetize(MediaFrame &frame, int payloadType);
+    // The timestamp writeHeader() puts on the wire for a frame's media timestamp
+    uint32_t rtpTimestamp(uint32_t mediaTimestamp) const { return mediaTimestamp + m_timestampOffset; }
+
+private:
+    uint32_t m_ssrc;
+    uint16_t m_sequenceNumber;
+    uint32_t m_timestampOffset;
+};
+
+#endif // RTPPACKETIZER_H
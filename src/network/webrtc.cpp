@@ -1,36 +1,31 @@
 #include "webrtc.h"
-#include <QtEndian>
+#include "src/audio/audioinput.h"
+#include "src/audio/audiooutput.h"
+#include <QDateTime>
+#include <QMetaMethod>
+#include <QRandomGenerator>
+#include <cstring>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QFile>
 
 static_assert(true);
 
-#pragma pack(push, 1)
-struct RtpHeader {
-    uint8_t first;
-    uint8_t marker:1;
-    uint8_t payloadType:7;
-    uint16_t sequenceNumber;
-    uint32_t timestamp;
-    uint32_t ssrc;
-};
-#pragma pack(pop)
+// RTCP report interval. Well inside the 5% of the session bandwidth RFC 3550
+// allows for RTCP at any Opus bitrate, and short enough for the statistics
+// to follow a call as it happens.
+static constexpr int ReportIntervalMs = 1000;
 
 
 WebRTC::WebRTC(QObject *parent)
     : QObject{parent},
+    m_packetizer(0, uint16_t(QRandomGenerator::global()->generate()), QRandomGenerator::global()->generate()),
     m_audio("Audio")
 {
-    connect(this, &WebRTC::gatheringCompleted, [this] (const QString &peerId) {
-        if (!m_gatheringCompleted) return;
-        m_localDescription = descriptionToJson(m_peerConnections[peerId]->localDescription().value());
-        Q_EMIT localDescriptionGenerated(peerId, m_localDescription);
-        if (m_isOfferer)
-            Q_EMIT this->offerIsReady(peerId, m_localDescription);
-        else
-            Q_EMIT this->answerIsReady(peerId, m_localDescription);
-    });
+    m_packetizer.setSsrc(m_ssrc);
+    connect(&m_reportTimer, &QTimer::timeout, this, &WebRTC::sendReports);
+    m_reportTimer.start(ReportIntervalMs);
+    connect(this, &WebRTC::gatheringCompleted, this, &WebRTC::publishLocalDescription, Qt::DirectConnection);
 }
 
 WebRTC::~WebRTC()
@@ -48,51 +43,55 @@ void WebRTC::init(const QString &id, bool isOfferer)
     // Initialize WebRTC using libdatachannel library
     rtc::InitLogger(rtc::LogLevel::Error, NULL);
 
-    // Create an instance of rtc::Configuration to Set up ICE configuration
-    rtc::Configuration config;
-
-    // Add a STUN server to help peers find their public IP addresses
-    //config.iceServers.emplace_back("stun:stun.l.google.com:19302");
-    config.iceServers.emplace_back("stun:74.234.202.9:3478");
-
-    // Add a TURN server for relaying media if a direct connection can't be established
-    config.iceServers.emplace_back("turn:guest:somepassword@74.234.202.9:3478");
-
-    m_config = config;
+    // ICE configuration with the STUN and TURN servers, shared with the SFU
+    m_config = RtcSetup::configuration();
 
     // Set up the audio stream configuration
     m_audio.setBitrate(m_bitRate);
     m_audio.addSSRC(m_ssrc, "audio-send");
-    m_audio.addOpusCodec(m_payloadType);
+    RtcSetup::addAudioCodecs(m_audio, m_payloadType, m_redundancy > 0 ? m_redPayloadType : -1, true);
 
     m_isOfferer = isOfferer;
     m_localId = id;
 }
 
+void WebRTC::setConfiguration(const rtc::Configuration &config)
+{
+    m_config = config;
+}
+
 void WebRTC::addPeer(const QString &peerId)
 {
-    if (m_peerConnections.contains(peerId))
+    if (findSession(peerId))
         return;
 
     // Create and add a new peer connection
+    auto session = std::make_shared<PeerSession>(peerId, m_ssrc, RtpPacketizer::ClockRate, maxSendBps());
+    session->offerer = m_isOfferer;
     auto newPeer = std::make_shared<rtc::PeerConnection>(m_config);
-    m_peerConnections.insert(peerId, newPeer);
+    session->connection = newPeer;
+    {
+        QMutexLocker locker(&m_peersMutex);
+        m_peers.insert(session);
+    }
 
-    // Set up a callback for when the local description is generated
-    newPeer->onLocalDescription([this, peerId](const rtc::Description &description) {
-        if (m_gatheringCompleted) return;
-        auto typeString = QString::fromStdString(description.typeString());
-        auto sdp = QString::fromStdString(description);
-        m_isOfferer = (typeString == "offer");
-        m_localDescription = descriptionToJson(description);
+    // The connection belongs to the session, so its callbacks only hold a
+    // weak reference back
+    const std::weak_ptr<PeerSession> weakSession = session;
 
+    // Set up a callback for when the local description is generated
+    newPeer->onLocalDescription([weakSession](const rtc::Description &description) {
+        const auto session = weakSession.lock();
+        if (!session || session->gatheringCompleted) return;
+        session->offerer = (description.type() == rtc::Description::Type::Offer);
     });
 
 
     // Set up a callback for handling local ICE candidates
-    newPeer->onLocalCandidate([this, peerId](rtc::Candidate candidate) {
+    newPeer->onLocalCandidate([this, peerId, weakSession](rtc::Candidate candidate) {
         // Emit the local candidates using the localCandidateGenerated signal
-        if (!m_gatheringCompleted) return;
+        const auto session = weakSession.lock();
+        if (!session || !session->gatheringCompleted) return;
         Q_EMIT localCandidateGenerated(peerId,
                                      QString::fromStdString(candidate.candidate()),
                                      QString::fromStdString(candidate.mid()));
@@ -113,7 +112,12 @@ void WebRTC::addPeer(const QString &peerId)
         case rtc::PeerConnection::State::Disconnected:
             break;
         case rtc::PeerConnection::State::Closed:
+            if (const std::shared_ptr<PeerSession> session = findSession(peerId)) {
+                for (const std::shared_ptr<ReceiveStream> &stream : session->streams())
+                    Q_EMIT streamClosed(stream->id);
+            }
             removeConnectionData(peerId);
+            Q_EMIT peerClosed(peerId);
             Q_EMIT connectionClosed();
             break;
         case rtc::PeerConnection::State::Failed:
@@ -126,19 +130,24 @@ void WebRTC::addPeer(const QString &peerId)
 
 
     // Set up a callback for monitoring the gathering state
-    newPeer->onGatheringStateChange([this, peerId](rtc::PeerConnection::GatheringState state) {
+    newPeer->onGatheringStateChange([this, peerId, weakSession](rtc::PeerConnection::GatheringState state) {
         // When the gathering is complete, emit the gatheringComplited signal
-        if (rtc::PeerConnection::GatheringState::Complete == state) {
-            m_gatheringCompleted = true;
+        const auto session = weakSession.lock();
+        if (session && rtc::PeerConnection::GatheringState::Complete == state) {
+            session->gatheringCompleted = true;
             Q_EMIT gatheringCompleted(peerId);
         }
     });
 
     // Set up a callback for handling incoming tracks
-    newPeer->onTrack([this, peerId](std::shared_ptr<rtc::Track> track) {
+    newPeer->onTrack([this, weakSession](std::shared_ptr<rtc::Track> track) {
         // handle the incoming media stream, emitting the incommingPacket signal if a stream is received
-        m_peerTracks[peerId] = track;
-        track->onMessage([this, peerId](rtc::message_variant data) {
+        const auto session = weakSession.lock();
+        if (!session)
+            return;
+        QMutexLocker locker(&m_peersMutex);
+        session->track = track;
+        track->onMessage([](rtc::message_variant data) {
             qDebug() << "on message called in add peer";
         });
     });
@@ -151,67 +160,125 @@ void WebRTC::addPeer(const QString &peerId)
 // Set the local description for the peer's connection
 void WebRTC::generateOfferSDP(const QString &peerId)
 {
-    if (!m_peerConnections.contains(peerId))
-        addPeer(peerId);
-    setIsOfferer(true);
-    std::shared_ptr<rtc::PeerConnection> connection = m_peerConnections[peerId];
-    connection->setLocalDescription(rtc::Description::Type::Offer);
+    addPeer(peerId);
+    const std::shared_ptr<PeerSession> session = findSession(peerId);
+    session->offerer = true;
+    session->connection->setLocalDescription(rtc::Description::Type::Offer);
 }
 
 // Generate an answer SDP for the peer
 void WebRTC::generateAnswerSDP(const QString &peerId)
 {
-    if (!m_peerConnections.contains(peerId))
-        addPeer(peerId);
-
-    setIsOfferer(false);
-    std::shared_ptr<rtc::PeerConnection> connection = m_peerConnections[peerId];
-    connection->localDescription()->generateSdp();
+    addPeer(peerId);
+    const std::shared_ptr<PeerSession> session = findSession(peerId);
+    session->offerer = false;
+    session->connection->localDescription()->generateSdp();
 }
 
 // Add an audio track to the peer connection
 void WebRTC::addAudioTrack(const QString &peerId, const QString &trackName)
 {
+    const std::shared_ptr<PeerSession> session = findSession(peerId);
+    if (!session)
+        return;
     // Add an audio track to the peer connection
-    auto track = m_peerConnections[peerId]->addTrack(m_audio);
-
-    // Handle track events
-    track->onMessage([this, peerId](rtc::message_variant data) {
-        QByteArray receivedData = readVariant(data);
-        Q_EMIT incommingPacket(peerId, receivedData, receivedData.size());
+    auto track = session->connection->addTrack(m_audio);
+
+    // Handle track events. The session holds the track's RED, NACK, RTCP and
+    // delay estimation state; the track belongs to the session, so the
+    // callback only holds weak references to both.
+    const std::weak_ptr<PeerSession> weakSession = session;
+    const std::weak_ptr<rtc::Track> weakTrack = track;
+    track->onMessage([this, weakSession, weakTrack](rtc::message_variant data) {
+        const uint8_t *bytes = nullptr;
+        size_t size = 0;
+        if (!RtcSetup::readVariant(data, bytes, size))
+            return;
+        if (const std::shared_ptr<PeerSession> session = weakSession.lock())
+            receivePacket(*session, weakTrack.lock(), bytes, size);
     });
 
-    m_peerTracks[peerId] = track;
+    QMutexLocker locker(&m_peersMutex);
+    session->track = track;
 }
 
-// Sends audio track data to the peer
-void WebRTC::sendTrack(const QString &peerId, const QByteArray &buffer)
+// Everything a packet from the peer goes through before it reaches the
+// output: RTCP feedback on our stream, receive statistics, NACK and REMB,
+// and the payload copied out of the transport's buffer. Runs on the track's
+// thread; feedback goes out on track, which may be null.
+void WebRTC::receivePacket(PeerSession &session, const std::shared_ptr<rtc::Track> &track,
+                           const uint8_t *data, size_t size)
 {
-    // Create the RTP header and initialize an RtpHeader struct
-    RtpHeader header;
-    header.first = 0x80; // RTP version 2
-    header.marker = 0;
-    header.payloadType = m_payloadType;
-    header.sequenceNumber = qToBigEndian(m_sequenceNumber++);
-    header.timestamp = qToBigEndian(getCurrentTimestamp());
-    header.ssrc = qToBigEndian(m_ssrc);
-
-
-    // Create the RTP packet by appending the RTP header and the payload buffer
-    QByteArray packet;
-    packet.append(reinterpret_cast<const char*>(&header), sizeof(RtpHeader));
-    packet.append(buffer);
-
+    RtpPacketView packet;
+    const RtpDepacketizer::Result result = m_depacketizer.parse(data, size, packet);
+    const int64_t now = RtcpSession::nowUs();
+    if (result == RtpDepacketizer::Result::Rtcp) {
+        // The encoder is steered from the GUI thread, where AudioInput lives
+        if (session.rtcp.onRtcp(data, size, now))
+            QMetaObject::invokeMethod(this, &WebRTC::updateBitrate, Qt::QueuedConnection);
+        std::array<uint16_t, Nack::History::Capacity> requested;
+        const size_t count = Nack::parse(data, size, session.rtcp.localSsrc(), requested.data(), requested.size());
+        if (count > 0)
+            retransmit(session, requested.data(), count);
+    }
+    if (result != RtpDepacketizer::Result::Ok)
+        return;
+    // A further SSRC the peer declared is a sender of its own
+    if (const std::shared_ptr<ReceiveStream> stream = session.findStream(packet.ssrc))
+        receiveStream(*stream, session.remb, track, packet, now);
+    else
+        receiveStream(session, session.remb, track, packet, now);
+}
 
-    // Send the packet, catch and handle any errors that occur during sending
-    try {
-        if (m_peerTracks.contains(peerId)) {
-            m_peerTracks[peerId]->send(packet.toStdString());
-        }
-    } catch (const std::exception& e) {
-        qWarning() << "Failed to send track data:" << e.what();
+// The part of the receive path that belongs to one stream of the track
+void WebRTC::receiveStream(ReceiveStream &stream, bool remb, const std::shared_ptr<rtc::Track> &track,
+                           const RtpPacketView &packet, int64_t nowUs)
+{
+    stream.rtcp.onReceived(packet, nowUs);
+    const bool requested = stream.nackTracker.onReceived(packet.sequenceNumber, packet.timestamp, nowUs);
+    stream.receiveRate.onPacket(packet.timestamp, packet.payloadSize, nowUs);
+    // A cut can't wait for the next report
+    if (stream.receiveRate.takeDecrease() && remb)
+        sendRemb(track, stream.rtcp, stream.receiveRate.estimateBps());
+
+    MediaFrame frame = copyPayload(packet);
+    if (!frame.isNull()) {
+        bool delivered = true;
+        if (packet.payloadType == m_redPayloadType)
+            delivered = deliverRedPacket(stream.id, stream.redDecoder, stream.nackTracker, frame);
+        else
+            deliverFrame(stream.id, frame);
+        if (requested && delivered)
+            stream.nackTracker.onRecovered();
     }
+    // Only now, so gaps the RED blocks of this packet filled aren't requested
+    requestRetransmission(track, stream.rtcp, stream.nackTracker, packet.ssrc, nowUs);
+}
 
+// Sends every frame the input encodes to all connected peers
+void WebRTC::attachAudioInput(AudioInput *input)
+{
+    if (!input)
+        return;
+    // Direct connection: packets are built and sent on the encoder thread
+    // instead of waiting for the GUI event loop
+    connect(input, &AudioInput::audioIsReady, this, &WebRTC::broadcastTrack, Qt::DirectConnection);
+    m_input = input;
+}
+
+// Hands every received payload to the output without a QByteArray copy
+void WebRTC::attachAudioOutput(AudioOutput *output)
+{
+    if (!output)
+        return;
+    // addFrame() only queues the frame in the peer's stream, so it is safe on
+    // the network thread
+    connect(this, &WebRTC::frameReceived, output, [output](const QString &peerId, const MediaFrame &frame) {
+        output->addFrame(peerId, frame);
+    }, Qt::DirectConnection);
+    connect(this, &WebRTC::peerClosed, output, &AudioOutput::removePeer, Qt::DirectConnection);
+    connect(this, &WebRTC::streamClosed, output, &AudioOutput::removePeer, Qt::DirectConnection);
+    m_output = output;
 }
 
 
@@ -224,24 +291,71 @@ void WebRTC::sendTrack(const QString &peerId, const QByteArray &buffer)
 // Set the remote SDP description for the peer that contains metadata about the media being transmitted
 void WebRTC::setRemoteDescription(const QString &peerId, const QString &sdp)
 {
-    if (!m_peerConnections.contains(peerId))
-        addPeer(peerId);
+    addPeer(peerId);
     // Set the remote SDP description for the peer that contains metadata about the media being transmitted
-    std::shared_ptr<rtc::PeerConnection> connection = m_peerConnections[peerId];
+    const std::shared_ptr<PeerSession> session = findSession(peerId);
     QJsonDocument doc = QJsonDocument::fromJson(sdp.toUtf8());
     QJsonObject jsonObj = doc.object();
     QString type = jsonObj.value("type").toString();
     QString sdpValue = jsonObj.value("sdp").toString();
-    m_isOfferer = (type != "offer");
-    connection->setRemoteDescription(rtc::Description(sdpValue.toStdString(), type.toStdString()));
+    session->offerer = (type != "offer");
+    const rtc::Description description(sdpValue.toStdString(), type.toStdString());
+    session->red = m_redundancy > 0 && acceptsRed(description);
+    session->nack = acceptsFeedback(description, "nack");
+    session->remb = acceptsFeedback(description, "goog-remb");
+    // Streams for the SSRCs it declares exist before their packets can arrive
+    const std::vector<std::shared_ptr<ReceiveStream>> closed = session->setDeclaredSsrcs(declaredSsrcs(description));
+    session->connection->setRemoteDescription(description);
+    for (const std::shared_ptr<ReceiveStream> &stream : closed)
+        Q_EMIT streamClosed(stream->id);
+    // A new offer on a connection that is already up, e.g. the SFU telling
+    // us who else is in the call: the answer is complete right away, as the
+    // candidates were gathered before
+    if (type == "offer" && session->gatheringCompleted)
+        publishLocalDescription(peerId);
+}
+
+// Sends one RTP packet carrying the frame to every peer with an audio track.
+// The header is written into the frame's headroom, so the frame belongs to
+// the send path once it is passed in. Peers that negotiated RED get the
+// frame together with the previous ones, under the same sequence number.
+void WebRTC::broadcastTrack(const MediaFrame &frame)
+{
+    QMutexLocker locker(&m_peersMutex);
+    const uint16_t sequenceNumber = m_packetizer.nextSequenceNumber();
+    MediaFrame redPacket;
+    if (m_redundancy > 0) {
+        // Built even without RED peers so the history is there when one joins
+        redPacket = buildRedPacket(frame);
+        if (!redPacket.isNull() && !m_packetizer.writeHeader(redPacket, m_redPayloadType, sequenceNumber))
+            redPacket.reset();
+    }
+
+    MediaFrame packet = frame;
+    if (!m_packetizer.writeHeader(packet, m_payloadType, sequenceNumber)) {
+        qWarning() << "No headroom for the RTP header";
+        return;
+    }
+
+    const uint32_t rtpTimestamp = m_packetizer.rtpTimestamp(frame.timestamp());
+    const int64_t now = RtcpSession::nowUs();
+    for (const std::shared_ptr<PeerSession> &session : m_peers.sessions()) {
+        if (!session->track)
+            continue;
+        const bool red = !redPacket.isNull() && session->red;
+        const MediaFrame &sent = red ? redPacket : packet;
+        sendPacket(session->track, sent);
+        session->rtcp.onSent(rtpTimestamp, sent.size() - RtpPacketizer::HeaderSize, now);
+    }
+    m_history.store(sequenceNumber, packet, redPacket, now);
 }
 
 // Add remote ICE candidates to the peer connection
 void WebRTC::setRemoteCandidate(const QString &peerId, const QString &candidate, const QString &sdpMid)
 {
     try{
-        if (m_peerConnections.contains(peerId)) {
-            m_peerConnections[peerId]->addRemoteCandidate(rtc::Candidate(candidate.toStdString(), sdpMid.toStdString()));
+        if (const std::shared_ptr<PeerSession> session = findSession(peerId)) {
+            session->connection->addRemoteCandidate(rtc::Candidate(candidate.toStdString(), sdpMid.toStdString()));
         }
     }
     catch (const std::exception& e) {
@@ -257,23 +371,271 @@ void WebRTC::setRemoteCandidate(const QString &peerId, const QString &candidate,
  * ====================================================
  */
 
-// Utility function to read the rtc::message_variant into a QByteArray
-QByteArray WebRTC::readVariant(const rtc::message_variant &data)
+// Packs the frame and the previous ones into an RFC 2198 payload in a new pooled frame
+MediaFrame WebRTC::buildRedPacket(const MediaFrame &frame)
+{
+    m_redEncoder.setRedundancy(size_t(m_redundancy));
+    MediaFrame packet = FramePool::media().acquire();
+    const size_t size = m_redEncoder.encode(frame.data(), frame.size(), frame.timestamp(), m_payloadType,
+                                            packet.data(), packet.capacity());
+    if (size == 0)
+        return MediaFrame();
+    packet.setSize(size);
+    packet.setMarker(frame.marker());
+    packet.setTimestamp(frame.timestamp());
+    return packet;
+}
+
+// Send the packet, catch and handle any errors that occur during sending
+void WebRTC::sendPacket(const std::shared_ptr<rtc::Track> &track, const MediaFrame &packet)
+{
+    try {
+        if (track && track->isOpen())
+            track->send(reinterpret_cast<const rtc::byte *>(packet.data()), packet.size());
+    } catch (const std::exception& e) {
+        qWarning() << "Failed to send track data:" << e.what();
+    }
+}
+
+// Copies only the payload of a packet parsed in place into a pooled frame,
+// the one copy it takes to hand it to the decoder thread
+MediaFrame WebRTC::copyPayload(const RtpPacketView &packet)
+{
+    if (packet.payloadSize == 0)
+        return MediaFrame();
+    MediaFrame frame = FramePool::media().acquire();
+    if (!frame.assign(packet.payload, packet.payloadSize))
+        return MediaFrame();
+    frame.setMarker(packet.marker);
+    frame.setSequenceNumber(packet.sequenceNumber);
+    frame.setTimestamp(packet.timestamp);
+    return frame;
+}
+
+// Sends every peer its next sender or receiver report, with our delay-based
+// estimate of its stream, and tells the NACK trackers how long each peer's
+// packets currently wait before playout. A peer that sends several streams
+// gets a receiver report on each of the further ones as well.
+void WebRTC::sendReports()
+{
+    // Also lets an REMB that nobody renewed expire
+    updateBitrate();
+
+    QMutexLocker locker(&m_peersMutex);
+    const int64_t now = RtcpSession::nowUs();
+    for (const std::shared_ptr<PeerSession> &session : m_peers.sessions()) {
+        const bool enabled = m_output && session->nack;
+        const std::vector<std::shared_ptr<ReceiveStream>> streams = session->streams();
+        session->nackTracker.setPlayoutDelayMs(enabled ? m_output->playoutDelayMs(session->id) : 0);
+        for (const std::shared_ptr<ReceiveStream> &stream : streams)
+            stream->nackTracker.setPlayoutDelayMs(enabled ? m_output->playoutDelayMs(stream->id) : 0);
+
+        if (!session->track || !session->track->isOpen())
+            continue;
+        sendReport(session->track, *session, session->remb, now);
+        for (const std::shared_ptr<ReceiveStream> &stream : streams)
+            sendReport(session->track, *stream, session->remb, now);
+    }
+}
+
+void WebRTC::sendReport(const std::shared_ptr<rtc::Track> &track, ReceiveStream &stream, bool remb, int64_t nowUs)
+{
+    MediaFrame report = FramePool::media().acquire();
+    size_t size = stream.rtcp.buildReport(report.data(), report.capacity(), nowUs);
+    if (size == 0)
+        return;
+    if (remb)
+        size += stream.rtcp.buildRemb(report.data() + size, report.capacity() - size,
+                                      stream.receiveRate.estimateBps());
+    report.setSize(size);
+    sendPacket(track, report);
+}
+
+void WebRTC::sendRemb(const std::shared_ptr<rtc::Track> &track, const RtcpSession &rtcp, int64_t bps)
+{
+    MediaFrame remb = FramePool::media().acquire();
+    const size_t size = rtcp.buildRemb(remb.data(), remb.capacity(), bps);
+    if (size == 0)
+        return;
+    remb.setSize(size);
+    sendPacket(track, remb);
+}
+
+// Feeds new reports and REMBs into each peer's estimator and points the
+// encoder at the rate the most constrained peer can take. There is one
+// encoder for all peers, so the slowest path sets the pace.
+void WebRTC::updateBitrate()
+{
+    const int64_t now = RtcpSession::nowUs();
+    int64_t targetBps = 0;
+    float loss = 0.0f;
+    {
+        QMutexLocker locker(&m_peersMutex);
+        for (const std::shared_ptr<PeerSession> &session : m_peers.sessions()) {
+            const RtcpSession::Stats stats = session->rtcp.stats();
+            if (stats.reportsReceived != session->reportsSeen) {
+                session->reportsSeen = stats.reportsReceived;
+                session->sendRate.onReport(stats.remoteFractionLost, now);
+            }
+            if (stats.rembsReceived != session->rembsSeen) {
+                session->rembsSeen = stats.rembsReceived;
+                session->sendRate.onRemb(stats.rembBps, now);
+            }
+            // Nothing heard from the peer about our stream yet
+            if (session->reportsSeen == 0 && session->rembsSeen == 0)
+                continue;
+            const int64_t peerBps = session->sendRate.targetBps(now);
+            targetBps = targetBps == 0 ? peerBps : std::min(targetBps, peerBps);
+            loss = std::max(loss, session->sendRate.lossFraction());
+        }
+    }
+    if (targetBps == 0 || !m_adaptiveBitrate || !m_input)
+        return;
+
+    const Bandwidth::EncoderTarget target = m_encoderController.update(targetBps, loss, m_bitRate);
+    OpusEncoderSettings settings = m_input->encoderSettings();
+    // Whole kbps, so small wobbles of the estimate don't reconfigure the encoder
+    const int bitrate = target.bitrate / 1000 * 1000;
+    if (settings.bitrate != bitrate || settings.inbandFec != target.inbandFec
+        || settings.packetLossPercent != target.packetLossPercent) {
+        settings.bitrate = bitrate;
+        settings.inbandFec = target.inbandFec;
+        settings.packetLossPercent = target.packetLossPercent;
+        m_input->setEncoderSettings(settings);
+    }
+    if (m_input->frameDuration() != target.frameMs)
+        m_input->setFrameDuration(target.frameMs);
+}
+
+// The rate on the wire of bitRate in 20 ms packets, the most the estimators allow
+int64_t WebRTC::maxSendBps() const
+{
+    return int64_t(m_bitRate) + int64_t(Bandwidth::PacketOverhead) * 8 * 1000 / 20;
+}
+
+// Sends the peer a NACK for the missing packets that are due for a request
+void WebRTC::requestRetransmission(const std::shared_ptr<rtc::Track> &track, const RtcpSession &rtcp,
+                                   Nack::Tracker &tracker, uint32_t mediaSsrc, int64_t nowUs)
 {
-    QByteArray resultData;
-    if (std::holds_alternative<rtc::binary>(data)) {
-        const rtc::binary &binData = std::get<rtc::binary>(data);
-        resultData =  QByteArray(reinterpret_cast<const char *>(binData.data()),
-                          static_cast<int>(binData.size()));
+    std::array<uint16_t, Nack::Tracker::MaxMissing> missing;
+    const size_t count = tracker.due(nowUs, rtcp.rttMs(), missing.data(), missing.size());
+    if (count == 0)
+        return;
+    MediaFrame request = FramePool::media().acquire();
+    const size_t size = Nack::write(rtcp.localSsrc(), mediaSsrc, missing.data(), count,
+                                    request.data(), request.capacity());
+    if (size == 0)
+        return;
+    request.setSize(size);
+    sendPacket(track, request);
+}
 
-    } else if (std::holds_alternative<std::string>(data)) {
-        const std::string &strData = std::get<std::string>(data);
-        resultData =  QByteArray(strData.c_str(), static_cast<int>(strData.size()));
+// Sends the packets a peer asked for again, as they went out the first time
+void WebRTC::retransmit(PeerSession &session, const uint16_t *sequenceNumbers, size_t count)
+{
+    QMutexLocker locker(&m_peersMutex);
+    if (!session.track)
+        return;
+    const int64_t now = RtcpSession::nowUs();
+    for (size_t i = 0; i < count; ++i) {
+        const MediaFrame packet = m_history.find(sequenceNumbers[i], session.red, now);
+        if (packet.isNull())
+            continue;
+        sendPacket(session.track, packet);
+        session.rtcp.onRetransmitted();
     }
-    if (resultData.size())
-        resultData.remove(0, sizeof(RtpHeader));
+}
 
-    return resultData;
+void WebRTC::deliverFrame(const QString &peerId, const MediaFrame &frame)
+{
+    Q_EMIT frameReceived(peerId, frame);
+    // The QByteArray copy is only made for listeners that still want one
+    if (isSignalConnected(QMetaMethod::fromSignal(&WebRTC::incommingPacket))) {
+        const QByteArray receivedData(reinterpret_cast<const char *>(frame.data()), qsizetype(frame.size()));
+        Q_EMIT incommingPacket(peerId, receivedData, receivedData.size());
+    }
+}
+
+// Hands on the frames of a RED payload that haven't been seen yet, oldest
+// first, so frames lost earlier are decoded before the current one. Their
+// packets are taken off the NACK tracker's list. Returns whether the primary
+// frame was passed on.
+bool WebRTC::deliverRedPacket(const QString &peerId, Red::Decoder &decoder, Nack::Tracker &tracker,
+                              MediaFrame &packet)
+{
+    std::array<Red::Block, Red::MaxRedundancy + 1> blocks;
+    const size_t count = decoder.unpack(packet.data(), packet.size(), packet.timestamp(),
+                                        blocks.data(), blocks.size());
+    for (size_t i = 0; i < count; ++i) {
+        const Red::Block &block = blocks[i];
+        if (i + 1 == count && block.timestamp == packet.timestamp()) {
+            // The primary is the tail of the packet, so it is used in place
+            packet.trimFront(size_t(block.data - packet.data()));
+            deliverFrame(peerId, packet);
+            return true;
+        }
+        const uint16_t sequenceNumber = uint16_t(packet.sequenceNumber() - block.distance);
+        MediaFrame recovered = FramePool::media().acquire();
+        if (!recovered.assign(block.data, block.size))
+            continue;
+        recovered.setTimestamp(block.timestamp);
+        recovered.setSequenceNumber(sequenceNumber);
+        tracker.onRepaired(sequenceNumber);
+        deliverFrame(peerId, recovered);
+    }
+    return false;
+}
+
+// The SSRCs the remote audio section declares, in the order listed
+std::vector<uint32_t> WebRTC::declaredSsrcs(const rtc::Description &description)
+{
+    for (int i = 0; i < description.mediaCount(); ++i) {
+        const auto media = description.media(i);
+        if (!std::holds_alternative<const rtc::Description::Media *>(media))
+            continue;
+        const rtc::Description::Media *audio = std::get<const rtc::Description::Media *>(media);
+        if (audio->type() == "audio")
+            return audio->getSSRCs();
+    }
+    return {};
+}
+
+// True if the remote audio section lists a red/48000 codec
+bool WebRTC::acceptsRed(const rtc::Description &description)
+{
+    for (int i = 0; i < description.mediaCount(); ++i) {
+        const auto media = description.media(i);
+        if (!std::holds_alternative<const rtc::Description::Media *>(media))
+            continue;
+        const rtc::Description::Media *audio = std::get<const rtc::Description::Media *>(media);
+        for (int payloadType : audio->payloadTypes()) {
+            const rtc::Description::Media::RtpMap *map = audio->rtpMap(payloadType);
+            if (map && QString::fromStdString(map->format).compare("red", Qt::CaseInsensitive) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+// True if the remote audio section lists the RTCP feedback (e.g. "nack") for Opus
+bool WebRTC::acceptsFeedback(const rtc::Description &description, const std::string &feedback)
+{
+    for (int i = 0; i < description.mediaCount(); ++i) {
+        const auto media = description.media(i);
+        if (!std::holds_alternative<const rtc::Description::Media *>(media))
+            continue;
+        const rtc::Description::Media *audio = std::get<const rtc::Description::Media *>(media);
+        for (int payloadType : audio->payloadTypes()) {
+            const rtc::Description::Media::RtpMap *map = audio->rtpMap(payloadType);
+            if (!map || QString::fromStdString(map->format).compare("opus", Qt::CaseInsensitive) != 0)
+                continue;
+            for (const std::string &listed : map->rtcpFbs) {
+                if (listed == feedback)
+                    return true;
+            }
+        }
+    }
+    return false;
 }
 
 // Utility function to convert rtc::Description to JSON format
@@ -286,6 +648,34 @@ QString WebRTC::descriptionToJson(const rtc::Description &description)
     return doc.toJson();
 }
 
+// Hands the peer our description once its candidates are gathered, as an
+// offer or an answer depending on the role we have towards it
+void WebRTC::publishLocalDescription(const QString &peerId)
+{
+    const std::shared_ptr<PeerSession> session = findSession(peerId);
+    if (!session || !session->gatheringCompleted)
+        return;
+    const std::optional<rtc::Description> description = session->connection->localDescription();
+    if (!description)
+        return;
+    const QString json = descriptionToJson(*description);
+    {
+        QMutexLocker locker(&m_peersMutex);
+        session->localDescription = json;
+    }
+    Q_EMIT localDescriptionGenerated(peerId, json);
+    if (session->offerer)
+        Q_EMIT offerIsReady(peerId, json);
+    else
+        Q_EMIT answerIsReady(peerId, json);
+}
+
+std::shared_ptr<PeerSession> WebRTC::findSession(const QString &peerId) const
+{
+    QMutexLocker locker(&m_peersMutex);
+    return m_peers.find(peerId);
+}
+
 // Retrieves the current bit rate
 int WebRTC::bitRate() const
 {
@@ -295,13 +685,59 @@ int WebRTC::bitRate() const
 // Set a new bit rate and emit the bitRateChanged signal
 void WebRTC::setBitRate(int newBitRate)
 {
+    if (m_bitRate == newBitRate)
+        return;
     m_bitRate = newBitRate;
+    {
+        QMutexLocker locker(&m_peersMutex);
+        for (const std::shared_ptr<PeerSession> &session : m_peers.sessions())
+            session->sendRate.setMaxBps(maxSendBps());
+    }
+    Q_EMIT bitRateChanged();
 }
 
 // Reset the bit rate to its default value
 void WebRTC::resetBitRate()
 {
-    m_bitRate = 48000;
+    setBitRate(48000);
+}
+
+int WebRTC::redundancy() const
+{
+    return m_redundancy;
+}
+
+// Sets the RED depth (0 to Red::MaxRedundancy) and emit the redundancyChanged signal
+void WebRTC::setRedundancy(int newRedundancy)
+{
+    newRedundancy = qBound(0, newRedundancy, int(Red::MaxRedundancy));
+    if (m_redundancy == newRedundancy)
+        return;
+    {
+        // Also read by broadcastTrack on the encoder thread
+        QMutexLocker locker(&m_peersMutex);
+        m_redundancy = newRedundancy;
+    }
+    Q_EMIT redundancyChanged();
+}
+
+void WebRTC::resetRedundancy()
+{
+    setRedundancy(0);
+}
+
+bool WebRTC::adaptiveBitrate() const
+{
+    return m_adaptiveBitrate;
+}
+
+// Off leaves the input's encoder settings as they are
+void WebRTC::setAdaptiveBitrate(bool newAdaptiveBitrate)
+{
+    if (m_adaptiveBitrate == newAdaptiveBitrate)
+        return;
+    m_adaptiveBitrate = newAdaptiveBitrate;
+    Q_EMIT adaptiveBitrateChanged();
 }
 
 // Sets a new payload type and emit the payloadTypeChanged signal
@@ -326,12 +762,91 @@ rtc::SSRC WebRTC::ssrc() const
 void WebRTC::setSsrc(rtc::SSRC newSsrc)
 {
     m_ssrc = newSsrc;
+    QMutexLocker locker(&m_peersMutex);
+    m_packetizer.setSsrc(newSsrc);
+    for (const std::shared_ptr<PeerSession> &session : m_peers.sessions())
+        session->setLocalSsrc(newSsrc);
 }
 
 // Reset the SSRC to its default value
 void WebRTC::resetSsrc()
 {
-    m_ssrc = 2;
+    setSsrc(2);
+}
+
+QVariantMap WebRTC::receiveStats() const
+{
+    const RtpDepacketizer::Stats stats = m_depacketizer.stats();
+    return {
+        {"packets", qulonglong(stats.packets)},
+        {"rtcp", qulonglong(stats.rtcp)},
+        {"tooShort", qulonglong(stats.tooShort)},
+        {"badVersion", qulonglong(stats.badVersion)},
+        {"truncatedHeader", qulonglong(stats.truncatedHeader)},
+        {"badPadding", qulonglong(stats.badPadding)},
+    };
+}
+
+QVariantMap WebRTC::getStats(const QString &peerId) const
+{
+    std::shared_ptr<PeerSession> session;
+    int64_t estimateBps = 0;
+    {
+        QMutexLocker locker(&m_peersMutex);
+        session = m_peers.find(peerId);
+        if (!session)
+            return {};
+        estimateBps = session->sendRate.targetBps(RtcpSession::nowUs());
+    }
+
+    const RtcpSession::Stats stats = session->rtcp.stats();
+    const Nack::Tracker::Stats nack = session->nackTracker.stats();
+    // The further streams the peer sends, with their receive-side figures
+    QVariantList streams;
+    for (const std::shared_ptr<ReceiveStream> &stream : session->streams()) {
+        const RtcpSession::Stats received = stream->rtcp.stats();
+        const Nack::Tracker::Stats recovered = stream->nackTracker.stats();
+        streams.append(QVariantMap{
+            {"id", stream->id},
+            {"ssrc", qulonglong(stream->ssrc)},
+            {"packetsReceived", qulonglong(received.packetsReceived)},
+            {"bytesReceived", qulonglong(received.bytesReceived)},
+            {"fractionLost", received.fractionLost},
+            {"cumulativeLost", qlonglong(received.cumulativeLost)},
+            {"jitterMs", received.jitterMs},
+            {"nackRequested", qulonglong(recovered.requested)},
+            {"nackRecovered", qulonglong(recovered.recovered)},
+            {"nackExpired", qulonglong(recovered.expired)},
+            {"receiveEstimateBps", qlonglong(stream->receiveRate.estimateBps())},
+            {"incomingBps", qlonglong(stream->receiveRate.incomingBps())},
+        });
+    }
+    return {
+        {"packetsSent", qulonglong(stats.packetsSent)},
+        {"bytesSent", qulonglong(stats.bytesSent)},
+        {"packetsRetransmitted", qulonglong(stats.packetsRetransmitted)},
+        {"packetsReceived", qulonglong(stats.packetsReceived)},
+        {"bytesReceived", qulonglong(stats.bytesReceived)},
+        {"fractionLost", stats.fractionLost},
+        {"cumulativeLost", qlonglong(stats.cumulativeLost)},
+        {"jitterMs", stats.jitterMs},
+        {"remoteFractionLost", stats.remoteFractionLost},
+        {"remoteCumulativeLost", qlonglong(stats.remoteCumulativeLost)},
+        {"remoteJitterMs", stats.remoteJitterMs},
+        {"rttMs", stats.rttMs},
+        // Invalid until the peer sent a report
+        {"lastSenderReport", stats.lastSenderReportUs != 0
+                                 ? QDateTime::fromMSecsSinceEpoch(stats.lastSenderReportUs / 1000)
+                                 : QDateTime()},
+        {"nackRequested", qulonglong(nack.requested)},
+        {"nackRecovered", qulonglong(nack.recovered)},
+        {"nackExpired", qulonglong(nack.expired)},
+        {"sendEstimateBps", qlonglong(estimateBps)},
+        {"rembBps", qlonglong(stats.rembBps)},
+        {"receiveEstimateBps", qlonglong(session->receiveRate.estimateBps())},
+        {"incomingBps", qlonglong(session->receiveRate.incomingBps())},
+        {"streams", streams},
+    };
 }
 
 // Retrieve the current payload type
@@ -364,17 +879,19 @@ void WebRTC::resetIsOfferer()
 
 void WebRTC::removeConnectionData(const QString &peerId)
 {
-    if (m_peerConnections.contains(peerId)) {
-        m_peerConnections.remove(peerId);
-        m_peerTracks.remove(peerId);
-        m_gatheringCompleted = false;
+    std::shared_ptr<PeerSession> session;
+    {
+        QMutexLocker locker(&m_peersMutex);
+        session = m_peers.remove(peerId);
     }
+    // Dropped outside the lock; the last reference may still be held by a
+    // track callback that is running
 }
 
 void WebRTC::closeConnection(const QString &peerId)
 {
-    if (m_peerConnections.contains(peerId)) {
-        m_peerConnections[peerId]->close();
+    if (const std::shared_ptr<PeerSession> session = findSession(peerId)) {
+        session->connection->close();
         removeConnectionData(peerId);
     }
 }
@@ -2,10 +2,25 @@
 #define WEBRTC_H
 
 #include <QObject>
-#include <QMap>
+#include <QMutex>
+#include <QPointer>
+#include <QTimer>
+#include <QVariantMap>
 
 // Build the datachannellib library and add the include path to .pro file
 #include <rtc/rtc.hpp>
+#include "src/audio/framepool.h"
+#include "bandwidthestimator.h"
+#include "nack.h"
+#include "peersession.h"
+#include "redcodec.h"
+#include "rtcpsession.h"
+#include "rtcsetup.h"
+#include "rtpdepacketizer.h"
+#include "rtppacketizer.h"
+
+class AudioInput;
+class AudioOutput;
 
 class WebRTC : public QObject
 {
@@ -17,13 +32,25 @@ public:
 
     // Q_INVOKABLE void init(const QString &id, bool isOfferer = false);
     Q_INVOKABLE void init(const QString &id, bool isOfferer = false);
+    // Replaces the ICE configuration init() set up, for the peers added from
+    // then on; e.g. without STUN and TURN for peers on the same machine
+    void setConfiguration(const rtc::Configuration &config);
     Q_INVOKABLE void addPeer(const QString &peerId);
     Q_INVOKABLE void generateOfferSDP(const QString &peerId);
     Q_INVOKABLE void generateAnswerSDP(const QString &peerId);
     Q_INVOKABLE void addAudioTrack(const QString &peerId, const QString &trackName);
-    Q_INVOKABLE void sendTrack(const QString &peerId, const QByteArray &buffer);
+    Q_INVOKABLE void attachAudioInput(AudioInput *input);
+    Q_INVOKABLE void attachAudioOutput(AudioOutput *output);
     Q_INVOKABLE void closeConnection(const QString &peerId);
-
+    // Received RTP packets, and the ones dropped as malformed by reason, over all peers
+    Q_INVOKABLE QVariantMap receiveStats() const;
+    // RTCP figures of the call with one peer: what was sent and received,
+    // loss and jitter both ways, RTT, the peer's last sender report and
+    // the retransmissions requested and served. A peer that sends several
+    // streams, like the SFU, also lists the further ones under "streams".
+    Q_INVOKABLE QVariantMap getStats(const QString &peerId) const;
+
+    // The role given to init(); each peer's own role follows its offer/answer
     bool isOfferer() const;
     void setIsOfferer(bool newIsOfferer);
     void resetIsOfferer();
@@ -40,12 +67,41 @@ public:
     void setBitRate(int newBitRate);
     void resetBitRate();
 
+    // RFC 2198 redundancy depth: number of earlier frames repeated in every
+    // packet. RED is only offered if this is above 0 when init() runs, and
+    // only used towards peers whose description accepts it.
+    int redundancy() const;
+    void setRedundancy(int newRedundancy);
+    void resetRedundancy();
+
+    // Steers the attached input's Opus bitrate, frame size and FEC from the
+    // peers' feedback, never above bitRate
+    bool adaptiveBitrate() const;
+    void setAdaptiveBitrate(bool newAdaptiveBitrate);
+
+    // The receive path of a peer's track, from the transport's bytes to
+    // frameReceived. Public so tools can run it without a connection.
+    void receivePacket(PeerSession &session, const std::shared_ptr<rtc::Track> &track,
+                       const uint8_t *data, size_t size);
+
 Q_SIGNALS:
 
     void connectionClosed();
 
+    // Emitted on the libdatachannel thread when a peer's connection closes
+    void peerClosed(const QString &peerId);
+
+    // Emitted when a further stream of a peer (see PeerSession) ends: its
+    // SSRC left the peer's description, or the peer's connection closed
+    void streamClosed(const QString &streamId);
+
     void incommingPacket(const QString &peerId, const QByteArray &data, qint64 len);
 
+    // Emitted on the libdatachannel thread with the RTP payload of every
+    // received packet, as a pooled frame. peerId is the stream's id, which
+    // is "peerId#ssrc" for the further streams of a peer.
+    void frameReceived(const QString &peerId, const MediaFrame &frame);
+
     void localDescriptionGenerated(const QString &peerId, const QString &sdp);
 
     void localCandidateGenerated(const QString &peerId, const QString &candidate, const QString &sdpMid);
@@ -64,47 +120,81 @@ Q_SIGNALS:
 
     void bitRateChanged();
 
+    void redundancyChanged();
+
+    void adaptiveBitrateChanged();
+
     void rtcConnected();
 
 public Q_SLOTS:
 
     void setRemoteDescription(const QString &peerId, const QString &sdp);
     void setRemoteCandidate(const QString &peerId, const QString &candidate, const QString &sdpMid);
+    void broadcastTrack(const MediaFrame &frame);
 
 private:
-    QByteArray readVariant(const rtc::message_variant &data);
+    MediaFrame buildRedPacket(const MediaFrame &frame);
+    void sendPacket(const std::shared_ptr<rtc::Track> &track, const MediaFrame &packet);
+    MediaFrame copyPayload(const RtpPacketView &packet);
+    void receiveStream(ReceiveStream &stream, bool remb, const std::shared_ptr<rtc::Track> &track,
+                       const RtpPacketView &packet, int64_t nowUs);
+    void sendReports();
+    void sendReport(const std::shared_ptr<rtc::Track> &track, ReceiveStream &stream, bool remb, int64_t nowUs);
+    void requestRetransmission(const std::shared_ptr<rtc::Track> &track, const RtcpSession &rtcp,
+                               Nack::Tracker &tracker, uint32_t mediaSsrc, int64_t nowUs);
+    void retransmit(PeerSession &session, const uint16_t *sequenceNumbers, size_t count);
+    void sendRemb(const std::shared_ptr<rtc::Track> &track, const RtcpSession &rtcp, int64_t bps);
+    void updateBitrate();
+    int64_t maxSendBps() const;
+    void deliverFrame(const QString &peerId, const MediaFrame &frame);
+    bool deliverRedPacket(const QString &peerId, Red::Decoder &decoder, Nack::Tracker &tracker, MediaFrame &packet);
+    std::vector<uint32_t> declaredSsrcs(const rtc::Description &description);
+    bool acceptsRed(const rtc::Description &description);
+    bool acceptsFeedback(const rtc::Description &description, const std::string &feedback);
     QString descriptionToJson(const rtc::Description &description);
+    void publishLocalDescription(const QString &peerId);
+    std::shared_ptr<PeerSession> findSession(const QString &peerId) const;
     void removeConnectionData(const QString &peerId);
 
-    inline uint32_t getCurrentTimestamp() {
-        using namespace std::chrono;
-        auto now = steady_clock::now();
-        auto ms = duration_cast<milliseconds>(now.time_since_epoch()).count();
-        return static_cast<uint32_t>(ms);
-    }
-
 private:
-    static inline uint16_t                              m_sequenceNumber = 0;
     static inline uint32_t                              m_instanceCounter = 0;
-    bool                                                m_gatheringCompleted = false;
     int                                                 m_bitRate = 48000;
     int                                                 m_payloadType = 111;
+    int                                                 m_redPayloadType = 63;
+    int                                                 m_redundancy = 0;
+    // Only used on the encoder thread, in broadcastTrack
+    Red::Encoder                                        m_redEncoder;
+    // SSRC, sequence numbers and timestamp offset of the outgoing stream, guarded by m_peersMutex
+    RtpPacketizer                                       m_packetizer;
+    // Recently sent packets, for peers that ask for one again; guarded by m_peersMutex
+    Nack::History                                       m_history;
+    // Stateless apart from its counters, shared by every track's callback
+    RtpDepacketizer                                     m_depacketizer;
     rtc::Description::Audio                             m_audio;
     rtc::SSRC                                           m_ssrc = 2;
     bool                                                m_isOfferer = false;
     QString                                             m_localId;
     rtc::Configuration                                  m_config;
-    QMap<QString, rtc::Description>                     m_peerSdps;
-    QMap<QString, std::shared_ptr<rtc::PeerConnection>> m_peerConnections;
-    QMap<QString, std::shared_ptr<rtc::Track>>          m_peerTracks;
-    QString                                             m_localDescription;
-    QString                                             m_remoteDescription;
+    // Every peer, guarded by m_peersMutex. The track callbacks hold their
+    // own session, so only signalling and statistics look peers up by id.
+    PeerTable                                           m_peers;
+    // Tells the trackers how long the peers' packets wait before playout
+    QPointer<AudioOutput>                               m_output;
+    // Congestion control, only used on the GUI thread
+    Bandwidth::EncoderController                        m_encoderController;
+    QPointer<AudioInput>                                m_input;
+    bool                                                m_adaptiveBitrate = true;
+    QTimer                                              m_reportTimer;
+    // The table is also read from the encoder thread and written from libdatachannel threads
+    mutable QMutex                                      m_peersMutex;
 
 
     Q_PROPERTY(bool isOfferer READ isOfferer WRITE setIsOfferer RESET resetIsOfferer NOTIFY isOffererChanged FINAL)
     Q_PROPERTY(rtc::SSRC ssrc READ ssrc WRITE setSsrc RESET resetSsrc NOTIFY ssrcChanged FINAL)
     Q_PROPERTY(int payloadType READ payloadType WRITE setPayloadType RESET resetPayloadType NOTIFY payloadTypeChanged FINAL)
     Q_PROPERTY(int bitRate READ bitRate WRITE setBitRate RESET resetBitRate NOTIFY bitRateChanged FINAL)
+    Q_PROPERTY(int redundancy READ redundancy WRITE setRedundancy RESET resetRedundancy NOTIFY redundancyChanged FINAL)
+    Q_PROPERTY(bool adaptiveBitrate READ adaptiveBitrate WRITE setAdaptiveBitrate NOTIFY adaptiveBitrateChanged FINAL)
 };
 
 #endif // WEBRTC_H
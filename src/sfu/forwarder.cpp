@@ -0,0 +1,323 @@
+#include "forwarder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static constexpr size_t RtpHeaderSize = 12;
+// Enough for every packet queued at once; the frames are shared by the workers
+static constexpr size_t PoolFrames = Forwarder::QueueCapacity;
+static constexpr size_t PoolHeadroom = 0;
+// Opus' RTP clock, for the timestamp gap across a publisher restart
+static constexpr int64_t ClockRate = 48000;
+
+static uint16_t readBigEndian16(const uint8_t *data)
+{
+    return uint16_t((data[0] << 8) | data[1]);
+}
+
+static uint32_t readBigEndian32(const uint8_t *data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+}
+
+static void writeBigEndian16(uint8_t *data, uint16_t value)
+{
+    data[0] = uint8_t(value >> 8);
+    data[1] = uint8_t(value);
+}
+
+static void writeBigEndian32(uint8_t *data, uint32_t value)
+{
+    data[0] = uint8_t(value >> 24);
+    data[1] = uint8_t(value >> 16);
+    data[2] = uint8_t(value >> 8);
+    data[3] = uint8_t(value);
+}
+
+// Multiplying by an odd constant is a bijection on 32-bit values, so every
+// serial gets its own SSRC, and they don't look sequential on the wire
+static uint32_t ssrcForSerial(uint32_t serial)
+{
+    return serial * 0x9E3779B1u;
+}
+
+Forwarder::Forwarder(size_t threads)
+    : m_pool(PoolFrames, MaxPacketSize, PoolHeadroom),
+    m_serials(std::make_unique<std::atomic<uint32_t>[]>(MaxParticipants))
+{
+    for (int slot = 0; slot < MaxParticipants; ++slot)
+        m_serials[size_t(slot)].store(0, std::memory_order_relaxed);
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->scratch.resize(MaxPacketSize);
+        m_workers.push_back(std::move(worker));
+    }
+    for (const auto &worker : m_workers)
+        worker->thread = std::thread(&Forwarder::run, this, std::ref(*worker));
+}
+
+Forwarder::~Forwarder()
+{
+    m_stopping.store(true);
+    for (const auto &worker : m_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+        }
+        worker->wake.notify_one();
+    }
+    for (const auto &worker : m_workers)
+        worker->thread.join();
+}
+
+int64_t Forwarder::nowUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int Forwarder::addParticipant(Sink sink, int payloadType)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int slot = 0;
+    while (slot < MaxParticipants && m_serials[size_t(slot)].load(std::memory_order_relaxed) != 0)
+        ++slot;
+    if (slot == MaxParticipants)
+        return -1;
+
+    Command command;
+    command.add = true;
+    command.subscriber.slot = slot;
+    command.subscriber.serial = m_nextSerial++;
+    command.subscriber.sink = std::move(sink);
+    command.subscriber.payloadType = payloadType;
+    const uint32_t serial = command.subscriber.serial;
+    Worker &worker = workerFor(slot);
+    worker.subscriberCount.fetch_add(1, std::memory_order_relaxed);
+    post(worker, std::move(command));
+    // Its packets are only taken from here on
+    m_serials[size_t(slot)].store(serial, std::memory_order_release);
+    ++m_participants;
+    return slot;
+}
+
+void Forwarder::removeParticipant(int slot)
+{
+    if (slot < 0 || slot >= MaxParticipants)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint32_t serial = m_serials[size_t(slot)].exchange(0, std::memory_order_acq_rel);
+    if (serial == 0)
+        return;
+    // Commands for one slot all go to the same worker, so a removal is
+    // applied before the add of whoever takes the slot next
+    Command command;
+    command.subscriber.slot = slot;
+    command.subscriber.serial = serial;
+    Worker &worker = workerFor(slot);
+    worker.subscriberCount.fetch_sub(1, std::memory_order_relaxed);
+    post(worker, std::move(command));
+    --m_participants;
+}
+
+uint32_t Forwarder::outputSsrc(int slot) const
+{
+    if (slot < 0 || slot >= MaxParticipants)
+        return 0;
+    const uint32_t serial = m_serials[size_t(slot)].load(std::memory_order_acquire);
+    return serial != 0 ? ssrcForSerial(serial) : 0;
+}
+
+int Forwarder::participants() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_participants;
+}
+
+bool Forwarder::push(int slot, const uint8_t *data, size_t size)
+{
+    m_received.fetch_add(1, std::memory_order_relaxed);
+    const uint32_t serial = slot >= 0 && slot < MaxParticipants
+        ? m_serials[size_t(slot)].load(std::memory_order_acquire) : 0;
+    if (serial == 0 || size < RtpHeaderSize || size > MaxPacketSize || (data[0] >> 6) != 2) {
+        m_invalid.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Job job;
+    job.source = slot;
+    job.serial = serial;
+    job.packet = m_pool.acquire();
+    job.packet.assign(data, size);
+    job.queuedUs = nowUs();
+
+    bool queued = false;
+    for (const auto &worker : m_workers) {
+        // Workers without subscribers, not even pending ones, don't need to see it
+        if (worker->subscriberCount.load(std::memory_order_relaxed) == 0)
+            continue;
+        if (!worker->queue.push(job))
+            continue;
+        queued = true;
+        worker->pending.fetch_add(1);
+        if (worker->sleeping.load()) {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->wake.notify_one();
+        }
+    }
+    return queued;
+}
+
+Forwarder::Stats Forwarder::stats() const
+{
+    Stats result;
+    result.received = m_received.load(std::memory_order_relaxed);
+    result.invalid = m_invalid.load(std::memory_order_relaxed);
+    for (const auto &worker : m_workers) {
+        result.forwarded += worker->forwarded.load(std::memory_order_relaxed);
+        result.restarts += worker->restarts.load(std::memory_order_relaxed);
+        result.queueOverflows += worker->queue.overflowCount();
+    }
+    return result;
+}
+
+LatencyHistogram::Summary Forwarder::latency() const
+{
+    LatencyHistogram merged;
+    for (const auto &worker : m_workers)
+        merged.merge(worker->latency);
+    return merged.summary();
+}
+
+void Forwarder::post(Worker &worker, Command command)
+{
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.commands.push_back(std::move(command));
+        worker.hasCommands.store(true);
+    }
+    worker.wake.notify_one();
+}
+
+// The producer publishes a job before it counts it and only then checks
+// whether the worker sleeps; the worker says it sleeps before it checks the
+// count. Both are sequentially consistent, so one of them always sees the
+// other and no wake-up is lost.
+void Forwarder::run(Worker &worker)
+{
+    while (true) {
+        Job job;
+        if (worker.queue.pop(job)) {
+            worker.pending.fetch_sub(1);
+            // A participant's add is posted before its slot is published, so
+            // once a job from it has been popped the add is visible here
+            if (worker.hasCommands.load(std::memory_order_acquire))
+                applyCommands(worker);
+            forward(worker, job);
+            continue;
+        }
+        if (worker.hasCommands.load(std::memory_order_acquire)) {
+            applyCommands(worker);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        worker.sleeping.store(true);
+        worker.wake.wait(lock, [&] {
+            return worker.pending.load() > 0 || worker.hasCommands.load() || m_stopping.load();
+        });
+        worker.sleeping.store(false);
+        if (m_stopping.load())
+            break;
+    }
+    // Sinks may hold connections; let them go on this thread
+    worker.subscribers.clear();
+}
+
+void Forwarder::applyCommands(Worker &worker)
+{
+    std::vector<Command> commands;
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        commands.swap(worker.commands);
+        worker.hasCommands.store(false);
+    }
+    for (Command &command : commands) {
+        if (command.add) {
+            worker.subscribers.push_back(std::move(command.subscriber));
+            continue;
+        }
+        const Subscriber &removed = command.subscriber;
+        worker.subscribers.erase(std::remove_if(worker.subscribers.begin(), worker.subscribers.end(),
+                                                [&](const Subscriber &subscriber) {
+                                                    return subscriber.slot == removed.slot
+                                                           && subscriber.serial == removed.serial;
+                                                }),
+                                 worker.subscribers.end());
+    }
+}
+
+void Forwarder::forward(Worker &worker, const Job &job)
+{
+    // Queued before its publisher left, or before someone else took the slot
+    if (m_serials[size_t(job.source)].load(std::memory_order_acquire) != job.serial)
+        return;
+
+    const size_t size = job.packet.size();
+    uint8_t *packet = worker.scratch.data();
+    // The payload is the same for everyone; only the header is rewritten per subscriber
+    std::memcpy(packet, job.packet.data(), size);
+    const uint16_t sequenceNumber = readBigEndian16(packet + 2);
+    const uint32_t timestamp = readBigEndian32(packet + 4);
+    const uint32_t ssrc = readBigEndian32(packet + 8);
+    const uint8_t markerAndType = packet[1];
+    const uint32_t outputSsrc = ssrcForSerial(job.serial);
+    const int64_t now = nowUs();
+
+    uint64_t forwarded = 0;
+    uint64_t restarts = 0;
+    for (Subscriber &subscriber : worker.subscribers) {
+        if (subscriber.slot == job.source)
+            continue;
+        if (subscriber.rewrites.size() <= size_t(job.source))
+            subscriber.rewrites.resize(size_t(job.source) + 1);
+        Rewrite &rewrite = subscriber.rewrites[size_t(job.source)];
+        if (rewrite.serial != job.serial) {
+            // A new publisher in this slot: its numbers go through unchanged
+            rewrite = Rewrite();
+            rewrite.serial = job.serial;
+            rewrite.sourceSsrc = ssrc;
+            rewrite.lastSequence = uint16_t(sequenceNumber - 1);
+            rewrite.lastTimestamp = timestamp;
+            rewrite.lastUs = now;
+        } else if (rewrite.sourceSsrc != ssrc) {
+            // The publisher restarted its stream: carry on from the last
+            // packet sent, with the time that passed since on the clock
+            const int64_t elapsed = std::max<int64_t>((now - rewrite.lastUs) * ClockRate / 1000000, 1);
+            rewrite.sourceSsrc = ssrc;
+            rewrite.sequenceOffset = uint16_t(rewrite.lastSequence + 1 - sequenceNumber);
+            rewrite.timestampOffset = uint32_t(rewrite.lastTimestamp + uint32_t(elapsed) - timestamp);
+            ++restarts;
+        }
+
+        const uint16_t outputSequence = uint16_t(sequenceNumber + rewrite.sequenceOffset);
+        const uint32_t outputTimestamp = timestamp + rewrite.timestampOffset;
+        // Reordered or repeated packets are forwarded but don't move the state on
+        if (int16_t(outputSequence - rewrite.lastSequence) > 0) {
+            rewrite.lastSequence = outputSequence;
+            rewrite.lastTimestamp = outputTimestamp;
+            rewrite.lastUs = now;
+        }
+
+        packet[1] = subscriber.payloadType >= 0
+            ? uint8_t((markerAndType & 0x80) | (subscriber.payloadType & 0x7F)) : markerAndType;
+        writeBigEndian16(packet + 2, outputSequence);
+        writeBigEndian32(packet + 4, outputTimestamp);
+        writeBigEndian32(packet + 8, outputSsrc);
+        subscriber.sink(packet, size);
+        ++forwarded;
+    }
+    worker.forwarded.fetch_add(forwarded, std::memory_order_relaxed);
+    if (restarts > 0)
+        worker.restarts.fetch_add(restarts, std::memory_order_relaxed);
+    worker.latency.record(nowUs() - job.queuedUs);
+}
@@ -0,0 +1,152 @@
+#ifndef FORWARDER_H
+#define FORWARDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "src/audio/framepool.h"
+#include "src/audio/latencyhistogram.h"
+#include "src/audio/mpscqueue.h"
+
+// Forwarding core of the SFU. Every participant publishes one RTP stream and
+// subscribes to everyone else's, without anything being decoded.
+// Subscribers are spread over a fixed set of worker threads. A published
+// packet is copied once into a pooled frame and queued to every worker, and
+// each worker sends it on to its own subscribers with the header rewritten
+// for them:
+// - the SSRC becomes the one the SFU gave the publisher, so publishers that
+//   picked the same SSRC stay apart;
+// - the payload type becomes the one the subscriber negotiated for Opus;
+// - sequence numbers and timestamps continue where they left off when the
+//   publisher restarts its stream.
+// A subscriber's rewrite state and sink are only touched by its worker, so
+// the packet path takes no lock (apart from waking an idle worker) and every
+// subscriber's packets leave from one thread, in order.
+class Forwarder
+{
+public:
+    // Sends one packet to a subscriber, e.g. through its track. Called on the
+    // subscriber's worker; the bytes are only valid during the call.
+    using Sink = std::function<void(const uint8_t *data, size_t size)>;
+
+    static constexpr int MaxParticipants = 1024;
+    // Packets queued per worker before new ones are dropped
+    static constexpr size_t QueueCapacity = 4096;
+    static constexpr size_t MaxPacketSize = 1500;
+
+    explicit Forwarder(size_t threads);
+    ~Forwarder();
+    Forwarder(const Forwarder &) = delete;
+    Forwarder &operator=(const Forwarder &) = delete;
+
+    // Signalling side, any thread. Returns the participant's slot, or -1 if
+    // the forwarder is full. payloadType is the subscriber's Opus payload
+    // type, -1 to leave it as published.
+    int addParticipant(Sink sink, int payloadType);
+    // Stops forwarding from and to the participant; its slot can be reused
+    void removeParticipant(int slot);
+    // The SSRC the participant's stream has towards the others, 0 if none
+    uint32_t outputSsrc(int slot) const;
+
+    // Network side, any thread: forwards an RTP packet the participant sent
+    // to everyone else; false if it was dropped
+    bool push(int slot, const uint8_t *data, size_t size);
+
+    size_t threads() const { return m_workers.size(); }
+    int participants() const;
+
+    struct Stats {
+        uint64_t received = 0;       // packets pushed
+        uint64_t invalid = 0;        // not RTP, too large, or from no participant
+        uint64_t forwarded = 0;      // packets handed to sinks
+        uint64_t queueOverflows = 0; // packets a worker had no room for
+        uint64_t restarts = 0;       // publisher restarts bridged for a subscriber
+    };
+    Stats stats() const;
+    // From push() until a worker has sent the packet to all its subscribers,
+    // over all workers
+    LatencyHistogram::Summary latency() const;
+
+    static int64_t nowUs();
+
+private:
+    // One publisher as one subscriber sees it
+    struct Rewrite {
+        uint32_t serial = 0;           // publisher the state belongs to, 0 before its first packet
+        uint32_t sourceSsrc = 0;
+        uint16_t sequenceOffset = 0;
+        uint32_t timestampOffset = 0;
+        uint16_t lastSequence = 0;     // newest sent, as rewritten
+        uint32_t lastTimestamp = 0;
+        int64_t  lastUs = 0;
+    };
+    struct Subscriber {
+        int                    slot = -1;
+        uint32_t               serial = 0;
+        Sink                   sink;
+        int                    payloadType = -1;
+        std::vector<Rewrite>   rewrites;   // by publisher slot
+    };
+    struct Command {
+        bool       add = false;
+        Subscriber subscriber;
+    };
+    struct Job {
+        int        source = -1;
+        uint32_t   serial = 0;
+        MediaFrame packet;
+        int64_t    queuedUs = 0;
+    };
+    struct Worker {
+        Worker() : queue(QueueCapacity) {}
+
+        MpscQueue<Job>              queue;
+        // Queued jobs; signed, as a job may be taken before it is counted
+        std::atomic<int64_t>        pending{0};
+        std::atomic<bool>           sleeping{false};
+        // Counted when added or removed, ahead of the worker applying it
+        std::atomic<int>            subscriberCount{0};
+        std::mutex                  mutex;
+        std::condition_variable     wake;
+        // Subscribers to add or remove, guarded by mutex
+        std::vector<Command>        commands;
+        std::atomic<bool>           hasCommands{false};
+        // Only touched by the worker
+        std::vector<Subscriber>     subscribers;
+        std::vector<uint8_t>        scratch;
+        alignas(64) std::atomic<uint64_t> forwarded{0};
+        std::atomic<uint64_t>       restarts{0};
+        // Recorded by the worker alone, so its cache lines aren't contended;
+        // latency() merges them
+        LatencyHistogram            latency;
+        std::thread                 thread;
+    };
+
+    void run(Worker &worker);
+    void applyCommands(Worker &worker);
+    void forward(Worker &worker, const Job &job);
+    void post(Worker &worker, Command command);
+    Worker &workerFor(int slot) { return *m_workers[size_t(slot) % m_workers.size()]; }
+
+    FramePool                               m_pool;
+    std::vector<std::unique_ptr<Worker>>    m_workers;
+    // Serial of the participant in each slot, 0 if free; read on every push
+    std::unique_ptr<std::atomic<uint32_t>[]> m_serials;
+    std::atomic<bool>                       m_stopping{false};
+
+    // Slot allocation, on the signalling side
+    mutable std::mutex                      m_mutex;
+    uint32_t                                m_nextSerial = 1;
+    int                                     m_participants = 0;
+
+    std::atomic<uint64_t>                   m_received{0};
+    std::atomic<uint64_t>                   m_invalid{0};
+};
+
+#endif // FORWARDER_H
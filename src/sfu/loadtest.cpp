@@ -0,0 +1,206 @@
+#include "loadtest.h"
+#include <QString>
+#include <QTextStream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "forwarder.h"
+
+namespace LoadTest {
+
+static constexpr int FrameMs = 20;
+static constexpr size_t PayloadSize = 80;   // about 32 kbit/s of Opus
+static constexpr int GeneratorThreads = 2;
+
+namespace {
+
+// What one participant receives, checked on its worker
+struct Receiver {
+    int                                         slot = -1;
+    int                                         payloadType = 111;
+    // By publisher slot; only touched by the receiver's worker
+    std::vector<uint16_t>                       nextSequence;
+    std::vector<uint32_t>                       lastTimestamp;
+    std::vector<bool>                           seen;
+    // Stands in for the socket the packet would be sent through
+    std::array<uint8_t, Forwarder::MaxPacketSize> sent{};
+    std::atomic<uint64_t>                       received{0};
+    std::atomic<uint64_t>                       gaps{0};
+    std::atomic<uint64_t>                       disorder{0};   // reordered, or time going backwards
+    std::atomic<uint64_t>                       echoes{0};
+    std::atomic<uint64_t>                       wrongPayloadType{0};
+};
+
+// What one participant publishes
+struct Publisher {
+    int      slot = -1;
+    // Everyone picks the same SSRC, which the forwarder has to sort out
+    uint32_t ssrc = 2;
+    uint16_t sequenceNumber = 0;
+    uint32_t timestamp = 0;
+    uint64_t sent = 0;
+};
+
+} // namespace
+
+static void receive(Receiver &receiver, const std::unordered_map<uint32_t, int> &publishers,
+                    const uint8_t *data, size_t size)
+{
+    std::memcpy(receiver.sent.data(), data, size);
+    receiver.received.fetch_add(1, std::memory_order_relaxed);
+    if ((data[1] & 0x7F) != receiver.payloadType)
+        receiver.wrongPayloadType.fetch_add(1, std::memory_order_relaxed);
+
+    const uint32_t ssrc = (uint32_t(data[8]) << 24) | (uint32_t(data[9]) << 16) | (uint32_t(data[10]) << 8) | data[11];
+    const auto publisher = publishers.find(ssrc);
+    if (publisher == publishers.end() || publisher->second == receiver.slot) {
+        receiver.echoes.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const size_t from = size_t(publisher->second);
+    const uint16_t sequenceNumber = uint16_t((data[2] << 8) | data[3]);
+    const uint32_t timestamp = (uint32_t(data[4]) << 24) | (uint32_t(data[5]) << 16) | (uint32_t(data[6]) << 8) | data[7];
+    if (receiver.seen[from]) {
+        const int16_t ahead = int16_t(sequenceNumber - receiver.nextSequence[from]);
+        if (ahead > 0)
+            receiver.gaps.fetch_add(uint64_t(ahead), std::memory_order_relaxed);
+        if (ahead < 0 || int32_t(timestamp - receiver.lastTimestamp[from]) <= 0)
+            receiver.disorder.fetch_add(1, std::memory_order_relaxed);
+    }
+    receiver.seen[from] = true;
+    receiver.nextSequence[from] = uint16_t(sequenceNumber + 1);
+    receiver.lastTimestamp[from] = timestamp;
+}
+
+// Publishes a packet every FrameMs for each of the given publishers; the
+// first one restarts its stream halfway through
+static void generate(Forwarder &forwarder, std::vector<Publisher *> publishers, int frames)
+{
+    std::array<uint8_t, 12 + PayloadSize> packet{};
+    for (size_t i = 12; i < packet.size(); ++i)
+        packet[i] = uint8_t(i);
+    auto next = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (Publisher *publisher : publishers) {
+            if (frame == frames / 2 && publisher->slot == 0) {
+                publisher->ssrc = 3;
+                publisher->sequenceNumber = uint16_t(publisher->sequenceNumber + 20000);
+                publisher->timestamp += 1234567;
+            }
+            packet[0] = 0x80;
+            packet[1] = 111;
+            packet[2] = uint8_t(publisher->sequenceNumber >> 8);
+            packet[3] = uint8_t(publisher->sequenceNumber);
+            for (int byte = 0; byte < 4; ++byte) {
+                packet[size_t(4 + byte)] = uint8_t(publisher->timestamp >> (24 - 8 * byte));
+                packet[size_t(8 + byte)] = uint8_t(publisher->ssrc >> (24 - 8 * byte));
+            }
+            forwarder.push(publisher->slot, packet.data(), packet.size());
+            ++publisher->sent;
+            ++publisher->sequenceNumber;
+            publisher->timestamp += 48 * FrameMs;
+        }
+        next += std::chrono::milliseconds(FrameMs);
+        std::this_thread::sleep_until(next);
+    }
+}
+
+int run(QTextStream &out, int participants, size_t threads, int seconds)
+{
+    participants = std::clamp(participants, 2, Forwarder::MaxParticipants);
+    seconds = std::max(seconds, 1);
+    const int frames = seconds * 1000 / FrameMs;
+    out << "SFU load test: " << participants << " participants, " << threads << " forwarding threads, "
+        << seconds << " s of " << FrameMs << " ms packets\n";
+    out.flush();
+
+    // Declared ahead of the forwarder, so they outlive its workers
+    std::vector<std::unique_ptr<Receiver>> receivers;
+    std::vector<Publisher> publishers(static_cast<size_t>(participants));
+    std::unordered_map<uint32_t, int> ssrcs;
+    Forwarder forwarder(threads);
+    for (int i = 0; i < participants; ++i) {
+        auto receiver = std::make_unique<Receiver>();
+        // Half of them negotiated another payload type, which has to be rewritten
+        receiver->payloadType = i % 2 ? 109 : 111;
+        receiver->nextSequence.resize(size_t(participants));
+        receiver->lastTimestamp.resize(size_t(participants));
+        receiver->seen.resize(size_t(participants));
+        Receiver *target = receiver.get();
+        receiver->slot = forwarder.addParticipant(
+            [target, &ssrcs](const uint8_t *data, size_t size) { receive(*target, ssrcs, data, size); },
+            receiver->payloadType);
+        publishers[size_t(i)].slot = receiver->slot;
+        publishers[size_t(i)].sequenceNumber = uint16_t(i * 1000);
+        publishers[size_t(i)].timestamp = uint32_t(i) * 100000u;
+        receivers.push_back(std::move(receiver));
+    }
+    // Filled in before anything is published, read-only afterwards
+    for (const Publisher &publisher : publishers)
+        ssrcs.emplace(forwarder.outputSsrc(publisher.slot), publisher.slot);
+
+    const std::clock_t cpuStart = std::clock();
+    const int64_t wallStart = Forwarder::nowUs();
+    std::vector<std::thread> generators;
+    for (int g = 0; g < GeneratorThreads; ++g) {
+        std::vector<Publisher *> share;
+        for (size_t i = size_t(g); i < publishers.size(); i += GeneratorThreads)
+            share.push_back(&publishers[i]);
+        generators.emplace_back(generate, std::ref(forwarder), std::move(share), frames);
+    }
+    for (std::thread &generator : generators)
+        generator.join();
+
+    uint64_t sent = 0;
+    for (const Publisher &publisher : publishers)
+        sent += publisher.sent;
+    const uint64_t expected = sent * uint64_t(participants - 1);
+    // Let the workers drain their queues
+    uint64_t forwarded = forwarder.stats().forwarded;
+    for (int wait = 0; wait < 200 && forwarded < expected; ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        const uint64_t now = forwarder.stats().forwarded;
+        if (now == forwarded && forwarder.stats().queueOverflows > 0)
+            break;
+        forwarded = now;
+    }
+    const double wallSeconds = (Forwarder::nowUs() - wallStart) / 1e6;
+    const double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    uint64_t received = 0, gaps = 0, disorder = 0, echoes = 0, wrongPayloadType = 0;
+    for (const auto &receiver : receivers) {
+        received += receiver->received.load();
+        gaps += receiver->gaps.load();
+        disorder += receiver->disorder.load();
+        echoes += receiver->echoes.load();
+        wrongPayloadType += receiver->wrongPayloadType.load();
+    }
+    const Forwarder::Stats stats = forwarder.stats();
+    const LatencyHistogram::Summary latency = forwarder.latency();
+
+    out << "Published: " << sent << " packets, " << QString::number(sent / wallSeconds, 'f', 0) << "/s\n";
+    out << "Forwarded: " << received << " of " << expected << " expected, "
+        << QString::number(received / wallSeconds, 'f', 0) << "/s\n";
+    out << QString("%1 %2 %3 %4 %5\n").arg("latency", -8).arg("p50", 8).arg("p95", 8).arg("p99", 8).arg("max", 8);
+    out << QString("%1 %2 %3 %4 %5\n").arg("us", -8)
+               .arg(latency.p50Us, 8).arg(latency.p95Us, 8).arg(latency.p99Us, 8).arg(latency.maxUs, 8);
+    out << "Queue overflows: " << stats.queueOverflows << ", sequence gaps: " << gaps << ", out of order: "
+        << disorder << ", echoes: " << echoes << ", wrong payload type: " << wrongPayloadType << "\n";
+    out << "Publisher restarts bridged: " << stats.restarts << " (" << participants - 1 << " expected)\n";
+    out << "CPU: " << QString::number(cpuSeconds / wallSeconds, 'f', 2) << " cores over "
+        << QString::number(wallSeconds, 'f', 1) << " s\n";
+
+    const bool passed = received == expected && gaps == 0 && disorder == 0 && echoes == 0 && wrongPayloadType == 0
+                        && stats.restarts == uint64_t(participants - 1);
+    out << (passed ? "PASS\n" : "FAIL\n");
+    return passed ? 0 : 1;
+}
+
+} // namespace LoadTest
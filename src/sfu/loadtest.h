@@ -0,0 +1,20 @@
+#ifndef LOADTEST_H
+#define LOADTEST_H
+
+#include <cstddef>
+
+class QTextStream;
+
+// Local load test for the forwarding core: N synthetic participants publish
+// 20 ms Opus-sized packets and every participant checks what it receives.
+// No network is involved, so it measures the forwarder itself (fan-out,
+// header rewriting, queueing) and leaves SRTP and sockets out.
+namespace LoadTest {
+
+// Runs for the given number of seconds and prints a report; 0 if everything
+// that was sent arrived in order, without echoes
+int run(QTextStream &out, int participants, size_t threads, int seconds);
+
+} // namespace LoadTest
+
+#endif // LOADTEST_H
@@ -0,0 +1,69 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include "src/network/client.h"
+#include "loadtest.h"
+#include "sfuserver.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Distributed Voice Call selective forwarding unit");
+    parser.addHelpOption();
+    QCommandLineOption serverOption("server", "Signalling server to register with.", "url",
+                                    QString::fromLatin1(Client::DefaultServerUrl));
+    parser.addOption(serverOption);
+    QCommandLineOption threadsOption("threads", "Forwarding threads (default: one per core).", "count",
+                                     QString::number(QThread::idealThreadCount()));
+    parser.addOption(threadsOption);
+    QCommandLineOption statsOption("stats-interval", "Print statistics every so many seconds, 0 for never (default 10).",
+                                   "seconds", "10");
+    parser.addOption(statsOption);
+    QCommandLineOption loadTestOption("load-test", "Forward between this many synthetic participants and exit.",
+                                      "participants");
+    parser.addOption(loadTestOption);
+    QCommandLineOption durationOption("duration", "Length of the load test (default 10).", "seconds", "10");
+    parser.addOption(durationOption);
+    parser.process(app);
+
+    const size_t threads = size_t(std::max(parser.value(threadsOption).toInt(), 1));
+    if (parser.isSet(loadTestOption)) {
+        QTextStream out(stdout);
+        return LoadTest::run(out, parser.value(loadTestOption).toInt(), threads, parser.value(durationOption).toInt());
+    }
+
+    rtc::InitLogger(rtc::LogLevel::Error, NULL);
+    SfuServer server(threads);
+    Client client(parser.value(serverOption));
+
+    // Participants call the SFU like any other peer: it answers their offers
+    QObject::connect(&client, &Client::localIdIsSet, [](const QString &id) {
+        qInfo() << "SFU registered as" << id;
+    });
+    QObject::connect(&client, &Client::newSdpReceived, &server, &SfuServer::setRemoteDescription);
+    QObject::connect(&client, &Client::newIceCandidateReceived, &server, &SfuServer::setRemoteCandidate);
+    QObject::connect(&server, &SfuServer::answerIsReady, &client, &Client::sendAnswer);
+    // Tells the others when someone joins or leaves; their answers come back through newSdpReceived
+    QObject::connect(&server, &SfuServer::offerIsReady, &client, &Client::sendOffer);
+    QObject::connect(&server, &SfuServer::participantJoined, [](const QString &peerId) {
+        qInfo() << "Joined:" << peerId;
+    });
+    QObject::connect(&server, &SfuServer::participantLeft, [](const QString &peerId) {
+        qInfo() << "Left:" << peerId;
+    });
+
+    QTimer statsTimer;
+    QObject::connect(&statsTimer, &QTimer::timeout, [&server] {
+        qInfo().noquote() << server.stats();
+    });
+    if (const int interval = parser.value(statsOption).toInt(); interval > 0)
+        statsTimer.start(interval * 1000);
+
+    return app.exec();
+}
@@ -0,0 +1,332 @@
+#include "sfuserver.h"
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "src/network/rtcsetup.h"
+
+// Used if the offer doesn't say, the same default as the client's
+static constexpr int DefaultPayloadType = 111;
+
+SfuServer::SfuServer(size_t threads, const rtc::Configuration &config, QObject *parent)
+    : QObject{parent},
+    m_config(config),
+    m_forwarder(threads)
+{
+}
+
+SfuServer::~SfuServer()
+{
+    QHash<QString, ParticipantPtr> participants;
+    {
+        QMutexLocker locker(&m_mutex);
+        participants.swap(m_participants);
+    }
+    for (const ParticipantPtr &participant : std::as_const(participants)) {
+        participant->active = false;
+        participant->connection->close();
+    }
+}
+
+int SfuServer::participants() const
+{
+    QMutexLocker locker(&m_mutex);
+    return int(m_participants.size());
+}
+
+void SfuServer::setRemoteDescription(const QString &peerId, const QString &sdp)
+{
+    QJsonDocument doc = QJsonDocument::fromJson(sdp.toUtf8());
+    QJsonObject jsonObj = doc.object();
+    QString type = jsonObj.value("type").toString();
+    QString sdpValue = jsonObj.value("sdp").toString();
+    if (type == "answer") {
+        try {
+            acceptAnswer(peerId, rtc::Description(sdpValue.toStdString(), type.toStdString()));
+        } catch (const std::exception &e) {
+            qWarning() << "Failed to accept the answer of" << peerId << e.what();
+        }
+        return;
+    }
+    if (type != "offer") {
+        qWarning() << "Ignoring" << type << "from" << peerId;
+        return;
+    }
+
+    try {
+        const rtc::Description offer(sdpValue.toStdString(), type.toStdString());
+        std::string mid;
+        int payloadType = DefaultPayloadType;
+        if (!offeredAudio(offer, mid, payloadType)) {
+            qWarning() << "No audio offered by" << peerId;
+            return;
+        }
+        if (const ParticipantPtr previous = findParticipant(peerId))
+            dropParticipant(peerId, previous);
+
+        auto participant = std::make_shared<Participant>();
+        participant->mid = mid;
+        participant->payloadType = payloadType;
+        participant->connection = std::make_shared<rtc::PeerConnection>(m_config);
+        const std::weak_ptr<Participant> weakParticipant = participant;
+
+        participant->connection->onStateChange([this, peerId, weakParticipant](rtc::PeerConnection::State state) {
+            if (state != rtc::PeerConnection::State::Closed && state != rtc::PeerConnection::State::Failed)
+                return;
+            // Not from inside the connection's own callback
+            QMetaObject::invokeMethod(this, [this, peerId, weakParticipant] {
+                if (const ParticipantPtr participant = weakParticipant.lock())
+                    dropParticipant(peerId, participant);
+            }, Qt::QueuedConnection);
+        });
+
+        participant->connection->onGatheringStateChange([this, peerId, weakParticipant](rtc::PeerConnection::GatheringState state) {
+            const ParticipantPtr participant = weakParticipant.lock();
+            if (!participant || rtc::PeerConnection::GatheringState::Complete != state)
+                return;
+            participant->gatheringCompleted = true;
+            publishDescription(peerId, participant);
+            bool changed = false;
+            {
+                QMutexLocker locker(&m_mutex);
+                participant->answered = true;
+                changed = participant->renegotiate;
+            }
+            // Someone joined or left since the answer was made
+            if (changed) {
+                QMetaObject::invokeMethod(this, [this, peerId, weakParticipant] {
+                    if (const ParticipantPtr participant = weakParticipant.lock())
+                        renegotiate(peerId, participant);
+                }, Qt::QueuedConnection);
+            }
+        });
+
+        participant->track = participant->connection->addTrack(describe(*participant));
+
+        const std::weak_ptr<rtc::Track> weakTrack = participant->track;
+        participant->slot = m_forwarder.addParticipant([weakTrack](const uint8_t *data, size_t size) {
+            try {
+                const std::shared_ptr<rtc::Track> track = weakTrack.lock();
+                if (track && track->isOpen())
+                    track->send(reinterpret_cast<const rtc::byte *>(data), size);
+            } catch (const std::exception &e) {
+                qWarning() << "Failed to forward a packet:" << e.what();
+            }
+        }, payloadType);
+        if (participant->slot < 0) {
+            qWarning() << "The SFU is full, refusing" << peerId;
+            participant->connection->close();
+            return;
+        }
+        participant->active = true;
+
+        participant->track->onMessage([this, weakParticipant](rtc::message_variant data) {
+            if (const ParticipantPtr participant = weakParticipant.lock())
+                onPacket(*participant, data);
+        });
+
+        {
+            QMutexLocker locker(&m_mutex);
+            m_participants.insert(peerId, participant);
+        }
+        // Answered automatically; publishDescription() sends it once the candidates are in
+        participant->connection->setRemoteDescription(offer);
+        Q_EMIT participantJoined(peerId);
+        updateParticipants(peerId);
+    } catch (const std::exception &e) {
+        qWarning() << "Failed to accept the offer of" << peerId << e.what();
+    }
+}
+
+void SfuServer::setRemoteCandidate(const QString &peerId, const QString &candidate, const QString &sdpMid)
+{
+    try {
+        if (const ParticipantPtr participant = findParticipant(peerId))
+            participant->connection->addRemoteCandidate(rtc::Candidate(candidate.toStdString(), sdpMid.toStdString()));
+    } catch (const std::exception &e) {
+        qWarning() << "Failed to set remote candidate" << e.what();
+    }
+}
+
+void SfuServer::removeParticipant(const QString &peerId)
+{
+    if (const ParticipantPtr participant = findParticipant(peerId))
+        dropParticipant(peerId, participant);
+}
+
+QVariantMap SfuServer::stats() const
+{
+    const Forwarder::Stats forwarded = m_forwarder.stats();
+    const RtpDepacketizer::Stats received = m_depacketizer.stats();
+    const LatencyHistogram::Summary latency = m_forwarder.latency();
+    return {
+        {"participants", participants()},
+        {"threads", qulonglong(m_forwarder.threads())},
+        {"received", qulonglong(received.packets)},
+        {"malformed", qulonglong(received.tooShort + received.badVersion + received.truncatedHeader + received.badPadding)},
+        {"rtcpTerminated", qulonglong(m_rtcpTerminated.load())},
+        {"forwarded", qulonglong(forwarded.forwarded)},
+        {"dropped", qulonglong(forwarded.invalid + forwarded.queueOverflows)},
+        {"restarts", qulonglong(forwarded.restarts)},
+        {"latencyP50Us", qlonglong(latency.p50Us)},
+        {"latencyP99Us", qlonglong(latency.p99Us)},
+        {"latencyMaxUs", qlonglong(latency.maxUs)},
+    };
+}
+
+SfuServer::ParticipantPtr SfuServer::findParticipant(const QString &peerId) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_participants.value(peerId);
+}
+
+// Our answer to a participant's offer, or the offer of a renegotiation
+void SfuServer::publishDescription(const QString &peerId, const ParticipantPtr &participant)
+{
+    const std::optional<rtc::Description> description = participant->connection->localDescription();
+    if (!description)
+        return;
+    QJsonObject json;
+    json["type"] = QString::fromStdString(description->typeString());
+    json["sdp"] = QString::fromStdString(std::string(*description));
+    const QString sdp = QString::fromUtf8(QJsonDocument(json).toJson());
+    if (description->type() == rtc::Description::Type::Offer)
+        Q_EMIT offerIsReady(peerId, sdp);
+    else
+        Q_EMIT answerIsReady(peerId, sdp);
+}
+
+void SfuServer::acceptAnswer(const QString &peerId, const rtc::Description &answer)
+{
+    const ParticipantPtr participant = findParticipant(peerId);
+    if (!participant) {
+        qWarning() << "Ignoring an answer from" << peerId << "who is not in the call";
+        return;
+    }
+    participant->connection->setRemoteDescription(answer);
+    bool changed = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        participant->offerPending = false;
+        changed = participant->renegotiate;
+    }
+    if (changed)
+        renegotiate(peerId, participant);
+}
+
+// Sends and receives Opus only, at the payload type the participant offered;
+// RED and the NACK/REMB feedback stay between the clients. Each other
+// participant's stream is declared under its output SSRC, named after it.
+rtc::Description::Audio SfuServer::describe(const Participant &participant) const
+{
+    rtc::Description::Audio audio(participant.mid, rtc::Description::Direction::SendRecv);
+    RtcSetup::addAudioCodecs(audio, participant.payloadType, -1, false);
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_participants.cbegin(); it != m_participants.cend(); ++it) {
+        if (it->get() == &participant)
+            continue;
+        if (const uint32_t ssrc = m_forwarder.outputSsrc((*it)->slot))
+            audio.addSSRC(ssrc, it.key().toStdString());
+    }
+    return audio;
+}
+
+// Offers the participant its current list of publishers, or leaves a note
+// to do so once the answer or offer in flight is through
+void SfuServer::renegotiate(const QString &peerId, const ParticipantPtr &participant)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_participants.value(peerId) != participant)
+            return;
+        if (!participant->answered || participant->offerPending) {
+            participant->renegotiate = true;
+            return;
+        }
+        participant->offerPending = true;
+        participant->renegotiate = false;
+    }
+    try {
+        // Same mid: the track is updated in place and the connection flagged
+        // for renegotiation. Its candidates are already in, so the offer can
+        // go out right away.
+        participant->connection->addTrack(describe(*participant));
+        participant->connection->setLocalDescription(rtc::Description::Type::Offer);
+        publishDescription(peerId, participant);
+    } catch (const std::exception &e) {
+        qWarning() << "Failed to renegotiate with" << peerId << e.what();
+    }
+}
+
+void SfuServer::updateParticipants(const QString &peerId)
+{
+    QHash<QString, ParticipantPtr> participants;
+    {
+        QMutexLocker locker(&m_mutex);
+        participants = m_participants;
+    }
+    for (auto it = participants.cbegin(); it != participants.cend(); ++it) {
+        if (it.key() != peerId)
+            renegotiate(it.key(), it.value());
+    }
+}
+
+void SfuServer::dropParticipant(const QString &peerId, const ParticipantPtr &participant)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        // Already replaced by a newer connection from the same peer
+        if (m_participants.value(peerId) != participant)
+            return;
+        m_participants.remove(peerId);
+    }
+    participant->active = false;
+    participant->track->resetCallbacks();
+    m_forwarder.removeParticipant(participant->slot);
+    participant->connection->close();
+    Q_EMIT participantLeft(peerId);
+    updateParticipants(peerId);
+}
+
+void SfuServer::onPacket(Participant &participant, const rtc::message_variant &data)
+{
+    const uint8_t *bytes = nullptr;
+    size_t size = 0;
+    if (!participant.active || !RtcSetup::readVariant(data, bytes, size))
+        return;
+    RtpPacketView packet;
+    switch (m_depacketizer.parse(bytes, size, packet)) {
+    case RtpDepacketizer::Result::Ok:
+        // Forwarded as received, CSRCs, extensions and padding included
+        m_forwarder.push(participant.slot, bytes, size);
+        break;
+    case RtpDepacketizer::Result::Rtcp:
+        // Reports and feedback describe the hop to the SFU, not to the other participants
+        m_rtcpTerminated.fetch_add(1, std::memory_order_relaxed);
+        break;
+    default:
+        break;
+    }
+}
+
+// The first audio section of the offer, and the payload type it gave Opus
+bool SfuServer::offeredAudio(const rtc::Description &description, std::string &mid, int &payloadType)
+{
+    for (int i = 0; i < description.mediaCount(); ++i) {
+        const auto media = description.media(i);
+        if (!std::holds_alternative<const rtc::Description::Media *>(media))
+            continue;
+        const rtc::Description::Media *audio = std::get<const rtc::Description::Media *>(media);
+        if (audio->type() != "audio")
+            continue;
+        mid = audio->mid();
+        for (int offered : audio->payloadTypes()) {
+            const rtc::Description::Media::RtpMap *map = audio->rtpMap(offered);
+            if (map && QString::fromStdString(map->format).compare("opus", Qt::CaseInsensitive) == 0) {
+                payloadType = offered;
+                break;
+            }
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,100 @@
+#ifndef SFUSERVER_H
+#define SFUSERVER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QVariantMap>
+#include <atomic>
+#include <memory>
+
+// Build the datachannellib library and add the include path to .pro file
+#include <rtc/rtc.hpp>
+#include "src/network/rtcsetup.h"
+#include "src/network/rtpdepacketizer.h"
+#include "forwarder.h"
+
+// Headless selective forwarding unit. Every participant connects to the SFU
+// only, with the same offer a client sends to another client, and publishes
+// one audio track. Whatever RTP arrives on it is handed to the Forwarder,
+// which sends it on to every other participant over their own track, so a
+// client has one uplink and one encode however many people are in the call.
+// Nothing is decoded; RTCP is terminated here.
+//
+// Everything a participant receives arrives on its one track, each other
+// publisher under the SSRC the Forwarder gave it. A participant's
+// description declares those SSRCs, so its transport accepts the packets and
+// the client can tell the publishers apart. When someone joins or leaves,
+// the SFU sends everyone else a new offer with the updated list. Changes
+// that come while an offer is still unanswered are folded into the next one.
+class SfuServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SfuServer(size_t threads, const rtc::Configuration &config = RtcSetup::configuration(),
+                       QObject *parent = nullptr);
+    virtual ~SfuServer();
+
+    const Forwarder &forwarder() const { return m_forwarder; }
+    int participants() const;
+    // Participants, packets received, forwarded and dropped, and the
+    // forwarding latency in microseconds
+    QVariantMap stats() const;
+
+Q_SIGNALS:
+    void answerIsReady(const QString &peerId, const QString &sdp);
+    // A new offer to a participant whose list of publishers changed
+    void offerIsReady(const QString &peerId, const QString &sdp);
+    void participantJoined(const QString &peerId);
+    void participantLeft(const QString &peerId);
+
+public Q_SLOTS:
+    // An offer from a participant, or its answer to one of ours; a new offer
+    // from the same peer replaces its connection
+    void setRemoteDescription(const QString &peerId, const QString &sdp);
+    void setRemoteCandidate(const QString &peerId, const QString &candidate, const QString &sdpMid);
+    void removeParticipant(const QString &peerId);
+
+private:
+    struct Participant {
+        std::shared_ptr<rtc::PeerConnection> connection;
+        std::shared_ptr<rtc::Track>          track;
+        int                                  slot = -1;
+        // Cleared before the slot is given up; packets still arriving are
+        // dropped rather than pushed into a slot someone else may get next
+        std::atomic<bool>                    active{false};
+        std::atomic<bool>                    gatheringCompleted{false};
+        // From its offer
+        std::string                          mid;
+        int                                  payloadType = -1;
+        // Renegotiation, guarded by m_mutex: our first answer went out, an
+        // offer of ours awaits its answer, the publishers changed meanwhile
+        bool                                 answered = false;
+        bool                                 offerPending = false;
+        bool                                 renegotiate = false;
+    };
+    using ParticipantPtr = std::shared_ptr<Participant>;
+
+    ParticipantPtr findParticipant(const QString &peerId) const;
+    void acceptAnswer(const QString &peerId, const rtc::Description &answer);
+    void publishDescription(const QString &peerId, const ParticipantPtr &participant);
+    // The participant's audio section, declaring everyone else's output SSRC
+    rtc::Description::Audio describe(const Participant &participant) const;
+    void renegotiate(const QString &peerId, const ParticipantPtr &participant);
+    // Renegotiates with everyone but peerId
+    void updateParticipants(const QString &peerId);
+    void dropParticipant(const QString &peerId, const ParticipantPtr &participant);
+    void onPacket(Participant &participant, const rtc::message_variant &data);
+    // The mid and Opus payload type of the offered audio section; false if there is none
+    static bool offeredAudio(const rtc::Description &description, std::string &mid, int &payloadType);
+
+    rtc::Configuration                       m_config;
+    Forwarder                                m_forwarder;
+    RtpDepacketizer                          m_depacketizer;
+    mutable QMutex                           m_mutex;
+    QHash<QString, ParticipantPtr>           m_participants;
+    std::atomic<uint64_t>                    m_rtcpTerminated{0};
+};
+
+#endif // SFUSERVER_H
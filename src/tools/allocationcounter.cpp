@@ -0,0 +1,256 @@
+#include "allocationcounter.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+// A relaxed increment is all this adds to an allocation
+static std::atomic<uint64_t> allocations{0};
+
+static inline void counted()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+
+// The executable's malloc family takes the place of libc's for every library
+// in the process: Qt containers, libdatachannel, Opus and libstdc++'s
+// operator new all end up here, and go on to glibc's own entry points
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size) noexcept
+{
+    counted();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    counted();
+    return __libc_calloc(count, size);
+}
+
+// Growing a block may move it, so every realloc that doesn't free counts
+void *realloc(void *pointer, size_t size) noexcept
+{
+    if (size)
+        counted();
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) noexcept
+{
+    __libc_free(pointer);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    counted();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    counted();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) noexcept
+{
+    if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    counted();
+    void *pointer = __libc_memalign(alignment, size);
+    if (!pointer)
+        return ENOMEM;
+    *result = pointer;
+    return 0;
+}
+
+} // extern "C"
+
+namespace AllocationCounter {
+
+const char *coverage()
+{
+    return "every malloc, calloc, realloc and aligned allocation in the process";
+}
+
+} // namespace AllocationCounter
+
+#else
+
+// Without glibc there is no portable way into the C runtime's allocator, so
+// only the global operator new of this executable is replaced
+static void *allocate(std::size_t size)
+{
+    counted();
+    if (void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+static void *allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+    counted();
+    // _aligned_malloc/_aligned_free on Windows, where free() can't release it
+#if defined(_WIN32)
+    if (void *pointer = _aligned_malloc(size ? size : 1, std::size_t(alignment)))
+        return pointer;
+#else
+    const std::size_t align = std::max(std::size_t(alignment), sizeof(void *));
+    const std::size_t rounded = ((size ? size : 1) + align - 1) / align * align;
+    if (void *pointer = std::aligned_alloc(align, rounded))
+        return pointer;
+#endif
+    throw std::bad_alloc();
+}
+
+static void releaseAligned(void *pointer)
+{
+#if defined(_WIN32)
+    _aligned_free(pointer);
+#else
+    std::free(pointer);
+#endif
+}
+
+void *operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void *operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    counted();
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    counted();
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try {
+        return allocateAligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try {
+        return allocateAligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+    releaseAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+    releaseAligned(pointer);
+}
+
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept
+{
+    releaseAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept
+{
+    releaseAligned(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    releaseAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    releaseAligned(pointer);
+}
+
+namespace AllocationCounter {
+
+const char *coverage()
+{
+    return "global operator new in this executable only; malloc and realloc, which Qt containers "
+           "(QByteArray, QString, QList, QMap) use, and allocations inside Qt, libdatachannel and "
+           "Opus DLLs are not counted";
+}
+
+} // namespace AllocationCounter
+
+#endif
+
+namespace AllocationCounter {
+
+uint64_t count()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+} // namespace AllocationCounter
@@ -0,0 +1,20 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+// Counts heap allocations in the process, so tools can check that a code
+// path doesn't touch the heap once it is warmed up. With glibc it replaces
+// malloc and its relatives, which catches Qt containers and the other
+// libraries too; elsewhere it can only replace the global operator new.
+// It replaces the allocator of the whole process, so it is only built with
+// qmake CONFIG+=allocation_counter (which defines ALLOCATION_COUNTER).
+namespace AllocationCounter {
+
+uint64_t count();
+// What count() sees and what it misses on this platform
+const char *coverage();
+
+} // namespace AllocationCounter
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,1161 @@
+#include "tools.h"
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QtEndian>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include "src/audio/audiodecoder.h"
+#include "src/audio/audioencoder.h"
+#include "src/audio/audiomixer.h"
+#include "src/audio/audiopreprocessor.h"
+#include "src/audio/driftestimator.h"
+#include "src/audio/echocanceller.h"
+#include "src/audio/jitterbuffer.h"
+#include "src/audio/simd.h"
+#include "src/audio/timestretcher.h"
+#include "src/audio/wavfile.h"
+#include "src/network/bandwidthestimator.h"
+#include "src/network/peersession.h"
+#include "src/network/redcodec.h"
+#include "src/network/rtppacketizer.h"
+#include "src/network/webrtc.h"
+#include "src/sfu/sfuserver.h"
+#ifdef ALLOCATION_COUNTER
+#include "allocationcounter.h"
+#endif
+
+namespace Tools {
+
+static const char *const ToolOptions[] = {"--benchmark", "--aec-offline", "--jitter-trace", "--wsola", "--drift-sim",
+                                           "--simulate-bwe", "--sfu-check"};
+
+// Per-frame cost of the capture pre-processing chain for every SIMD level the
+// CPU supports, at 10 and 20 ms frames
+static int benchmarkPreprocessing(QTextStream &out)
+{
+    const int sampleRate = 48000;
+    const int iterations = 20000;
+
+    out << "Pre-processing chain (high-pass, gate, AGC) at " << sampleRate << " Hz, "
+        << iterations << " frames per run\n";
+    out << QString("%1 %2 %3 %4\n").arg("kernels", -8).arg("frame", 6).arg("ns/frame", 10).arg("budget", 8);
+
+    for (Simd::Level level : {Simd::Level::Scalar, Simd::Level::Sse41, Simd::Level::Avx2, Simd::Level::Neon}) {
+        if (!Simd::isSupported(level))
+            continue;
+        for (int frameMs : {10, 20}) {
+            const double nanoseconds = AudioPreprocessor::benchmark(sampleRate, frameMs, level, iterations);
+            // Share of the real-time budget of one frame
+            const double budget = nanoseconds / (frameMs * 1e6) * 100.0;
+            out << QString("%1 %2 %3 %4%\n")
+                       .arg(Simd::levelName(level), -8)
+                       .arg(QString("%1 ms").arg(frameMs), 6)
+                       .arg(nanoseconds, 10, 'f', 0)
+                       .arg(budget, 7, 'f', 3);
+        }
+    }
+    out << "Runtime dispatch selects: " << Simd::levelName(Simd::detectedLevel()) << "\n";
+    return 0;
+}
+
+// Runs the echo canceller over a recorded near-end (microphone) file using a
+// far-end (loudspeaker) file as reference, the way the capture chain does it
+static int aecOffline(QTextStream &out, const QStringList &files, int delayMs, int frameMs)
+{
+    if (files.size() != 3) {
+        out << "--aec-offline needs near.wav,far.wav,out.wav\n";
+        return 1;
+    }
+
+    std::vector<int16_t> nearEnd, farEnd;
+    int sampleRate = 0, farSampleRate = 0;
+    if (!WavFile::read(files[0], nearEnd, sampleRate) || !WavFile::read(files[1], farEnd, farSampleRate)) {
+        out << "Cannot read the input files (16-bit PCM WAV expected)\n";
+        return 1;
+    }
+    if (sampleRate != farSampleRate) {
+        out << "Near and far files must have the same sample rate\n";
+        return 1;
+    }
+
+    const size_t frameSize = size_t(sampleRate) * frameMs / 1000;
+    AudioRingBuffer reference;
+    reference.reset(size_t(sampleRate));
+    EchoCanceller canceller(Simd::kernels(), sampleRate, frameSize);
+    canceller.setReference(&reference);
+    canceller.setDelay(delayMs);
+    canceller.setEnabled(true);
+    canceller.reset();
+
+    // Feed the reference a frame at a time, as the playout side would
+    std::vector<int16_t> output(nearEnd.size());
+    std::vector<int16_t> silence(frameSize);
+    std::vector<float> frame(frameSize);
+    const Simd::Kernels &kernels = Simd::kernels();
+    size_t done = 0;
+    for (; done + frameSize <= nearEnd.size(); done += frameSize) {
+        reference.write(done + frameSize <= farEnd.size() ? farEnd.data() + done : silence.data(), frameSize);
+        kernels.int16ToFloat(nearEnd.data() + done, frame.data(), frameSize);
+        canceller.process(frame.data(), frameSize);
+        kernels.floatToInt16(frame.data(), output.data() + done, frameSize);
+    }
+    output.resize(done);
+
+    if (!WavFile::write(files[2], output, sampleRate)) {
+        out << "Cannot write " << files[2] << "\n";
+        return 1;
+    }
+
+    const EchoCanceller::Metrics metrics = canceller.metrics();
+    out << "Frames: " << metrics.frames << " of " << frameMs << " ms at " << sampleRate << " Hz, delay "
+        << delayMs << " ms, " << Simd::levelName(kernels.level) << " kernels\n";
+    out << "ERLE: " << QString::number(metrics.erleDb, 'f', 1) << " dB\n";
+    out << "Cost per frame: " << QString::number(metrics.averageNs / 1000.0, 'f', 1) << " us average, "
+        << QString::number(metrics.maxNs / 1000.0, 'f', 1) << " us max ("
+        << QString::number(metrics.averageNs / (frameMs * 1e6) * 100.0, 'f', 2) << "% of real time)\n";
+    out << "Over budget frames: " << metrics.overBudgetFrames << ", filter taps at the end: "
+        << metrics.activeTaps << "\n";
+    return 0;
+}
+
+// Runs 20 ms frames through the real objects a packet passes on the send and
+// receive side: the AudioEncoder thread (pre-processing, VAD, encoding into a
+// pooled frame), WebRTC::broadcastTrack (RTP header in the headroom, send
+// history), WebRTC::receivePacket (parsing, RTCP and NACK bookkeeping,
+// payload copy, frameReceived) and the AudioDecoder thread (jitter buffer,
+// Opus decoding, mixing into the playout ring, which is read here in blocks
+// the way the sink reads it). Frames are fed in real time, and the heap
+// allocations made on any thread once the pipeline is warmed up are counted.
+// Needs the allocation counter, which is only built on request.
+static int benchmarkAllocations(QTextStream &out)
+{
+#ifndef ALLOCATION_COUNTER
+    out << "Built without the allocation counter; rebuild with qmake CONFIG+=allocation_counter\n";
+    return 1;
+#else
+    const int sampleRate = 48000;
+    const int frameSize = sampleRate / 50;
+    const int frameMs = 20;
+    const int warmupFrames = 100;
+    const int measuredFrames = 500;
+
+    AudioRingBuffer capture;
+    capture.reset(size_t(sampleRate));
+    AudioEncoder encoder(&capture, sampleRate);
+    encoder.setFrameDuration(frameMs);
+    encoder.setSilenceSuppression(false);
+
+    AudioRingBuffer playout;
+    playout.reset(size_t(sampleRate) / 5);
+    AudioDecoder decoder(&playout, sampleRate);
+    std::vector<int16_t> block(decoder.blockSamples());
+    const int blocksPerFrame = int(size_t(frameSize) / decoder.blockSamples());
+
+    // The call has no peers to send to; every packet is looped back into a
+    // session of its own, as if a peer had sent it
+    WebRTC webrtc;
+    PeerSession session("loopback", 3, RtpPacketizer::ClockRate, 64000);
+    RtpPacketizer loopback(2, 1000, 0);
+    // What AudioOutput::addFrame does with a received frame
+    QObject::connect(&webrtc, &WebRTC::frameReceived, &webrtc, [&decoder](const QString &peerId, const MediaFrame &frame) {
+        decoder.push(peerId, frame);
+    }, Qt::DirectConnection);
+
+    std::atomic<int> received{0};
+    std::atomic<uint64_t> before{0};
+    std::atomic<uint64_t> after{0};
+    QObject::connect(&encoder, &AudioEncoder::frameEncoded, &encoder, [&](const MediaFrame &frame) {
+        webrtc.broadcastTrack(frame);
+        MediaFrame packet = frame;
+        if (loopback.packetize(packet, webrtc.payloadType()))
+            webrtc.receivePacket(session, nullptr, packet.data(), packet.size());
+
+        const int count = received.fetch_add(1) + 1;
+        if (count == warmupFrames)
+            before.store(AllocationCounter::count());
+        else if (count == warmupFrames + measuredFrames)
+            after.store(AllocationCounter::count());
+    }, Qt::DirectConnection);
+
+    // Speech-like input generated up front so feeding doesn't allocate
+    std::vector<int16_t> input(size_t(frameSize) * 50);
+    for (size_t i = 0; i < input.size(); ++i)
+        input[i] = int16_t(6000.0f * std::sin(i * 0.037f) * std::sin(i * 0.0007f) + (i * 7919 % 401) - 200);
+
+    encoder.start();
+    decoder.start();
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < warmupFrames + measuredFrames; ++i) {
+        capture.write(input.data() + size_t(i % 50) * frameSize, size_t(frameSize));
+        encoder.notify();
+        // The sink's clock: one block every block duration
+        for (int b = 0; b < blocksPerFrame; ++b) {
+            const qint64 dueUs = (qint64(i) * blocksPerFrame + b + 1) * frameMs * 1000 / blocksPerFrame;
+            const qint64 waitUs = dueUs - timer.nsecsElapsed() / 1000;
+            if (waitUs > 0)
+                QThread::usleep(quint64(waitUs));
+            playout.readFrame(block.data(), block.size());
+            decoder.notify();
+        }
+    }
+    while (received.load() < warmupFrames + measuredFrames && timer.elapsed() < 30000)
+        QThread::msleep(1);
+    encoder.stop();
+    decoder.stop();
+
+    if (received.load() < warmupFrames + measuredFrames) {
+        out << "Only " << received.load() << " frames made it through\n";
+        return 1;
+    }
+
+    const uint64_t allocations = after.load() - before.load();
+    const FramePool::Stats pool = FramePool::media().stats();
+    const std::shared_ptr<PeerStream> stream = decoder.stream(session.id);
+    const uint64_t decoded = stream ? stream->stats().decodedFrames : 0;
+    out << "Send + receive path, " << measuredFrames << " frames of " << frameMs << " ms after " << warmupFrames
+        << " warm-up frames, in real time\n";
+    out << "Frames decoded by the playout thread: " << decoded << "\n";
+    out << "Heap allocations: " << allocations << " ("
+        << QString::number(double(allocations) / measuredFrames, 'f', 3) << " per frame)\n";
+    out << "Frame pool: " << pool.capacity << " frames, " << pool.heapFallbacks << " heap fallbacks\n";
+    out << "Counted: " << AllocationCounter::coverage() << "\n";
+    return allocations == 0 && decoded > 0 ? 0 : 1;
+#endif
+}
+
+// Frames that never reach the decoder with RED at depths 0-3, for random and
+// bursty (Gilbert-Elliott, mean burst of 3 packets) loss. The payloads go
+// through the real RED encoder and decoder.
+static int benchmarkRed(QTextStream &out)
+{
+    const int frames = 50000;
+    const uint32_t frameTicks = 960; // 20 ms at the 48 kHz RTP clock
+    const size_t opusFrameSize = 120; // about 48 kbit/s
+
+    out << "RED, " << frames << " frames of 20 ms with " << opusFrameSize << " byte Opus payloads\n";
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n").arg("loss", -7).arg("pattern", -8)
+               .arg("depth 0", 9).arg("depth 1", 9).arg("depth 2", 9).arg("depth 3", 9).arg("bytes/pkt", 20);
+
+    std::vector<uint8_t> opusFrame(opusFrameSize, 0x5A);
+    std::vector<uint8_t> packet(1500);
+    std::vector<uint8_t> delivered(frames);
+
+    for (double loss : {0.01, 0.05, 0.10, 0.20, 0.30}) {
+        for (bool bursty : {false, true}) {
+            QString row = QString("%1 %2 ").arg(QString("%1%").arg(loss * 100, 0, 'f', 0), -7)
+                              .arg(bursty ? "bursty" : "random", -8);
+            QStringList sizes;
+            for (size_t depth = 0; depth <= 3; ++depth) {
+                // Same loss pattern for every depth
+                std::mt19937 generator(7);
+                std::uniform_real_distribution<double> uniform(0.0, 1.0);
+                // Bursty: leave the loss state with probability 1/3, enter it so the average matches
+                const double leaveLoss = 1.0 / 3.0;
+                const double enterLoss = loss * leaveLoss / (1.0 - loss);
+                bool inLoss = false;
+
+                Red::Encoder encoder;
+                encoder.setRedundancy(depth);
+                Red::Decoder decoder;
+                std::fill(delivered.begin(), delivered.end(), 0);
+                const uint32_t firstTimestamp = 123456;
+                size_t totalBytes = 0;
+
+                for (int i = 0; i < frames; ++i) {
+                    const uint32_t timestamp = firstTimestamp + uint32_t(i) * frameTicks;
+                    const size_t size = encoder.encode(opusFrame.data(), opusFrame.size(), timestamp, 111,
+                                                       packet.data(), packet.size());
+                    totalBytes += size;
+
+                    bool lost;
+                    if (bursty) {
+                        inLoss = inLoss ? uniform(generator) >= leaveLoss : uniform(generator) < enterLoss;
+                        lost = inLoss;
+                    } else {
+                        lost = uniform(generator) < loss;
+                    }
+                    if (lost)
+                        continue;
+
+                    std::array<Red::Block, Red::MaxRedundancy + 1> blocks;
+                    const size_t count = decoder.unpack(packet.data(), size, timestamp, blocks.data(), blocks.size());
+                    for (size_t b = 0; b < count; ++b)
+                        delivered[(blocks[b].timestamp - firstTimestamp) / frameTicks] = 1;
+                }
+
+                const int missing = frames - int(std::count(delivered.begin(), delivered.end(), 1));
+                row += QString("%1 ").arg(QString("%1%").arg(100.0 * missing / frames, 0, 'f', 2), 9);
+                sizes << QString::number(totalBytes / frames);
+            }
+            out << row << QString("%1\n").arg(sizes.join('/'), 20);
+        }
+    }
+    out << "Depth 0 is plain RED framing (one byte of overhead), the loss it shows is the network loss\n";
+    return 0;
+}
+
+// Packets per second one core can packetize: a pooled frame as the encoder
+// hands it over, with the header written into its headroom, against
+// assembling header and payload in a QByteArray and copying it into a
+// std::string the way packets used to be built. Sending is not included.
+static int benchmarkPacketizer(QTextStream &out)
+{
+    const int packets = 2000000;
+    const size_t payloadSize = 120; // 20 ms of Opus at about 48 kbit/s
+    const uint32_t frameTicks = 960;
+    std::vector<uint8_t> payload(payloadSize, 0x5A);
+
+    RtpPacketizer packetizer(0x12345678, 4242, 77);
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < packets; ++i) {
+        MediaFrame frame = FramePool::media().acquire();
+        // The encoder writes its output straight into the frame
+        frame.data()[0] = uint8_t(i);
+        frame.setSize(payloadSize);
+        frame.setTimestamp(uint32_t(i) * frameTicks);
+        frame.setMarker(i % 50 == 0);
+        packetizer.packetize(frame, 111);
+    }
+    const double inPlaceNs = double(timer.nsecsElapsed()) / packets;
+
+    uint16_t sequenceNumber = 4242;
+    timer.restart();
+    for (int i = 0; i < packets; ++i) {
+        QByteArray packet;
+        packet.append(char(0x80));
+        packet.append(char(i % 50 == 0 ? 0x80 | 111 : 111));
+        const uint16_t sequence = qToBigEndian(sequenceNumber++);
+        const uint32_t timestamp = qToBigEndian(uint32_t(i) * frameTicks);
+        const uint32_t ssrc = qToBigEndian(uint32_t(0x12345678));
+        packet.append(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+        packet.append(reinterpret_cast<const char *>(&timestamp), sizeof(timestamp));
+        packet.append(reinterpret_cast<const char *>(&ssrc), sizeof(ssrc));
+        packet.append(reinterpret_cast<const char *>(payload.data()), qsizetype(payloadSize));
+        const std::string sent = packet.toStdString();
+    }
+    const double copyingNs = double(timer.nsecsElapsed()) / packets;
+
+    out << "RTP packetizer, " << packets << " packets with " << payloadSize << " byte payloads\n";
+    out << QString("%1 %2 %3\n").arg("method", -22).arg("ns/packet", 10).arg("packets/s", 14);
+    out << QString("%1 %2 %3\n").arg("in place (pooled)", -22).arg(inPlaceNs, 10, 'f', 1).arg(1e9 / inPlaceNs, 14, 'f', 0);
+    out << QString("%1 %2 %3\n").arg("QByteArray + string", -22).arg(copyingNs, 10, 'f', 1).arg(1e9 / copyingNs, 14, 'f', 0);
+    return 0;
+}
+
+// Speech-like test signal: a gliding harmonic voice with syllable-rate
+// amplitude modulation and a little noise
+static std::vector<float> syntheticSpeech(int sampleRate, int seconds)
+{
+    std::vector<float> samples(size_t(sampleRate) * seconds);
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+    const double pi = std::acos(-1.0);
+    double phase = 0.0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const double t = double(i) / sampleRate;
+        phase += 2.0 * pi * (130.0 + 40.0 * std::sin(2.0 * pi * 0.7 * t)) / sampleRate;
+        const double envelope = 0.5 + 0.5 * std::sin(2.0 * pi * 4.0 * t);
+        samples[i] = float(envelope * (0.3 * std::sin(phase) + 0.15 * std::sin(2 * phase) + 0.08 * std::sin(3 * phase)))
+                     + noise(generator);
+    }
+    return samples;
+}
+
+// Per-frame cost of WSOLA time-stretching for every SIMD level the CPU
+// supports, at normal speed and at the playout adaptation rates
+static int benchmarkWsola(QTextStream &out)
+{
+    const int sampleRate = 48000;
+    const size_t frameSize = sampleRate / 50;
+    const std::vector<float> speech = syntheticSpeech(sampleRate, 10);
+    const size_t frames = speech.size() / frameSize;
+
+    out << "WSOLA time-stretching, 20 ms frames at " << sampleRate << " Hz, " << frames * 5 << " frames per run\n";
+    out << QString("%1 %2 %3 %4\n").arg("kernels", -8).arg("rate", 6).arg("ns/frame", 10).arg("budget", 8);
+
+    for (Simd::Level level : {Simd::Level::Scalar, Simd::Level::Sse41, Simd::Level::Avx2, Simd::Level::Neon}) {
+        if (!Simd::isSupported(level))
+            continue;
+        for (float rate : {1.0f, 1.06f, 0.94f}) {
+            TimeStretcher stretcher(sampleRate, frameSize, Simd::kernels(level));
+            stretcher.setRate(rate);
+            std::vector<float> output(stretcher.maxOutput(frameSize));
+            QElapsedTimer timer;
+            timer.start();
+            for (int pass = 0; pass < 5; ++pass) {
+                for (size_t i = 0; i < frames; ++i)
+                    stretcher.process(speech.data() + i * frameSize, frameSize, output.data());
+            }
+            const double nanoseconds = double(timer.nsecsElapsed()) / double(frames * 5);
+            out << QString("%1 %2 %3 %4%\n")
+                       .arg(Simd::levelName(level), -8)
+                       .arg(rate, 6, 'f', 2)
+                       .arg(nanoseconds, 10, 'f', 0)
+                       .arg(nanoseconds / 20e6 * 100.0, 7, 'f', 3);
+        }
+    }
+    return 0;
+}
+
+// Cost of mixing one 10 ms tick of 2 to 64 peers for every SIMD level the CPU
+// supports; decoding is per peer and not included
+static int benchmarkMixer(QTextStream &out)
+{
+    const int sampleRate = 48000;
+    const size_t blockSize = sampleRate / 100;
+    const int ticks = 20000;
+    const std::vector<float> speech = syntheticSpeech(sampleRate, 1);
+    const size_t blocks = speech.size() / blockSize;
+
+    out << "Conference mixer with limiter, 10 ms ticks at " << sampleRate << " Hz, " << ticks << " ticks per run\n";
+    out << QString("%1 %2 %3 %4\n").arg("kernels", -8).arg("peers", 6).arg("ns/tick", 10).arg("budget", 8);
+
+    for (Simd::Level level : {Simd::Level::Scalar, Simd::Level::Sse41, Simd::Level::Avx2, Simd::Level::Neon}) {
+        if (!Simd::isSupported(level))
+            continue;
+        for (int peers : {2, 4, 8, 16, 32, 64}) {
+            AudioMixer mixer(blockSize, Simd::kernels(level));
+            QElapsedTimer timer;
+            timer.start();
+            for (int tick = 0; tick < ticks; ++tick) {
+                mixer.begin(blockSize);
+                // Every peer talks, each from a different point of the signal
+                for (int peer = 0; peer < peers; ++peer)
+                    mixer.add(speech.data() + size_t(tick + peer * 7) % blocks * blockSize, 0.8f);
+                mixer.finish();
+            }
+            const double nanoseconds = double(timer.nsecsElapsed()) / ticks;
+            out << QString("%1 %2 %3 %4%\n")
+                       .arg(Simd::levelName(level), -8)
+                       .arg(peers, 6)
+                       .arg(nanoseconds, 10, 'f', 0)
+                       .arg(nanoseconds / 10e6 * 100.0, 7, 'f', 3);
+        }
+    }
+    return 0;
+}
+
+// A/B files for listening: a recording played at the given rate once through
+// WSOLA and once the way a jitter buffer without it adapts (whole frames
+// skipped or repeated whenever a frame of drift has built up)
+static int wsolaOffline(QTextStream &out, const QStringList &files, double rate, int frameMs)
+{
+    if (files.size() != 3) {
+        out << "--wsola needs in.wav,wsola.wav,naive.wav\n";
+        return 1;
+    }
+    if (rate < TimeStretcher::MinRate || rate > TimeStretcher::MaxRate) {
+        out << "--rate must be between " << TimeStretcher::MinRate << " and " << TimeStretcher::MaxRate << "\n";
+        return 1;
+    }
+
+    std::vector<int16_t> input;
+    int sampleRate = 0;
+    if (!WavFile::read(files[0], input, sampleRate)) {
+        out << "Cannot read " << files[0] << " (16-bit PCM WAV expected)\n";
+        return 1;
+    }
+
+    const size_t frameSize = size_t(sampleRate) * frameMs / 1000;
+    const Simd::Kernels &kernels = Simd::kernels();
+    TimeStretcher stretcher(sampleRate, frameSize, kernels);
+    stretcher.setRate(float(rate));
+
+    std::vector<float> frame(frameSize);
+    std::vector<float> stretched(stretcher.maxOutput(frameSize));
+    std::vector<int16_t> pcm(stretched.size());
+    std::vector<int16_t> wsola, naive;
+    double drift = 0.0;
+    int64_t elapsedNs = 0;
+    size_t frames = 0;
+    QElapsedTimer timer;
+
+    for (size_t position = 0; position + frameSize <= input.size(); position += frameSize, ++frames) {
+        kernels.int16ToFloat(input.data() + position, frame.data(), frameSize);
+        timer.start();
+        const size_t produced = stretcher.process(frame.data(), frameSize, stretched.data());
+        elapsedNs += timer.nsecsElapsed();
+        kernels.floatToInt16(stretched.data(), pcm.data(), produced);
+        wsola.insert(wsola.end(), pcm.begin(), pcm.begin() + produced);
+
+        // Every frame is worth 1/rate frames of output
+        drift += 1.0 / rate - 1.0;
+        if (drift <= -1.0) {
+            drift += 1.0;
+            continue;
+        }
+        naive.insert(naive.end(), input.begin() + position, input.begin() + position + frameSize);
+        if (drift >= 1.0) {
+            drift -= 1.0;
+            naive.insert(naive.end(), input.begin() + position, input.begin() + position + frameSize);
+        }
+    }
+
+    if (!WavFile::write(files[1], wsola, sampleRate) || !WavFile::write(files[2], naive, sampleRate)) {
+        out << "Cannot write the output files\n";
+        return 1;
+    }
+    const double inputSeconds = double(frames * frameSize) / sampleRate;
+    out << "Rate " << rate << ", " << frames << " frames of " << frameMs << " ms at " << sampleRate << " Hz\n";
+    out << "WSOLA:     " << QString::number(double(wsola.size()) / sampleRate, 'f', 2) << " s from "
+        << QString::number(inputSeconds, 'f', 2) << " s, "
+        << QString::number(frames ? double(elapsedNs) / frames / 1000.0 : 0.0, 'f', 1) << " us per frame\n";
+    out << "Frame skip/repeat: " << QString::number(double(naive.size()) / sampleRate, 'f', 2) << " s\n";
+    return 0;
+}
+
+struct TracePacket {
+    uint16_t sequence = 0;
+    double   sendMs = 0.0;
+    double   arrivalMs = -1.0; // negative: lost
+};
+
+// One packet per line: sequence,send_ms,arrival_ms with an empty or negative
+// arrival for a lost packet; lines starting with # are skipped
+static bool readTrace(const QString &path, std::vector<TracePacket> &packets)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        const QStringList fields = line.split(',');
+        if (fields.size() < 2)
+            return false;
+        TracePacket packet;
+        packet.sequence = uint16_t(fields[0].toUInt());
+        packet.sendMs = fields[1].toDouble();
+        packet.arrivalMs = fields.size() > 2 && !fields[2].trimmed().isEmpty() ? fields[2].toDouble() : -1.0;
+        packets.push_back(packet);
+    }
+    return !packets.empty();
+}
+
+// 60 s of 20 ms packets over a path with 40 ms of base delay, mild
+// exponential jitter, 1% loss, and a two second spell of heavy jitter every
+// 15 s (a congested uplink or a Wi-Fi scan)
+static std::vector<TracePacket> syntheticTrace()
+{
+    std::mt19937 generator(11);
+    std::exponential_distribution<double> mildJitter(1.0 / 4.0);
+    std::exponential_distribution<double> heavyJitter(1.0 / 35.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<TracePacket> packets(3000);
+    for (size_t i = 0; i < packets.size(); ++i) {
+        TracePacket &packet = packets[i];
+        packet.sequence = uint16_t(65000 + i); // wraps on the way
+        packet.sendMs = double(i) * 20.0;
+        const bool congested = std::fmod(packet.sendMs, 15000.0) >= 13000.0;
+        const double jitter = congested ? heavyJitter(generator) : mildJitter(generator);
+        packet.arrivalMs = uniform(generator) < 0.01 ? -1.0 : 40.0 + jitter + packet.sendMs;
+    }
+    return packets;
+}
+
+// Replays a packet trace through the jitter buffer at fixed target delays and
+// adaptive, with playout pulling one 20 ms frame per 20 ms, and reports the
+// resulting mouth-to-ear delay against the glitches (frames that had to be
+// concealed or underruns)
+static int jitterTrace(QTextStream &out, const QString &source)
+{
+    std::vector<TracePacket> packets;
+    if (source == "synthetic") {
+        packets = syntheticTrace();
+    } else if (!readTrace(source, packets)) {
+        out << "Cannot read the trace " << source << " (sequence,send_ms,arrival_ms per line)\n";
+        return 1;
+    }
+
+    std::vector<const TracePacket *> arrivals;
+    for (const TracePacket &packet : packets) {
+        if (packet.arrivalMs >= 0.0)
+            arrivals.push_back(&packet);
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(), [](const TracePacket *a, const TracePacket *b) {
+        return a->arrivalMs < b->arrivalMs;
+    });
+    if (arrivals.empty()) {
+        out << "Every packet in the trace is lost\n";
+        return 1;
+    }
+
+    const double frameMs = 20.0;
+    const uint32_t frameTicks = 960;
+    out << "Jitter buffer on " << packets.size() << " packets (" << packets.size() - arrivals.size()
+        << " lost in the network)\n";
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n").arg("target", -9).arg("mean ms", 8).arg("p95 ms", 8)
+               .arg("late", 6).arg("missing", 8).arg("underrun", 9).arg("skipped", 8).arg("glitch", 8);
+
+    FramePool pool(JitterBuffer::Capacity * 2, 16, 0);
+    for (int fixedDelay : {20, 40, 60, 80, 120, 200, 0}) {
+        JitterBuffer buffer;
+        buffer.setFixedDelay(fixedDelay);
+
+        std::vector<double> latencies;
+        latencies.reserve(packets.size());
+        uint64_t glitches = 0;
+        size_t next = 0;
+        // Playout ticks run on the receiver clock from the first arrival on
+        for (double now = arrivals.front()->arrivalMs;; now += frameMs) {
+            for (; next < arrivals.size() && arrivals[next]->arrivalMs <= now; ++next) {
+                MediaFrame frame = pool.acquire();
+                frame.setSequenceNumber(arrivals[next]->sequence);
+                frame.setTimestamp(uint32_t(std::llround(arrivals[next]->sendMs / frameMs)) * frameTicks);
+                buffer.insert(frame, int64_t(arrivals[next]->arrivalMs * 1000.0));
+            }
+
+            MediaFrame frame;
+            const JitterBuffer::Result result = buffer.pop(frame);
+            if (result == JitterBuffer::Result::Frame) {
+                // The frame finishes playing one frame after it starts
+                latencies.push_back(now + frameMs - frame.timestamp() / double(frameTicks) * frameMs);
+            } else if (result == JitterBuffer::Result::Missing || !latencies.empty()) {
+                ++glitches;
+            }
+            if (next == arrivals.size() && result == JitterBuffer::Result::Empty)
+                break;
+        }
+        // The final Empty is the end of the trace, not an underrun
+        if (glitches > 0)
+            --glitches;
+
+        const JitterBuffer::Stats stats = buffer.stats();
+        std::sort(latencies.begin(), latencies.end());
+        double mean = 0.0;
+        for (double latency : latencies)
+            mean += latency;
+        mean = latencies.empty() ? 0.0 : mean / latencies.size();
+        const double p95 = latencies.empty() ? 0.0 : latencies[latencies.size() * 95 / 100];
+        const QString target = fixedDelay > 0 ? QString("%1 ms").arg(fixedDelay) : QString("adaptive");
+        out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n").arg(target, -9)
+                   .arg(mean, 8, 'f', 1).arg(p95, 8, 'f', 1)
+                   .arg(stats.late, 6).arg(stats.missing, 8).arg(stats.underruns, 9).arg(stats.dropped, 8)
+                   .arg(QString("%1%").arg(100.0 * glitches / packets.size(), 0, 'f', 2), 8);
+    }
+    out << "Latency is send to end of playout; glitches are concealed frames and underrun turns\n";
+    return 0;
+}
+
+bool isToolInvocation(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        for (const char *option : ToolOptions) {
+            if (std::strncmp(argv[i], option, std::strlen(option)) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+// Two hours of a call between a sender and a sink whose clocks are off by the
+// given amounts against the local clock: packets every 20 ms with network
+// jitter, the sink taking 10 ms blocks with scheduling noise. Reports how well
+// both skews are estimated, and how far the buffer delay has wandered with
+// and without playing the estimated skew out.
+static int driftSimulation(QTextStream &out, const QStringList &values)
+{
+    if (values.size() != 2) {
+        out << "Expected sender_ppm,sink_ppm\n";
+        return 1;
+    }
+    const double senderPpm = values[0].toDouble();
+    const double sinkPpm = values[1].toDouble();
+    const double trueSkewPpm = ((1.0 + senderPpm * 1e-6) / (1.0 + sinkPpm * 1e-6) - 1.0) * 1e6;
+
+    std::mt19937 generator(5);
+    std::exponential_distribution<double> networkJitterUs(1.0 / 6000.0);
+    std::uniform_real_distribution<double> schedulingUs(0.0, 2000.0);
+
+    DriftEstimator senderClock;
+    DriftEstimator sinkClock;
+    out << "Sender " << senderPpm << " ppm, sink " << sinkPpm << " ppm against the local clock (skew "
+        << QString::number(trueSkewPpm, 'f', 2) << " ppm)\n";
+    out << QString("%1 %2 %3 %4 %5\n").arg("time", -8).arg("sender", 9).arg("sink", 9)
+               .arg("fixed ms", 9).arg("tracked ms", 11);
+
+    const int64_t durationUs = int64_t(2) * 3600 * 1000000;
+    const int64_t reportsUs[] = {30000000, 60000000, 600000000, 3600000000LL, durationUs};
+    size_t report = 0;
+    int64_t nextPacketUs = 0, nextBlockUs = 0, packet = 0, block = 0;
+    // Media time that has arrived minus media time played, starting level at 0
+    double playedFixedUs = 0.0, playedTrackedUs = 0.0;
+    while (report < std::size(reportsUs)) {
+        if (nextPacketUs <= nextBlockUs) {
+            // Sent on the sender clock, so the local spacing is 20 ms / (1 + skew)
+            senderClock.update(nextPacketUs + 30000 + int64_t(networkJitterUs(generator)), packet * 20000);
+            ++packet;
+            nextPacketUs = int64_t(double(packet) * 20000.0 / (1.0 + senderPpm * 1e-6));
+            continue;
+        }
+        sinkClock.update(nextBlockUs + int64_t(schedulingUs(generator)), block * 10000);
+        ++block;
+        playedFixedUs += 10000.0;
+        double rate = 1.0;
+        if (senderClock.isValid() && sinkClock.isValid())
+            rate = (1.0 + senderClock.ppm() * 1e-6) / (1.0 + sinkClock.ppm() * 1e-6);
+        playedTrackedUs += 10000.0 * rate;
+        nextBlockUs = int64_t(double(block) * 10000.0 / (1.0 + sinkPpm * 1e-6));
+
+        if (nextBlockUs >= reportsUs[report]) {
+            const double baseUs = double(block) * 10000.0 * (1.0 + trueSkewPpm * 1e-6);
+            out << QString("%1 %2 %3 %4 %5\n").arg(QString("%1 min").arg(reportsUs[report] / 60000000.0, 0, 'f', 1), -8)
+                       .arg(senderClock.ppm(), 9, 'f', 2).arg(sinkClock.ppm(), 9, 'f', 2)
+                       .arg((baseUs - playedFixedUs) / 1000.0, 9, 'f', 1)
+                       .arg((baseUs - playedTrackedUs) / 1000.0, 11, 'f', 1);
+            ++report;
+        }
+    }
+    out << "Delay change since the start; the fixed column plays at nominal speed\n";
+    return 0;
+}
+
+struct CapacityStep {
+    double startSeconds = 0.0;
+    double kbps = 0.0;
+};
+
+// One step per line: start_seconds,capacity_kbps; the last line only ends
+// the trace. Lines starting with # are skipped.
+static bool readCapacityTrace(const QString &path, std::vector<CapacityStep> &steps)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        const QStringList fields = line.split(',');
+        if (fields.size() < 2)
+            return false;
+        steps.push_back({fields[0].toDouble(), fields[1].toDouble()});
+    }
+    return steps.size() >= 2;
+}
+
+// A call sending at most 64 kbps of Opus through a bottleneck whose capacity
+// steps up and down every 20 s, from plenty to barely enough
+static std::vector<CapacityStep> syntheticCapacityTrace()
+{
+    return {{0, 256}, {20, 32}, {40, 96}, {60, 24}, {80, 160}, {100, 48}, {120, 0}};
+}
+
+// Runs the congestion controller end to end against a bottleneck link: the
+// sender encodes at the controller's bitrate and frame size, packets queue
+// at the link (drop-tail at 300 ms) and reach the receiver 20 ms later, whose
+// delay estimator sends REMB, and every second a receiver report with the
+// loss. Reports, for every capacity step, how long the send rate took to
+// settle between 70% and 100% of what the link can take (or what the encoder
+// can use), the queueing delay and the loss.
+static int simulateBandwidth(QTextStream &out, const QString &source)
+{
+    std::vector<CapacityStep> steps;
+    if (source == "synthetic") {
+        steps = syntheticCapacityTrace();
+    } else if (!readCapacityTrace(source, steps)) {
+        out << "Cannot read the trace " << source << " (start_seconds,capacity_kbps per line)\n";
+        return 1;
+    }
+
+    const int maxBitrate = 64000;
+    const int64_t maxWireBps = maxBitrate + int64_t(Bandwidth::PacketOverhead) * 8 * 1000 / 20;
+    const int64_t oneWayUs = 20000;
+    const int64_t maxQueueUs = 300000;
+    const int64_t stepUs = 100;
+
+    struct Packet {
+        int64_t  arrivalUs;
+        uint32_t timestamp;
+        size_t   payload;
+        bool     lost;
+    };
+    struct Feedback {
+        int64_t arrivalUs;
+        float   loss;       // negative: REMB only
+        int64_t rembBps;
+    };
+
+    std::mt19937 generator(3);
+    std::exponential_distribution<double> jitterUs(1.0 / 1000.0);
+    Bandwidth::Estimator estimator(maxWireBps, maxWireBps);
+    Bandwidth::EncoderController controller;
+    Bandwidth::DelayEstimator receiver;
+    Bandwidth::EncoderTarget target = controller.update(estimator.targetBps(0), 0.0f, maxBitrate);
+
+    std::deque<Packet> network;
+    std::deque<Feedback> feedback;
+    std::deque<std::pair<int64_t, int64_t>> sentWindow; // send time, bits over the last second
+    int64_t sentWindowBits = 0;
+    int64_t linkFreeUs = 0, nextSendUs = 0, nextReportUs = 1000000;
+    uint32_t timestamp = 0;
+    uint64_t intervalExpected = 0, intervalLost = 0;
+
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n").arg("capacity", -10).arg("settled", 8).arg("queue ms", 9)
+               .arg("p95 ms", 7).arg("loss", 7).arg("sent", 10).arg("frame", 6).arg("fec", 4);
+    for (size_t step = 0; step + 1 < steps.size(); ++step) {
+        const int64_t startUs = int64_t(steps[step].startSeconds * 1e6);
+        const int64_t endUs = int64_t(steps[step + 1].startSeconds * 1e6);
+        const double capacityBps = std::max(steps[step].kbps, 1.0) * 1000.0;
+        const double usableBps = std::min(capacityBps, double(maxWireBps));
+        std::vector<double> queueMs;
+        int64_t sentBits = 0, settledUs = -1;
+        uint64_t packets = 0, lost = 0;
+        std::array<int, 3> frameUse{};
+
+        for (int64_t now = startUs; now < endUs; now += stepUs) {
+            if (now >= nextSendUs) {
+                const size_t payload = size_t(target.bitrate) * size_t(target.frameMs) / 8000;
+                const size_t wire = payload + Bandwidth::PacketOverhead;
+                const int64_t queuedUs = std::max(now, linkFreeUs) - now;
+                const bool dropped = queuedUs > maxQueueUs;
+                if (!dropped) {
+                    linkFreeUs = now + queuedUs + int64_t(double(wire) * 8.0 * 1e6 / capacityBps);
+                    queueMs.push_back(double(queuedUs) / 1000.0);
+                }
+                network.push_back({dropped ? now : linkFreeUs + oneWayUs + int64_t(jitterUs(generator)),
+                                   timestamp, payload, dropped});
+                ++packets;
+                lost += dropped ? 1 : 0;
+                ++frameUse[size_t(target.frameMs / 20 - 1)];
+                sentBits += int64_t(wire) * 8;
+                sentWindow.push_back({now, int64_t(wire) * 8});
+                sentWindowBits += int64_t(wire) * 8;
+                while (sentWindow.front().first <= now - 1000000) {
+                    sentWindowBits -= sentWindow.front().second;
+                    sentWindow.pop_front();
+                }
+                if (settledUs < 0 && now - startUs >= 1000000 && sentWindowBits >= 0.7 * usableBps
+                    && sentWindowBits <= capacityBps)
+                    settledUs = now - startUs;
+
+                timestamp += uint32_t(target.frameMs * 48);
+                nextSendUs = now + target.frameMs * 1000;
+                // The encoder picks the new settings up between frames
+                target = controller.update(estimator.targetBps(now), estimator.lossFraction(), maxBitrate);
+            }
+
+            while (!network.empty() && network.front().arrivalUs <= now) {
+                const Packet packet = network.front();
+                network.pop_front();
+                ++intervalExpected;
+                if (packet.lost) {
+                    ++intervalLost;
+                    continue;
+                }
+                receiver.onPacket(packet.timestamp, packet.payload, packet.arrivalUs);
+                if (receiver.takeDecrease())
+                    feedback.push_back({now + oneWayUs, -1.0f, receiver.estimateBps()});
+            }
+            if (now >= nextReportUs) {
+                const float loss = intervalExpected ? float(intervalLost) / float(intervalExpected) : 0.0f;
+                feedback.push_back({now + oneWayUs, loss, receiver.estimateBps()});
+                intervalExpected = intervalLost = 0;
+                nextReportUs += 1000000;
+            }
+            while (!feedback.empty() && feedback.front().arrivalUs <= now) {
+                const Feedback report = feedback.front();
+                feedback.pop_front();
+                if (report.loss >= 0.0f)
+                    estimator.onReport(report.loss, now);
+                if (report.rembBps > 0)
+                    estimator.onRemb(report.rembBps, now);
+            }
+        }
+
+        std::sort(queueMs.begin(), queueMs.end());
+        double meanQueue = 0.0;
+        for (double delay : queueMs)
+            meanQueue += delay;
+        meanQueue = queueMs.empty() ? 0.0 : meanQueue / queueMs.size();
+        const double p95 = queueMs.empty() ? 0.0 : queueMs[queueMs.size() * 95 / 100];
+        const double seconds = double(endUs - startUs) / 1e6;
+        const int mostUsed = int(std::max_element(frameUse.begin(), frameUse.end()) - frameUse.begin() + 1) * 20;
+        out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                   .arg(QString("%1 kbps").arg(steps[step].kbps), -10)
+                   .arg(settledUs >= 0 ? QString("%1 s").arg(settledUs / 1e6, 0, 'f', 1) : QString("never"), 8)
+                   .arg(meanQueue, 9, 'f', 1).arg(p95, 7, 'f', 1)
+                   .arg(QString("%1%").arg(packets ? 100.0 * lost / packets : 0.0, 0, 'f', 1), 7)
+                   .arg(QString("%1 kbps").arg(sentBits / 1000.0 / seconds, 0, 'f', 1), 10)
+                   .arg(QString("%1 ms").arg(mostUsed), 6)
+                   .arg(target.inbandFec ? "on" : "off", 4);
+    }
+    out << "Rates are on the wire (" << Bandwidth::PacketOverhead << " bytes of headers per packet); the frame is "
+        << "the one used most in the step, FEC its state at the end\n";
+    return 0;
+}
+
+// One caller in the SFU check, and what arrived on each of its streams
+struct SfuCheckClient {
+    struct Stream {
+        int      publisher = -1;  // from the first packet
+        uint64_t packets = 0;
+        uint64_t mixed = 0;       // packets of another publisher on the stream
+        uint32_t last = 0;        // counter of the newest packet
+    };
+
+    QString                    id;
+    std::unique_ptr<WebRTC>    webrtc;
+    bool                       inCall = false;
+    uint32_t                   sent = 0;
+    std::atomic<int>           closedStreams{0};
+    // Written on the libdatachannel threads
+    std::mutex                 mutex;
+    std::map<QString, Stream>  streams;
+};
+
+// Real WebRTC clients calling an SfuServer in this process, over ICE, DTLS
+// and SRTP on this machine. Every client publishes packets that carry its
+// index and a counter. They join one at a time, so the ones already in the
+// call are renegotiated with each join, and the first one leaves halfway.
+// Each remaining client has to get every other one on a stream of its own,
+// with no packet of one publisher on another's stream, and still be
+// receiving from all of them at the end.
+static int sfuCheck(QTextStream &out, int participants)
+{
+    participants = std::clamp(participants, 3, 16);
+    const int joinIntervalMs = 1000;
+    const int frameMs = 20;
+    const int callMs = 4000;
+    const QString sfuId = "sfu";
+
+    // Everyone is on this machine, so host candidates are enough
+    rtc::Configuration config = RtcSetup::configuration();
+    config.iceServers.clear();
+    SfuServer server(2, config);
+
+    std::vector<std::unique_ptr<SfuCheckClient>> clients;
+    const auto findClient = [&clients](const QString &id) -> SfuCheckClient * {
+        for (const auto &client : clients) {
+            if (client->id == id)
+                return client.get();
+        }
+        return nullptr;
+    };
+    // What the signalling server would carry, queued like its messages
+    QObject::connect(&server, &SfuServer::answerIsReady, &server, [&](const QString &peerId, const QString &sdp) {
+        if (SfuCheckClient *client = findClient(peerId))
+            client->webrtc->setRemoteDescription(sfuId, sdp);
+    }, Qt::QueuedConnection);
+    QObject::connect(&server, &SfuServer::offerIsReady, &server, [&](const QString &peerId, const QString &sdp) {
+        if (SfuCheckClient *client = findClient(peerId); client && client->inCall)
+            client->webrtc->setRemoteDescription(sfuId, sdp);
+    }, Qt::QueuedConnection);
+
+    for (int i = 0; i < participants; ++i) {
+        auto client = std::make_unique<SfuCheckClient>();
+        client->id = QString("client-%1").arg(i);
+        // All with the default SSRC, as real clients are
+        client->webrtc = std::make_unique<WebRTC>();
+        WebRTC *webrtc = client->webrtc.get();
+        SfuCheckClient *state = client.get();
+        const QString id = client->id;
+        const auto toServer = [&server, id](const QString &, const QString &sdp) {
+            server.setRemoteDescription(id, sdp);
+        };
+        QObject::connect(webrtc, &WebRTC::offerIsReady, &server, toServer, Qt::QueuedConnection);
+        QObject::connect(webrtc, &WebRTC::answerIsReady, &server, toServer, Qt::QueuedConnection);
+        QObject::connect(webrtc, &WebRTC::localCandidateGenerated, &server,
+                         [&server, id](const QString &, const QString &candidate, const QString &mid) {
+            server.setRemoteCandidate(id, candidate, mid);
+        }, Qt::QueuedConnection);
+        QObject::connect(webrtc, &WebRTC::frameReceived, webrtc, [state](const QString &streamId, const MediaFrame &frame) {
+            if (frame.size() < 5)
+                return;
+            const int publisher = frame.data()[0];
+            const uint32_t counter = qFromBigEndian<quint32>(frame.data() + 1);
+            std::lock_guard<std::mutex> locker(state->mutex);
+            SfuCheckClient::Stream &stream = state->streams[streamId];
+            if (stream.publisher < 0)
+                stream.publisher = publisher;
+            if (stream.publisher != publisher) {
+                ++stream.mixed;
+                return;
+            }
+            ++stream.packets;
+            stream.last = std::max(stream.last, counter);
+        }, Qt::DirectConnection);
+        QObject::connect(webrtc, &WebRTC::streamClosed, webrtc, [state](const QString &) {
+            state->closedStreams.fetch_add(1);
+        }, Qt::DirectConnection);
+        clients.push_back(std::move(client));
+    }
+
+    // Every client in the call sends a packet each frame
+    QTimer sendTimer;
+    QObject::connect(&sendTimer, &QTimer::timeout, [&clients] {
+        for (size_t i = 0; i < clients.size(); ++i) {
+            SfuCheckClient &client = *clients[i];
+            if (!client.inCall)
+                continue;
+            MediaFrame frame = FramePool::media().acquire();
+            std::array<uint8_t, 40> payload{};
+            payload[0] = uint8_t(i);
+            qToBigEndian<quint32>(++client.sent, payload.data() + 1);
+            frame.assign(payload.data(), payload.size());
+            frame.setTimestamp(client.sent * 960);
+            client.webrtc->broadcastTrack(frame);
+        }
+    });
+    sendTimer.start(frameMs);
+
+    QEventLoop loop;
+    for (int i = 0; i < participants; ++i) {
+        QTimer::singleShot(i * joinIntervalMs, &loop, [&clients, i, sfuId, config] {
+            SfuCheckClient &client = *clients[size_t(i)];
+            client.webrtc->init(client.id, true);
+            client.webrtc->setConfiguration(config);
+            client.webrtc->generateOfferSDP(sfuId);
+            client.inCall = true;
+        });
+    }
+    const int leaveMs = participants * joinIntervalMs + callMs / 2;
+    QTimer::singleShot(leaveMs, &loop, [&] {
+        SfuCheckClient &client = *clients.front();
+        client.inCall = false;
+        client.webrtc->closeConnection(sfuId);
+        server.removeParticipant(client.id);
+    });
+    QTimer::singleShot(leaveMs + callMs / 2, &loop, &QEventLoop::quit);
+    loop.exec();
+    sendTimer.stop();
+
+    out << "SFU check, " << participants << " clients joining " << joinIntervalMs << " ms apart, "
+        << clients.front()->id << " leaving after " << leaveMs << " ms\n";
+    out << QString("%1 %2 %3 %4 %5 %6\n").arg("client", -10).arg("streams", 8).arg("packets", 9)
+               .arg("mixed", 6).arg("closed", 7).arg("missing publishers", -20);
+    bool passed = true;
+    for (size_t i = 1; i < clients.size(); ++i) {
+        SfuCheckClient &client = *clients[i];
+        std::lock_guard<std::mutex> locker(client.mutex);
+        uint64_t packets = 0;
+        uint64_t mixed = 0;
+        QStringList missing;
+        for (const auto &[streamId, stream] : client.streams) {
+            packets += stream.packets;
+            mixed += stream.mixed;
+            // Its own packets must never come back
+            if (stream.publisher == int(i))
+                ++mixed;
+        }
+        // Everyone still in the call is on a stream of its own, and still arriving
+        for (size_t other = 1; other < clients.size(); ++other) {
+            if (other == i)
+                continue;
+            int found = 0;
+            bool current = false;
+            for (const auto &[streamId, stream] : client.streams) {
+                if (stream.publisher != int(other))
+                    continue;
+                ++found;
+                current = stream.last + 10 >= clients[other]->sent;
+            }
+            if (found != 1 || !current)
+                missing << clients[other]->id;
+        }
+        out << QString("%1 %2 %3 %4 %5 %6\n").arg(client.id, -10).arg(client.streams.size(), 8).arg(packets, 9)
+                   .arg(mixed, 6).arg(client.closedStreams.load(), 7).arg(missing.join(','), -20);
+        passed &= mixed == 0 && missing.isEmpty();
+    }
+    const QVariantMap stats = server.stats();
+    out << "SFU: " << stats.value("forwarded").toULongLong() << " packets forwarded, "
+        << stats.value("dropped").toULongLong() << " dropped\n";
+    out << (passed ? "Passed" : "Failed") << "\n";
+    return passed ? 0 : 1;
+}
+
+int run(const QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Distributed Voice Call developer tools");
+    parser.addHelpOption();
+    QCommandLineOption benchmarkOption("benchmark", "Run a microbenchmark: preprocessing, allocations, red, wsola, mixer, packetizer.",
+                                       "name");
+    parser.addOption(benchmarkOption);
+    QCommandLineOption aecOption("aec-offline", "Cancel the echo of far.wav in near.wav and write out.wav.",
+                                 "near.wav,far.wav,out.wav");
+    parser.addOption(aecOption);
+    QCommandLineOption aecDelayOption("aec-delay", "Delay of the echo in the near file (default 0).", "ms", "0");
+    parser.addOption(aecDelayOption);
+    QCommandLineOption jitterOption("jitter-trace",
+                                    "Replay a packet trace (sequence,send_ms,arrival_ms) through the jitter buffer.",
+                                    "file|synthetic");
+    parser.addOption(jitterOption);
+    QCommandLineOption wsolaOption("wsola", "Play in.wav at --rate through WSOLA and through frame skip/repeat.",
+                                   "in.wav,wsola.wav,naive.wav");
+    parser.addOption(wsolaOption);
+    QCommandLineOption rateOption("rate", "Playout rate for --wsola (default 1.06).", "rate", "1.06");
+    parser.addOption(rateOption);
+    QCommandLineOption driftOption("drift-sim", "Simulate a long call between skewed clocks and track the skew.",
+                                   "sender_ppm,sink_ppm");
+    parser.addOption(driftOption);
+    QCommandLineOption bandwidthOption("simulate-bwe",
+                                       "Run the congestion controller against a bottleneck with a capacity trace (start_seconds,capacity_kbps).",
+                                       "file|synthetic");
+    parser.addOption(bandwidthOption);
+    QCommandLineOption sfuCheckOption("sfu-check",
+                                      "Call through an SFU in this process with real clients and check that every publisher arrives on a stream of its own.",
+                                      "clients");
+    parser.addOption(sfuCheckOption);
+    QCommandLineOption frameOption("frame", "Frame duration for the offline tools (default 20).", "ms", "20");
+    parser.addOption(frameOption);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    if (parser.isSet(benchmarkOption)) {
+        const QString name = parser.value(benchmarkOption);
+        if (name == "preprocessing")
+            return benchmarkPreprocessing(out);
+        if (name == "allocations")
+            return benchmarkAllocations(out);
+        if (name == "red")
+            return benchmarkRed(out);
+        if (name == "wsola")
+            return benchmarkWsola(out);
+        if (name == "mixer")
+            return benchmarkMixer(out);
+        if (name == "packetizer")
+            return benchmarkPacketizer(out);
+        out << "Unknown benchmark: " << name << "\n";
+        return 1;
+    }
+    if (parser.isSet(aecOption)) {
+        return aecOffline(out, parser.value(aecOption).split(','), parser.value(aecDelayOption).toInt(),
+                          parser.value(frameOption).toInt());
+    }
+
+    if (parser.isSet(jitterOption))
+        return jitterTrace(out, parser.value(jitterOption));
+    if (parser.isSet(driftOption))
+        return driftSimulation(out, parser.value(driftOption).split(','));
+    if (parser.isSet(bandwidthOption))
+        return simulateBandwidth(out, parser.value(bandwidthOption));
+    if (parser.isSet(sfuCheckOption))
+        return sfuCheck(out, parser.value(sfuCheckOption).toInt());
+    if (parser.isSet(wsolaOption)) {
+        return wsolaOffline(out, parser.value(wsolaOption).split(','), parser.value(rateOption).toDouble(),
+                            parser.value(frameOption).toInt());
+    }
+
+    parser.showHelp(1);
+}
+
+} // namespace Tools
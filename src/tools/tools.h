@@ -0,0 +1,18 @@
+#ifndef TOOLS_H
+#define TOOLS_H
+
+#include <QCoreApplication>
+
+// Developer tools that run headless instead of the call UI, e.g.
+//   DistributedVoiceCall --benchmark preprocessing
+namespace Tools {
+
+// True if the command line asks for a tool rather than the UI
+bool isToolInvocation(int argc, char *argv[]);
+
+// Parses the command line, runs the requested tool and returns the exit code
+int run(const QCoreApplication &app);
+
+} // namespace Tools
+
+#endif // TOOLS_H